@@ -3,17 +3,51 @@
 #include "AcquisitionCompletion.hpp"
 #include "DataStream.hpp"
 #include "FIFOAcquisition.hpp"
+#include "FIFOPolling.hpp"
+#include "RateCounters.h"
 #include "SPCFileWriter.hpp"
+#include "SetupTimer.hpp"
+#include "ThreadPlacement.hpp"
+#include "WorkerThreadPool.hpp"
 
+#include <algorithm>
+#include <array>
 #include <bitset>
 #include <cmath>
 #include <chrono>
 #include <fstream>
 #include <future>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 
+// C++ state that we keep while the device is open, so that starting an
+// acquisition does not create threads, nor allocate buffers or histograms
+// when the configuration is unchanged.
+struct AcqEngine {
+	// Runs the acquisition, processing, and cleanup tasks
+	std::shared_ptr<WorkerThreadPool> workers;
+
+	// Buffers passed from acquisition to processing, one pool per module;
+	// replaced when the buffer size changes. Idle buffers are kept.
+	std::vector<std::shared_ptr<EventBufferPool<BHSPCEvent>>> bufferPools;
+
+	// Storage of the histograms of the last acquisition, cleared after the
+	// acquisition so that it is ready for reuse
+	std::shared_ptr<HistogramPool<uint16_t>> histogramPool;
+
+	explicit AcqEngine(std::size_t moduleCount) :
+		// A FIFO reader, up to 2 event pumps, and a histogramming stage per
+		// module, plus processing setup and cleanup and up to 2 more pipeline
+		// stages (.spc files are created before the readers start)
+		workers(std::make_shared<WorkerThreadPool>(4 * moduleCount + 4)),
+		histogramPool(std::make_shared<HistogramPool<uint16_t>>())
+	{}
+};
+
+
 // C++ state that we store in our device private data. Members are kept
 // minimal; data that can be passed as lambda captures/parameters is passed
 // that way.
@@ -30,10 +64,32 @@ struct AcqState {
 	// promise_already_satisfied.
 	std::promise<void> requestStop;
 
-	// Futures from std::async that we need to hold.
+	// Buffers passed from acquisition to processing, one pool per module.
+	// Held here (rather than only by the acquisition threads) because buffers
+	// are checked in by the processing threads, possibly after acquisition has
+	// finished.
+	std::vector<std::shared_ptr<EventBufferPool<BHSPCEvent>>> bufferPools;
+
+	// Device FIFO fill level tracking, one per module
+	std::vector<std::shared_ptr<FIFOMonitor>> fifoMonitors;
+
+	// Futures from the engine's worker threads that we need to hold.
 	std::future<void> eventPumpingFinish;
-	std::future<void> acquisitionFinish;
+	std::vector<std::future<void>> acquisitionFinishes; // One per module
 	std::future<void> logStopFinish;
+
+	// Unlike those from std::async, our futures do not block on destruction;
+	// wait for them here so that, once an AcqState is deleted, its threads
+	// are no longer using the engine's pools.
+	~AcqState() {
+		if (logStopFinish.valid())
+			logStopFinish.wait();
+		if (eventPumpingFinish.valid())
+			eventPumpingFinish.wait();
+		for (auto& f : acquisitionFinishes) {
+			f.wait();
+		}
+	}
 };
 
 
@@ -72,7 +128,17 @@ static int ResetAcquisitionState(OScDev_Device* device)
 extern "C"
 int InitializeDeviceForAcquisition(OScDev_Device* device)
 {
-	return ConfigureDeviceForFIFOAcquisition(GetData(device)->moduleNr);
+	auto data = GetData(device);
+	for (int32_t m = 0; m < data->detectedModuleCount; ++m) {
+		int err = ConfigureDeviceForFIFOAcquisition(data->moduleNrs[m]);
+		if (err != 0)
+			return err;
+	}
+
+	if (data->acqEngine == nullptr) {
+		data->acqEngine = new AcqEngine(data->detectedModuleCount);
+	}
+	return 0;
 }
 
 
@@ -80,15 +146,16 @@ int InitializeDeviceForAcquisition(OScDev_Device* device)
 extern "C"
 void ShutdownAcquisitionState(OScDev_Device* device)
 {
-	if (GetData(device)->acqState == nullptr) {
-		return;
-	}
+	if (GetData(device)->acqState) {
+		RequestAcquisitionStop(GetData(device)->acqState);
+		GetData(device)->acqState->finish.get();
 
-	RequestAcquisitionStop(GetData(device)->acqState);
-	GetData(device)->acqState->finish.get();
+		delete GetData(device)->acqState;
+		GetData(device)->acqState = nullptr;
+	}
 
-	delete GetData(device)->acqState;
-	GetData(device)->acqState = nullptr;
+	delete GetData(device)->acqEngine;
+	GetData(device)->acqEngine = nullptr;
 }
 
 
@@ -107,7 +174,12 @@ static int ConfigureMarkers(OScDev_Device* device)
 		enabled |= (data->markerActiveEdges[i] != MarkerPolarityDisabled) << i;
 		risingEdgeActive |= (data->markerActiveEdges[i] == MarkerPolarityRisingEdge) << i;
 	}
-	return SetMarkerPolarities(data->moduleNr, enabled, risingEdgeActive);
+	for (int32_t m = 0; m < data->moduleCount; ++m) {
+		int err = SetMarkerPolarities(data->moduleNrs[m], enabled, risingEdgeActive);
+		if (err != 0)
+			return err;
+	}
+	return 0;
 }
 
 
@@ -132,18 +204,163 @@ static int CheckMarkers(OScDev_Device* device)
 		}
 	}
 
-	// Line marker must be assigned and enabled (until we support pixel marker)
-	if (data->lineMarkerBit >= NUM_MARKER_BITS) {
-		return 1; // Line marker required
+	// The marker used for pixel mapping must be assigned and enabled
+	uint32_t const mappingMarkerBit =
+		data->pixelMappingMode == PixelMappingModePixelMarkers ?
+		data->pixelMarkerBit : data->lineMarkerBit;
+	if (mappingMarkerBit >= NUM_MARKER_BITS) {
+		return 1; // Pixel or line marker required
+	}
+	if (data->markerActiveEdges[mappingMarkerBit] == MarkerPolarityDisabled) {
+		return 1; // Pixel or line marker required
 	}
-	if (data->markerActiveEdges[data->lineMarkerBit] == MarkerPolarityDisabled) {
-		return 1; // Line marker required
+
+	// Frame marker synchronization is only implemented for line markers
+	if (data->startFramesOnFrameMarker) {
+		if (data->pixelMappingMode == PixelMappingModePixelMarkers) {
+			return 1; // Unimplemented mode
+		}
+		if (data->frameMarkerBit >= NUM_MARKER_BITS ||
+			data->markerActiveEdges[data->frameMarkerBit] == MarkerPolarityDisabled) {
+			return 1; // Frame marker required
+		}
 	}
 
 	return 0;
 }
 
 
+static EventBufferPoolPolicy ToEventBufferPoolPolicy(enum BufferOverflowPolicy policy)
+{
+	switch (policy) {
+	case BufferOverflowPolicyBlock:
+		return EventBufferPoolPolicy::Block;
+	case BufferOverflowPolicyReport:
+		return EventBufferPoolPolicy::Report;
+	default:
+		return EventBufferPoolPolicy::Fail;
+	}
+}
+
+
+static ThreadPriority ToThreadPriority(enum AcqThreadPriority priority)
+{
+	switch (priority) {
+	case AcqThreadPriorityHigh:
+		return ThreadPriority::High;
+	case AcqThreadPriorityRealTime:
+		return ThreadPriority::RealTime;
+	default:
+		return ThreadPriority::Normal;
+	}
+}
+
+
+// Threads log their effective placement as they start
+static std::shared_ptr<ThreadPlacer const> MakeThreadPlacer(OScDev_Device* device)
+{
+	auto placer = std::make_shared<ThreadPlacer>(
+		[device](std::string const& m) { OScDev_Log_Info(device, m.c_str()); });
+	ThreadRole const roles[AcqThreadNumValues] = {
+		ThreadRole::FIFOReader, ThreadRole::Processing,
+		ThreadRole::Histogramming, ThreadRole::FileWriting,
+		ThreadRole::RateMonitor,
+	};
+	for (int i = 0; i < AcqThreadNumValues; ++i) {
+		ThreadPlacement placement;
+		placement.cpu = GetData(device)->threadCPUs[i];
+		placement.priority = ToThreadPriority(GetData(device)->threadPriorities[i]);
+		placer->SetPlacement(roles[i], placement);
+	}
+	return placer;
+}
+
+
+static void LogBufferPoolUsage(OScDev_Device* device, short module,
+	EventBufferPool<BHSPCEvent> const& pool, std::size_t bufferBytes)
+{
+	std::string msg = "Buffer pool (module " + std::to_string(module) + "): peak " +
+		std::to_string(pool.GetHighWaterCount()) + " of " +
+		std::to_string(pool.GetMaxBufferCount()) + " buffers in use (" +
+		std::to_string(pool.GetHighWaterCount() * bufferBytes / (1024 * 1024)) +
+		" MB)";
+	if (pool.GetOverflowCount() > 0) {
+		msg += "; limit reached " + std::to_string(pool.GetOverflowCount()) +
+			" time(s) because processing could not keep up";
+		OScDev_Log_Warning(device, msg.c_str());
+	}
+	else {
+		OScDev_Log_Info(device, msg.c_str());
+	}
+}
+
+
+static void LogFIFOUsage(OScDev_Device* device, short module,
+	FIFOMonitor const& monitor)
+{
+	std::string msg = "Device FIFO (module " + std::to_string(module) + "): peak " +
+		std::to_string(static_cast<int>(monitor.GetPeakFillLevel() * 100.0 + 0.5)) +
+		"% full; drained at " +
+		std::to_string(static_cast<int64_t>(monitor.GetMeanDrainRate())) +
+		" events/s on average";
+	if (monitor.GetOverflowCount() > 0) {
+		msg += "; overflowed " + std::to_string(monitor.GetOverflowCount()) + " time(s)";
+		OScDev_Log_Warning(device, msg.c_str());
+	}
+	else if (monitor.GetWarningCount() > 0) {
+		msg += "; came close to overflowing " +
+			std::to_string(monitor.GetWarningCount()) + " time(s)";
+		OScDev_Log_Warning(device, msg.c_str());
+	}
+	else {
+		OScDev_Log_Info(device, msg.c_str());
+	}
+}
+
+
+static void LogLineMarkerBufferUsage(OScDev_Device* device,
+	LineMarkerBufferUsage const& usage)
+{
+	std::string msg = "Pixel assignment: peak " +
+		std::to_string(usage.peakPendingPhotons.load()) +
+		" photons buffered awaiting line markers; peak " +
+		std::to_string(usage.peakPendingLines.load()) +
+		" line markers buffered awaiting line start";
+	OScDev_Log_Info(device, msg.c_str());
+}
+
+
+// Consumer 0 is processing (histogramming); consumer 1, if any, is the SPC
+// file writer (see SetUpProcessing())
+static void LogStreamLag(OScDev_Device* device, short module,
+	BroadcastEventStream<BHSPCEvent> const& stream)
+{
+	std::string msg = "Peak lag behind acquisition of module " +
+		std::to_string(module) + " (buffers): processing " +
+		std::to_string(stream.GetPeakConsumerLag(0));
+	if (stream.GetConsumerCount() > 1) {
+		msg += ", SPC file writer " + std::to_string(stream.GetPeakConsumerLag(1));
+	}
+	OScDev_Log_Info(device, msg.c_str());
+}
+
+
+// Raw data of the m-th module (m > 0) goes to a separate file, named by
+// inserting "-m<m>" before the extension
+static std::string ModuleFilename(std::string const& filename, int32_t m)
+{
+	if (m == 0 || filename.empty()) {
+		return filename;
+	}
+	auto const slash = filename.find_last_of("/\\");
+	auto dot = filename.rfind('.');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+		dot = filename.size();
+	}
+	return filename.substr(0, dot) + "-m" + std::to_string(m) + filename.substr(dot);
+}
+
+
 static void WaitForCompletionAndLog(OScDev_Device* device, AcqState* acqState, std::string const& proc)
 {
 	auto messages = acqState->finish.get();
@@ -163,11 +380,14 @@ extern "C"
 int StartAcquisition(OScDev_Device* device, OScDev_Acquisition* acq)
 {
 	OScDev_Log_Info(device, "Starting acquisition setup");
+	auto const setupTimer = std::make_shared<SetupTimer>(
+		[device](std::string const& m) { OScDev_Log_Info(device, m.c_str()); });
 
 	int err = ResetAcquisitionState(device);
 	if (err != 0)
 		return err;
 	auto acqState = GetData(device)->acqState;
+	auto engine = GetData(device)->acqEngine;
 	std::shared_future<void> stopRequested =
 		acqState->requestStop.get_future().share();
 
@@ -177,14 +397,10 @@ int StartAcquisition(OScDev_Device* device, OScDev_Acquisition* acq)
 	acqState->finish = unstarted.get_future().share();
 	unstarted.set_value({});
 
-	err = ConfigureMarkers(device);
-	if (err != 0)
-		return err;
-
-	err = CheckMarkers(device);
-	if (err != 0)
-		return err;
 	uint32_t lineMarkerBit = GetData(device)->lineMarkerBit;
+	uint32_t pixelMarkerBit = GetData(device)->pixelMarkerBit;
+	uint32_t frameMarkerBit = GetData(device)->startFramesOnFrameMarker ?
+		GetData(device)->frameMarkerBit : UINT32_MAX;
 
 	uint32_t nFrames = OScDev_Acquisition_GetNumberOfFrames(acq);
 	double pixelRateHz = OScDev_Acquisition_GetPixelRate(acq);
@@ -198,32 +414,78 @@ int StartAcquisition(OScDev_Device* device, OScDev_Acquisition* acq)
 
 	bool accumulateIntensity = GetData(device)->accumulateIntensity;
 
-	bool lineMarkersAtLineEnds;
+	bool lineMarkersAtLineEnds = false;
+	bool usePixelMarkers = false;
+	bool resonant = false;
+	bool bidirectional = false;
 	switch (GetData(device)->pixelMappingMode) {
 	case PixelMappingModeLineStartMarkers:
-		lineMarkersAtLineEnds = false;
 		break;
 	case PixelMappingModeLineEndMarkers:
 		lineMarkersAtLineEnds = true;
 		break;
+	case PixelMappingModePixelMarkers:
+		usePixelMarkers = true;
+		break;
+	case PixelMappingModeResonantUnidirectional:
+		resonant = true;
+		break;
+	case PixelMappingModeResonantBidirectional:
+		resonant = true;
+		bidirectional = true;
+		if (height % 2 != 0) {
+			return 1; // Each line marker starts 2 rows
+		}
+		break;
 	default:
 		return 1; // Unimplemented mode
 	}
 	double lineDelayPixels = GetData(device)->lineDelayPx;
+	double resonantLineRateHz = GetData(device)->resonantLineRateHz;
+	double resonantFillFraction = GetData(device)->resonantFillFraction;
 	std::string spcFilename(GetData(device)->spcFilename);
 	std::string sdtFilename(GetData(device)->sdtFilename);
 	bool compressHistograms = GetData(device)->compressHistograms;
 	bool checkSync = GetData(device)->checkSyncBeforeAcq;
 
-	char fileHeader[4];
-	short fifoType;
-	int macroTimeUnitsTenthNs;
-	err = SetUpAcquisition(GetData(device)->moduleNr, checkSync,
-		fileHeader, &fifoType, &macroTimeUnitsTenthNs);
-	if (err != 0)
-		return err;
-	if (!IsStandardFIFO(fifoType)) {
-		return 1; // Unsupported data format
+	int32_t const moduleCount = GetData(device)->moduleCount;
+	std::vector<short> modules(GetData(device)->moduleNrs,
+		GetData(device)->moduleNrs + moduleCount);
+	bool alignModules = GetData(device)->alignModulesOnFirstMarker;
+	bool pipelined = GetData(device)->pipelinedProcessing;
+
+	// All calls to the SPC library are made from this thread.
+	std::vector<std::array<char, 4>> fileHeaders(moduleCount);
+	int macroTimeUnitsTenthNs = 0;
+	{
+		SetupTimer::Phase phase(setupTimer.get(), "device configuration");
+
+		err = ConfigureMarkers(device);
+		if (err != 0)
+			return err;
+
+		err = CheckMarkers(device);
+		if (err != 0)
+			return err;
+
+		for (int32_t m = 0; m < moduleCount; ++m) {
+			short fifoType;
+			int moduleMacroTimeUnits;
+			err = SetUpAcquisition(modules[m], checkSync,
+				fileHeaders[m].data(), &fifoType, &moduleMacroTimeUnits);
+			if (err != 0)
+				return err;
+			if (!IsStandardFIFO(fifoType)) {
+				return 1; // Unsupported data format
+			}
+			if (m == 0) {
+				macroTimeUnitsTenthNs = moduleMacroTimeUnits;
+			}
+			else if (moduleMacroTimeUnits != macroTimeUnitsTenthNs) {
+				OScDev_Log_Error(device, "Cannot merge data from modules with different macro-time clocks");
+				return 1;
+			}
+		}
 	}
 
 	uint32_t lineTime = PixelsToMacroTime(width, pixelRateHz, macroTimeUnitsTenthNs);
@@ -231,6 +493,36 @@ int StartAcquisition(OScDev_Device* device, OScDev_Acquisition* acq)
 	if (lineMarkersAtLineEnds) {
 		lineDelay -= lineTime;
 	}
+	// With pixel markers, the line delay setting applies to each pixel, and
+	// a pixel lasts at most the nominal pixel time (ending earlier if the
+	// next pixel marker arrives first).
+	uint32_t pixelTime = std::max(1,
+		PixelsToMacroTime(1.0, pixelRateHz, macroTimeUnitsTenthNs));
+	if (!usePixelMarkers) {
+		pixelMarkerBit = UINT32_MAX;
+	}
+
+	// A resonant scanner is assumed to give a line marker at the start of each
+	// period (adjusted by the line delay), and its sweeps are mapped to pixels
+	// of equal size in position. Otherwise a line lasts width pixels at the
+	// pixel rate.
+	std::unique_ptr<LineMapping> lineMapping;
+	try {
+		if (resonant) {
+			uint32_t scanPeriod = PixelsToMacroTime(1.0, resonantLineRateHz,
+				macroTimeUnitsTenthNs);
+			lineMapping.reset(new LineMapping(LineMapping::Sinusoidal(width,
+				scanPeriod, resonantFillFraction, bidirectional)));
+		}
+		else {
+			lineMapping.reset(new LineMapping(
+				LineMapping::Linear(width, lineTime)));
+		}
+	}
+	catch (std::invalid_argument const& e) {
+		OScDev_Log_Error(device, e.what());
+		return 1;
+	}
 
 	auto completion = std::make_shared<AcquisitionCompletion>(
 		[acqState]() mutable { RequestAcquisitionStop(acqState); },
@@ -241,61 +533,175 @@ int StartAcquisition(OScDev_Device* device, OScDev_Acquisition* acq)
 	// completion from firing during setup.
 	completion->AddProcess("Setup");
 
-	std::shared_ptr<SPCFileWriter> spcWriter;
+	auto threadPlacer = MakeThreadPlacer(device);
+	if (GetData(device)->rates) {
+		SetRateCounterThreadPlacer(GetData(device)->rates, threadPlacer);
+	}
+
+	// The remaining setup steps overlap: .spc files are created, and the
+	// decoders and histograms constructed, on worker threads while this
+	// thread collects the .sdt file metadata from the device.
+
+	std::vector<PendingDeviceEventProcessor> spcWriters(moduleCount);
 	if (!spcFilename.empty()) {
-		spcWriter = std::make_shared<SPCFileWriter>(spcFilename, fileHeader, completion);
+		for (int32_t m = 0; m < moduleCount; ++m) {
+			spcWriters[m] = RunOnWorkerThread(engine->workers,
+				[setupTimer, m, filename = ModuleFilename(spcFilename, m),
+				fileHeader = fileHeaders[m], completion]() mutable
+				-> std::shared_ptr<DeviceEventProcessor> {
+				SetupTimer::Phase phase(setupTimer.get(),
+					"SPC file creation (module " + std::to_string(m) + ")");
+				try {
+					return std::make_shared<SPCFileWriter>(filename,
+						fileHeader.data(), completion);
+				}
+				catch (std::exception const& e) {
+					// The writer did not get to add its process
+					completion->AddProcess("SPCFileWriter");
+					completion->HandleError(std::string("Cannot create SPC file: ") +
+						e.what(), "SPCFileWriter");
+					return nullptr;
+				}
+			}).share();
+		}
 	}
 
 	std::shared_ptr<SDTWriter> sdtWriter;
 	if (!sdtFilename.empty()) {
 		sdtWriter = std::make_shared<SDTWriter>(sdtFilename,
-			static_cast<unsigned>(channelMask.count()), completion);
+			static_cast<unsigned>(channelMask.count() * moduleCount), completion);
+		sdtWriter->SetThreadPlacer(threadPlacer);
+	}
+
+	// Buffers are sized so that, at the highest event rate the device can
+	// transfer (~10M events/s), a buffer fills in about the latency target.
+	// At lower rates, buffers are sent partially filled.
+	auto const latencyTarget = std::chrono::microseconds(static_cast<int64_t>(
+		std::round(1000.0 * GetData(device)->fifoLatencyTargetMs)));
+	std::size_t const bufferEvents =
+		AdaptiveFIFOPoller::BufferCapacityForLatency(latencyTarget, 10e6);
+	std::size_t const bufferBytes = bufferEvents * sizeof(BHSPCEvent);
+	// The buffer memory limit is shared equally by the modules.
+	std::size_t const maxBufferCount = std::max<std::size_t>(1,
+		static_cast<std::size_t>(GetData(device)->maxBufferMemoryMB) * 1024 * 1024 /
+		bufferBytes / moduleCount);
+
+	// The streams can receive data as soon as they are returned; histograms
+	// are allocated in the background (and need not be ready before arming).
+	std::shared_ptr<LineMarkerBufferUsage> lineMarkerBufferUsage;
+	if (!usePixelMarkers) {
+		lineMarkerBufferUsage = std::make_shared<LineMarkerBufferUsage>();
+	}
+	std::vector<std::shared_ptr<BroadcastEventStream<BHSPCEvent>>> streams;
+	try {
+		completion->AddProcess("StreamSetup");
+		auto streams_and_done = SetUpProcessing(width, height, nFrames,
+			channelMask, accumulateIntensity, lineDelay, *lineMapping, lineMarkerBit,
+			pixelMarkerBit, pixelTime, frameMarkerBit,
+			0.1 * macroTimeUnitsTenthNs, GetData(device)->maxLineMarkerLagMs,
+			lineMarkerBufferUsage, acq,
+			[acqState]() mutable { RequestAcquisitionStop(acqState); },
+			spcWriters, alignModules, pipelined, sdtWriter, maxBufferCount, threadPlacer,
+			engine->histogramPool, engine->workers, setupTimer, completion);
+		streams = std::get<0>(streams_and_done);
+		acqState->eventPumpingFinish = std::move(std::get<1>(streams_and_done));
+		completion->HandleFinish("StreamSetup");
+	}
+	catch (std::bad_alloc const&) {
+		completion->HandleError("Cannot allocate memory for event streams", "StreamSetup");
+	}
+
+	if (sdtWriter) {
+		SetupTimer::Phase phase(setupTimer.get(), "SDT file metadata");
+		// The .sdt file records the setup of the first module only; the
+		// other modules are assumed to be configured alike (by the .ini file)
 		sdtWriter->SetPreacquisitionData(GetData(device)->moduleNr,
-			8, width, height, compressHistograms, pixelRateHz, false,
+			8, width, height, compressHistograms, pixelRateHz, usePixelMarkers,
 			GetData(device)->pixelMarkerBit < NUM_MARKER_BITS,
 			GetData(device)->lineMarkerBit < NUM_MARKER_BITS,
 			GetData(device)->frameMarkerBit < NUM_MARKER_BITS);
 	}
 
-	std::shared_ptr<EventStream<BHSPCEvent>> stream;
-	try {
-		completion->AddProcess("ProcessingSetup");
-		auto stream_and_done = SetUpProcessing(width, height, nFrames,
-			channelMask, accumulateIntensity, lineDelay, lineTime, lineMarkerBit, acq,
-			[acqState]() mutable { RequestAcquisitionStop(acqState); },
-			spcWriter, sdtWriter, completion);
-		stream = std::get<0>(stream_and_done);
-		acqState->eventPumpingFinish = std::move(std::get<1>(stream_and_done));
-		completion->HandleFinish("ProcessingSetup");
-	}
-	catch (std::bad_alloc const&) { // Likely could not allocate histogram memory
-		completion->HandleError("Cannot allocate memory for histogram(s)", "ProcessingSetup");
+	// The .spc files must be open before we arm, so that a file that cannot
+	// be created fails the start (rather than losing the raw data).
+	for (auto& w : spcWriters) {
+		if (w.valid()) {
+			w.wait();
+		}
 	}
 
 	completion->HandleFinish("Setup");
 	using namespace std::chrono_literals;
 	if (stopRequested.wait_for(0s) == std::future_status::ready) {
 		// A synchronous error occurred during setup
-		stream->Send({});
+		for (auto& stream : streams) {
+			stream->Send({});
+		}
 		OScDev_Log_Error(device, "Failed during acquisition setup; waiting for cleanup");
 		WaitForCompletionAndLog(device, acqState, "Acquisition setup");
 		return 1;
 	}
 
-	// 48k events = ~5 ms at 10M events/s
-	auto pool = std::make_shared<EventBufferPool<BHSPCEvent>>(48 * 1024);
+	if (engine->bufferPools.size() < static_cast<std::size_t>(moduleCount)) {
+		engine->bufferPools.resize(moduleCount);
+	}
+	for (int32_t m = 0; m < moduleCount; ++m) {
+		// No buffers are checked out, because the previous acquisition's
+		// threads have finished (see ~AcqState())
+		auto& pool = engine->bufferPools[m];
+		if (!pool || pool->GetBufferSize() != bufferEvents) {
+			pool = std::make_shared<EventBufferPool<BHSPCEvent>>(bufferEvents);
+		}
+		pool->SetMaxBufferCount(maxBufferCount,
+			ToEventBufferPoolPolicy(GetData(device)->bufferOverflowPolicy));
+		pool->ResetStatistics();
+		acqState->bufferPools.push_back(pool);
+
+		short const module = modules[m];
+		acqState->fifoMonitors.push_back(std::make_shared<FIFOMonitor>(
+			[device, module](std::string const& msg) {
+				std::string const m = "Module " + std::to_string(module) + ": " + msg;
+				OScDev_Log_Warning(device, m.c_str());
+			}));
+	}
 
-	auto err_and_finish = StartAcquisitionStandardFIFO(
-		GetData(device)->moduleNr, pool, stream, stopRequested, completion);
-	err = std::get<0>(err_and_finish);
-	acqState->acquisitionFinish = std::move(std::get<1>(err_and_finish));
-	if (err != 0) {
-		// A synchronous error occurred while starting acquisition
-		OScDev_Log_Error(device, "Failed to start acquisition; waiting for cleanup");
-		WaitForCompletionAndLog(device, acqState, "Starting acquisition");
-		return err;
+	// The ADC rate counter (photons converted per second) lets the read loop
+	// anticipate a rising event rate. Rates are only monitored for the first
+	// module.
+	auto rateCounts = GetData(device)->rates;
+	auto adcRate = [rateCounts]() -> double {
+		float values[4];
+		GetRates(rateCounts, values);
+		return values[3];
+	};
+
+	// Each module is read on its own thread. Modules are started one after
+	// another, so their macro-times are offset unless they are started by a
+	// common trigger (see AlignModulesOnFirstMarker).
+	for (int32_t m = 0; m < moduleCount; ++m) {
+		SetupTimer::Phase phase(setupTimer.get(),
+			"arming module " + std::to_string(modules[m]));
+		auto err_and_finish = StartAcquisitionStandardFIFO(
+			modules[m], acqState->bufferPools[m], streams[m], latencyTarget,
+			m == 0 ? std::function<double()>(adcRate) : nullptr,
+			acqState->fifoMonitors[m], threadPlacer, engine->workers,
+			stopRequested, completion);
+		err = std::get<0>(err_and_finish);
+		acqState->acquisitionFinishes.push_back(std::move(std::get<1>(err_and_finish)));
+		if (err != 0) {
+			// A synchronous error occurred while starting acquisition; stop
+			// the modules already started, and end the streams of the others
+			RequestAcquisitionStop(acqState);
+			for (int32_t n = m + 1; n < moduleCount; ++n) {
+				streams[n]->Send({});
+			}
+			OScDev_Log_Error(device, "Failed to start acquisition; waiting for cleanup");
+			WaitForCompletionAndLog(device, acqState, "Starting acquisition");
+			return err;
+		}
 	}
 
+	setupTimer->LogMilestone("all modules armed");
 	OScDev_Log_Info(device, "Started acquisition");
 
 	// TODO: Arrange to actually set post-acquisition data to SDTWriter
@@ -303,10 +709,33 @@ int StartAcquisition(OScDev_Device* device, OScDev_Acquisition* acq)
 		sdtWriter->FinishPostAcquisitionData();
 	}
 
-	// Arrange to log the end of acquisition.
-	acqState->logStopFinish = std::async(std::launch::async, [device, acqState] {
+	// Arrange to log the end of acquisition, and then (once processing has
+	// finished and released its histograms) start preparing the histogram
+	// storage for the next acquisition. Idle buffers are kept for reuse.
+	auto histogramPool = engine->histogramPool;
+	auto workers = engine->workers;
+	acqState->logStopFinish = RunOnWorkerThread(engine->workers,
+		[device, acqState, bufferBytes, streams, modules, lineMarkerBufferUsage,
+		histogramPool, workers] {
 		OScDev_Log_Info(device, "Waiting for acquisition to finish");
 		WaitForCompletionAndLog(device, acqState, "Acquisition");
+
+		for (auto& f : acqState->acquisitionFinishes) {
+			f.wait();
+		}
+		acqState->eventPumpingFinish.wait();
+		for (std::size_t m = 0; m < modules.size(); ++m) {
+			LogFIFOUsage(device, modules[m], *acqState->fifoMonitors[m]);
+			LogBufferPoolUsage(device, modules[m], *acqState->bufferPools[m], bufferBytes);
+			LogStreamLag(device, modules[m], *streams[m]);
+		}
+		if (lineMarkerBufferUsage) {
+			LogLineMarkerBufferUsage(device, *lineMarkerBufferUsage);
+		}
+		// Not waited for (~AcqState() waits for logStopFinish), so that the
+		// next acquisition can start meanwhile; its Get() takes over storage
+		// not yet cleared.
+		workers->Run([histogramPool] { histogramPool->ClearIdle(); });
 	});
 
 	return 0;
@@ -342,3 +771,10 @@ void WaitForAcquisitionToFinish(OScDev_Device* device)
 
 	GetData(device)->acqState->finish.get();
 }
+
+
+extern "C"
+int GetThreadPlacementCPUCount(void)
+{
+	return GetCPUCount();
+}
@@ -13,6 +13,9 @@ void StopAcquisition(OScDev_Device* device);
 bool IsAcquisitionRunning(OScDev_Device* device);
 void WaitForAcquisitionToFinish(OScDev_Device* device);
 
+// Number of CPUs that threads can be pinned to
+int GetThreadPlacementCPUCount(void);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
\ No newline at end of file
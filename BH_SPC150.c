@@ -33,9 +33,25 @@ static void PopulateDefaultParameters(struct BH_PrivateData *data)
 
 	data->pixelMappingMode = PixelMappingModeLineEndMarkers;
 	data->lineDelayPx = 0.0;
+	data->startFramesOnFrameMarker = false;
+	data->resonantLineRateHz = 8000.0;
+	data->resonantFillFraction = 0.8;
 	strcpy(data->spcFilename, "OpenScan-BHSPC.spc");
 	strcpy(data->sdtFilename, "OpenScan-BHSPC.sdt");
 	data->checkSyncBeforeAcq = true;
+	data->moduleCount = 1;
+	data->alignModulesOnFirstMarker = true;
+	data->pipelinedProcessing = true;
+	data->fifoLatencyTargetMs = 20.0;
+	data->maxBufferMemoryMB = 1024;
+	data->bufferOverflowPolicy = BufferOverflowPolicyFail;
+	data->maxLineMarkerLagMs = 10000.0;
+	for (int i = 0; i < AcqThreadNumValues; ++i) {
+		data->threadCPUs[i] = -1;
+		data->threadPriorities[i] = AcqThreadPriorityNormal;
+	}
+	// Scheduling delays in reading the FIFO can cause it to overflow
+	data->threadPriorities[AcqThreadFIFOReader] = AcqThreadPriorityHigh;
 }
 
 
@@ -43,12 +59,12 @@ static OScDev_Error EnsureFLIMBoardInitialized(void)
 {
 	// There is a mismatch between the OpenScan model of initializing a device
 	// with how BH SPC works: multiple BH modules (boards) are initialized at
-	// once using a single .ini file. We will need to figure out a workaround
-	// for this when we support multiple modules, but for now we assume a
-	// single module.
+	// once using a single .ini file. We therefore present all the modules
+	// initialized by the .ini file as a single device (see DetectModules()),
+	// acquiring from them together.
 
 	if (g_BH_initialized) {
-		// Reject second instance, as we don't yet support multiple modules
+		// Reject second instance; all modules belong to the first
 		return OScDev_Error_Device_Already_Open;
 	}
 
@@ -75,13 +91,32 @@ static OScDev_Error EnsureFLIMBoardInitialized(void)
 }
 
 
+// Find the modules initialized by SPC_init() (those enabled in the .ini file)
+static void DetectModules(struct BH_PrivateData *data)
+{
+	data->detectedModuleCount = 0;
+	for (short i = 0; i < MAX_NO_OF_SPC; ++i) {
+		if (data->detectedModuleCount == MAX_NUM_MODULES)
+			break;
+		if (SPC_test_id(i) >= 0)
+			data->moduleNrs[data->detectedModuleCount++] = i;
+	}
+	if (data->detectedModuleCount == 0) {
+		// Leave errors to be reported when accessing module 0
+		data->moduleNrs[0] = 0;
+		data->detectedModuleCount = 1;
+	}
+	data->moduleNr = data->moduleNrs[0];
+	data->moduleCount = data->detectedModuleCount;
+}
+
+
 static OScDev_Error DeinitializeFLIMBoard(void)
 {
 	if (!g_BH_initialized)
 		return OScDev_OK;
 
-	// See comment where we call SPC_init(). We assume only one module is in
-	// use.
+	// See comment where we call SPC_init(). This closes all modules.
 	SPC_close();
 
 	g_BH_initialized = false;
@@ -91,13 +126,10 @@ static OScDev_Error DeinitializeFLIMBoard(void)
 
 static OScDev_Error BH_EnumerateInstances(OScDev_PtrArray **devices)
 {
-	// TODO SPC_test_id(0...7) can be used to get all modules present.
-	// We would then have the user supply a .ini file for each module,
-	// and check that the .ini file specifies the correct module number
-	// before calling SPC_init().
+	// A single device covers all modules enabled in the .ini file; they are
+	// enumerated with SPC_test_id() once initialized (see BH_Open()).
 
 	struct BH_PrivateData *data = calloc(1, sizeof(struct BH_PrivateData));
-	// For now, support just one board
 	data->moduleNr = 0;
 
 	OScDev_Device *device;
@@ -147,6 +179,7 @@ static OScDev_Error BH_Open(OScDev_Device *device)
 		return err;
 
 	PopulateDefaultParameters(GetData(device));
+	DetectModules(GetData(device));
 
 	if (OScDev_CHECK(err, InitializeDeviceForAcquisition(device)))
 		return err;
@@ -155,7 +188,10 @@ static OScDev_Error BH_Open(OScDev_Device *device)
 
 	++g_openDeviceCount;
 
-	OScDev_Log_Debug(device, "BH SPC board initialized");
+	char msg[OScDev_MAX_STR_LEN + 1];
+	snprintf(msg, sizeof(msg), "BH SPC board initialized (%d module(s))",
+		(int)GetData(device)->detectedModuleCount);
+	OScDev_Log_Debug(device, msg);
 	return OScDev_OK;
 }
 
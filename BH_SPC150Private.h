@@ -2,9 +2,12 @@
 
 #include <OpenScanDeviceLib.h>
 
+#ifdef _WIN32
 #include <Windows.h>
+#endif
 
 
+struct AcqEngine; // Defined in C++
 struct AcqState; // Defined in C++
 struct RateCounts; // Defined in C++
 
@@ -16,6 +19,9 @@ struct RateCounts; // Defined in C++
 // All BH SPC models supporting FIFO mode have 4 routing bits in FIFO mode.
 #define MAX_NUM_CHANNELS 16
 
+// The SPCM DLL supports up to 8 modules (MAX_NO_OF_SPC).
+#define MAX_NUM_MODULES 8
+
 
 enum MarkerPolarity {
 	MarkerPolarityDisabled,
@@ -36,14 +42,58 @@ enum ScanMarkerType {
 enum PixelMappingMode {
 	PixelMappingModeLineStartMarkers,
 	PixelMappingModeLineEndMarkers,
-	// In future, add pixel marker modes
+	PixelMappingModePixelMarkers,
+	// Line marker at start of each period of a resonant (sinusoidal) scanner
+	PixelMappingModeResonantUnidirectional,
+	PixelMappingModeResonantBidirectional, // Reverse sweep is next row
 	PixelMappingModeNumValues,
 };
 
 
+// What to do when acquired data is not being processed fast enough and the
+// buffer memory limit is reached
+enum BufferOverflowPolicy {
+	BufferOverflowPolicyBlock, // Stop reading the device FIFO until buffers are free
+	BufferOverflowPolicyFail, // Stop the acquisition with an error
+	BufferOverflowPolicyReport, // Keep going (device FIFO may overflow); log at end
+	BufferOverflowPolicyNumValues,
+};
+
+
+// Threads we start, by role; each role can be given a CPU and priority
+enum AcqThread {
+	AcqThreadFIFOReader, // Reads the device FIFO (one per module)
+	AcqThreadProcessing, // Decodes events (and, unless pipelined, builds images and histograms)
+	AcqThreadHistogramming, // Pipeline stages: assigns photons to pixels, builds histograms
+	AcqThreadFileWriting, // Writes .spc and .sdt files
+	AcqThreadRateMonitor, // Polls rate counters while the device is open
+	AcqThreadNumValues,
+};
+
+
+enum AcqThreadPriority {
+	AcqThreadPriorityNormal,
+	AcqThreadPriorityHigh,
+	AcqThreadPriorityRealTime, // Falls back to High if not permitted
+	AcqThreadPriorityNumValues,
+};
+
+
 struct BH_PrivateData
 {
-	short moduleNr;
+	short moduleNr; // First module; rate counters are for this module
+
+	// Modules found when opening the device, of which the first moduleCount
+	// are used for acquisition (moduleNrs[0] == moduleNr). Data from multiple
+	// modules is merged by macro-time; channel c of the m-th module becomes
+	// channel 16m + c in histograms.
+	short moduleNrs[MAX_NUM_MODULES];
+	int32_t detectedModuleCount;
+	int32_t moduleCount;
+	bool alignModulesOnFirstMarker; // Modules not started by common trigger
+
+	// Assign pixels and build histograms on threads other than the decoder's
+	bool pipelinedProcessing;
 
 	uint16_t channelMask;
 
@@ -58,6 +108,9 @@ struct BH_PrivateData
 	// Pixel assignment configuration
 	enum PixelMappingMode pixelMappingMode;
 	double lineDelayPx; // Delay of photons relative to markers
+	bool startFramesOnFrameMarker; // Else count lines; data loss is fatal
+	double resonantLineRateHz; // Line markers per second in resonant modes
+	double resonantFillFraction; // Fraction of each sweep used for pixels
 
 	char spcFilename[OScDev_MAX_STR_SIZE];
 	char sdtFilename[OScDev_MAX_STR_SIZE];
@@ -65,10 +118,28 @@ struct BH_PrivateData
 
 	bool checkSyncBeforeAcq;
 
+	// How soon acquired data should reach processing
+	double fifoLatencyTargetMs;
+
+	// Limit on memory used to buffer data between acquisition and processing
+	int32_t maxBufferMemoryMB;
+	enum BufferOverflowPolicy bufferOverflowPolicy;
+
+	// Photons arriving without line markers for this long fail acquisition
+	double maxLineMarkerLagMs;
+
+	// Placement of threads, indexed by enum AcqThread; CPU -1 = any CPU
+	int32_t threadCPUs[AcqThreadNumValues];
+	enum AcqThreadPriority threadPriorities[AcqThreadNumValues];
+
 	// C++ data for rate counter monitoring. Manually initialized on device
 	// open; deleted on device close.
 	struct RateCounts *rates;
 
+	// C++ data kept across acquisitions (worker threads, buffer pools, and
+	// histogram storage). Created on device open; deleted on device close.
+	struct AcqEngine *acqEngine;
+
 	// C++ data for a single acquisition. Access to this pointer is not
 	// protected by a mutex (i.e. relies on synchronization by OpenScanLib and
 	// application). Thus, although we create a new AcqState for each
@@ -1,5 +1,6 @@
 #include "BH_SPC150Private.h"
 
+#include "AcquisitionControl.h"
 #include "RateCounters.h"
 
 #include <stdio.h>
@@ -296,6 +297,15 @@ static OScDev_Error GetPixelMappingModeNameForValue(OScDev_Setting *setting, uin
 	case PixelMappingModeLineEndMarkers:
 		strcpy(name, "LineEndMarkers");
 		break;
+	case PixelMappingModePixelMarkers:
+		strcpy(name, "PixelMarkers");
+		break;
+	case PixelMappingModeResonantUnidirectional:
+		strcpy(name, "ResonantUnidirectional");
+		break;
+	case PixelMappingModeResonantBidirectional:
+		strcpy(name, "ResonantBidirectional");
+		break;
 	default:
 		return OScDev_Error_Illegal_Argument;
 	}
@@ -311,6 +321,15 @@ static OScDev_Error GetPixelMappingModeValueForName(OScDev_Setting *setting, uin
 	else if (strcmp(name, "LineEndMarkers") == 0) {
 		*value = PixelMappingModeLineEndMarkers;
 	}
+	else if (strcmp(name, "PixelMarkers") == 0) {
+		*value = PixelMappingModePixelMarkers;
+	}
+	else if (strcmp(name, "ResonantUnidirectional") == 0) {
+		*value = PixelMappingModeResonantUnidirectional;
+	}
+	else if (strcmp(name, "ResonantBidirectional") == 0) {
+		*value = PixelMappingModeResonantBidirectional;
+	}
 	else {
 		return OScDev_Error_Illegal_Argument;
 	}
@@ -372,6 +391,66 @@ static OScDev_SettingImpl SettingImpl_LineDelayPx = {
 };
 
 
+static OScDev_Error GetResonantLineRateHzRange(OScDev_Setting *setting, double *min, double *max)
+{
+	*min = 100.0;
+	*max = 100000.0;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetResonantLineRateHz(OScDev_Setting *setting, double *value)
+{
+	*value = GetSettingDeviceData(setting)->resonantLineRateHz;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetResonantLineRateHz(OScDev_Setting *setting, double value)
+{
+	GetSettingDeviceData(setting)->resonantLineRateHz = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_ResonantLineRateHz = {
+	.GetNumericConstraintType = GetNumericConstraintTypeImpl_Range,
+	.GetFloat64Range = GetResonantLineRateHzRange,
+	.GetFloat64 = GetResonantLineRateHz,
+	.SetFloat64 = SetResonantLineRateHz,
+};
+
+
+static OScDev_Error GetResonantFillFractionRange(OScDev_Setting *setting, double *min, double *max)
+{
+	*min = 0.05;
+	*max = 1.0;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetResonantFillFraction(OScDev_Setting *setting, double *value)
+{
+	*value = GetSettingDeviceData(setting)->resonantFillFraction;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetResonantFillFraction(OScDev_Setting *setting, double value)
+{
+	GetSettingDeviceData(setting)->resonantFillFraction = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_ResonantFillFraction = {
+	.GetNumericConstraintType = GetNumericConstraintTypeImpl_Range,
+	.GetFloat64Range = GetResonantFillFractionRange,
+	.GetFloat64 = GetResonantFillFraction,
+	.SetFloat64 = SetResonantFillFraction,
+};
+
+
 static OScDev_Error GetCheckSync(OScDev_Setting *setting, bool *value)
 {
 	*value = GetSettingDeviceData(setting)->checkSyncBeforeAcq;
@@ -392,6 +471,374 @@ static OScDev_SettingImpl SettingImpl_CheckSync = {
 };
 
 
+static OScDev_Error GetNumberOfModulesRange(OScDev_Setting *setting, int32_t *min, int32_t *max)
+{
+	*min = 1;
+	*max = GetSettingDeviceData(setting)->detectedModuleCount;
+	if (*max < 1)
+		*max = 1;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetNumberOfModules(OScDev_Setting *setting, int32_t *value)
+{
+	*value = GetSettingDeviceData(setting)->moduleCount;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetNumberOfModules(OScDev_Setting *setting, int32_t value)
+{
+	GetSettingDeviceData(setting)->moduleCount = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_NumberOfModules = {
+	.GetNumericConstraintType = GetNumericConstraintTypeImpl_Range,
+	.GetInt32Range = GetNumberOfModulesRange,
+	.GetInt32 = GetNumberOfModules,
+	.SetInt32 = SetNumberOfModules,
+};
+
+
+static OScDev_Error GetAlignModules(OScDev_Setting *setting, bool *value)
+{
+	*value = GetSettingDeviceData(setting)->alignModulesOnFirstMarker;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetAlignModules(OScDev_Setting *setting, bool value)
+{
+	GetSettingDeviceData(setting)->alignModulesOnFirstMarker = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_AlignModules = {
+	.GetBool = GetAlignModules,
+	.SetBool = SetAlignModules,
+};
+
+
+static OScDev_Error GetPipelinedProcessing(OScDev_Setting *setting, bool *value)
+{
+	*value = GetSettingDeviceData(setting)->pipelinedProcessing;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetPipelinedProcessing(OScDev_Setting *setting, bool value)
+{
+	GetSettingDeviceData(setting)->pipelinedProcessing = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_PipelinedProcessing = {
+	.GetBool = GetPipelinedProcessing,
+	.SetBool = SetPipelinedProcessing,
+};
+
+
+static OScDev_Error GetStartFramesOnFrameMarker(OScDev_Setting *setting, bool *value)
+{
+	*value = GetSettingDeviceData(setting)->startFramesOnFrameMarker;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetStartFramesOnFrameMarker(OScDev_Setting *setting, bool value)
+{
+	GetSettingDeviceData(setting)->startFramesOnFrameMarker = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_StartFramesOnFrameMarker = {
+	.GetBool = GetStartFramesOnFrameMarker,
+	.SetBool = SetStartFramesOnFrameMarker,
+};
+
+
+static OScDev_Error GetFIFOLatencyTargetMsRange(OScDev_Setting *setting, double *min, double *max)
+{
+	*min = 1.0;
+	*max = 1000.0;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetFIFOLatencyTargetMs(OScDev_Setting *setting, double *value)
+{
+	*value = GetSettingDeviceData(setting)->fifoLatencyTargetMs;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetFIFOLatencyTargetMs(OScDev_Setting *setting, double value)
+{
+	GetSettingDeviceData(setting)->fifoLatencyTargetMs = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_FIFOLatencyTargetMs = {
+	.GetNumericConstraintType = GetNumericConstraintTypeImpl_Range,
+	.GetFloat64Range = GetFIFOLatencyTargetMsRange,
+	.GetFloat64 = GetFIFOLatencyTargetMs,
+	.SetFloat64 = SetFIFOLatencyTargetMs,
+};
+
+
+static OScDev_Error GetMaxBufferMemoryMBRange(OScDev_Setting *setting, int32_t *min, int32_t *max)
+{
+	*min = 16;
+	*max = 65536;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetMaxBufferMemoryMB(OScDev_Setting *setting, int32_t *value)
+{
+	*value = GetSettingDeviceData(setting)->maxBufferMemoryMB;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetMaxBufferMemoryMB(OScDev_Setting *setting, int32_t value)
+{
+	GetSettingDeviceData(setting)->maxBufferMemoryMB = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_MaxBufferMemoryMB = {
+	.GetNumericConstraintType = GetNumericConstraintTypeImpl_Range,
+	.GetInt32Range = GetMaxBufferMemoryMBRange,
+	.GetInt32 = GetMaxBufferMemoryMB,
+	.SetInt32 = SetMaxBufferMemoryMB,
+};
+
+
+static OScDev_Error GetMaxLineMarkerLagMsRange(OScDev_Setting *setting, double *min, double *max)
+{
+	*min = 1.0;
+	*max = 3600000.0;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetMaxLineMarkerLagMs(OScDev_Setting *setting, double *value)
+{
+	*value = GetSettingDeviceData(setting)->maxLineMarkerLagMs;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetMaxLineMarkerLagMs(OScDev_Setting *setting, double value)
+{
+	GetSettingDeviceData(setting)->maxLineMarkerLagMs = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_MaxLineMarkerLagMs = {
+	.GetNumericConstraintType = GetNumericConstraintTypeImpl_Range,
+	.GetFloat64Range = GetMaxLineMarkerLagMsRange,
+	.GetFloat64 = GetMaxLineMarkerLagMs,
+	.SetFloat64 = SetMaxLineMarkerLagMs,
+};
+
+
+static OScDev_Error GetBufferOverflowPolicyNumValues(OScDev_Setting *setting, uint32_t *count)
+{
+	*count = BufferOverflowPolicyNumValues;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetBufferOverflowPolicyNameForValue(OScDev_Setting *setting, uint32_t value, char *name)
+{
+	switch (value) {
+	case BufferOverflowPolicyBlock:
+		strcpy(name, "Block");
+		break;
+	case BufferOverflowPolicyFail:
+		strcpy(name, "Fail");
+		break;
+	case BufferOverflowPolicyReport:
+		strcpy(name, "Report");
+		break;
+	default:
+		return OScDev_Error_Illegal_Argument;
+	}
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetBufferOverflowPolicyValueForName(OScDev_Setting *setting, uint32_t *value, const char *name)
+{
+	if (strcmp(name, "Block") == 0) {
+		*value = BufferOverflowPolicyBlock;
+	}
+	else if (strcmp(name, "Fail") == 0) {
+		*value = BufferOverflowPolicyFail;
+	}
+	else if (strcmp(name, "Report") == 0) {
+		*value = BufferOverflowPolicyReport;
+	}
+	else {
+		return OScDev_Error_Illegal_Argument;
+	}
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetBufferOverflowPolicy(OScDev_Setting *setting, uint32_t *value)
+{
+	*value = GetSettingDeviceData(setting)->bufferOverflowPolicy;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetBufferOverflowPolicy(OScDev_Setting *setting, uint32_t value)
+{
+	GetSettingDeviceData(setting)->bufferOverflowPolicy = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_BufferOverflowPolicy = {
+	.GetEnumNumValues = GetBufferOverflowPolicyNumValues,
+	.GetEnumNameForValue = GetBufferOverflowPolicyNameForValue,
+	.GetEnumValueForName = GetBufferOverflowPolicyValueForName,
+	.GetEnum = GetBufferOverflowPolicy,
+	.SetEnum = SetBufferOverflowPolicy,
+};
+
+
+struct AcqThreadSettingData {
+	OScDev_Device *device;
+	enum AcqThread thread;
+};
+
+
+static void ReleaseAcqThreadSetting(OScDev_Setting *setting)
+{
+	free(OScDev_Setting_GetImplData(setting));
+}
+
+
+static OScDev_Error GetAcqThreadCPURange(OScDev_Setting *setting, int32_t *min, int32_t *max)
+{
+	*min = -1; // Any CPU
+	*max = GetThreadPlacementCPUCount() - 1;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetAcqThreadCPU(OScDev_Setting *setting, int32_t *value)
+{
+	struct AcqThreadSettingData *data = OScDev_Setting_GetImplData(setting);
+	struct BH_PrivateData *deviceData = OScDev_Device_GetImplData(data->device);
+	*value = deviceData->threadCPUs[data->thread];
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetAcqThreadCPU(OScDev_Setting *setting, int32_t value)
+{
+	struct AcqThreadSettingData *data = OScDev_Setting_GetImplData(setting);
+	struct BH_PrivateData *deviceData = OScDev_Device_GetImplData(data->device);
+	deviceData->threadCPUs[data->thread] = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_AcqThreadCPU = {
+	.Release = ReleaseAcqThreadSetting,
+	.GetNumericConstraintType = GetNumericConstraintTypeImpl_Range,
+	.GetInt32Range = GetAcqThreadCPURange,
+	.GetInt32 = GetAcqThreadCPU,
+	.SetInt32 = SetAcqThreadCPU,
+};
+
+
+static OScDev_Error GetAcqThreadPriorityNumValues(OScDev_Setting *setting, uint32_t *count)
+{
+	*count = AcqThreadPriorityNumValues;
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetAcqThreadPriorityNameForValue(OScDev_Setting *setting, uint32_t value, char *name)
+{
+	switch (value) {
+	case AcqThreadPriorityNormal:
+		strcpy(name, "Normal");
+		break;
+	case AcqThreadPriorityHigh:
+		strcpy(name, "High");
+		break;
+	case AcqThreadPriorityRealTime:
+		strcpy(name, "RealTime");
+		break;
+	default:
+		return OScDev_Error_Illegal_Argument;
+	}
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetAcqThreadPriorityValueForName(OScDev_Setting *setting, uint32_t *value, const char *name)
+{
+	if (strcmp(name, "Normal") == 0) {
+		*value = AcqThreadPriorityNormal;
+	}
+	else if (strcmp(name, "High") == 0) {
+		*value = AcqThreadPriorityHigh;
+	}
+	else if (strcmp(name, "RealTime") == 0) {
+		*value = AcqThreadPriorityRealTime;
+	}
+	else {
+		return OScDev_Error_Illegal_Argument;
+	}
+	return OScDev_OK;
+}
+
+
+static OScDev_Error GetAcqThreadPriority(OScDev_Setting *setting, uint32_t *value)
+{
+	struct AcqThreadSettingData *data = OScDev_Setting_GetImplData(setting);
+	struct BH_PrivateData *deviceData = OScDev_Device_GetImplData(data->device);
+	*value = deviceData->threadPriorities[data->thread];
+	return OScDev_OK;
+}
+
+
+static OScDev_Error SetAcqThreadPriority(OScDev_Setting *setting, uint32_t value)
+{
+	struct AcqThreadSettingData *data = OScDev_Setting_GetImplData(setting);
+	struct BH_PrivateData *deviceData = OScDev_Device_GetImplData(data->device);
+	deviceData->threadPriorities[data->thread] = value;
+	return OScDev_OK;
+}
+
+
+static OScDev_SettingImpl SettingImpl_AcqThreadPriority = {
+	.Release = ReleaseAcqThreadSetting,
+	.GetEnumNumValues = GetAcqThreadPriorityNumValues,
+	.GetEnumNameForValue = GetAcqThreadPriorityNameForValue,
+	.GetEnumValueForName = GetAcqThreadPriorityValueForName,
+	.GetEnum = GetAcqThreadPriority,
+	.SetEnum = SetAcqThreadPriority,
+};
+
+
 static OScDev_Error GetSPCFilename(OScDev_Setting *setting, char *value)
 {
 	strcpy(value, GetSettingDeviceData(setting)->spcFilename);
@@ -547,12 +994,100 @@ OScDev_Error BH_MakeSettings(OScDev_Device *device, OScDev_PtrArray **settings)
 		goto error;
 	OScDev_PtrArray_Append(*settings, lineDelayPx);
 
+	OScDev_Setting *resonantLineRateHz;
+	if (OScDev_CHECK(err, OScDev_Setting_Create(&resonantLineRateHz, "ResonantLineRate_Hz", OScDev_ValueType_Float64,
+		&SettingImpl_ResonantLineRateHz, device)))
+		goto error;
+	OScDev_PtrArray_Append(*settings, resonantLineRateHz);
+
+	OScDev_Setting *resonantFillFraction;
+	if (OScDev_CHECK(err, OScDev_Setting_Create(&resonantFillFraction, "ResonantFillFraction", OScDev_ValueType_Float64,
+		&SettingImpl_ResonantFillFraction, device)))
+		goto error;
+	OScDev_PtrArray_Append(*settings, resonantFillFraction);
+
+	OScDev_Setting *startFramesOnFrameMarker;
+	if (OScDev_CHECK(err, OScDev_Setting_Create(&startFramesOnFrameMarker, "StartFramesOnFrameMarker", OScDev_ValueType_Bool,
+		&SettingImpl_StartFramesOnFrameMarker, device)))
+		goto error;
+	OScDev_PtrArray_Append(*settings, startFramesOnFrameMarker);
+
 	OScDev_Setting *checkSync;
 	if (OScDev_CHECK(err, OScDev_Setting_Create(&checkSync, "CheckSyncBeforeAcquisition", OScDev_ValueType_Bool,
 		&SettingImpl_CheckSync, device)))
 		goto error;
 	OScDev_PtrArray_Append(*settings, checkSync);
 
+	OScDev_Setting *numberOfModules;
+	if (OScDev_CHECK(err, OScDev_Setting_Create(&numberOfModules, "NumberOfModules", OScDev_ValueType_Int32,
+		&SettingImpl_NumberOfModules, device)))
+		goto error;
+	OScDev_PtrArray_Append(*settings, numberOfModules);
+
+	OScDev_Setting *alignModules;
+	if (OScDev_CHECK(err, OScDev_Setting_Create(&alignModules, "AlignModulesOnFirstMarker", OScDev_ValueType_Bool,
+		&SettingImpl_AlignModules, device)))
+		goto error;
+	OScDev_PtrArray_Append(*settings, alignModules);
+
+	OScDev_Setting *fifoLatencyTarget;
+	if (OScDev_CHECK(err, OScDev_Setting_Create(&fifoLatencyTarget, "FIFOLatencyTarget_ms", OScDev_ValueType_Float64,
+		&SettingImpl_FIFOLatencyTargetMs, device)))
+		goto error;
+	OScDev_PtrArray_Append(*settings, fifoLatencyTarget);
+
+	OScDev_Setting *maxBufferMemory;
+	if (OScDev_CHECK(err, OScDev_Setting_Create(&maxBufferMemory, "MaxBufferMemory_MB", OScDev_ValueType_Int32,
+		&SettingImpl_MaxBufferMemoryMB, device)))
+		goto error;
+	OScDev_PtrArray_Append(*settings, maxBufferMemory);
+
+	OScDev_Setting *bufferOverflowPolicy;
+	if (OScDev_CHECK(err, OScDev_Setting_Create(&bufferOverflowPolicy, "BufferOverflowPolicy", OScDev_ValueType_Enum,
+		&SettingImpl_BufferOverflowPolicy, device)))
+		goto error;
+	OScDev_PtrArray_Append(*settings, bufferOverflowPolicy);
+
+	OScDev_Setting *maxLineMarkerLag;
+	if (OScDev_CHECK(err, OScDev_Setting_Create(&maxLineMarkerLag, "MaxLineMarkerLag_ms", OScDev_ValueType_Float64,
+		&SettingImpl_MaxLineMarkerLagMs, device)))
+		goto error;
+	OScDev_PtrArray_Append(*settings, maxLineMarkerLag);
+
+	OScDev_Setting *pipelinedProcessing;
+	if (OScDev_CHECK(err, OScDev_Setting_Create(&pipelinedProcessing, "PipelinedProcessing", OScDev_ValueType_Bool,
+		&SettingImpl_PipelinedProcessing, device)))
+		goto error;
+	OScDev_PtrArray_Append(*settings, pipelinedProcessing);
+
+	const char *threadNames[] = { "FIFOReader", "Processing", "Histogramming", "FileWriting", "RateMonitor" };
+	for (int i = 0; i < AcqThreadNumValues; ++i) {
+		struct AcqThreadSettingData *cpuData = calloc(1, sizeof(struct AcqThreadSettingData));
+		cpuData->device = device;
+		cpuData->thread = i;
+		char name[64];
+		snprintf(name, sizeof(name), "%sThreadCPU", threadNames[i]);
+		OScDev_Setting *threadCPU;
+		if (OScDev_CHECK(err, OScDev_Setting_Create(&threadCPU, name, OScDev_ValueType_Int32,
+			&SettingImpl_AcqThreadCPU, cpuData))) {
+			free(cpuData);
+			goto error;
+		}
+		OScDev_PtrArray_Append(*settings, threadCPU);
+
+		struct AcqThreadSettingData *priorityData = calloc(1, sizeof(struct AcqThreadSettingData));
+		priorityData->device = device;
+		priorityData->thread = i;
+		snprintf(name, sizeof(name), "%sThreadPriority", threadNames[i]);
+		OScDev_Setting *threadPriority;
+		if (OScDev_CHECK(err, OScDev_Setting_Create(&threadPriority, name, OScDev_ValueType_Enum,
+			&SettingImpl_AcqThreadPriority, priorityData))) {
+			free(priorityData);
+			goto error;
+		}
+		OScDev_PtrArray_Append(*settings, threadPriority);
+	}
+
 	OScDev_Setting *spcFilename;
 	if (OScDev_CHECK(err, OScDev_Setting_Create(&spcFilename, "SPCFilename", OScDev_ValueType_String,
 		&SettingImpl_SPCFilename, device)))
@@ -1,18 +1,93 @@
 #include "DataStream.hpp"
 
 #include <FLIMEvents/BHDeviceEvent.hpp>
+#include <FLIMEvents/BroadcastStream.hpp>
+#include <FLIMEvents/DecodedEventMerger.hpp>
+#include <FLIMEvents/DecodedEventQueue.hpp>
 #include <FLIMEvents/Histogram.hpp>
+#include <FLIMEvents/HistogramPool.hpp>
 #include <FLIMEvents/LineClockPixellator.hpp>
+#include <FLIMEvents/PixelClockPixellator.hpp>
+#include <FLIMEvents/PixelPhotonQueue.hpp>
 #include <FLIMEvents/PixelPhotonRouter.hpp>
+#include <FLIMEvents/StaticDownstream.hpp>
 #include <FLIMEvents/StreamBuffer.hpp>
+#include <FLIMEvents/TimestampCoalescer.hpp>
 
+#include <algorithm>
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 
 using SampleType = uint16_t;
 
 
 namespace {
+	// Part of the processing graph that runs on a thread of its own, receiving
+	// events from upstream through a queue (when processing is pipelined)
+	struct ProcessingStage {
+		std::string name; // For logging
+		std::function<void()> pump; // Returns when the stage has finished
+	};
+
+	// Line clock pixellator that records its peak buffering in usage when it
+	// receives the end of the event stream
+	template <typename P>
+	class UsageRecordingPixellator final : public DecodedEventProcessor {
+		P pixellator;
+		std::shared_ptr<LineMarkerBufferUsage> usage;
+
+		void RecordUsage() {
+			if (usage) {
+				usage->peakPendingPhotons = pixellator.GetPeakPendingPhotonCount();
+				usage->peakPendingLines = pixellator.GetPeakPendingLineCount();
+			}
+		}
+
+	public:
+		UsageRecordingPixellator(P pixellator,
+			std::shared_ptr<LineMarkerBufferUsage> usage) :
+			pixellator(std::move(pixellator)),
+			usage(std::move(usage))
+		{}
+
+		void HandleTimestamp(DecodedEvent const& event) override {
+			pixellator.HandleTimestamp(event);
+		}
+
+		void HandleValidPhoton(ValidPhotonEvent const& event) override {
+			pixellator.HandleValidPhoton(event);
+		}
+
+		void HandleInvalidPhoton(InvalidPhotonEvent const& event) override {
+			pixellator.HandleInvalidPhoton(event);
+		}
+
+		void HandleMarker(MarkerEvent const& event) override {
+			pixellator.HandleMarker(event);
+		}
+
+		void HandleDataLost(DataLostEvent const& event) override {
+			pixellator.HandleDataLost(event);
+		}
+
+		void HandleEventBatch(DecodedEventBatch const& batch) override {
+			pixellator.HandleEventBatch(batch);
+		}
+
+		void HandleError(std::string const& message) override {
+			RecordUsage();
+			pixellator.HandleError(message);
+		}
+
+		void HandleFinish() override {
+			RecordUsage();
+			pixellator.HandleFinish();
+		}
+	};
+
 	class IntensityImageSink : public HistogramProcessor<SampleType> {
 		OScDev_Acquisition* acquisition;
 		std::function<void(void)> stopFunc;
@@ -87,72 +162,210 @@ namespace {
 }
 
 
+// Runs on its own thread for each consumer of the stream, so that a slow
+// processor (such as a file writer stalled on disk) does not hold up the
+// others. Waits for the processor to be constructed; events are discarded if
+// it is null (because its construction failed and was reported).
 template <typename E>
-static void PumpDeviceEvents(std::shared_ptr<EventStream<E>> stream,
-	std::vector<std::shared_ptr<DeviceEventProcessor>> processors)
+static void PumpDeviceEvents(std::shared_ptr<BroadcastEventStream<E>> stream,
+	std::size_t consumer, PendingDeviceEventProcessor pendingProcessor)
 {
+	auto processor = pendingProcessor.get();
+	if (!processor) {
+		for (;;) {
+			try {
+				if (!stream->ReceiveBlocking(consumer))
+					break;
+			}
+			catch (std::exception const&) {
+				break;
+			}
+		}
+		return;
+	}
+
 	for (;;) {
-		std::shared_ptr<EventBuffer<E>> buffer;
+		SharedEventBuffer<E> buffer;
 		try {
-			buffer = stream->ReceiveBlocking();
+			buffer = stream->ReceiveBlocking(consumer);
 		}
 		catch (std::exception const& e) {
-			for (auto& p : processors) {
-				p->HandleError(e.what());
-			}
+			processor->HandleError(e.what());
 			break;
 		}
 
 		if (!buffer) {
-			for (auto& p : processors) {
-				p->HandleFinish();
-			}
+			processor->HandleFinish();
 			break;
 		}
 
 		char const* data = reinterpret_cast<char const*>(buffer->GetData());
-		for (auto& p : processors) {
-			p->HandleDeviceEvents(data, buffer->GetSize());
-		}
+		processor->HandleDeviceEvents(data, buffer->GetSize());
+	}
+}
+
+
+// Histograms are taken from pool, if not null, so that their storage is
+// reused across acquisitions. Frame histograms need not be zeroed, because
+// the histogrammer clears them at the start of each frame. New storage is
+// always zeroed, which also faults in its pages before acquisition needs them.
+template <typename T>
+static Histogram<T> MakeHistogram(HistogramPool<T>* pool, uint32_t histoBits,
+	uint32_t inputBits, uint32_t width, uint32_t height, bool zeroed)
+{
+	if (pool) {
+		return pool->Get(histoBits, inputBits, true, width, height, zeroed);
 	}
+	Histogram<T> histo(histoBits, inputBits, true, width, height);
+	histo.Clear();
+	return histo;
 }
 
 
 template <typename T>
 static std::shared_ptr<PixelPhotonProcessor> MakeNoncumulativeHistogrammer(
+	HistogramPool<T>* pool,
 	uint32_t histoBits, uint32_t inputBits, uint32_t width, uint32_t height,
 	std::shared_ptr<HistogramProcessor<T>> downstream)
 {
-	Histogram<T> frameHisto(histoBits, inputBits, true, width, height);
-	return std::make_shared<Histogrammer<T>>(std::move(frameHisto),
+	return std::make_shared<Histogrammer<T>>(
+		MakeHistogram<T>(pool, histoBits, inputBits, width, height, false),
+		downstream);
+}
+
+
+template <typename T>
+static std::shared_ptr<HistogramProcessor<T>> MakeHistogramAccumulator(
+	HistogramPool<T>* pool,
+	uint32_t histoBits, uint32_t inputBits, uint32_t width, uint32_t height,
+	std::shared_ptr<HistogramProcessor<T>> downstream)
+{
+	return std::make_shared<HistogramAccumulator<T>>(
+		MakeHistogram<T>(pool, histoBits, inputBits, width, height, true),
 		downstream);
 }
 
 
 template <typename T>
 static std::shared_ptr<PixelPhotonProcessor> MakeCumulativeHistogrammer(
+	HistogramPool<T>* pool,
 	uint32_t histoBits, uint32_t inputBits, uint32_t width, uint32_t height,
 	std::shared_ptr<HistogramProcessor<T>> downstream)
 {
-	Histogram<T> cumulHisto(histoBits, inputBits, true, width, height);
-	cumulHisto.Clear();
-	return MakeNoncumulativeHistogrammer<T>(histoBits, inputBits, width, height,
-		std::make_shared<HistogramAccumulator<T>>(std::move(cumulHisto),
+	return MakeNoncumulativeHistogrammer<T>(pool, histoBits, inputBits, width, height,
+		MakeHistogramAccumulator<T>(pool, histoBits, inputBits, width, height,
 			downstream));
 }
 
 
-// Returns stream to which events should be sent
-// Second retval is completion of event pumping, which needs to be stored
-// until processing finishes (or else destructor will block).
-std::tuple<std::shared_ptr<EventStream<BHSPCEvent>>, std::future<void>>
-SetUpProcessing(uint32_t width, uint32_t height, uint32_t maxFrames,
+template <typename P>
+static void ConfigureLineClockPixellator(P& pixellator,
+	uint32_t frameMarkerBit, double macroTimeUnitNs, double maxLineMarkerLagMs)
+{
+	pixellator.SetMacrotimeUnitNs(macroTimeUnitNs);
+	pixellator.SetMaxLineMarkerLag(static_cast<uint64_t>(
+		maxLineMarkerLagMs * 1e6 / macroTimeUnitNs));
+	if (frameMarkerBit != UINT32_MAX) {
+		pixellator.SetFrameMarkerBit(frameMarkerBit);
+	}
+}
+
+
+// Construct decoder -> timestamp coalescer -> downstream as a single
+// statically composed object
+template <typename D>
+static std::shared_ptr<DeviceEventProcessor> MakeCoalescingDecoder(
+	D downstream, uint32_t timestampInterval, std::bitset<16> channelMask)
+{
+	auto coalescer = MakeStaticDownstream(
+		BasicTimestampCoalescer<D>(timestampInterval, std::move(downstream)));
+	auto decoder = std::make_shared<
+		BHEventDecoder<BHSPCEvent, decltype(coalescer)>>(
+			std::move(coalescer));
+	decoder->SetRouteMask(channelMask.to_ullong());
+	decoder->SetSendInvalidPhotons(false); // Not used by pixellator
+	return decoder;
+}
+
+
+// Construct decoder -> timestamp coalescer -> pixellator as a single
+// statically composed object; or, if stages is not null, with the pixellator
+// (statically composed with its downstream) as a separate stage, added to
+// stages.
+template <typename P>
+static std::shared_ptr<DeviceEventProcessor> MakeFusedDecoder(P&& pixellator,
+	uint32_t timestampInterval, std::bitset<16> channelMask,
+	std::vector<ProcessingStage>* stages)
+{
+	auto px = MakeStaticDownstream(std::forward<P>(pixellator));
+	if (stages) {
+		auto queue = std::make_shared<BasicDecodedEventQueue<decltype(px)>>(
+			std::move(px));
+		stages->push_back({ "Pixel assignment and histogramming",
+			[queue] { queue->Pump(); } });
+		return MakeCoalescingDecoder(
+			std::shared_ptr<DecodedEventProcessor>(queue), timestampInterval,
+			channelMask);
+	}
+	return MakeCoalescingDecoder(std::move(px), timestampInterval,
+		channelMask);
+}
+
+
+// Construct decoder -> timestamp coalescer -> pixellator -> histogrammer as a
+// single statically composed object, so that the per-photon processing is
+// inlined into one loop without virtual calls. Histograms are sent to
+// downstream once per frame, which need not be efficient. Photons on disabled
+// channels are dropped by the decoder.
+template <typename T>
+static std::shared_ptr<DeviceEventProcessor> MakeFusedHistogrammingDecoder(
+	HistogramPool<T>* pool, uint32_t histoBits, uint32_t inputBits, uint32_t width, uint32_t height,
+	uint32_t maxFrames, std::bitset<16> channelMask,
+	int32_t lineDelay, LineMapping const& lineMapping, uint32_t lineMarkerBit,
+	uint32_t pixelMarkerBit, uint32_t pixelTime, uint32_t frameMarkerBit,
+	double macroTimeUnitNs, double maxLineMarkerLagMs,
+	std::shared_ptr<LineMarkerBufferUsage> lineMarkerBufferUsage,
+	std::shared_ptr<HistogramProcessor<T>> downstream,
+	std::vector<ProcessingStage>* stages)
+{
+	auto histogrammer = MakeStaticDownstream(Histogrammer<T>(
+		MakeHistogram<T>(pool, histoBits, inputBits, width, height, false),
+		downstream));
+	if (pixelMarkerBit != UINT32_MAX) {
+		return MakeFusedDecoder(
+			BasicPixelClockPixellator<decltype(histogrammer)>(width, height,
+				maxFrames, lineDelay, pixelTime, pixelMarkerBit,
+				std::move(histogrammer)),
+			lineMapping.GetLineTime(), channelMask, stages);
+	}
+	BasicLineClockPixellator<decltype(histogrammer)> lcp(lineMapping,
+		height / lineMapping.GetRowsPerLine(), maxFrames, lineDelay,
+		lineMarkerBit, std::move(histogrammer));
+	ConfigureLineClockPixellator(lcp, frameMarkerBit, macroTimeUnitNs,
+		maxLineMarkerLagMs);
+	return MakeFusedDecoder(UsageRecordingPixellator<decltype(lcp)>(
+		std::move(lcp), std::move(lineMarkerBufferUsage)),
+		lineMapping.GetLineTime(), channelMask, stages);
+}
+
+
+// Construct the decoder chain for each module, feeding intensity images (to
+// intensitySink) and, if histogramWriter is not null, per-channel histograms.
+// If stages is not null, the graph is split into stages, which are added to
+// stages (downstream stages first) and must each be run on a thread of its
+// own: pixel assignment; then the intensity image and each module's
+// histograms (if not in the same stage as pixel assignment).
+template <typename T>
+static std::vector<std::shared_ptr<DeviceEventProcessor>> MakeDecoders(
+	std::size_t moduleCount, uint32_t width, uint32_t height, uint32_t maxFrames,
 	std::bitset<16> channelMask, bool accumulateIntensity,
-	int32_t lineDelay, uint32_t lineTime, uint32_t lineMarkerBit,
-	OScDev_Acquisition* acquisition, std::function<void(void)> stopFunc,
-	std::shared_ptr<DeviceEventProcessor> additionalProcessor,
-	std::shared_ptr<SDTWriter> histogramWriter,
-	std::shared_ptr<AcquisitionCompletion> completion)
+	int32_t lineDelay, LineMapping const& lineMapping, uint32_t lineMarkerBit,
+	uint32_t pixelMarkerBit, uint32_t pixelTime, uint32_t frameMarkerBit,
+	double macroTimeUnitNs, double maxLineMarkerLagMs,
+	std::shared_ptr<LineMarkerBufferUsage> lineMarkerBufferUsage,
+	bool alignModules, std::shared_ptr<HistogramProcessor<T>> intensitySink,
+	std::shared_ptr<SDTWriter> histogramWriter, HistogramPool<T>* histogramPool,
+	std::vector<ProcessingStage>* stages)
 {
 	uint32_t inputBits = 12;
 	uint32_t intensityBits = 0; // Intensity image is 0-bit histogram
@@ -160,64 +373,342 @@ SetUpProcessing(uint32_t width, uint32_t height, uint32_t maxFrames,
 
 	// Construct our processing graph starting at downstream.
 
-	auto intensitySink = std::make_shared<IntensityImageSink>(
-		acquisition, stopFunc, completion);
-	auto intensityAccumulator = accumulateIntensity ?
-		MakeCumulativeHistogrammer<SampleType>(intensityBits, inputBits,
-			width, height, intensitySink) :
-		MakeNoncumulativeHistogrammer<SampleType>(intensityBits, inputBits,
-			width, height, intensitySink);
+	if (accumulateIntensity) {
+		intensitySink = MakeHistogramAccumulator<T>(histogramPool,
+			intensityBits, inputBits, width, height, intensitySink);
+	}
 
-	// We construct a single-channel intensity image as the sum of all enabled
-	// channels (for now, at least).
-	std::vector<std::shared_ptr<PixelPhotonProcessor>> channelAccumulators;
-	channelAccumulators.resize(channelMask.size());
-	for (unsigned i = 0; i < channelMask.size(); ++i) {
-		if (!channelMask[i])
-			continue;
-		channelAccumulators[i] = intensityAccumulator;
+	std::vector<std::shared_ptr<DeviceEventProcessor>> decoders;
+
+	if (!histogramWriter && moduleCount == 1) {
+		// Common case: intensity images only. Use the statically composed
+		// pipeline, which is equivalent to the dynamic graph below. If
+		// pipelined, histogramming stays in the pixel assignment stage, as it
+		// costs less than passing the pixel photons to another thread.
+		decoders.emplace_back(MakeFusedHistogrammingDecoder<T>(
+			histogramPool, intensityBits, inputBits, width, height,
+			maxFrames, channelMask, lineDelay, lineMapping, lineMarkerBit,
+			pixelMarkerBit, pixelTime, frameMarkerBit, macroTimeUnitNs,
+			maxLineMarkerLagMs, lineMarkerBufferUsage, intensitySink, stages));
+		return decoders;
 	}
-	auto intensityProc = std::make_shared<PixelPhotonRouter>(channelAccumulators);
 
-	std::shared_ptr<PixelPhotonProcessor> pixelPhotonProcs = intensityProc;
+	// We construct a single-channel intensity image as the sum of all
+	// enabled channels (for now, at least). Photons on disabled channels
+	// are dropped by the decoder.
+	std::shared_ptr<PixelPhotonProcessor> pixelPhotonProcs =
+		MakeNoncumulativeHistogrammer<T>(histogramPool,
+			intensityBits, inputBits, width, height, intensitySink);
+	if (stages && histogramWriter) {
+		auto queue = std::make_shared<PixelPhotonQueue>(pixelPhotonProcs);
+		stages->push_back({ "Intensity histogramming",
+			[queue] { queue->Pump(); } });
+		pixelPhotonProcs = queue;
+	}
 
-	// If saving histograms, create histogrammers for each enabled channel.
 	if (histogramWriter) {
+		// Create histogrammers for each enabled channel.
 		std::vector<std::shared_ptr<PixelPhotonProcessor>> histogrammers;
-		histogrammers.resize(channelMask.size());
+		histogrammers.resize(moduleCount * channelMask.size());
 		int n = 0;
-		for (unsigned i = 0; i < channelMask.size(); ++i) {
-			if (!channelMask[i])
-				continue;
-			auto histoSink = std::make_shared<HistogramSink>(n, histogramWriter);
-			auto histoProc = MakeCumulativeHistogrammer<SampleType>(
-				histoBits, inputBits, width, height, histoSink);
-			histogrammers[i] = histoProc;
-			++n;
+		for (std::size_t m = 0; m < moduleCount; ++m) {
+			for (unsigned i = 0; i < channelMask.size(); ++i) {
+				if (!channelMask[i])
+					continue;
+				auto histoSink = std::make_shared<HistogramSink>(n, histogramWriter);
+				auto histoProc = MakeCumulativeHistogrammer<T>(
+					histogramPool, histoBits, inputBits, width, height, histoSink);
+				histogrammers[m * channelMask.size() + i] = histoProc;
+				++n;
+			}
+		}
+		if (stages) {
+			// Each module's channels are histogrammed in a stage of its own
+			std::vector<std::shared_ptr<PixelPhotonProcessor>> moduleQueues(
+				histogrammers.size());
+			for (std::size_t m = 0; m < moduleCount; ++m) {
+				auto const first = histogrammers.begin() + m * channelMask.size();
+				auto const last = first + channelMask.size();
+				std::vector<std::shared_ptr<PixelPhotonProcessor>> moduleHistogrammers(
+					histogrammers.size());
+				std::copy(first, last, moduleHistogrammers.begin() + m * channelMask.size());
+				auto queue = std::make_shared<PixelPhotonQueue>(
+					std::make_shared<PixelPhotonRouter>(moduleHistogrammers));
+				stages->push_back({ "Histogramming (module " + std::to_string(m) + ")",
+					[queue] { queue->Pump(); } });
+				for (auto it = first; it != last; ++it) {
+					if (*it) {
+						moduleQueues[it - histogrammers.begin()] = queue;
+					}
+				}
+			}
+			histogrammers = moduleQueues;
 		}
 		auto histoProc = std::make_shared<PixelPhotonRouter>(histogrammers);
 
-		pixelPhotonProcs = std::make_shared<BroadcastPixelPhotonProcessor<2>>(
-			intensityProc, histoProc);
+		pixelPhotonProcs =
+			std::make_shared<BroadcastPixelPhotonProcessor<2>>(
+				pixelPhotonProcs, histoProc);
 	}
 
-	auto pixellator = std::make_shared<LineClockPixellator>(
-		width, height, maxFrames, lineDelay, lineTime, lineMarkerBit,
-		pixelPhotonProcs);
+	std::shared_ptr<DecodedEventProcessor> pixellator;
+	if (pixelMarkerBit != UINT32_MAX) {
+		pixellator = std::make_shared<PixelClockPixellator>(
+			width, height, maxFrames, lineDelay, pixelTime, pixelMarkerBit,
+			pixelPhotonProcs);
+	}
+	else {
+		LineClockPixellator lcp(lineMapping,
+			height / lineMapping.GetRowsPerLine(), maxFrames, lineDelay,
+			lineMarkerBit, pixelPhotonProcs);
+		ConfigureLineClockPixellator(lcp, frameMarkerBit, macroTimeUnitNs,
+			maxLineMarkerLagMs);
+		pixellator = std::make_shared<UsageRecordingPixellator<LineClockPixellator>>(
+			std::move(lcp), lineMarkerBufferUsage);
+	}
+
+	if (stages) {
+		auto queue = std::make_shared<DecodedEventQueue>(pixellator);
+		stages->push_back({ "Pixel assignment", [queue] { queue->Pump(); } });
+		pixellator = queue;
+	}
 
-	auto decoder = std::make_shared<BHSPCEventDecoder>(pixellator);
+	// Timestamps (which make the pixellator finish pixels, lines, and
+	// frames) need not be more frequent than lines.
+	auto coalescer = std::make_shared<TimestampCoalescer>(
+		lineMapping.GetLineTime(), pixellator);
 
-	std::vector<std::shared_ptr<DeviceEventProcessor>> procs;
-	procs.emplace_back(decoder);
-	if (additionalProcessor) {
-		procs.emplace_back(additionalProcessor);
+	std::shared_ptr<DecodedEventMerger> merger;
+	if (moduleCount > 1) {
+		merger = std::make_shared<DecodedEventMerger>(moduleCount, 4,
+			coalescer);
+		merger->SetAlignOnFirstMarker(alignModules);
 	}
 
-	auto stream = std::make_shared<EventStream<BHSPCEvent>>();
+	for (std::size_t m = 0; m < moduleCount; ++m) {
+		std::shared_ptr<DecodedEventProcessor> downstream = coalescer;
+		if (merger) {
+			downstream = merger->GetInput(m);
+		}
+		auto decoder = std::make_shared<BHSPCEventDecoder>(downstream);
+		decoder->SetRouteMask(channelMask.to_ullong());
+		decoder->SetSendInvalidPhotons(false); // Not used by pixellator
+		decoders.emplace_back(decoder);
+	}
+	return decoders;
+}
+
+
+// Returns streams to which events should be sent, one per module (the number
+// of modules is additionalProcessors.size()). Each processor (the decoder
+// chain and each module's additionalProcessor) receives the events on its own
+// thread. With more than one module, the decoded events of all modules are
+// merged by macro-time, with module m's channel c becoming channel 16m + c.
+// Second retval is completion of event pumping, which should be waited for
+// before tearing down (and, without workers, needs to be stored until
+// processing finishes, or else its destructor will block).
+// The streams can receive events as soon as this function returns; the
+// decoders and histograms are constructed concurrently (on a worker thread),
+// and events are held in the streams until they are ready. Failure to
+// allocate histograms is reported to completion.
+// lineMapping: time-to-pixel mapping within each line, following the line
+// delay (line markers only); if it covers 2 rows per line (bidirectional),
+// height must be even. Its line time is also the interval at which timestamps
+// are processed.
+// pixelMarkerBit: UINT32_MAX to assign photons to pixels by line markers;
+// otherwise by pixel markers, each starting a pixel (delayed by lineDelay)
+// that lasts until the next or for at most pixelTime
+// frameMarkerBit: UINT32_MAX to delimit frames by counting lines (data loss
+// is then an error); otherwise frames start on frame markers, and data loss
+// discards only the frame in progress (line markers only)
+// macroTimeUnitNs: used to limit (and report) the time for which photons
+// arrive without line markers
+// maxLineMarkerLagMs: photons arriving without line markers for this long
+// fail the acquisition (the line marker cable is likely disconnected, or the
+// marker misconfigured)
+// lineMarkerBufferUsage: if not null, receives the peak buffering of the line
+// clock pixellator (line markers only) when it reaches the end of the events
+// additionalProcessors: may still be under construction; an invalid future
+// means none for that module
+// maxBuffers: the most buffers each module's acquisition can have in flight
+// pipelined: if true, pixel assignment and histogramming run on threads
+// (Histogramming) separate from decoding, receiving events through queues
+// threadPlacer: if not null, used to place the decoding (Processing),
+// pipeline stage (Histogramming), and additionalProcessor (FileWriting)
+// threads
+// histogramPool: if not null, histograms are taken from it
+// workers: if not null, the threads are taken from it
+// setupTimer: if not null, used to log the time taken to construct the
+// decoders and histograms
+std::tuple<std::vector<std::shared_ptr<BroadcastEventStream<BHSPCEvent>>>, std::future<void>>
+SetUpProcessing(uint32_t width, uint32_t height, uint32_t maxFrames,
+	std::bitset<16> channelMask, bool accumulateIntensity,
+	int32_t lineDelay, LineMapping lineMapping, uint32_t lineMarkerBit,
+	uint32_t pixelMarkerBit, uint32_t pixelTime, uint32_t frameMarkerBit,
+	double macroTimeUnitNs, double maxLineMarkerLagMs,
+	std::shared_ptr<LineMarkerBufferUsage> lineMarkerBufferUsage,
+	OScDev_Acquisition* acquisition, std::function<void(void)> stopFunc,
+	std::vector<PendingDeviceEventProcessor> additionalProcessors,
+	bool alignModules, bool pipelined,
+	std::shared_ptr<SDTWriter> histogramWriter,
+	std::size_t maxBuffers,
+	std::shared_ptr<ThreadPlacer const> threadPlacer,
+	std::shared_ptr<HistogramPool<uint16_t>> histogramPool,
+	std::shared_ptr<WorkerThreadPool> workers,
+	std::shared_ptr<SetupTimer const> setupTimer,
+	std::shared_ptr<AcquisitionCompletion> completion)
+{
+	std::size_t const moduleCount = std::max<std::size_t>(additionalProcessors.size(), 1);
+	additionalProcessors.resize(moduleCount);
 
-	auto done = std::async(std::launch::async, [stream, procs = std::move(procs)] {
-		PumpDeviceEvents(stream, procs);
+	// Prevent completion until the decoders exist (and have added their
+	// processes to completion).
+	if (completion) {
+		completion->AddProcess("ProcessingSetup");
+	}
+
+	// Decoder of each module, once constructed
+	std::vector<std::promise<std::shared_ptr<DeviceEventProcessor>>> decoderPromises(moduleCount);
+	std::vector<PendingDeviceEventProcessor> decoders;
+	for (auto& p : decoderPromises) {
+		decoders.push_back(p.get_future().share());
+	}
+
+	// Returns completion of the pipeline stages, if any
+	auto processingSetup = RunOnWorkerThread(workers,
+		[=, decoderPromises = std::move(decoderPromises)]() mutable {
+		SetupTimer::Phase phase(setupTimer.get(), "decoders and histograms");
+
+		std::vector<std::future<void>> stageFinishes;
+		std::shared_ptr<HistogramProcessor<SampleType>> intensitySink;
+		auto fail = [&](std::string const& message) {
+			// End the processes of the sinks, which will not receive data
+			if (intensitySink) {
+				intensitySink->HandleError(message);
+			}
+			if (histogramWriter) {
+				histogramWriter->HandleError(message);
+			}
+			for (auto& p : decoderPromises) {
+				p.set_value(nullptr); // Events will be discarded
+			}
+			if (completion) {
+				completion->HandleError(message, "ProcessingSetup");
+			}
+		};
+		try {
+			intensitySink = std::make_shared<IntensityImageSink>(acquisition,
+				stopFunc, completion);
+			std::vector<ProcessingStage> stages;
+			auto procs = MakeDecoders<SampleType>(moduleCount, width, height,
+				maxFrames, channelMask, accumulateIntensity, lineDelay,
+				lineMapping, lineMarkerBit, pixelMarkerBit, pixelTime,
+				frameMarkerBit, macroTimeUnitNs, maxLineMarkerLagMs,
+				lineMarkerBufferUsage, alignModules, intensitySink,
+				histogramWriter, histogramPool.get(),
+				pipelined ? &stages : nullptr);
+			// Storage still idle was not needed by this configuration
+			if (histogramPool) {
+				histogramPool->ReleaseIdle();
+			}
+
+			// Start the stages downstream first. If one cannot be started,
+			// end the stream so that the stages finish (delivering the error
+			// to the sinks), running those not started here.
+			std::size_t started = 0;
+			try {
+				for (; started < stages.size(); ++started) {
+					stageFinishes.emplace_back(RunOnWorkerThread(workers,
+						[stage = stages[started], threadPlacer] {
+						ThreadPlacementScope placement;
+						if (threadPlacer) {
+							placement = threadPlacer->PlaceCurrentThread(
+								ThreadRole::Histogramming, stage.name);
+						}
+						stage.pump();
+					}));
+				}
+			}
+			catch (std::exception const& e) {
+				auto const message =
+					std::string("Cannot start processing thread: ") + e.what();
+				for (auto& proc : procs) {
+					proc->HandleError(message);
+				}
+				for (std::size_t i = stages.size(); i > started; --i) {
+					stages[i - 1].pump();
+				}
+				for (auto& p : decoderPromises) {
+					p.set_value(nullptr); // Events will be discarded
+				}
+				if (completion) {
+					completion->HandleError(message, "ProcessingSetup");
+				}
+				return stageFinishes;
+			}
+
+			for (std::size_t m = 0; m < moduleCount; ++m) {
+				decoderPromises[m].set_value(procs[m]);
+			}
+			if (completion) {
+				completion->HandleFinish("ProcessingSetup");
+			}
+		}
+		catch (std::bad_alloc const&) { // Likely could not allocate histogram memory
+			fail("Cannot allocate memory for histogram(s)");
+		}
+		catch (std::exception const& e) {
+			fail(std::string("Cannot set up processing: ") + e.what());
+		}
+		return stageFinishes;
+	});
+
+	// Each module's stream, and its consumers
+	std::vector<std::shared_ptr<BroadcastEventStream<BHSPCEvent>>> streams;
+	std::vector<std::function<void()>> pumps;
+	for (std::size_t m = 0; m < moduleCount; ++m) {
+		std::vector<PendingDeviceEventProcessor> procs;
+		procs.push_back(decoders[m]);
+		if (additionalProcessors[m].valid()) {
+			procs.push_back(additionalProcessors[m]);
+		}
+
+		// The stream need not hold more buffers than the pool can provide.
+		auto stream = std::make_shared<BroadcastEventStream<BHSPCEvent>>(
+			procs.size(),
+			flimevents::internal::RoundUpToPowerOfTwo(std::max<std::size_t>(maxBuffers, 1)));
+		for (std::size_t i = 0; i < procs.size(); ++i) {
+			pumps.emplace_back([stream, i, proc = procs[i], threadPlacer, m] {
+				ThreadPlacementScope placement;
+				if (threadPlacer) {
+					auto const module = " (module " + std::to_string(m) + ")";
+					if (i == 0)
+						placement = threadPlacer->PlaceCurrentThread(ThreadRole::Processing, "Processing" + module);
+					else
+						placement = threadPlacer->PlaceCurrentThread(ThreadRole::FileWriting, "File writing" + module);
+				}
+				PumpDeviceEvents(stream, i, proc);
+			});
+		}
+		streams.emplace_back(stream);
+	}
+
+	// The first consumer runs on the thread whose completion we return
+	std::vector<std::future<void>> consumerFinishes;
+	for (std::size_t i = 1; i < pumps.size(); ++i) {
+		consumerFinishes.emplace_back(RunOnWorkerThread(workers, pumps[i]));
+	}
+	auto done = RunOnWorkerThread(workers,
+		[pump = pumps[0], processingSetup = std::move(processingSetup),
+		consumerFinishes = std::move(consumerFinishes)]() mutable {
+		pump();
+		for (auto& f : consumerFinishes) {
+			f.wait();
+		}
+		for (auto& f : processingSetup.get()) {
+			f.wait();
+		}
 	});
 
-	return std::make_tuple(stream, std::move(done));
+	return std::make_tuple(streams, std::move(done));
 }
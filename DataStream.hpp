@@ -3,24 +3,56 @@
 #include "AcquisitionCompletion.hpp"
 #include "SPCFileWriter.hpp"
 #include "SDTFileWriter.hpp"
+#include "SetupTimer.hpp"
+#include "ThreadPlacement.hpp"
+#include "WorkerThreadPool.hpp"
 
 #include <FLIMEvents/BHDeviceEvent.hpp>
-#include <FLIMEvents/StreamBuffer.hpp>
+#include <FLIMEvents/BroadcastStream.hpp>
+#include <FLIMEvents/HistogramPool.hpp>
+#include <FLIMEvents/LineMapping.hpp>
 
 #include <OpenScanDeviceLib.h>
 
+#include <atomic>
 #include <bitset>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <future>
 #include <memory>
 #include <tuple>
+#include <vector>
 
 
-std::tuple<std::shared_ptr<EventStream<BHSPCEvent>>, std::future<void>>
+// A processor that may still be under construction (for example, while its
+// file is being created)
+using PendingDeviceEventProcessor =
+	std::shared_future<std::shared_ptr<DeviceEventProcessor>>;
+
+
+// Peak numbers of photons and line markers buffered by the line clock
+// pixellator, waiting for line markers and for lines to start, respectively
+struct LineMarkerBufferUsage {
+	std::atomic<std::size_t> peakPendingPhotons{ 0 };
+	std::atomic<std::size_t> peakPendingLines{ 0 };
+};
+
+
+std::tuple<std::vector<std::shared_ptr<BroadcastEventStream<BHSPCEvent>>>, std::future<void>>
 SetUpProcessing(uint32_t width, uint32_t height, uint32_t maxFrames,
 	std::bitset<16> channelMask, bool accumulateIntensity,
-	int32_t lineDelay, uint32_t lineTime, uint32_t lineMarkerBit,
+	int32_t lineDelay, LineMapping lineMapping, uint32_t lineMarkerBit,
+	uint32_t pixelMarkerBit, uint32_t pixelTime, uint32_t frameMarkerBit,
+	double macroTimeUnitNs, double maxLineMarkerLagMs,
+	std::shared_ptr<LineMarkerBufferUsage> lineMarkerBufferUsage,
 	OScDev_Acquisition* acquisition, std::function<void(void)> stopFunc,
-	std::shared_ptr<DeviceEventProcessor> additionalProcessor,
+	std::vector<PendingDeviceEventProcessor> additionalProcessors,
+	bool alignModules, bool pipelined,
 	std::shared_ptr<SDTWriter> histogramWriter,
+	std::size_t maxBuffers,
+	std::shared_ptr<ThreadPlacer const> threadPlacer,
+	std::shared_ptr<HistogramPool<uint16_t>> histogramPool,
+	std::shared_ptr<WorkerThreadPool> workers,
+	std::shared_ptr<SetupTimer const> setupTimer,
 	std::shared_ptr<AcquisitionCompletion> completion);
@@ -1,13 +1,18 @@
 #include "FIFOAcquisition.hpp"
 
+#include "FIFOPolling.hpp"
+
 #include <Spcm_def.h>
 
 #include <chrono>
 #include <cstdlib>
+#include <cstring>
 #include <exception>
+#include <functional>
 #include <stdexcept>
 #include <string>
 #include <thread>
+#include <utility>
 
 
 int ConfigureDeviceForFIFOAcquisition(short module)
@@ -168,7 +173,7 @@ bool IsSPC600FIFO48(short fifoType) {
 
 
 template <typename E>
-static void PushError(short code, EventStream<E>* stream,
+static void PushError(short code, BroadcastEventStream<E>* stream,
 	AcquisitionCompletion* completion)
 {
 	std::string message;
@@ -198,13 +203,57 @@ static short ReadFifo(short module, std::size_t* eventCount, T* buffer)
 }
 
 
+// Sample the device FIFO fill level into monitor. Returns false if the
+// device cannot report it.
+static bool SampleFIFOState(short module, FIFOMonitor& monitor,
+	FIFOMonitor::Clock::time_point now)
+{
+	short state;
+	float usage;
+	if (SPC_get_fifo_usage(module, &usage) >= 0) {
+		// The overflow flag stays set once the FIFO has overflowed, so it can
+		// only tell us about the first overflow (which may have happened
+		// between samples); after that, count overflows from the usage
+		bool const checkFlag = usage >= 0.99f || monitor.GetOverflowCount() == 0;
+		if (checkFlag && SPC_test_state(module, &state) >= 0 &&
+			(state & SPC_FOVFL)) {
+			monitor.RecordOverflow();
+		}
+		else {
+			monitor.RecordFillLevel(usage, now);
+		}
+		return true;
+	}
+
+	// Fall back to the FIFO state flags, which only tell us whether the FIFO
+	// is empty or has overflowed
+	if (SPC_test_state(module, &state) < 0) {
+		return false;
+	}
+	if (state & SPC_FOVFL) {
+		monitor.RecordOverflow();
+	}
+	else if (state & SPC_FEMPTY) {
+		monitor.RecordFillLevel(0.0, now);
+	}
+	return true;
+}
+
+
 // Start measurement, read data, stop measurement
-// pool: buffer pool for data
+// pool: buffer pool for data (may be bounded; see EventBufferPoolPolicy)
 // stream: destination for data
+// latencyTarget: how soon read data should be sent
+// rateHint: optional source of the event rate (events/s), such as the ADC rate
+// fifoMonitor: receives samples of the device FIFO fill level; the read loop
+// drains the FIFO more aggressively when it reports pressure
 // stopRequested: setting this future's shared state stops the acquisition
 template <typename E>
 static void RunAcquisition(short module, EventBufferPool<E>* pool,
-	EventStream<E>* stream,
+	BroadcastEventStream<E>* stream,
+	std::chrono::microseconds latencyTarget,
+	std::function<double()> rateHint,
+	FIFOMonitor* fifoMonitor,
 	std::shared_future<void> stopRequested,
 	AcquisitionCompletion* completion)
 {
@@ -215,11 +264,25 @@ static void RunAcquisition(short module, EventBufferPool<E>* pool,
 
 	// Since we are not using stop_on_time, measurement continues until we
 	// decide to stop from software. That decision is made by downstream data
-	// analysis, or user input. Thus, we have no need for SPC_test_state().
-
-	// Our read loop ensures that we send any read data within 20 ms, but
-	// otherwise avoids sending data in batches smaller than a fraction of the
-	// capacity of a buffer.
+	// analysis, or user input. SPC_test_state() is used only when sampling
+	// the FIFO (for the overflow and empty flags; see SampleFIFOState()).
+
+	// Our read loop sends read data within about the latency target, but
+	// otherwise avoids sending data in small batches. How much to put in each
+	// buffer, and how long to wait between reads, are adapted to the event
+	// rate, so that we also read often enough to keep the device FIFO from
+	// filling up.
+	AdaptiveFIFOPoller poller(latencyTarget, rateHint);
+	using Clock = AdaptiveFIFOPoller::Clock;
+
+	// Sample the FIFO fill level between reads (if the device can report it)
+	bool monitorFIFO = true;
+	auto sampleFIFO = [&](Clock::time_point now) {
+		if (monitorFIFO && fifoMonitor->ShouldSample(now)) {
+			monitorFIFO = SampleFIFOState(module, *fifoMonitor, now);
+			poller.SetUnderPressure(monitorFIFO && fifoMonitor->IsUnderPressure());
+		}
+	};
 
 	for (;;) {
 		using namespace std::chrono_literals;
@@ -227,37 +290,65 @@ static void RunAcquisition(short module, EventBufferPool<E>* pool,
 			break;
 		}
 
-		auto buffer = pool->CheckOut();
-
-		std::size_t eventCount = buffer->GetCapacity();
-		err = ReadFifo<E>(module, &eventCount, buffer->GetData());
-		if (err < 0) {
-			goto error;
+		EventBufferHandle<E> buffer;
+		try {
+			buffer = pool->CheckOut();
+		}
+		catch (std::exception const& e) { // Buffer limit reached (Fail policy)
+			SPC_stop_measurement(module);
+			stream->SendException(std::current_exception());
+			completion->HandleError("Acquisition stopped: " + std::string(e.what()), "FIFOAcquisition");
+			return;
 		}
-		std::size_t eventsRead = eventCount;
 
-		// No events (unlikely due to macro-time overflow records); wait a
-		// little and try again.
-		if (eventsRead == 0) {
-			std::this_thread::sleep_for(20ms);
+		// Buffer limit reached (Report policy); leave the data in the device
+		// FIFO for now. If the FIFO overflows, the device flags the data loss
+		// in the event stream.
+		if (!buffer) {
+			sampleFIFO(Clock::now());
+			std::this_thread::sleep_for(1ms);
 			continue;
 		}
 
-		// If buffer is <50% utilized, wait a little and try to fill further
-		if (eventsRead * 2 < buffer->GetCapacity()) {
-			std::this_thread::sleep_for(20ms);
-
-			eventCount = buffer->GetCapacity() - eventsRead;
+		std::size_t const targetCount = poller.GetTargetEventCount(buffer->GetCapacity());
+		std::size_t eventsRead = 0;
+		Clock::time_point firstEventTime;
+		for (;;) {
+			std::size_t eventCount = targetCount - eventsRead;
 			err = ReadFifo<E>(module, &eventCount, buffer->GetData() + eventsRead);
 			if (err < 0) {
 				goto error;
 			}
+			auto const now = Clock::now();
+			poller.RecordRead(eventCount, now);
+			fifoMonitor->RecordRead(eventCount, now);
+			sampleFIFO(now);
+			if (eventsRead == 0 && eventCount > 0) {
+				firstEventTime = now;
+			}
 			eventsRead += eventCount;
-		}
 
-		buffer->SetSize(eventsRead);
+			// Full (there may be more in the FIFO, so read again right away)
+			if (eventsRead == targetCount) {
+				break;
+			}
+
+			// The FIFO is empty; wait, unless that would make us late sending
+			// what we have
+			auto const sleep = poller.GetSleepInterval(targetCount - eventsRead);
+			if (eventsRead > 0 && now + sleep - firstEventTime > poller.GetLatencyTarget()) {
+				break;
+			}
+			if (stopRequested.wait_for(0s) == std::future_status::ready) {
+				break;
+			}
+			std::this_thread::sleep_for(sleep);
+		}
 
-		stream->Send(buffer);
+		if (eventsRead > 0) {
+			buffer->SetSize(eventsRead);
+			stream->Send(std::move(buffer));
+		}
 	}
 
 	// A single call to SPC_stop_measurement() is sufficient, as we are NOT
@@ -285,13 +376,21 @@ error:
 template <typename E>
 static std::tuple<int, std::future<void>> StartAcquisition(short module,
 	std::shared_ptr<EventBufferPool<E>> pool,
-	std::shared_ptr<EventStream<E>> stream,
+	std::shared_ptr<BroadcastEventStream<E>> stream,
+	std::chrono::microseconds latencyTarget,
+	std::function<double()> rateHint,
+	std::shared_ptr<FIFOMonitor> fifoMonitor,
+	std::shared_ptr<ThreadPlacer const> threadPlacer,
+	std::shared_ptr<WorkerThreadPool> workers,
 	std::shared_future<void> stopRequested,
 	std::shared_ptr<AcquisitionCompletion> completion)
 {
 	if (completion) {
 		completion->AddProcess("FIFOAcquisition");
 	}
+	if (!fifoMonitor) {
+		fifoMonitor = std::make_shared<FIFOMonitor>();
+	}
 
 	// Start of measurement must be synchronous (on current thread) so that
 	// the device is actually armed before we return.
@@ -304,8 +403,16 @@ static std::tuple<int, std::future<void>> StartAcquisition(short module,
 		return std::make_tuple(static_cast<int>(err), done.get_future());
 	}
 
-	auto finish = std::async(std::launch::async, [module, pool, stream, stopRequested, completion]() {
-		RunAcquisition<E>(module, pool.get(), stream.get(), stopRequested, completion.get());
+	auto finish = RunOnWorkerThread(workers,
+		[module, pool, stream, latencyTarget, rateHint, fifoMonitor, threadPlacer,
+		stopRequested, completion]() {
+		ThreadPlacementScope placement;
+		if (threadPlacer) {
+			placement = threadPlacer->PlaceCurrentThread(ThreadRole::FIFOReader,
+				"FIFO reader (module " + std::to_string(module) + ")");
+		}
+		RunAcquisition<E>(module, pool.get(), stream.get(), latencyTarget,
+			rateHint, fifoMonitor.get(), stopRequested, completion.get());
 	});
 	return std::make_tuple(0, std::move(finish));
 }
@@ -313,9 +420,15 @@ static std::tuple<int, std::future<void>> StartAcquisition(short module,
 
 std::tuple<int, std::future<void>> StartAcquisitionStandardFIFO(short module,
 	std::shared_ptr<EventBufferPool<BHSPCEvent>> pool,
-	std::shared_ptr<EventStream<BHSPCEvent>> stream,
+	std::shared_ptr<BroadcastEventStream<BHSPCEvent>> stream,
+	std::chrono::microseconds latencyTarget,
+	std::function<double()> rateHint,
+	std::shared_ptr<FIFOMonitor> fifoMonitor,
+	std::shared_ptr<ThreadPlacer const> threadPlacer,
+	std::shared_ptr<WorkerThreadPool> workers,
 	std::shared_future<void> stopRequested,
 	std::shared_ptr<AcquisitionCompletion> completion)
 {
-	return StartAcquisition<BHSPCEvent>(module, pool, stream, stopRequested, completion);
+	return StartAcquisition<BHSPCEvent>(module, pool, stream, latencyTarget,
+		rateHint, fifoMonitor, threadPlacer, workers, stopRequested, completion);
 }
\ No newline at end of file
@@ -1,11 +1,16 @@
 #pragma once
 
 #include "AcquisitionCompletion.hpp"
+#include "FIFOPolling.hpp"
+#include "ThreadPlacement.hpp"
+#include "WorkerThreadPool.hpp"
 
 #include <FLIMEvents/BHDeviceEvent.hpp>
-#include <FLIMEvents/StreamBuffer.hpp>
+#include <FLIMEvents/BroadcastStream.hpp>
 
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <future>
 #include <memory>
 #include <tuple>
@@ -21,6 +26,11 @@ bool IsSPC600FIFO48(short fifoType);
 
 std::tuple<int, std::future<void>> StartAcquisitionStandardFIFO(short module,
 	std::shared_ptr<EventBufferPool<BHSPCEvent>> pool,
-	std::shared_ptr<EventStream<BHSPCEvent>> stream,
+	std::shared_ptr<BroadcastEventStream<BHSPCEvent>> stream,
+	std::chrono::microseconds latencyTarget,
+	std::function<double()> rateHint,
+	std::shared_ptr<FIFOMonitor> fifoMonitor,
+	std::shared_ptr<ThreadPlacer const> threadPlacer,
+	std::shared_ptr<WorkerThreadPool> workers,
 	std::shared_future<void> stopRequested,
 	std::shared_ptr<AcquisitionCompletion> completion);
\ No newline at end of file
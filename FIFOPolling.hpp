@@ -0,0 +1,307 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+
+
+// Tracks how full the device FIFO is, from periodic samples of its fill level
+// taken by the read loop, so that we can tell when it is at risk of
+// overflowing before data is actually lost.
+class FIFOMonitor {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// Above this fill level (or when predicted to overflow within
+	// PressureHorizon), the read loop should drain the FIFO as fast as it can
+	static constexpr double PressureFill = 0.25;
+
+	// Above this fill level (or when predicted to overflow within
+	// WarningHorizon), we warn once until the level drops below PressureFill
+	static constexpr double WarningFill = 0.5;
+
+	static std::chrono::milliseconds PressureHorizon() noexcept {
+		return std::chrono::milliseconds(250);
+	}
+
+	static std::chrono::milliseconds WarningHorizon() noexcept {
+		return std::chrono::milliseconds(50);
+	}
+
+	static std::chrono::microseconds MinSampleInterval() noexcept {
+		return std::chrono::microseconds(1000);
+	}
+
+private:
+	std::function<void(std::string const&)> warn;
+
+	bool sampled = false;
+	Clock::time_point lastSampleTime;
+	double fill = 0.0;
+	double fillRate = 0.0; // Fraction of capacity per second; + = filling
+	// Whether we have warned in the current high-fill episode
+	bool warnedImminent = false;
+	bool warnedOverflow = false;
+
+	double peakFill = 0.0;
+	std::size_t warningCount = 0;
+	std::size_t overflowCount = 0;
+
+	bool reading = false;
+	Clock::time_point firstReadTime;
+	Clock::time_point lastReadTime;
+	std::size_t eventsRead = 0;
+
+	static std::string Percent(double fraction) {
+		return std::to_string(static_cast<int>(fraction * 100.0 + 0.5)) + "%";
+	}
+
+public:
+	// warn: optional; called (on the read loop thread) when overflow appears
+	// imminent
+	explicit FIFOMonitor(std::function<void(std::string const&)> warn = {}) :
+		warn(warn)
+	{}
+
+	// Whether it is time to sample the fill level again
+	bool ShouldSample(Clock::time_point now) const noexcept {
+		return !sampled || now - lastSampleTime >= MinSampleInterval();
+	}
+
+	// fillLevel: fraction of the FIFO capacity in use (1 = overflowed)
+	void RecordFillLevel(double fillLevel, Clock::time_point now) {
+		fillLevel = std::min(std::max(fillLevel, 0.0), 1.0);
+		if (sampled) {
+			double seconds = std::chrono::duration<double>(now - lastSampleTime).count();
+			if (seconds > 0.0) {
+				double sample = (fillLevel - fill) / seconds;
+				// Follow increases immediately, as for the event rate
+				fillRate = sample > fillRate ? sample : 0.5 * fillRate + 0.5 * sample;
+			}
+		}
+		sampled = true;
+		lastSampleTime = now;
+		fill = fillLevel;
+		peakFill = std::max(peakFill, fill);
+
+		if (fill >= 1.0) {
+			RecordOverflow();
+			return;
+		}
+		if (fill < PressureFill) {
+			warnedImminent = warnedOverflow = false;
+		}
+		else if (!warnedImminent && (fill >= WarningFill ||
+			GetTimeToOverflow() < WarningHorizon())) {
+			warnedImminent = true;
+			++warningCount;
+			if (warn) {
+				auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+					GetTimeToOverflow()).count();
+				warn("Device FIFO is " + Percent(fill) + " full" +
+					(fillRate > 0.0 ? "; overflow predicted in " +
+						std::to_string(ms) + " ms" : std::string()) +
+					" unless reading catches up");
+			}
+		}
+	}
+
+	// The device reported that the FIFO overflowed (data has been lost)
+	void RecordOverflow() {
+		fill = peakFill = 1.0;
+		if (!warnedOverflow) {
+			++overflowCount;
+			warnedImminent = warnedOverflow = true;
+			if (warn) {
+				warn("Device FIFO overflowed; data has been lost");
+			}
+		}
+	}
+
+	// Record events read from the FIFO at time 'now' (for the drain rate)
+	void RecordRead(std::size_t events, Clock::time_point now) {
+		if (!reading) {
+			reading = true;
+			firstReadTime = now;
+		}
+		lastReadTime = now;
+		eventsRead += events;
+	}
+
+	double GetFillLevel() const noexcept { return fill; }
+
+	// Fraction of capacity per second (negative while draining)
+	double GetFillRate() const noexcept { return fillRate; }
+
+	// Predicted time until the FIFO is full at the current fill rate
+	// (Clock::duration::max() if not filling)
+	Clock::duration GetTimeToOverflow() const {
+		if (fillRate <= 0.0) {
+			return Clock::duration::max();
+		}
+		double seconds = (1.0 - fill) / fillRate;
+		if (seconds > 3600.0) {
+			return Clock::duration::max();
+		}
+		return std::chrono::duration_cast<Clock::duration>(
+			std::chrono::duration<double>(seconds));
+	}
+
+	// Whether the read loop should drain the FIFO as fast as it can
+	bool IsUnderPressure() const {
+		return fill >= PressureFill || GetTimeToOverflow() < PressureHorizon();
+	}
+
+	double GetPeakFillLevel() const noexcept { return peakFill; }
+	std::size_t GetWarningCount() const noexcept { return warningCount; }
+	std::size_t GetOverflowCount() const noexcept { return overflowCount; } // Episodes
+
+	// Mean rate (events/s) at which data was read, over the acquisition
+	double GetMeanDrainRate() const {
+		double seconds = std::chrono::duration<double>(lastReadTime - firstReadTime).count();
+		return seconds > 0.0 ? eventsRead / seconds : 0.0;
+	}
+};
+
+
+// Decides how much data to read from the device FIFO per buffer, and how long
+// to wait between reads, based on an estimate of the incoming event rate.
+//
+// The goal is to send each buffer within the latency target of its first
+// event, while reading often enough that the device FIFO stays well below
+// full, and without sending many small buffers at high rates.
+class AdaptiveFIFOPoller {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// Conservative lower bound on the FIFO capacity of the supported models,
+	// in events; we aim to keep the FIFO no more than a quarter full between
+	// reads.
+	static constexpr std::size_t MinFIFOCapacity = 128 * 1024;
+
+	// Buffers are not filled to less than this (unless the latency target
+	// is reached first)
+	static constexpr std::size_t MinTargetEvents = 1024;
+
+private:
+	std::chrono::microseconds const latencyTarget;
+	std::function<double()> rateHint; // Events/s; may be empty
+
+	double rateEstimate; // Events/s
+	Clock::time_point sampleStart;
+	std::size_t sampleEvents;
+	bool underPressure;
+
+	static std::chrono::microseconds MinSampleDuration() noexcept {
+		return std::chrono::microseconds(5000);
+	}
+
+	static std::chrono::microseconds MinSleep() noexcept {
+		return std::chrono::microseconds(1000);
+	}
+
+public:
+	// rateHint: optional independent estimate of the event rate (such as the
+	// ADC rate counter), used as a lower bound for our own estimate
+	explicit AdaptiveFIFOPoller(std::chrono::microseconds latencyTarget,
+		std::function<double()> rateHint = {}) :
+		latencyTarget(std::max(latencyTarget, MinSleep())),
+		rateHint(rateHint),
+		rateEstimate(0.0),
+		sampleStart(Clock::now()),
+		sampleEvents(0),
+		underPressure(false)
+	{}
+
+	// Buffer capacity (in events) needed to meet the latency target at the
+	// given maximum event rate
+	static std::size_t BufferCapacityForLatency(
+		std::chrono::microseconds latencyTarget, double maxEventRate) {
+		double events = maxEventRate * latencyTarget.count() * 1e-6;
+		return std::min<std::size_t>(std::max<std::size_t>(
+			static_cast<std::size_t>(events), 16 * 1024), 1024 * 1024);
+	}
+
+	// Record the result of a FIFO read that completed at time 'now'
+	void RecordRead(std::size_t eventsRead, Clock::time_point now) {
+		sampleEvents += eventsRead;
+		auto elapsed = now - sampleStart;
+		if (elapsed < MinSampleDuration()) {
+			return;
+		}
+
+		double seconds = std::chrono::duration<double>(elapsed).count();
+		double sample = sampleEvents / seconds;
+		// Follow increases immediately (to protect the FIFO) and decreases
+		// gradually (to avoid oscillating)
+		rateEstimate = sample > rateEstimate ? sample :
+			0.75 * rateEstimate + 0.25 * sample;
+		sampleStart = now;
+		sampleEvents = 0;
+	}
+
+	double GetRateEstimate() const {
+		double rate = rateEstimate;
+		if (rateHint) {
+			rate = std::max(rate, rateHint());
+		}
+		return rate;
+	}
+
+	std::chrono::microseconds GetLatencyTarget() const noexcept {
+		return latencyTarget;
+	}
+
+	// When the device FIFO is filling up (see FIFOMonitor), read in the
+	// largest chunks and wait as little as possible between reads until it is
+	// drained
+	void SetUnderPressure(bool pressure) noexcept {
+		underPressure = pressure;
+	}
+
+	bool IsUnderPressure() const noexcept {
+		return underPressure;
+	}
+
+	// Number of events to collect in the next buffer
+	std::size_t GetTargetEventCount(std::size_t capacity) const {
+		if (underPressure) {
+			return capacity;
+		}
+		double events = GetRateEstimate() * latencyTarget.count() * 1e-6;
+		if (events >= capacity) {
+			return capacity;
+		}
+		std::size_t target = static_cast<std::size_t>(events);
+		if (target < MinTargetEvents) {
+			target = MinTargetEvents;
+		}
+		return std::min(target, capacity);
+	}
+
+	// How long to wait before reading again, when the last read emptied the
+	// FIFO and eventsNeeded more events are wanted for the current buffer
+	std::chrono::microseconds GetSleepInterval(std::size_t eventsNeeded) const {
+		if (underPressure) {
+			return MinSleep();
+		}
+		double rate = GetRateEstimate();
+		double seconds = latencyTarget.count() * 1e-6 / 2;
+		if (rate <= 0.0) {
+			// No estimate yet (start of acquisition); the FIFO may be filling
+			// at any rate
+			seconds = std::min(seconds, MinSampleDuration().count() * 1e-6);
+		}
+		else {
+			seconds = std::min(seconds, (MinFIFOCapacity / 4) / rate);
+			seconds = std::min(seconds, eventsNeeded / rate);
+		}
+		auto interval = std::chrono::microseconds(
+			static_cast<int64_t>(seconds * 1e6));
+		return std::max(interval, MinSleep());
+	}
+};
@@ -5,6 +5,7 @@
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <vector>
 
 
@@ -116,12 +117,16 @@ void DumpRawEvent(char const* rawEvent, std::ostream& output)
 }
 
 
-int DumpEvents(std::istream& input, std::ostream& output)
+// Raw records are also dumped unless a macro-time window is given
+int DumpEvents(std::istream& input, std::ostream& output,
+    uint64_t startMacrotime, uint64_t stopMacrotime)
 {
     BHSPCEventDecoder decoder(std::make_shared<PrintProcessor>(output));
+    decoder.SetMacrotimeWindow(startMacrotime, stopMacrotime);
+    bool const dumpRaw = startMacrotime == 0 && stopMacrotime == UINT64_MAX;
     std::size_t const eventSize = decoder.GetEventSize();
 
-    while (input.good()) {
+    while (input.good() && !decoder.IsFinished()) {
         std::vector<char> event(eventSize);
         input.read(event.data(), eventSize);
         auto const bytesRead = input.gcount();
@@ -133,7 +138,9 @@ int DumpEvents(std::istream& input, std::ostream& output)
             return 1;
         }
 
-        DumpRawEvent(event.data(), output);
+        if (dumpRaw) {
+            DumpRawEvent(event.data(), output);
+        }
         decoder.HandleDeviceEvent(event.data());
     }
     decoder.HandleFinish();
@@ -142,13 +149,14 @@ int DumpEvents(std::istream& input, std::ostream& output)
 }
 
 
-int Dump(std::istream& input, std::ostream& output)
+int Dump(std::istream& input, std::ostream& output,
+    uint64_t startMacrotime = 0, uint64_t stopMacrotime = UINT64_MAX)
 {
     int ret = DumpHeader(input, output);
     if (ret)
         return ret;
 
-    ret = DumpEvents(input, output);
+    ret = DumpEvents(input, output, startMacrotime, stopMacrotime);
     if (ret)
         return ret;
 
@@ -159,8 +167,10 @@ int Dump(std::istream& input, std::ostream& output)
 int main(int argc, char* argv[])
 {
 
-    if (argc > 2) {
-        std::cerr << "Too many arguments\n";
+    // DumpSPC [input.spc [<start> <stop>]], where <start> and <stop> give
+    // the macro-time window to decode.
+    if (argc > 4 || argc == 3) {
+        std::cerr << "Usage: DumpSPC [input.spc [<start> <stop>]]\n";
         return 1;
     }
 
@@ -175,5 +185,12 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    return Dump(input, std::cout);
+    uint64_t startMacrotime = 0;
+    uint64_t stopMacrotime = UINT64_MAX;
+    if (argc == 4) {
+        std::istringstream(argv[2]) >> startMacrotime;
+        std::istringstream(argv[3]) >> stopMacrotime;
+    }
+
+    return Dump(input, std::cout, startMacrotime, stopMacrotime);
 }
@@ -0,0 +1,176 @@
+#include "FLIMEvents/PQT3DeviceEvent.hpp"
+#include "../PQTTTRFile.hpp"
+
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+
+void Usage() {
+    std::cerr <<
+        "Decode PicoQuant T3 records and print event counts and decoding speed.\n" <<
+        "Usage: PQT3Stats input.ptu|input.ht3\n";
+}
+
+
+class CountingProcessor : public DecodedEventProcessor {
+public:
+    std::array<uint64_t, 64> photonsPerChannel{};
+    std::array<uint64_t, 16> markersPerBit{};
+    uint64_t lastMacrotime = 0;
+    bool hadError = false;
+
+    void HandleTimestamp(DecodedEvent const& event) override {
+        lastMacrotime = event.macrotime;
+    }
+
+    void HandleValidPhoton(ValidPhotonEvent const& event) override {
+        ++photonsPerChannel[event.route % 64];
+        lastMacrotime = event.macrotime;
+    }
+
+    void HandleInvalidPhoton(InvalidPhotonEvent const& event) override {
+        lastMacrotime = event.macrotime;
+    }
+
+    void HandleMarker(MarkerEvent const& event) override {
+        for (unsigned i = 0; i < 16; ++i) {
+            if (event.bits & (1 << i)) {
+                ++markersPerBit[i];
+            }
+        }
+        lastMacrotime = event.macrotime;
+    }
+
+    void HandleDataLost(DataLostEvent const& event) override {
+        lastMacrotime = event.macrotime;
+    }
+
+    void HandleError(std::string const& message) override {
+        std::cerr << "Invalid data: " << message << '\n';
+        hadError = true;
+    }
+
+    void HandleFinish() override {
+        // Ignore
+    }
+
+    void HandleEventBatch(DecodedEventBatch const& batch) override {
+        // Count photons without the per-event virtual calls
+        auto const n = batch.GetPhotonCount();
+        for (std::size_t i = 0; i < n; ++i) {
+            ++photonsPerChannel[batch.photonRoutes[i] % 64];
+        }
+        for (auto const& m : batch.markers) {
+            HandleMarker(m);
+        }
+        uint64_t last = batch.GetLastEventMacrotime();
+        if (batch.timestamp > last) {
+            last = batch.timestamp;
+        }
+        if (last > lastMacrotime) {
+            lastMacrotime = last;
+        }
+    }
+};
+
+
+template <typename Decoder>
+int DecodeRecords(std::istream& input, PQTTTRFileInfo const& info)
+{
+    auto counter = std::make_shared<CountingProcessor>();
+    Decoder decoder(counter);
+    std::size_t const eventSize = decoder.GetEventSize();
+
+    std::size_t const bufferRecords = 1024 * 1024;
+    std::vector<char> buffer(bufferRecords * eventSize);
+    uint64_t recordCount = 0;
+    std::chrono::steady_clock::duration decodeTime{};
+
+    while (input.good()) {
+        input.read(buffer.data(), buffer.size());
+        auto const recordsRead = std::size_t(input.gcount()) / eventSize;
+        if (recordsRead == 0) {
+            break;
+        }
+
+        auto const start = std::chrono::steady_clock::now();
+        decoder.HandleDeviceEvents(buffer.data(), recordsRead);
+        decodeTime += std::chrono::steady_clock::now() - start;
+        recordCount += recordsRead;
+    }
+    decoder.HandleFinish();
+
+    if (recordCount != info.numberOfRecords) {
+        std::cerr << "Warning: header says " << info.numberOfRecords <<
+            " records; read " << recordCount << '\n';
+    }
+
+    std::cout << "Records: " << recordCount << '\n';
+    for (unsigned ch = 0; ch < counter->photonsPerChannel.size(); ++ch) {
+        if (counter->photonsPerChannel[ch]) {
+            std::cout << "Photons in channel " << ch << ": " <<
+                counter->photonsPerChannel[ch] << '\n';
+        }
+    }
+    for (unsigned bit = 0; bit < counter->markersPerBit.size(); ++bit) {
+        if (counter->markersPerBit[bit]) {
+            std::cout << "Markers on bit " << bit << ": " <<
+                counter->markersPerBit[bit] << '\n';
+        }
+    }
+    std::cout << "Last nsync: " << counter->lastMacrotime;
+    if (info.syncPeriodSeconds > 0.0) {
+        std::cout << " (" << counter->lastMacrotime * info.syncPeriodSeconds << " s)";
+    }
+    std::cout << '\n';
+
+    double const seconds = std::chrono::duration<double>(decodeTime).count();
+    if (seconds > 0.0) {
+        std::cout << "Decoding time: " << 1000.0 * seconds << " ms (" <<
+            recordCount / seconds / 1e6 << " Mrecords/s)\n";
+    }
+
+    return counter->hadError ? 1 : 0;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        Usage();
+        return 1;
+    }
+
+    auto filename = argv[1];
+    std::fstream input(filename, std::fstream::binary | std::fstream::in);
+    if (!input.is_open()) {
+        std::cerr << "Cannot open " << filename << '\n';
+        return 1;
+    }
+
+    PQTTTRFileInfo info;
+    try {
+        info = ReadPQTTTRHeader(input);
+    }
+    catch (std::exception const& e) {
+        std::cerr << e.what() << '\n';
+        return 1;
+    }
+
+    switch (info.format) {
+    case PQT3Format::PicoT3:
+        std::cout << "Format: PicoHarp T3\n";
+        return DecodeRecords<PQPicoT3EventDecoder>(input, info);
+    case PQT3Format::HydraV1T3:
+        std::cout << "Format: HydraHarp V1 T3\n";
+        return DecodeRecords<PQHydraV1T3EventDecoder>(input, info);
+    case PQT3Format::HydraV2T3:
+        std::cout << "Format: HydraHarp V2 / MultiHarp / TimeHarp 260 T3\n";
+        return DecodeRecords<PQHydraV2T3EventDecoder>(input, info);
+    }
+    return 1;
+}
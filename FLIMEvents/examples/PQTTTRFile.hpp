@@ -0,0 +1,237 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <string>
+
+
+// Minimal reading of PicoQuant TTTR file headers, sufficient to locate and
+// interpret the T3 records that follow. The formats are documented (by way of
+// demo code) at
+// https://github.com/PicoQuant/PicoQuant-Time-Tagged-File-Format-Demos
+
+// Two file formats are supported:
+// - .ptu (unified TTTR format), with a header of tagged values, for PicoHarp,
+//   HydraHarp, MultiHarp, and TimeHarp 260 T3 data.
+// - .ht3 (legacy HydraHarp T3 format), with a fixed binary header. Format
+//   version 1.0 files contain HydraHarp V1 records, and 2.0 files contain V2
+//   records.
+
+// All values in the headers are little-endian.
+
+
+enum class PQT3Format {
+    PicoT3, // PicoT3Event
+    HydraV1T3, // HydraT3Event<true>
+    HydraV2T3, // HydraT3Event<false>
+};
+
+
+struct PQTTTRFileInfo {
+    PQT3Format format;
+    uint64_t numberOfRecords;
+    double syncPeriodSeconds; // Macro-time (nsync) units; 0 if unknown
+    double dtimeResolutionSeconds; // Micro-time units; 0 if unknown
+};
+
+
+namespace pqtttr {
+    inline void ReadBytes(std::istream& input, void* dest, std::size_t size) {
+        input.read(static_cast<char*>(dest), size);
+        if (!input.good()) {
+            throw std::runtime_error("Unexpected end of file in header");
+        }
+    }
+
+    inline uint64_t ReadLE(std::istream& input, std::size_t size) {
+        uint8_t bytes[8];
+        ReadBytes(input, bytes, size);
+        uint64_t value = 0;
+        for (std::size_t i = 0; i < size; ++i) {
+            value |= uint64_t(bytes[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    inline int32_t ReadInt32(std::istream& input) {
+        return int32_t(uint32_t(ReadLE(input, 4)));
+    }
+
+    inline double ReadFloat64(std::istream& input) {
+        uint64_t bits = ReadLE(input, 8);
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    inline void Skip(std::istream& input, std::streamoff size) {
+        input.seekg(size, std::ios_base::cur);
+        if (!input.good()) {
+            throw std::runtime_error("Unexpected end of file in header");
+        }
+    }
+
+    // Record types (TTResultFormat_TTTRRecType)
+    uint32_t const rtPicoHarpT3 = 0x00010303;
+    uint32_t const rtHydraHarpT3 = 0x00010304;
+    uint32_t const rtHydraHarp2T3 = 0x01010304;
+    uint32_t const rtTimeHarp260NT3 = 0x00010305;
+    uint32_t const rtTimeHarp260PT3 = 0x00010306;
+    uint32_t const rtMultiHarpT3 = 0x00010307;
+
+    // Tag types
+    uint32_t const tyEmpty8 = 0xFFFF0008;
+    uint32_t const tyBool8 = 0x00000008;
+    uint32_t const tyInt8 = 0x10000008;
+    uint32_t const tyBitSet64 = 0x11000008;
+    uint32_t const tyColor8 = 0x12000008;
+    uint32_t const tyFloat8 = 0x20000008;
+    uint32_t const tyTDateTime = 0x21000008;
+    uint32_t const tyFloat8Array = 0x2001FFFF;
+    uint32_t const tyAnsiString = 0x4001FFFF;
+    uint32_t const tyWideString = 0x4002FFFF;
+    uint32_t const tyBinaryBlob = 0xFFFFFFFF;
+
+    // Read .ptu header after the 8-byte magic
+    inline PQTTTRFileInfo ReadPTUHeader(std::istream& input) {
+        Skip(input, 8); // Version
+
+        PQTTTRFileInfo info{};
+        bool haveRecType = false;
+        for (;;) {
+            char ident[33] = {};
+            ReadBytes(input, ident, 32);
+            Skip(input, 4); // Index (for array tags)
+            uint32_t type = uint32_t(ReadLE(input, 4));
+            uint64_t value = ReadLE(input, 8);
+
+            std::string name(ident);
+            if (name == "Header_End") {
+                break;
+            }
+
+            switch (type) {
+            case tyFloat8Array:
+            case tyAnsiString:
+            case tyWideString:
+            case tyBinaryBlob:
+                // value is length of data following the tag
+                Skip(input, std::streamoff(value));
+                continue;
+            default:
+                break;
+            }
+
+            if (name == "TTResultFormat_TTTRRecType") {
+                switch (uint32_t(value)) {
+                case rtPicoHarpT3:
+                    info.format = PQT3Format::PicoT3;
+                    break;
+                case rtHydraHarpT3:
+                    info.format = PQT3Format::HydraV1T3;
+                    break;
+                case rtHydraHarp2T3:
+                case rtTimeHarp260NT3:
+                case rtTimeHarp260PT3:
+                case rtMultiHarpT3:
+                    info.format = PQT3Format::HydraV2T3;
+                    break;
+                default:
+                    throw std::runtime_error("Unsupported record type (only T3 is supported)");
+                }
+                haveRecType = true;
+            }
+            else if (name == "TTResult_NumberOfRecords") {
+                info.numberOfRecords = value;
+            }
+            else if (name == "MeasDesc_GlobalResolution" && type == tyFloat8) {
+                std::memcpy(&info.syncPeriodSeconds, &value, sizeof(double));
+            }
+            else if (name == "MeasDesc_Resolution" && type == tyFloat8) {
+                std::memcpy(&info.dtimeResolutionSeconds, &value, sizeof(double));
+            }
+        }
+
+        if (!haveRecType) {
+            throw std::runtime_error("Record type not found in header");
+        }
+        return info;
+    }
+
+    // Read .ht3 header after the 16-byte identifier
+    inline PQTTTRFileInfo ReadHT3Header(std::istream& input) {
+        PQTTTRFileInfo info{};
+
+        // Text header (328 bytes in total)
+        char formatVersion[7] = {};
+        ReadBytes(input, formatVersion, 6);
+        Skip(input, 18 + 12 + 18 + 2 + 256); // Creator, time, comment
+        std::string version(formatVersion);
+        if (version == "1.0") {
+            info.format = PQT3Format::HydraV1T3;
+        }
+        else if (version == "2.0") {
+            info.format = PQT3Format::HydraV2T3;
+        }
+        else {
+            throw std::runtime_error("Unsupported .ht3 format version: " + version);
+        }
+
+        // Binary header (368 bytes)
+        Skip(input, 4); // Curves
+        int32_t bitsPerRecord = ReadInt32(input);
+        Skip(input, 4 * 4); // ActiveCurve, MeasMode, SubMode, Binning
+        double resolutionPs = ReadFloat64(input);
+        Skip(input, 10 * 4 + 8 * 8 + 3 * 12 + 4 * 4 + 20); // To HardwareIdent
+        Skip(input, 16 + 8 + 4 + 4 + 10 * 8); // To BaseResolution
+        Skip(input, 8 + 8); // BaseResolution, InputsEnabled
+        int32_t inputChannelsPresent = ReadInt32(input);
+        Skip(input, 7 * 4); // RefClockSource through SyncOffset
+
+        if (bitsPerRecord != 32) {
+            throw std::runtime_error("Unexpected bits per record in .ht3 header");
+        }
+        if (inputChannelsPresent < 0 || inputChannelsPresent > 64) {
+            throw std::runtime_error("Invalid number of input channels in .ht3 header");
+        }
+
+        // Per-channel settings (4 ints each), then input rates
+        Skip(input, std::streamoff(inputChannelsPresent) * (4 * 4 + 4));
+
+        // TTTR header
+        int32_t syncRate = ReadInt32(input);
+        Skip(input, 2 * 4); // StopAfter, StopReason
+        int32_t imageHeaderSize = ReadInt32(input);
+        info.numberOfRecords = ReadLE(input, 8);
+        if (imageHeaderSize < 0) {
+            throw std::runtime_error("Invalid image header size in .ht3 header");
+        }
+        Skip(input, std::streamoff(imageHeaderSize) * 4);
+
+        info.syncPeriodSeconds = syncRate > 0 ? 1.0 / syncRate : 0.0;
+        info.dtimeResolutionSeconds = resolutionPs * 1e-12;
+        return info;
+    }
+}
+
+
+// Read the header of a .ptu or .ht3 file, leaving input positioned at the
+// first record. Throws std::runtime_error if the file is not recognized.
+inline PQTTTRFileInfo ReadPQTTTRHeader(std::istream& input) {
+    char magic[8];
+    pqtttr::ReadBytes(input, magic, sizeof(magic));
+    if (std::memcmp(magic, "PQTTTR\0\0", 8) == 0) {
+        return pqtttr::ReadPTUHeader(input);
+    }
+
+    char ident[16];
+    std::memcpy(ident, magic, 8);
+    pqtttr::ReadBytes(input, ident + 8, 8);
+    if (std::memcmp(ident, "HydraHarp", 9) == 0) {
+        return pqtttr::ReadHT3Header(input);
+    }
+
+    throw std::runtime_error("Not a PicoQuant .ptu or .ht3 file");
+}
@@ -0,0 +1,179 @@
+#include "FLIMEvents/LineClockPixellator.hpp"
+#include "FLIMEvents/PixelClockPixellator.hpp"
+#include "FLIMEvents/StaticDownstream.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+
+
+void Usage() {
+    std::cerr <<
+        "Measure the throughput of the pixellators alone (decoded events in,\n" <<
+        "pixel photons to a counting sink out).\n" <<
+        "Usage: PixellatorBenchmark [<repetitions>]\n";
+}
+
+
+using Clock = std::chrono::steady_clock;
+
+uint32_t const LineMarkerBit = 1;
+uint32_t const PixelMarkerBit = 0;
+uint32_t const PixelTime = 20; // Macro-time units (e.g. 2 MHz pixel rate at 25 ns)
+uint32_t const LinesPerFrame = 64;
+uint32_t const FrameCount = 16;
+
+
+struct Counts {
+    uint64_t photonCount = 0;
+    uint64_t checksum = 0; // So that the pixel assignment is not optimized out
+};
+
+
+class CountingProcessor final : public PixelPhotonProcessor {
+    Counts* counts;
+
+public:
+    explicit CountingProcessor(Counts* counts) : counts(counts) {}
+
+    void HandleBeginFrame() override {}
+    void HandleEndFrame() override {}
+
+    void HandlePixelPhoton(PixelPhotonEvent const& event) override {
+        ++counts->photonCount;
+        counts->checksum += event.x + event.y + event.frame;
+    }
+
+    void HandleError(std::string const& message) override {
+        std::cerr << "Error: " << message << '\n';
+    }
+
+    void HandleFinish() override {}
+};
+
+
+// Scan of FrameCount frames with a line marker at the start of every line,
+// optionally a pixel marker at the start of every pixel, and photons at
+// random times
+DecodedEventBatch MakeEvents(uint32_t pixelsPerLine, double photonsPerPixel,
+    bool pixelMarkers) {
+    DecodedEventBatch batch;
+    uint64_t const lineTime = uint64_t(pixelsPerLine) * PixelTime;
+    uint64_t const linePeriod = lineTime + lineTime / 4; // Include flyback
+    uint64_t const endTime = 1000 + FrameCount * LinesPerFrame * linePeriod;
+
+    std::mt19937_64 rng(42);
+    std::exponential_distribution<double> interval(photonsPerPixel / PixelTime);
+    double nextPhoton = 1000.0 + interval(rng);
+    for (uint64_t lineStart = 1000; lineStart < endTime; lineStart += linePeriod) {
+        for (uint64_t px = 0; px < pixelsPerLine; ++px) {
+            uint64_t const pixelStart = lineStart + px * PixelTime;
+            if (pixelMarkers || px == 0) {
+                MarkerEvent marker;
+                marker.macrotime = pixelStart;
+                marker.bits = (pixelMarkers ? 1 << PixelMarkerBit : 0) |
+                    (px == 0 ? 1 << LineMarkerBit : 0);
+                batch.markers.push_back(marker);
+            }
+
+            uint64_t const nextStart = px + 1 < pixelsPerLine ?
+                pixelStart + PixelTime : lineStart + linePeriod;
+            while (nextPhoton < nextStart) {
+                uint64_t const t = static_cast<uint64_t>(nextPhoton);
+                if (t > pixelStart) { // Keep photons after markers
+                    batch.AppendPhoton(t, static_cast<uint16_t>(rng() % 4096), 0);
+                }
+                nextPhoton += interval(rng);
+            }
+        }
+    }
+    batch.timestamp = endTime;
+    return batch;
+}
+
+
+// Returns photons per second, from the fastest of the repetitions.
+// makePixellator(Counts*) returns a new pixellator sending to a
+// CountingProcessor.
+template <typename MakePixellator>
+double Measure(DecodedEventBatch const& events, unsigned repetitions,
+    MakePixellator makePixellator) {
+    Counts counts;
+    Clock::duration best = Clock::duration::max();
+    for (unsigned r = 0; r < repetitions; ++r) {
+        auto pixellator = makePixellator(&counts);
+        auto const start = Clock::now();
+        pixellator.HandleEventBatch(events);
+        pixellator.HandleFinish();
+        best = std::min(best, Clock::now() - start);
+    }
+    return counts.photonCount / repetitions /
+        std::chrono::duration<double>(best).count();
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2) {
+        Usage();
+        return 1;
+    }
+    unsigned repetitions = 20;
+    if (argc == 2) {
+        std::istringstream(argv[1]) >> repetitions;
+    }
+    if (repetitions < 1) {
+        Usage();
+        return 1;
+    }
+
+    using Sink = StaticDownstream<CountingProcessor>;
+    std::cout << "Throughput in M photons/s\n";
+    std::cout << "   pixels  photons/px  line clock  resonant (bidirectional)  pixel clock\n";
+    for (uint32_t pixelsPerLine : { 256u, 1024u }) {
+        for (double photonsPerPixel : { 0.1, 1.0, 8.0 }) {
+            auto const lineEvents = MakeEvents(pixelsPerLine, photonsPerPixel, false);
+            auto const pixelEvents = MakeEvents(pixelsPerLine, photonsPerPixel, true);
+            uint32_t const lineTime = pixelsPerLine * PixelTime;
+            uint32_t const linePeriod = lineTime + lineTime / 4;
+
+            double const lineClockRate = Measure(lineEvents, repetitions,
+                [&](Counts* counts) {
+                    return BasicLineClockPixellator<Sink>(pixelsPerLine,
+                        LinesPerFrame, FrameCount, 0, lineTime, LineMarkerBit,
+                        Sink(CountingProcessor(counts)));
+                });
+            // Same events, treating each line marker as the start of a
+            // resonant scan period covering two rows
+            auto const resonantMapping = LineMapping::Sinusoidal(pixelsPerLine,
+                linePeriod, 0.8, true);
+            double const resonantRate = Measure(lineEvents, repetitions,
+                [&](Counts* counts) {
+                    return BasicLineClockPixellator<Sink>(resonantMapping,
+                        LinesPerFrame / 2, FrameCount, 0, LineMarkerBit,
+                        Sink(CountingProcessor(counts)));
+                });
+            double const pixelClockRate = Measure(pixelEvents, repetitions,
+                [&](Counts* counts) {
+                    return BasicPixelClockPixellator<Sink>(pixelsPerLine,
+                        LinesPerFrame, FrameCount, 0, PixelTime, PixelMarkerBit,
+                        Sink(CountingProcessor(counts)));
+                });
+
+            std::cout << std::setw(9) << pixelsPerLine <<
+                std::setw(12) << photonsPerPixel <<
+                std::fixed << std::setprecision(1) <<
+                std::setw(12) << lineClockRate / 1e6 <<
+                std::setw(26) << resonantRate / 1e6 <<
+                std::setw(13) << pixelClockRate / 1e6 << '\n';
+            std::cout.unsetf(std::ios::fixed);
+        }
+    }
+    return 0;
+}
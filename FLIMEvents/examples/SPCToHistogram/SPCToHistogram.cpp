@@ -4,19 +4,22 @@
 #include "FLIMEvents/StreamBuffer.hpp"
 #include "../BHSPCFile.hpp"
 
+#include <atomic>
 #include <ctime>
 #include <fstream>
 #include <future>
 #include <iostream>
 #include <memory>
 #include <sstream>
+#include <thread>
 
 
 void Usage() {
     std::cerr <<
         "Test driver for histogramming.\n" <<
-        "Usage: SPCToHistogram <width> <height> <lineDelay> <lineTime> input.spc output.raw\n" <<
+        "Usage: SPCToHistogram <width> <height> <lineDelay> <lineTime> input.spc output.raw [<start> <stop>]\n" <<
         "where <lineDelay> and <lineTime> are in macro-time units.\n" <<
+        "If given, only events with macro-time in [<start>, <stop>) are used.\n" <<
         "Currently the output contains only the raw cumulative histogram.\n";
 }
 
@@ -61,7 +64,7 @@ public:
 
 int main(int argc, char* argv[])
 {
-    if (argc != 7) {
+    if (argc != 7 && argc != 9) {
         Usage();
         return 1;
     }
@@ -76,6 +79,12 @@ int main(int argc, char* argv[])
     std::istringstream(argv[4]) >> lineTime;
     std::string inFilename(argv[5]);
     std::string outFilename(argv[6]);
+    uint64_t startMacrotime = 0;
+    uint64_t stopMacrotime = UINT64_MAX;
+    if (argc == 9) {
+        std::istringstream(argv[7]) >> startMacrotime;
+        std::istringstream(argv[8]) >> stopMacrotime;
+    }
 
     uint32_t maxFrames = UINT32_MAX;
 
@@ -93,9 +102,13 @@ int main(int argc, char* argv[])
                     std::make_shared<HistogramSaver<SampleType>>(outFilename))));
 
     auto decoder = std::make_shared<BHSPCEventDecoder>(processor);
+    decoder->SetParallelism(std::thread::hardware_concurrency());
+    decoder->SetSendInvalidPhotons(false); // Not used by pixellator
+    decoder->SetMacrotimeWindow(startMacrotime, stopMacrotime);
 
     EventStream<BHSPCEvent> stream;
-    auto processorDone = std::async(std::launch::async, [&stream, decoder]{
+    std::atomic<bool> decoderFinished{ false };
+    auto processorDone = std::async(std::launch::async, [&stream, &decoderFinished, decoder]{
         std::clock_t start = std::clock();
         for (;;) {
             auto eventBuffer = stream.ReceiveBlocking();
@@ -105,6 +118,9 @@ int main(int argc, char* argv[])
             decoder->HandleDeviceEvents(
                 reinterpret_cast<char const*>(eventBuffer->GetData()),
                 eventBuffer->GetSize());
+            if (decoder->IsFinished()) {
+                decoderFinished = true; // Past the window; stop reading
+            }
         }
         std::clock_t elapsed = std::clock() - start;
 
@@ -120,16 +136,20 @@ int main(int argc, char* argv[])
         return 1;
     }
 
-    EventBufferPool<BHSPCEvent> pool(48 * 1024);
+    // Large buffers, so that each can be decoded in parallel
+    EventBufferPool<BHSPCEvent> pool(1024 * 1024);
+    // Reading is faster than processing; wait rather than read the whole file
+    // into memory
+    pool.SetMaxBufferCount(16, EventBufferPoolPolicy::Block);
 
     input.seekg(sizeof(BHSPCFileHeader));
-    while (input.good()) {
+    while (input.good() && !decoderFinished) {
         auto buf = pool.CheckOut();
         auto const maxSize = buf->GetCapacity() * sizeof(BHSPCEvent);
         input.read(reinterpret_cast<char*>(buf->GetData()), maxSize);
         auto const readSize = input.gcount() / sizeof(BHSPCEvent);
         buf->SetSize(static_cast<std::size_t>(readSize));
-        stream.Send(buf);
+        stream.Send(std::move(buf));
     }
     stream.Send({});
 
@@ -0,0 +1,220 @@
+#include "FLIMEvents/StreamBuffer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+void Usage() {
+    std::cerr <<
+        "Compare buffer handoff between threads: EventBufferPool/EventStream\n" <<
+        "versus the previous mutex-based implementation.\n" <<
+        "Usage: StreamBenchmark [<bufferCount>]\n";
+}
+
+
+// The previous implementation (mutex + condition variable + deque; pool with
+// a mutex-protected free list and shared_ptr handles), kept for comparison.
+namespace legacy {
+    template <typename E>
+    class EventBufferPool {
+        std::size_t const bufferSize;
+
+        std::mutex mutex;
+        std::vector<std::unique_ptr<EventBuffer<E>>> buffers;
+
+        std::unique_ptr<EventBuffer<E>> MakeBuffer() {
+            return std::make_unique<EventBuffer<E>>(bufferSize);
+        }
+
+    public:
+        explicit EventBufferPool(std::size_t size) :
+            bufferSize(size)
+        {}
+
+        std::shared_ptr<EventBuffer<E>> CheckOut() {
+            std::unique_ptr<EventBuffer<E>> uptr;
+
+            {
+                std::lock_guard<std::mutex> hold(mutex);
+                if (!buffers.empty()) {
+                    uptr = std::move(buffers.back());
+                    buffers.pop_back();
+                }
+            }
+
+            if (!uptr) {
+                uptr = MakeBuffer();
+            }
+
+            uptr->SetSize(0);
+
+            return { uptr.release(),
+                [this](auto ptr) {
+                    if (!ptr)
+                        return;
+
+                    std::lock_guard<std::mutex> hold(mutex);
+                    buffers.emplace_back(std::unique_ptr<EventBuffer<E>>(ptr));
+                }
+            };
+        }
+    };
+
+    template <typename E>
+    class EventStream {
+        std::mutex mutex;
+        std::condition_variable queueNotEmptyCondition;
+        std::deque<std::shared_ptr<EventBuffer<E>>> queue;
+
+    public:
+        void Send(std::shared_ptr<EventBuffer<E>> buffer) {
+            {
+                std::lock_guard<std::mutex> hold(mutex);
+                queue.emplace_back(buffer);
+            }
+            queueNotEmptyCondition.notify_one();
+        }
+
+        std::shared_ptr<EventBuffer<E>> ReceiveBlocking() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (queue.empty()) {
+                queueNotEmptyCondition.wait(lock);
+            }
+            auto ret = queue.front();
+            queue.pop_front();
+            return ret;
+        }
+    };
+}
+
+
+using Clock = std::chrono::steady_clock;
+using Event = uint64_t; // Holds a timestamp for latency measurement
+std::size_t const BufferSize = 48 * 1024; // As used for acquisition
+
+
+// Send bufferCount buffers as fast as possible; return buffers per second
+template <typename Pool, typename Stream>
+double MeasureThroughput(std::size_t bufferCount) {
+    Pool pool(BufferSize);
+    Stream stream;
+
+    auto const start = Clock::now();
+    std::thread receiver([&] {
+        for (;;) {
+            auto buf = stream.ReceiveBlocking();
+            if (!buf) {
+                break;
+            }
+        }
+    });
+    for (std::size_t i = 0; i < bufferCount; ++i) {
+        auto buf = pool.CheckOut();
+        buf->SetSize(1);
+        stream.Send(std::move(buf));
+    }
+    stream.Send({});
+    receiver.join();
+    auto const elapsed = std::chrono::duration<double>(Clock::now() - start);
+    return bufferCount / elapsed.count();
+}
+
+
+// Send bufferCount buffers at intervals, so that the receiver is waiting;
+// return the sorted send-to-receive latencies in microseconds
+template <typename Pool, typename Stream>
+std::vector<double> MeasureLatency(std::size_t bufferCount,
+    std::chrono::microseconds interval) {
+    Pool pool(BufferSize);
+    Stream stream;
+    std::vector<double> latencies;
+    latencies.reserve(bufferCount);
+
+    std::thread receiver([&] {
+        for (;;) {
+            auto buf = stream.ReceiveBlocking();
+            auto const now = Clock::now();
+            if (!buf) {
+                break;
+            }
+            auto const sent = Clock::time_point(Clock::duration(
+                static_cast<Clock::rep>(buf->GetData()[0])));
+            latencies.push_back(
+                std::chrono::duration<double, std::micro>(now - sent).count());
+        }
+    });
+    for (std::size_t i = 0; i < bufferCount; ++i) {
+        std::this_thread::sleep_for(interval);
+        auto buf = pool.CheckOut();
+        buf->GetData()[0] = static_cast<Event>(
+            Clock::now().time_since_epoch().count());
+        buf->SetSize(1);
+        stream.Send(std::move(buf));
+    }
+    stream.Send({});
+    receiver.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    return latencies;
+}
+
+
+template <typename Pool, typename Stream>
+void RunBenchmark(std::string const& name, std::size_t bufferCount) {
+    // Warm up (allocate pool buffers)
+    MeasureThroughput<Pool, Stream>(1000);
+
+    double const rate = MeasureThroughput<Pool, Stream>(bufferCount);
+    auto const latencies = MeasureLatency<Pool, Stream>(
+        std::max<std::size_t>(bufferCount / 100, 100),
+        std::chrono::microseconds(200));
+    auto percentile = [&](double p) {
+        return latencies[static_cast<std::size_t>(p * (latencies.size() - 1))];
+    };
+
+    std::cout << std::setw(10) << name << ": " <<
+        std::fixed << std::setprecision(2) <<
+        std::setw(8) << rate / 1e6 << " M buffers/s; latency (us) " <<
+        "median " << std::setw(7) << percentile(0.5) <<
+        ", p99 " << std::setw(7) << percentile(0.99) <<
+        ", max " << std::setw(8) << latencies.back() << '\n';
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc > 2) {
+        Usage();
+        return 1;
+    }
+
+    std::size_t bufferCount = 1000000;
+    if (argc == 2) {
+        std::istringstream(argv[1]) >> bufferCount;
+    }
+    if (bufferCount < 1) {
+        Usage();
+        return 1;
+    }
+
+    std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << '\n';
+    for (int i = 0; i < 2; ++i) {
+        RunBenchmark<legacy::EventBufferPool<Event>,
+            legacy::EventStream<Event>>("mutex", bufferCount);
+        RunBenchmark<EventBufferPool<Event>,
+            EventStream<Event>>("lock-free", bufferCount);
+    }
+
+    return 0;
+}
@@ -1,6 +1,12 @@
 #pragma once
 
+#include "BHSPCEventSIMD.hpp"
 #include "DeviceEvent.hpp"
+#include "ParallelRunner.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
 
 
 // Raw photon event data formats are documented in The bh TCSPC Handbook (see
@@ -18,7 +24,7 @@
 struct BHSPCEvent {
     uint8_t bytes[4];
 
-    static uint64_t const MacroTimeOverflowPeriod = 1 << 12;
+    static constexpr uint64_t MacroTimeOverflowPeriod = 1 << 12;
 
     uint16_t GetADCValue() const noexcept {
         uint8_t lo8 = bytes[2];
@@ -83,7 +89,7 @@ struct BHSPCEvent {
 struct BHSPC600Event48 {
     uint8_t bytes[6];
 
-    static uint64_t const MacroTimeOverflowPeriod = 1 << 24;
+    static constexpr uint64_t MacroTimeOverflowPeriod = 1 << 24;
 
     uint16_t GetADCValue() const noexcept {
         uint8_t lo8 = bytes[0];
@@ -136,7 +142,7 @@ struct BHSPC600Event48 {
 struct BHSPC600Event32 {
     uint8_t bytes[4];
 
-    static uint64_t const MacroTimeOverflowPeriod = 1 << 17;
+    static constexpr uint64_t MacroTimeOverflowPeriod = 1 << 17;
 
     uint16_t GetADCValue() const noexcept {
         return bytes[0];
@@ -183,84 +189,412 @@ struct BHSPC600Event32 {
 };
 
 
+// Vectorized decoding is available only for the standard FIFO format
+template <typename E>
+inline BHSPCFastDecodeFunction GetBHFastDecodeFunction(SIMDLevel) noexcept {
+    return nullptr;
+}
+
+template <>
+inline BHSPCFastDecodeFunction GetBHFastDecodeFunction<BHSPCEvent>(SIMDLevel level) noexcept {
+    return GetBHSPCFastDecodeFunction(level);
+}
+
+
 /**
  * \brief Decode BH SPC event stream.
  *
+ * Events can be decoded one at a time (HandleDeviceEvent(), which sends each
+ * decoded event to the downstream processor individually) or a buffer at a
+ * time (HandleDeviceEvents(), which sends a single DecodedEventBatch). Both
+ * produce the same sequence of events.
+ *
+ * When decoding a buffer, vectorized (SIMD) code is used where available for
+ * runs of plain photon records; the SIMD level is chosen at run time based on
+ * CPU support (see SetSIMDLevel()).
+ *
+ * Large buffers can also be decoded in parallel on multiple threads (see
+ * SetParallelism()). This is done in two passes: the first counts macro-time
+ * overflows in each chunk of the buffer, which determines (by prefix sum) the
+ * macro-time base at the start of each chunk; the second decodes the chunks
+ * independently. The chunks are sent downstream, in order, as separate
+ * batches, so the events are the same as when decoding serially, except that
+ * batch timestamps may be sent at chunk boundaries. The worker threads are
+ * started on first use and kept for later buffers.
+ *
+ * Decoding can be limited to a macro-time window (see SetMacrotimeWindow()),
+ * after which the decoder finishes by itself.
+ *
  * User code should normally use one of the following concrete classes:
  * BHSPCEventDecoder, BHSPC600Event48Decoder, BHSPC600Event32Decoder.
  *
  * \tparam E binary record interpreter class
+ * \tparam D downstream holder (see BasicDeviceEventDecoder)
  */
-template <typename E>
-class BHEventDecoder : public DeviceEventDecoder {
-    uint64_t macrotimeBase; // Time of last overflow
-    uint64_t lastMacrotime;
-
-public:
-    BHEventDecoder(std::shared_ptr<DecodedEventProcessor> downstream) :
-        DeviceEventDecoder(downstream),
-        macrotimeBase(0),
-        lastMacrotime(0)
-    {}
-
-    std::size_t GetEventSize() const noexcept override {
-        return sizeof(E);
-    }
-
-    void HandleDeviceEvent(char const* event) override {
-        E const* devEvt = reinterpret_cast<E const*>(event);
-
+template <typename E,
+    typename D = std::shared_ptr<DecodedEventProcessor>>
+class BHEventDecoder : public BasicDeviceEventDecoder<D> {
+    // Decoding state carried over from one record to the next
+    struct State {
+        uint64_t macrotimeBase; // Time of last overflow
+        uint64_t lastMacrotime; // 0 if no event yet
+    };
+
+    State state;
+
+    // Events are sent only in [start, stop)
+    struct Window {
+        uint64_t start;
+        uint64_t stop;
+    };
+
+    Window window;
+
+    enum class DecodeStatus {
+        Ok,
+        NonMonotonic, // Invalid record; nothing sent for it
+        Stopped, // Reached the end of the window; nothing sent for record
+    };
+
+    DecodedEventBatch batch; // Reused to avoid reallocation
+    BHSPCFastDecodeFunction fastDecode; // Null if not available
+
+    unsigned maxThreads;
+    std::size_t minChunkSize;
+    std::vector<DecodedEventBatch> chunkBatches; // For parallel decoding
+    std::unique_ptr<flimevents::internal::ParallelRunner> runner; // Ditto
+
+    using EventSender = typename BasicDeviceEventDecoder<D>::EventSender;
+    using BatchAppender = typename BasicDeviceEventDecoder<D>::BatchAppender;
+
+    // Decode a single record, passing the result to sink. The sink is not
+    // called for records outside of the window (other than to update the
+    // macro-time base) or for invalid records.
+    template <typename S>
+    static DecodeStatus DecodeEvent(E const* devEvt, State& st,
+        Window const& win, S& sink) {
         if (devEvt->IsMultipleMacroTimeOverflow()) {
-            macrotimeBase += E::MacroTimeOverflowPeriod *
+            st.macrotimeBase += E::MacroTimeOverflowPeriod *
                 devEvt->GetMultipleMacroTimeOverflowCount();
-
-            DecodedEvent e;
-            e.macrotime = macrotimeBase;
-            SendTimestamp(e);
-            return;
+            if (st.macrotimeBase >= win.stop) {
+                return DecodeStatus::Stopped;
+            }
+            if (st.macrotimeBase >= win.start) {
+                sink.Timestamp(st.macrotimeBase);
+            }
+            return DecodeStatus::Ok;
         }
 
         if (devEvt->GetMacroTimeOverflowFlag()) {
-            macrotimeBase += E::MacroTimeOverflowPeriod;
+            st.macrotimeBase += E::MacroTimeOverflowPeriod;
         }
 
-        uint64_t macrotime = macrotimeBase + devEvt->GetMacroTime();
+        uint64_t macrotime = st.macrotimeBase + devEvt->GetMacroTime();
+        if (macrotime < win.start) {
+            return DecodeStatus::Ok;
+        }
+        if (macrotime >= win.stop) {
+            return DecodeStatus::Stopped;
+        }
 
         // Validate input: ensure macrotime increases monotonically (a common
         // assumption made by downstream processors)
-        if (macrotime <= lastMacrotime) {
-            SendError("Non-monotonic macro-time encountered");
-            return;
+        if (macrotime <= st.lastMacrotime) {
+            return DecodeStatus::NonMonotonic;
         }
-        lastMacrotime = macrotime;
+        st.lastMacrotime = macrotime;
 
         if (devEvt->GetGapFlag()) {
-            DataLostEvent e;
-            e.macrotime = macrotime;
-            SendDataLost(e);
+            sink.DataLost(macrotime);
         }
 
         if (devEvt->GetMarkerFlag()) {
-            MarkerEvent e;
-            e.macrotime = macrotime;
-            e.bits = devEvt->GetMarkerBits();
-            SendMarker(e);
-            return;
+            sink.Marker(macrotime, devEvt->GetMarkerBits());
+            return DecodeStatus::Ok;
         }
 
         if (devEvt->GetInvalidFlag()) {
-            InvalidPhotonEvent e;
-            e.macrotime = macrotime;
-            e.microtime = devEvt->GetADCValue();
-            e.route = devEvt->GetRoutingSignals();
-            SendInvalidPhoton(e);
+            sink.InvalidPhoton(macrotime, devEvt->GetADCValue(),
+                devEvt->GetRoutingSignals());
+        }
+        else {
+            sink.ValidPhoton(macrotime, devEvt->GetADCValue(),
+                devEvt->GetRoutingSignals());
+        }
+        return DecodeStatus::Ok;
+    }
+
+    // Decode records into batch (which is cleared first), using the fast
+    // path where possible. Returns the status of the record at which
+    // decoding stopped (Ok if all records were decoded). The number of
+    // invalid photons decoded is stored in invalidPhotonCount.
+    DecodeStatus DecodeRecords(E const* devEvts, std::size_t count, State& st,
+        DecodedEventBatch& out, uint64_t& invalidPhotonCount) const {
+        out.ClearForDecoding(count);
+        BatchAppender appender(*this, out);
+        DecodeStatus status = DecodeStatus::Ok;
+        std::size_t i = 0;
+        while (status == DecodeStatus::Ok && i < count) {
+            // The fast path does not know about the window start, so is only
+            // used once all records are past it
+            if (fastDecode && st.macrotimeBase >= window.start) {
+                auto* macrotimes = out.photonMacrotimes.data() +
+                    appender.photonCount;
+                auto n = fastDecode(devEvts + i, count - i,
+                    st.macrotimeBase, st.lastMacrotime, macrotimes,
+                    out.photonMicrotimes.data() + appender.photonCount,
+                    out.photonRoutes.data() + appender.photonCount);
+                i += n;
+                if (n > 0 && macrotimes[n - 1] >= window.stop) {
+                    n = std::lower_bound(macrotimes, macrotimes + n,
+                        window.stop) - macrotimes;
+                    status = DecodeStatus::Stopped;
+                }
+                appender.CommitPhotons(n);
+                if (status != DecodeStatus::Ok) {
+                    break;
+                }
+            }
+
+            // Records that the fast path could not handle (at least a block)
+            std::size_t blockEnd = i + 8 < count ? i + 8 : count;
+            for (; i < blockEnd; ++i) {
+                status = DecodeEvent(devEvts + i, st, window, appender);
+                if (status != DecodeStatus::Ok) {
+                    break;
+                }
+            }
+        }
+        out.ResizePhotons(appender.photonCount);
+        invalidPhotonCount = appender.invalidPhotonCount;
+        return status;
+    }
+
+    // First pass of parallel decoding: the number of macro-time overflow
+    // periods in the given records
+    static uint64_t CountOverflows(E const* devEvts, std::size_t count) noexcept {
+        uint64_t overflows = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            if (devEvts[i].IsMultipleMacroTimeOverflow()) {
+                overflows += devEvts[i].GetMultipleMacroTimeOverflowCount();
+            }
+            else if (devEvts[i].GetMacroTimeOverflowFlag()) {
+                ++overflows;
+            }
+        }
+        return overflows;
+    }
+
+    // The macro-time of the first record that would be subject to the
+    // monotonicity check (not a multiple overflow and in the window) in the
+    // given records; 0 if none, or if the window ends first
+    static uint64_t FirstMacrotimeInWindow(E const* devEvts, std::size_t count,
+        uint64_t macrotimeBase, Window const& win) noexcept {
+        for (std::size_t i = 0; i < count; ++i) {
+            if (devEvts[i].IsMultipleMacroTimeOverflow()) {
+                macrotimeBase += E::MacroTimeOverflowPeriod *
+                    devEvts[i].GetMultipleMacroTimeOverflowCount();
+                if (macrotimeBase >= win.stop) {
+                    return 0;
+                }
+                continue;
+            }
+            if (devEvts[i].GetMacroTimeOverflowFlag()) {
+                macrotimeBase += E::MacroTimeOverflowPeriod;
+            }
+            uint64_t const macrotime = macrotimeBase + devEvts[i].GetMacroTime();
+            if (macrotime >= win.stop) {
+                return 0;
+            }
+            if (macrotime >= win.start) {
+                return macrotime;
+            }
+        }
+        return 0;
+    }
+
+    // Call func(k) for k in [0, n), using the worker threads, which are
+    // kept from one buffer to the next
+    template <typename F>
+    void RunInParallel(std::size_t n, F func) {
+        if (!runner) {
+            runner = std::make_unique<flimevents::internal::ParallelRunner>();
+        }
+        runner->Run(n, func);
+    }
+
+    std::size_t GetChunkCount(std::size_t count) const noexcept {
+        if (maxThreads < 2 || count < 2 * minChunkSize) {
+            return 1;
+        }
+        return std::min<std::size_t>(maxThreads, count / minChunkSize);
+    }
+
+    // Send error or finish, if decoding stopped
+    void HandleStatus(DecodeStatus status) {
+        switch (status) {
+        case DecodeStatus::NonMonotonic:
+            this->SendError("Non-monotonic macro-time encountered");
+            break;
+        case DecodeStatus::Stopped:
+            this->SendFinish();
+            break;
+        default:
+            break;
+        }
+    }
+
+    void DecodeAndSend(E const* devEvts, std::size_t count) {
+        uint64_t invalidPhotonCount;
+        auto status = DecodeRecords(devEvts, count, state, batch,
+            invalidPhotonCount);
+        this->AddInvalidPhotonCount(invalidPhotonCount);
+
+        // Events preceding an error are sent, as with HandleDeviceEvent()
+        this->SendEventBatch(batch);
+        HandleStatus(status);
+    }
+
+    void DecodeAndSendParallel(E const* devEvts, std::size_t count,
+        std::size_t nChunks) {
+        std::size_t const chunkSize = (count + nChunks - 1) / nChunks;
+        std::vector<std::size_t> starts(nChunks + 1);
+        for (std::size_t k = 0; k <= nChunks; ++k) {
+            starts[k] = std::min(k * chunkSize, count);
+        }
+
+        // Pass 1: count overflows in each chunk
+        std::vector<uint64_t> overflows(nChunks);
+        RunInParallel(nChunks, [&](std::size_t k) {
+            overflows[k] = CountOverflows(devEvts + starts[k],
+                starts[k + 1] - starts[k]);
+        });
+
+        // Prefix sum gives the macro-time base at the start of each chunk.
+        // The monotonicity check across chunk boundaries is deferred.
+        std::vector<State> chunkStates(nChunks);
+        uint64_t base = state.macrotimeBase;
+        for (std::size_t k = 0; k < nChunks; ++k) {
+            chunkStates[k].macrotimeBase = base;
+            chunkStates[k].lastMacrotime = 0;
+            base += E::MacroTimeOverflowPeriod * overflows[k];
+        }
+
+        // Pass 2: decode each chunk independently
+        chunkBatches.resize(nChunks);
+        std::vector<State> endStates(chunkStates);
+        std::vector<DecodeStatus> chunkStatus(nChunks);
+        std::vector<uint64_t> invalidCounts(nChunks);
+        std::vector<uint64_t> firstMacrotimes(nChunks);
+        RunInParallel(nChunks, [&](std::size_t k) {
+            auto const* chunk = devEvts + starts[k];
+            auto const chunkCount = starts[k + 1] - starts[k];
+            chunkStatus[k] = DecodeRecords(chunk, chunkCount, endStates[k],
+                chunkBatches[k], invalidCounts[k]);
+            firstMacrotimes[k] = FirstMacrotimeInWindow(chunk, chunkCount,
+                chunkStates[k].macrotimeBase, window);
+        });
+
+        for (std::size_t k = 0; k < nChunks; ++k) {
+            auto const* chunk = devEvts + starts[k];
+            auto const chunkCount = starts[k + 1] - starts[k];
+            bool const nonMonotonic = firstMacrotimes[k] != 0 &&
+                firstMacrotimes[k] <= state.lastMacrotime;
+            if (chunkStatus[k] == DecodeStatus::NonMonotonic || nonMonotonic) {
+                // Redo this chunk serially so that exactly the events
+                // preceding the invalid record are sent
+                state.macrotimeBase = chunkStates[k].macrotimeBase;
+                DecodeAndSend(chunk, chunkCount);
+                if (!this->HasDownstream()) {
+                    return;
+                }
+                continue;
+            }
+
+            this->AddInvalidPhotonCount(invalidCounts[k]);
+            this->SendEventBatch(chunkBatches[k]);
+            if (chunkStatus[k] == DecodeStatus::Stopped) {
+                HandleStatus(chunkStatus[k]);
+                return;
+            }
+            state.macrotimeBase = endStates[k].macrotimeBase;
+            if (endStates[k].lastMacrotime != 0) {
+                state.lastMacrotime = endStates[k].lastMacrotime;
+            }
+        }
+    }
+
+public:
+    BHEventDecoder(D downstream) :
+        BasicDeviceEventDecoder<D>(std::move(downstream)),
+        state{ 0, 0 },
+        window{ 0, UINT64_MAX },
+        fastDecode(GetBHFastDecodeFunction<E>(SIMDLevel::AVX2)),
+        maxThreads(1),
+        minChunkSize(DefaultMinChunkSize)
+    {}
+
+    // Default minimum number of records per chunk for parallel decoding;
+    // smaller chunks do not repay the cost of dispatching to threads.
+    static constexpr std::size_t DefaultMinChunkSize = 1 << 16;
+
+    // Limit the SIMD instruction set used (mainly for testing). The level is
+    // further limited to what the CPU supports.
+    void SetSIMDLevel(SIMDLevel level) noexcept {
+        fastDecode = GetBHFastDecodeFunction<E>(level);
+    }
+
+    // Decode buffers passed to HandleDeviceEvents() on up to maxThreads
+    // threads (including the calling thread), in chunks of at least
+    // minChunkSize records. The default of 1 thread disables parallel
+    // decoding. The worker threads are kept until the decoder is destroyed.
+    void SetParallelism(unsigned maxThreads,
+        std::size_t minChunkSize = DefaultMinChunkSize) noexcept {
+        this->maxThreads = maxThreads;
+        this->minChunkSize = minChunkSize > 0 ? minChunkSize : 1;
+    }
+
+    /**
+     * \brief Send only events with macro-time in [start, stop).
+     *
+     * Records before start only advance the macro-time base, so that
+     * skipping them is cheap. When a record at or after stop is reached, the
+     * decoder finishes (sends HandleFinish() downstream) and ignores further
+     * input; see IsFinished().
+     *
+     * This should be set before decoding any events.
+     */
+    void SetMacrotimeWindow(uint64_t start, uint64_t stop) noexcept {
+        window.start = start;
+        window.stop = stop;
+    }
+
+    std::size_t GetEventSize() const noexcept override {
+        return sizeof(E);
+    }
+
+    void HandleDeviceEvent(char const* event) override {
+        if (!this->HasDownstream()) {
+            return;
+        }
+
+        E const* devEvt = reinterpret_cast<E const*>(event);
+        EventSender sender(*this);
+        HandleStatus(DecodeEvent(devEvt, state, window, sender));
+    }
+
+    void HandleDeviceEvents(char const* events, std::size_t count) override {
+        if (!this->HasDownstream()) {
+            return;
+        }
+
+        E const* devEvts = reinterpret_cast<E const*>(events);
+        std::size_t nChunks = GetChunkCount(count);
+        if (nChunks > 1) {
+            DecodeAndSendParallel(devEvts, count, nChunks);
         }
         else {
-            ValidPhotonEvent e;
-            e.macrotime = macrotime;
-            e.microtime = devEvt->GetADCValue();
-            e.route = devEvt->GetRoutingSignals();
-            SendValidPhoton(e);
+            DecodeAndSend(devEvts, count);
         }
     }
 };
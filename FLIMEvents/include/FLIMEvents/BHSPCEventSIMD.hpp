@@ -0,0 +1,214 @@
+#pragma once
+
+#include "SIMDSupport.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+
+// Vectorized decoding of the standard BH SPC FIFO format (BHSPCEvent).
+//
+// The kernels here only handle the common case: blocks of 8 records that are
+// all valid photons (the INVALID, GAP, and MARK flags clear), possibly with
+// single macro-time overflows (MTOV flag), with strictly increasing
+// macro-times. They stop at the first block that does not meet these
+// conditions, leaving it to the scalar decoder (which then reproduces exactly
+// what it would have done, including reporting non-monotonic macro-times).
+//
+// Each 4-byte record is viewed as a little-endian 32-bit word (which is
+// always the case on x86):
+//   bits  0-11: macro-time
+//   bits 12-15: routing signals
+//   bits 16-27: ADC value (micro-time)
+//   bit 28: MARK; bit 29: GAP; bit 30: MTOV; bit 31: INVALID
+
+
+// Decode leading blocks of plain photon records. Returns the number of
+// records decoded (a multiple of 8), each of which produced a photon written
+// to the output arrays. macrotimeBase and lastMacrotime are updated as they
+// would be by the scalar decoder.
+using BHSPCFastDecodeFunction = std::size_t (*)(void const* events,
+    std::size_t count, uint64_t& macrotimeBase, uint64_t& lastMacrotime,
+    uint64_t* macrotimes, uint16_t* microtimes, uint16_t* routes);
+
+
+namespace flimevents {
+namespace internal {
+    uint32_t const BHSPCSlowFlagsMask = 0xb0000000; // INVALID | GAP | MARK
+    unsigned const BHSPCOverflowShift = 12; // log2(MacroTimeOverflowPeriod)
+
+#ifdef FLIMEVENTS_X86_64
+
+    FLIMEVENTS_TARGET_SSE41
+    inline std::size_t DecodeBHSPCFastSSE41(void const* events,
+        std::size_t count, uint64_t& macrotimeBase, uint64_t& lastMacrotime,
+        uint64_t* macrotimes, uint16_t* microtimes, uint16_t* routes) {
+        auto const* src = static_cast<char const*>(events);
+        __m128i const slowMask = _mm_set1_epi32(int(BHSPCSlowFlagsMask));
+        __m128i const low12 = _mm_set1_epi32(0xfff);
+        __m128i const low4 = _mm_set1_epi32(0xf);
+        __m128i const one = _mm_set1_epi32(1);
+
+        uint64_t base = macrotimeBase;
+        uint64_t last = lastMacrotime;
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i w0 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + 4 * i));
+            __m128i w1 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + 4 * i + 16));
+
+            __m128i slow = _mm_or_si128(_mm_and_si128(w0, slowMask),
+                _mm_and_si128(w1, slowMask));
+            if (!_mm_testz_si128(slow, slow)) {
+                break;
+            }
+
+            // Inclusive prefix sum of overflow flags
+            __m128i ov0 = _mm_and_si128(_mm_srli_epi32(w0, 30), one);
+            __m128i ov1 = _mm_and_si128(_mm_srli_epi32(w1, 30), one);
+            ov0 = _mm_add_epi32(ov0, _mm_slli_si128(ov0, 4));
+            ov0 = _mm_add_epi32(ov0, _mm_slli_si128(ov0, 8));
+            ov1 = _mm_add_epi32(ov1, _mm_slli_si128(ov1, 4));
+            ov1 = _mm_add_epi32(ov1, _mm_slli_si128(ov1, 8));
+            ov1 = _mm_add_epi32(ov1, _mm_shuffle_epi32(ov0, 0xff));
+
+            // Macro-time relative to base (fits in 32 bits)
+            __m128i t0 = _mm_add_epi32(_mm_slli_epi32(ov0, BHSPCOverflowShift),
+                _mm_and_si128(w0, low12));
+            __m128i t1 = _mm_add_epi32(_mm_slli_epi32(ov1, BHSPCOverflowShift),
+                _mm_and_si128(w1, low12));
+
+            // Strictly increasing within block (lane 0 checked below)
+            __m128i prev0 = _mm_slli_si128(t0, 4);
+            __m128i prev1 = _mm_alignr_epi8(t1, t0, 12);
+            int increasing = _mm_movemask_ps(_mm_castsi128_ps(
+                _mm_cmpgt_epi32(t0, prev0))) |
+                (_mm_movemask_ps(_mm_castsi128_ps(
+                    _mm_cmpgt_epi32(t1, prev1))) << 4);
+            uint64_t const first = base + uint32_t(_mm_cvtsi128_si32(t0));
+            if ((increasing | 1) != 0xff || first <= last) {
+                break;
+            }
+
+            __m128i const vbase = _mm_set1_epi64x(int64_t(base));
+            auto* mtDst = reinterpret_cast<__m128i*>(macrotimes + i);
+            _mm_storeu_si128(mtDst + 0, _mm_add_epi64(vbase, _mm_cvtepu32_epi64(t0)));
+            _mm_storeu_si128(mtDst + 1, _mm_add_epi64(vbase, _mm_cvtepu32_epi64(_mm_srli_si128(t0, 8))));
+            _mm_storeu_si128(mtDst + 2, _mm_add_epi64(vbase, _mm_cvtepu32_epi64(t1)));
+            _mm_storeu_si128(mtDst + 3, _mm_add_epi64(vbase, _mm_cvtepu32_epi64(_mm_srli_si128(t1, 8))));
+
+            __m128i adc = _mm_packus_epi32(
+                _mm_and_si128(_mm_srli_epi32(w0, 16), low12),
+                _mm_and_si128(_mm_srli_epi32(w1, 16), low12));
+            __m128i route = _mm_packus_epi32(
+                _mm_and_si128(_mm_srli_epi32(w0, 12), low4),
+                _mm_and_si128(_mm_srli_epi32(w1, 12), low4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(microtimes + i), adc);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(routes + i), route);
+
+            last = base + uint32_t(_mm_extract_epi32(t1, 3));
+            base += uint64_t(uint32_t(_mm_extract_epi32(ov1, 3))) << BHSPCOverflowShift;
+        }
+
+        macrotimeBase = base;
+        lastMacrotime = last;
+        return i;
+    }
+
+    FLIMEVENTS_TARGET_AVX2
+    inline std::size_t DecodeBHSPCFastAVX2(void const* events,
+        std::size_t count, uint64_t& macrotimeBase, uint64_t& lastMacrotime,
+        uint64_t* macrotimes, uint16_t* microtimes, uint16_t* routes) {
+        auto const* src = static_cast<char const*>(events);
+        __m256i const slowMask = _mm256_set1_epi32(int(BHSPCSlowFlagsMask));
+        __m256i const low12 = _mm256_set1_epi32(0xfff);
+        __m256i const low4 = _mm256_set1_epi32(0xf);
+        __m256i const one = _mm256_set1_epi32(1);
+        __m256i const lowHalfTotal = _mm256_setr_epi32(0, 0, 0, 0, 3, 3, 3, 3);
+        __m256i const previousLane = _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6);
+
+        uint64_t base = macrotimeBase;
+        uint64_t last = lastMacrotime;
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256i w = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + 4 * i));
+
+            __m256i slow = _mm256_and_si256(w, slowMask);
+            if (!_mm256_testz_si256(slow, slow)) {
+                break;
+            }
+
+            // Inclusive prefix sum of overflow flags (within 128-bit halves,
+            // then carry the low half total into the high half)
+            __m256i ov = _mm256_and_si256(_mm256_srli_epi32(w, 30), one);
+            ov = _mm256_add_epi32(ov, _mm256_slli_si256(ov, 4));
+            ov = _mm256_add_epi32(ov, _mm256_slli_si256(ov, 8));
+            ov = _mm256_add_epi32(ov, _mm256_blend_epi32(_mm256_setzero_si256(),
+                _mm256_permutevar8x32_epi32(ov, lowHalfTotal), 0xf0));
+
+            // Macro-time relative to base (fits in 32 bits)
+            __m256i t = _mm256_add_epi32(_mm256_slli_epi32(ov, BHSPCOverflowShift),
+                _mm256_and_si256(w, low12));
+
+            // Strictly increasing within block (lane 0 checked below)
+            __m256i prev = _mm256_permutevar8x32_epi32(t, previousLane);
+            int increasing = _mm256_movemask_ps(_mm256_castsi256_ps(
+                _mm256_cmpgt_epi32(t, prev)));
+            __m128i const tLow = _mm256_castsi256_si128(t);
+            __m128i const tHigh = _mm256_extracti128_si256(t, 1);
+            uint64_t const first = base + uint32_t(_mm_cvtsi128_si32(tLow));
+            if ((increasing | 1) != 0xff || first <= last) {
+                break;
+            }
+
+            __m256i const vbase = _mm256_set1_epi64x(int64_t(base));
+            auto* mtDst = reinterpret_cast<__m256i*>(macrotimes + i);
+            _mm256_storeu_si256(mtDst + 0, _mm256_add_epi64(vbase, _mm256_cvtepu32_epi64(tLow)));
+            _mm256_storeu_si256(mtDst + 1, _mm256_add_epi64(vbase, _mm256_cvtepu32_epi64(tHigh)));
+
+            // Pack ADC values and routes to 16 bits; packus interleaves the
+            // 128-bit halves, which the permute undoes.
+            __m256i packed = _mm256_packus_epi32(
+                _mm256_and_si256(_mm256_srli_epi32(w, 16), low12),
+                _mm256_and_si256(_mm256_srli_epi32(w, 12), low4));
+            packed = _mm256_permute4x64_epi64(packed, 0xd8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(microtimes + i),
+                _mm256_castsi256_si128(packed));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(routes + i),
+                _mm256_extracti128_si256(packed, 1));
+
+            last = base + uint32_t(_mm_extract_epi32(tHigh, 3));
+            base += uint64_t(uint32_t(_mm_extract_epi32(
+                _mm256_extracti128_si256(ov, 1), 3))) << BHSPCOverflowShift;
+        }
+
+        macrotimeBase = base;
+        lastMacrotime = last;
+        return i;
+    }
+
+#endif // FLIMEVENTS_X86_64
+}
+}
+
+
+// Get the fast decoding function for the given SIMD level, which is reduced
+// to what the CPU supports. Returns null if there is no vectorized decoder at
+// that level (in which case the scalar decoder should be used for all
+// records).
+inline BHSPCFastDecodeFunction GetBHSPCFastDecodeFunction(SIMDLevel level) noexcept {
+#ifdef FLIMEVENTS_X86_64
+    SIMDLevel const supported = GetSupportedSIMDLevel();
+    if (level > supported) {
+        level = supported;
+    }
+    switch (level) {
+    case SIMDLevel::AVX2:
+        return flimevents::internal::DecodeBHSPCFastAVX2;
+    case SIMDLevel::SSE41:
+        return flimevents::internal::DecodeBHSPCFastSSE41;
+    default:
+        break;
+    }
+#endif
+    return nullptr;
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include "LockFreeQueue.hpp"
+#include "StreamBuffer.hpp"
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+
+template <typename E> class BroadcastEventStream;
+
+
+// Move-only reference, held by one consumer of a BroadcastEventStream, to a
+// buffer shared by all consumers. The buffer is returned to its pool when the
+// last consumer releases its reference. A null reference indicates the end
+// of the stream.
+template <typename E>
+class SharedEventBuffer {
+    BroadcastEventStream<E>* stream;
+    std::size_t slot;
+
+    friend class BroadcastEventStream<E>;
+
+    SharedEventBuffer(BroadcastEventStream<E>* stream, std::size_t slot) noexcept :
+        stream(stream),
+        slot(slot)
+    {}
+
+public:
+    SharedEventBuffer() noexcept :
+        stream(nullptr),
+        slot(0)
+    {}
+
+    SharedEventBuffer(SharedEventBuffer const&) = delete;
+    SharedEventBuffer& operator=(SharedEventBuffer const&) = delete;
+
+    SharedEventBuffer(SharedEventBuffer&& other) noexcept :
+        stream(other.stream),
+        slot(other.slot)
+    {
+        other.stream = nullptr;
+    }
+
+    SharedEventBuffer& operator=(SharedEventBuffer&& rhs) noexcept {
+        if (&rhs != this) {
+            reset();
+            stream = rhs.stream;
+            slot = rhs.slot;
+            rhs.stream = nullptr;
+        }
+        return *this;
+    }
+
+    ~SharedEventBuffer() {
+        reset();
+    }
+
+    // Release this consumer's reference
+    void reset() noexcept {
+        if (stream) {
+            stream->Release(slot);
+            stream = nullptr;
+        }
+    }
+
+    EventBuffer<E> const* get() const noexcept {
+        return stream ? stream->GetSlotBuffer(slot) : nullptr;
+    }
+
+    explicit operator bool() const noexcept {
+        return get() != nullptr;
+    }
+
+    EventBuffer<E> const* operator->() const noexcept {
+        return get();
+    }
+
+    EventBuffer<E> const& operator*() const noexcept {
+        return *get();
+    }
+};
+
+
+/**
+ * \brief A stream of EventBuffer<E> from one sending thread to a fixed number
+ * of consumers, each of which receives every buffer (on its own thread).
+ *
+ * Buffers are not copied: every consumer receives a SharedEventBuffer
+ * referring to the same buffer, and the buffer is checked back in to its pool
+ * when the last consumer releases it. Each consumer has its own read
+ * position, so that a slow consumer does not delay the others until it falls
+ * behind by the capacity of the stream; then Send() blocks.
+ *
+ * Like EventStream, both ends spin briefly and then block when they need to
+ * wait. Buffers not yet released are checked in when the stream is
+ * destroyed, so the pool must outlive the stream.
+ *
+ * \tparam E event data type
+ */
+template <typename E>
+class BroadcastEventStream {
+    struct Slot {
+        EventBufferHandle<E> buffer;
+        std::atomic<std::size_t> refCount;
+        std::atomic<bool> isFree; // Set after buffer is released
+
+        Slot() noexcept : refCount(0), isFree(true) {}
+    };
+
+    struct Consumer {
+        char padding[flimevents::internal::CacheLineSize];
+        std::atomic<std::size_t> cursor; // Next receive
+        std::atomic<std::size_t> peakLag;
+
+        Consumer() noexcept : cursor(0), peakLag(0) {}
+    };
+
+    std::size_t const consumerCount;
+    std::size_t const mask;
+    std::unique_ptr<Slot[]> slots;
+    std::unique_ptr<Consumer[]> consumers;
+
+    char padding0[flimevents::internal::CacheLineSize];
+    std::atomic<std::size_t> tail; // Next send
+    char padding1[flimevents::internal::CacheLineSize];
+
+    flimevents::internal::WaitSignal published;
+    flimevents::internal::WaitSignal slotFreed;
+    std::exception_ptr exception; // Written before the terminating null
+
+    friend class SharedEventBuffer<E>;
+
+    EventBuffer<E> const* GetSlotBuffer(std::size_t slot) const noexcept {
+        return slots[slot].buffer.get();
+    }
+
+    void Release(std::size_t slot) noexcept {
+        Slot& s = slots[slot];
+        if (s.refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            s.buffer.reset();
+            s.isFree.store(true, std::memory_order_seq_cst);
+            slotFreed.NotifyAll();
+        }
+    }
+
+public:
+    // Default maximum number of buffers in the stream
+    static constexpr std::size_t DefaultCapacity = 1024;
+
+    // capacity must be a power of 2
+    explicit BroadcastEventStream(std::size_t consumerCount,
+        std::size_t capacity = DefaultCapacity) :
+        consumerCount(consumerCount),
+        mask(capacity - 1),
+        slots(new Slot[capacity]),
+        consumers(new Consumer[consumerCount]),
+        tail(0)
+    {
+        if (consumerCount < 1) {
+            throw std::invalid_argument("Stream must have at least one consumer");
+        }
+        if (!flimevents::internal::IsPowerOfTwo(capacity)) {
+            throw std::invalid_argument("Stream capacity must be a power of 2");
+        }
+    }
+
+    BroadcastEventStream(BroadcastEventStream const&) = delete;
+    BroadcastEventStream& operator=(BroadcastEventStream const&) = delete;
+
+    std::size_t GetConsumerCount() const noexcept {
+        return consumerCount;
+    }
+
+    // Sending a null will terminate the stream. Blocks if the slowest
+    // consumer has yet to release the buffer sent a capacity ago.
+    void Send(EventBufferHandle<E> buffer) {
+        std::size_t const t = tail.load(std::memory_order_relaxed);
+        Slot& slot = slots[t & mask];
+        flimevents::internal::SpinThenWait(slotFreed, [&] {
+            return slot.isFree.load(std::memory_order_seq_cst);
+        });
+        slot.isFree.store(false, std::memory_order_relaxed);
+        slot.buffer = std::move(buffer);
+        slot.refCount.store(consumerCount, std::memory_order_relaxed);
+        tail.store(t + 1, std::memory_order_seq_cst);
+        published.NotifyAll();
+    }
+
+    // Terminate the stream with an exception, which each consumer receives
+    // after all buffers sent before it.
+    void SendException(std::exception_ptr e) {
+        exception = e;
+        Send({});
+    }
+
+    // Receive the next buffer for the given consumer (0 <= consumer <
+    // consumerCount). Must only be called from one thread at a time for each
+    // consumer. A null return value indicates that the stream has been
+    // terminated; subsequent calls will block forever.
+    // Throws if upstream sent an exception.
+    SharedEventBuffer<E> ReceiveBlocking(std::size_t consumer) {
+        Consumer& c = consumers[consumer];
+        std::size_t const pos = c.cursor.load(std::memory_order_relaxed);
+        std::size_t t = 0;
+        flimevents::internal::SpinThenWait(published, [&] {
+            t = tail.load(std::memory_order_seq_cst);
+            return t != pos;
+        });
+        c.cursor.store(pos + 1, std::memory_order_relaxed);
+        if (t - pos > c.peakLag.load(std::memory_order_relaxed)) {
+            c.peakLag.store(t - pos, std::memory_order_relaxed);
+        }
+
+        SharedEventBuffer<E> ret(this, pos & mask);
+        if (!ret && exception) {
+            std::rethrow_exception(exception);
+        }
+        return ret;
+    }
+
+    // Number of buffers sent but not yet received by the given consumer
+    // (approximate)
+    std::size_t GetConsumerLag(std::size_t consumer) const noexcept {
+        std::size_t const pos =
+            consumers[consumer].cursor.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) - pos;
+    }
+
+    // Largest lag seen by the given consumer when receiving
+    std::size_t GetPeakConsumerLag(std::size_t consumer) const noexcept {
+        return consumers[consumer].peakLag.load(std::memory_order_relaxed);
+    }
+};
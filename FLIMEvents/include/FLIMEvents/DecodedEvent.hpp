@@ -1,7 +1,57 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace flimevents {
+namespace internal {
+
+    // Allocator whose value-less construct() default-initializes, so that
+    // std::vector::resize() leaves new elements of trivial type unwritten
+    template <typename T, typename A = std::allocator<T>>
+    class DefaultInitAllocator : public A {
+        using Traits = std::allocator_traits<A>;
+
+    public:
+        template <typename U>
+        struct rebind {
+            using other = DefaultInitAllocator<U,
+                typename Traits::template rebind_alloc<U>>;
+        };
+
+        using A::A;
+
+        DefaultInitAllocator() = default;
+
+        template <typename U, typename AU>
+        DefaultInitAllocator(DefaultInitAllocator<U, AU> const& other) noexcept :
+            A(static_cast<AU const&>(other))
+        {}
+
+        template <typename U>
+        void construct(U* ptr)
+            noexcept(std::is_nothrow_default_constructible<U>::value) {
+            ::new (static_cast<void*>(ptr)) U;
+        }
+
+        template <typename U, typename... Args>
+        void construct(U* ptr, Args&&... args) {
+            Traits::construct(static_cast<A&>(*this), ptr,
+                std::forward<Args>(args)...);
+        }
+    };
+
+    template <typename T>
+    using UninitializedVector = std::vector<T, DefaultInitAllocator<T>>;
+
+} // namespace internal
+} // namespace flimevents
 
 
 /**
@@ -92,6 +142,192 @@ struct MarkerEvent : public DecodedEvent {
 };
 
 
+/**
+ * \brief A batch of decoded events, in structure-of-arrays form.
+ *
+ * Valid photons, which make up the bulk of any event stream, are stored as
+ * parallel arrays of macro-time, micro-time, and route. The less frequent
+ * kinds of event are stored in separate lists.
+ *
+ * Producers must ensure that every event in a batch has a distinct
+ * macro-time, except that a DataLostEvent may share its macro-time with
+ * (and then precedes) one other event. This holds for decoders of raw device
+ * events, because each raw record yields at most one photon or marker and
+ * macro-times are required to increase monotonically. The original order of
+ * events can therefore be recovered by merging the lists on macro-time (see
+ * ForEachEventInBatch()).
+ *
+ * Some formats (PicoQuant T3) allow several events to share a macro-time
+ * (nsync). For these, the merge delivers invalid photons, markers, and data
+ * lost events before any valid photons with the same macro-time; events
+ * within each list keep their order.
+ *
+ * The photon arrays do not zero elements added by resizing, so that decoders
+ * can size them to the largest possible number of photons, decode in place,
+ * and trim them, without an extra pass over the memory.
+ */
+struct DecodedEventBatch {
+    flimevents::internal::UninitializedVector<uint64_t> photonMacrotimes;
+    flimevents::internal::UninitializedVector<uint16_t> photonMicrotimes;
+    flimevents::internal::UninitializedVector<uint16_t> photonRoutes;
+
+    std::vector<InvalidPhotonEvent> invalidPhotons;
+    std::vector<MarkerEvent> markers;
+    std::vector<DataLostEvent> dataLost;
+
+    /**
+     * \brief The latest macro-time known to have been reached by the end of
+     * the batch.
+     *
+     * This plays the role of DecodedEventProcessor::HandleTimestamp() for the
+     * whole batch. It is only meaningful if it is greater than the
+     * macro-time of the last event in the batch; 0 indicates no information.
+     */
+    uint64_t timestamp = 0;
+
+    void Clear() noexcept {
+        photonMacrotimes.clear();
+        photonMicrotimes.clear();
+        photonRoutes.clear();
+        invalidPhotons.clear();
+        markers.clear();
+        dataLost.clear();
+        timestamp = 0;
+    }
+
+    // Reserve space for the photons decoded from up to count raw records
+    void Reserve(std::size_t count) {
+        photonMacrotimes.reserve(count);
+        photonMicrotimes.reserve(count);
+        photonRoutes.reserve(count);
+    }
+
+    // Set the number of photons (new elements are uninitialized)
+    void ResizePhotons(std::size_t count) {
+        photonMacrotimes.resize(count);
+        photonMicrotimes.resize(count);
+        photonRoutes.resize(count);
+    }
+
+    // Discard all events, leaving room for a decoder to write the photons from
+    // up to count raw records in place; finish with ResizePhotons()
+    void ClearForDecoding(std::size_t count) {
+        invalidPhotons.clear();
+        markers.clear();
+        dataLost.clear();
+        timestamp = 0;
+        if (photonMacrotimes.size() < count) {
+            ResizePhotons(count);
+        }
+    }
+
+    std::size_t GetPhotonCount() const noexcept {
+        return photonMacrotimes.size();
+    }
+
+    bool IsEmpty() const noexcept {
+        return photonMacrotimes.empty() && invalidPhotons.empty() &&
+            markers.empty() && dataLost.empty() && timestamp == 0;
+    }
+
+    // Macro-time of the last event (not counting the batch timestamp); 0 if
+    // there are no events
+    uint64_t GetLastEventMacrotime() const noexcept {
+        uint64_t last = 0;
+        if (!photonMacrotimes.empty()) {
+            last = photonMacrotimes.back();
+        }
+        if (!invalidPhotons.empty() && invalidPhotons.back().macrotime > last) {
+            last = invalidPhotons.back().macrotime;
+        }
+        if (!markers.empty() && markers.back().macrotime > last) {
+            last = markers.back().macrotime;
+        }
+        if (!dataLost.empty() && dataLost.back().macrotime > last) {
+            last = dataLost.back().macrotime;
+        }
+        return last;
+    }
+
+    void AppendPhoton(uint64_t macrotime, uint16_t microtime, uint16_t route) {
+        photonMacrotimes.push_back(macrotime);
+        photonMicrotimes.push_back(microtime);
+        photonRoutes.push_back(route);
+    }
+};
+
+
+/**
+ * \brief Visit the events of a batch in their original order.
+ *
+ * Each of the function objects is called with the corresponding event type
+ * (ValidPhotonEvent, InvalidPhotonEvent, MarkerEvent, DataLostEvent). Then
+ * onTimestamp is called with a DecodedEvent if the batch timestamp is later
+ * than all events in the batch.
+ *
+ * Being a template, this allows processors to handle a batch without any
+ * virtual function calls per event.
+ */
+template <typename FPhoton, typename FInvalid, typename FMarker,
+    typename FDataLost, typename FTimestamp>
+inline void ForEachEventInBatch(DecodedEventBatch const& batch,
+    FPhoton onPhoton, FInvalid onInvalidPhoton, FMarker onMarker,
+    FDataLost onDataLost, FTimestamp onTimestamp)
+{
+    auto const nPhotons = batch.photonMacrotimes.size();
+    auto const nInvalid = batch.invalidPhotons.size();
+    auto const nMarkers = batch.markers.size();
+    auto const nDataLost = batch.dataLost.size();
+    uint64_t const none = UINT64_MAX;
+
+    std::size_t p = 0, i = 0, m = 0, d = 0;
+    for (;;) {
+        uint64_t const nextInvalid = i < nInvalid ?
+            batch.invalidPhotons[i].macrotime : none;
+        uint64_t const nextMarker = m < nMarkers ?
+            batch.markers[m].macrotime : none;
+        uint64_t const nextDataLost = d < nDataLost ?
+            batch.dataLost[d].macrotime : none;
+        uint64_t nextOther = nextInvalid < nextMarker ?
+            nextInvalid : nextMarker;
+        if (nextDataLost < nextOther) {
+            nextOther = nextDataLost;
+        }
+
+        // Photons up to the next non-photon event (common case)
+        ValidPhotonEvent photon;
+        while (p < nPhotons && batch.photonMacrotimes[p] < nextOther) {
+            photon.macrotime = batch.photonMacrotimes[p];
+            photon.microtime = batch.photonMicrotimes[p];
+            photon.route = batch.photonRoutes[p];
+            onPhoton(photon);
+            ++p;
+        }
+
+        if (nextOther == none) {
+            break;
+        }
+
+        // Data lost precedes any other event with the same macro-time
+        if (nextDataLost == nextOther) {
+            onDataLost(batch.dataLost[d++]);
+        }
+        else if (nextInvalid == nextOther) {
+            onInvalidPhoton(batch.invalidPhotons[i++]);
+        }
+        else {
+            onMarker(batch.markers[m++]);
+        }
+    }
+
+    if (batch.timestamp > batch.GetLastEventMacrotime()) {
+        DecodedEvent e;
+        e.macrotime = batch.timestamp;
+        onTimestamp(e);
+    }
+}
+
+
 /**
  * \brief Receiver of decoded events.
  */
@@ -126,4 +362,21 @@ public:
     virtual void HandleDataLost(DataLostEvent const& event) = 0;
     virtual void HandleError(std::string const& message) = 0;
     virtual void HandleFinish() = 0;
+
+    /**
+     * \brief Receive a batch of decoded events.
+     *
+     * Decoders call this function (instead of the per-event functions) when
+     * decoding a buffer of raw events at once. The default implementation
+     * replays the events through the per-event functions, in their original
+     * order. Processors can override this to avoid per-event virtual calls.
+     */
+    virtual void HandleEventBatch(DecodedEventBatch const& batch) {
+        ForEachEventInBatch(batch,
+            [this](ValidPhotonEvent const& e) { HandleValidPhoton(e); },
+            [this](InvalidPhotonEvent const& e) { HandleInvalidPhoton(e); },
+            [this](MarkerEvent const& e) { HandleMarker(e); },
+            [this](DataLostEvent const& e) { HandleDataLost(e); },
+            [this](DecodedEvent const& e) { HandleTimestamp(e); });
+    }
 };
@@ -0,0 +1,466 @@
+#pragma once
+
+#include "DecodedEvent.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+/**
+ * \brief Merge the decoded event streams of several devices into one, in
+ * macro-time order.
+ *
+ * This is for acquiring from several modules (such as BH SPC boards on a
+ * shared sync) into a single processing pipeline. Each module's decoder sends
+ * its events to one of the inputs (see GetInput()), possibly on its own
+ * thread. Events are held until every other input has been seen to reach
+ * their macro-time (through an event or timestamp), and are then sent
+ * downstream as batches, serialized by a mutex. Events from different inputs
+ * that share a macro-time are sent in an unspecified order.
+ *
+ * The route of each photon is mapped to route | (input << routeBits), so that
+ * downstream processors see the channels of all modules as one route space.
+ * Markers are passed on from input 0 only.
+ *
+ * Modules started separately do not share a macro-time origin. If alignment
+ * on the first marker is enabled (SetAlignOnFirstMarker()), which requires
+ * every module to receive the scan markers, each input's macro-times are
+ * offset so that its first marker coincides with that of input 0; events
+ * before the first marker are discarded.
+ *
+ * An input that produces no events (not even timestamps) holds up the merge;
+ * if more than the maximum number of pending events accumulate, an error is
+ * sent downstream.
+ */
+class DecodedEventMerger final :
+    public std::enable_shared_from_this<DecodedEventMerger> {
+    enum class EventKind : uint8_t {
+        ValidPhoton,
+        InvalidPhoton,
+        Marker,
+        DataLost,
+    };
+
+    struct PendingEvent {
+        uint64_t macrotime; // Raw (not offset)
+        uint16_t microtime;
+        uint16_t routeOrBits;
+        EventKind kind;
+    };
+
+    struct InputState {
+        std::deque<PendingEvent> pending;
+        uint64_t watermark = 0; // All events before this (raw) have been seen
+        bool seenFirstMarker = false;
+        bool aligned = false;
+        int64_t offset = 0; // Added to raw macro-times
+        uint64_t firstMarker = 0;
+        bool finished = false;
+    };
+
+    class Input;
+
+    uint32_t const routeBits;
+    bool alignOnFirstMarker;
+    std::size_t maxPendingEvents;
+
+    std::mutex mutex;
+    std::vector<InputState> inputs;
+    std::size_t pendingCount;
+    uint64_t lastSent;
+    DecodedEventBatch batch; // Reused for output
+
+    std::shared_ptr<DecodedEventProcessor> downstream;
+
+    static uint64_t const None = UINT64_MAX;
+
+    uint64_t Mapped(InputState const& in, uint64_t raw) const noexcept {
+        int64_t t = static_cast<int64_t>(raw) + in.offset;
+        return t < 0 ? 0 : static_cast<uint64_t>(t);
+    }
+
+    // Events of other inputs before this (mapped) macro-time can be merged
+    // without waiting for more events from the given input
+    uint64_t Limit(InputState const& in) const noexcept {
+        if (in.aligned && !in.pending.empty()) {
+            // Ties may go either way
+            return Mapped(in, in.pending.front().macrotime) + 1;
+        }
+        if (in.finished) {
+            return None;
+        }
+        if (!in.aligned || in.watermark == 0) {
+            return 0;
+        }
+        return Mapped(in, in.watermark);
+    }
+
+    void Fail(std::string const& message) {
+        if (downstream) {
+            downstream->HandleError(message);
+            downstream.reset();
+        }
+        for (auto& in : inputs) {
+            in.pending.clear();
+        }
+        pendingCount = 0;
+    }
+
+    void Align(std::size_t index) {
+        InputState& in = inputs[index];
+        InputState const& reference = inputs[0];
+        in.offset = static_cast<int64_t>(reference.firstMarker) -
+            static_cast<int64_t>(in.firstMarker);
+        in.aligned = true;
+    }
+
+    void Receive(std::size_t index, DecodedEventBatch const& input) {
+        InputState& in = inputs[index];
+        if (!downstream || in.finished) {
+            return;
+        }
+
+        uint16_t const routeHigh = static_cast<uint16_t>(index << routeBits);
+        uint16_t const routeMask = static_cast<uint16_t>((1u << routeBits) - 1);
+        auto push = [&](uint64_t macrotime, uint16_t microtime,
+            uint16_t routeOrBits, EventKind kind) {
+            // More events may follow at the same macro-time
+            if (macrotime > in.watermark) {
+                in.watermark = macrotime;
+            }
+            if (alignOnFirstMarker && !in.seenFirstMarker &&
+                kind != EventKind::DataLost) {
+                return;
+            }
+            in.pending.push_back({ macrotime, microtime, routeOrBits, kind });
+            ++pendingCount;
+        };
+
+        ForEachEventInBatch(input,
+            [&](ValidPhotonEvent const& e) {
+                push(e.macrotime, e.microtime,
+                    routeHigh | (e.route & routeMask), EventKind::ValidPhoton);
+            },
+            [&](InvalidPhotonEvent const& e) {
+                push(e.macrotime, e.microtime,
+                    routeHigh | (e.route & routeMask), EventKind::InvalidPhoton);
+            },
+            [&](MarkerEvent const& e) {
+                if (alignOnFirstMarker && !in.seenFirstMarker) {
+                    in.seenFirstMarker = true;
+                    in.firstMarker = e.macrotime;
+                    if (index == 0) {
+                        in.aligned = true;
+                        for (std::size_t i = 1; i < inputs.size(); ++i) {
+                            if (inputs[i].seenFirstMarker) {
+                                Align(i);
+                            }
+                        }
+                    }
+                    else if (inputs[0].seenFirstMarker) {
+                        Align(index);
+                    }
+                }
+                if (index == 0) {
+                    push(e.macrotime, 0, e.bits, EventKind::Marker);
+                }
+                else if (e.macrotime > in.watermark) {
+                    in.watermark = e.macrotime;
+                }
+            },
+            [&](DataLostEvent const& e) {
+                push(e.macrotime, 0, 0, EventKind::DataLost);
+            },
+            [&](DecodedEvent const& e) {
+                if (e.macrotime > in.watermark) {
+                    in.watermark = e.macrotime;
+                }
+            });
+    }
+
+    // Send all events that can be ordered with respect to all inputs
+    void Merge() {
+        if (!downstream) {
+            return;
+        }
+
+        batch.Clear();
+        for (;;) {
+            // Input with the earliest pending event, and the limit imposed by
+            // the others
+            std::size_t first = inputs.size();
+            uint64_t firstTime = None;
+            for (std::size_t i = 0; i < inputs.size(); ++i) {
+                InputState const& in = inputs[i];
+                if (in.aligned && !in.pending.empty()) {
+                    uint64_t t = Mapped(in, in.pending.front().macrotime);
+                    if (t < firstTime) {
+                        first = i;
+                        firstTime = t;
+                    }
+                }
+            }
+            if (first == inputs.size()) {
+                break;
+            }
+            uint64_t limit = None;
+            for (std::size_t i = 0; i < inputs.size(); ++i) {
+                if (i != first) {
+                    uint64_t l = Limit(inputs[i]);
+                    if (l < limit) {
+                        limit = l;
+                    }
+                }
+            }
+            if (firstTime >= limit) {
+                break;
+            }
+
+            InputState& in = inputs[first];
+            while (!in.pending.empty()) {
+                PendingEvent const& e = in.pending.front();
+                uint64_t t = Mapped(in, e.macrotime);
+                if (t >= limit) {
+                    break;
+                }
+                Append(t, e);
+                in.pending.pop_front();
+                --pendingCount;
+            }
+        }
+
+        // All inputs have reached the earliest limit
+        uint64_t reached = None;
+        for (auto const& in : inputs) {
+            if (!in.finished || !in.pending.empty()) {
+                uint64_t l = 0;
+                if (in.aligned) {
+                    l = in.pending.empty() ? Mapped(in, in.watermark) :
+                        Mapped(in, in.pending.front().macrotime);
+                }
+                if (l < reached) {
+                    reached = l;
+                }
+            }
+        }
+        if (reached != None && reached > lastSent) {
+            batch.timestamp = reached;
+        }
+
+        if (!batch.IsEmpty()) {
+            uint64_t last = batch.GetLastEventMacrotime();
+            if (batch.timestamp > last) {
+                last = batch.timestamp;
+            }
+            if (last > lastSent) {
+                lastSent = last;
+            }
+            downstream->HandleEventBatch(batch);
+        }
+
+        if (pendingCount > maxPendingEvents) {
+            std::size_t stalled = 0;
+            for (std::size_t i = 0; i < inputs.size(); ++i) {
+                if (Limit(inputs[i]) < Limit(inputs[stalled])) {
+                    stalled = i;
+                }
+            }
+            Fail("Cannot merge event streams: no events from input " +
+                std::to_string(stalled) +
+                (alignOnFirstMarker ? " (markers required for alignment)" : ""));
+        }
+    }
+
+    void Append(uint64_t macrotime, PendingEvent const& e) {
+        switch (e.kind) {
+        case EventKind::ValidPhoton:
+            batch.AppendPhoton(macrotime, e.microtime, e.routeOrBits);
+            break;
+        case EventKind::InvalidPhoton: {
+            InvalidPhotonEvent p;
+            p.macrotime = macrotime;
+            p.microtime = e.microtime;
+            p.route = e.routeOrBits;
+            batch.invalidPhotons.push_back(p);
+            break;
+        }
+        case EventKind::Marker: {
+            MarkerEvent m;
+            m.macrotime = macrotime;
+            m.bits = e.routeOrBits;
+            batch.markers.push_back(m);
+            break;
+        }
+        case EventKind::DataLost: {
+            DataLostEvent d;
+            d.macrotime = macrotime;
+            batch.dataLost.push_back(d);
+            break;
+        }
+        }
+    }
+
+public:
+    /**
+     * \brief Construct with the given number of inputs.
+     *
+     * \param routeBits number of route bits used by each input (4 for BH SPC)
+     */
+    DecodedEventMerger(std::size_t inputCount, uint32_t routeBits,
+        std::shared_ptr<DecodedEventProcessor> downstream) :
+        routeBits(routeBits),
+        alignOnFirstMarker(false),
+        maxPendingEvents(std::size_t(1) << 22),
+        inputs(inputCount),
+        pendingCount(0),
+        lastSent(0),
+        downstream(downstream)
+    {
+        if (inputCount == 0 || (inputCount << routeBits) > 65536) {
+            throw std::invalid_argument("Too many inputs to merge");
+        }
+        for (auto& in : inputs) {
+            in.aligned = true;
+        }
+    }
+
+    // Must be called before any events are received
+    void SetAlignOnFirstMarker(bool align) {
+        std::lock_guard<std::mutex> hold(mutex);
+        alignOnFirstMarker = align;
+        for (auto& in : inputs) {
+            in.aligned = !align;
+        }
+    }
+
+    void SetMaxPendingEvents(std::size_t count) {
+        std::lock_guard<std::mutex> hold(mutex);
+        maxPendingEvents = count;
+    }
+
+    std::size_t GetInputCount() const noexcept {
+        return inputs.size();
+    }
+
+    /**
+     * \brief Get the processor receiving events for the given input.
+     *
+     * The merger must be owned by a std::shared_ptr. The downstream is
+     * finished once all inputs have finished, or receives the first error
+     * from any input.
+     */
+    std::shared_ptr<DecodedEventProcessor> GetInput(std::size_t index);
+
+private:
+    void HandleInputBatch(std::size_t index, DecodedEventBatch const& input) {
+        std::lock_guard<std::mutex> hold(mutex);
+        Receive(index, input);
+        Merge();
+    }
+
+    void HandleInputError(std::size_t index, std::string const& message) {
+        std::lock_guard<std::mutex> hold(mutex);
+        inputs[index].finished = true;
+        Fail(message);
+    }
+
+    void HandleInputFinish(std::size_t index) {
+        std::lock_guard<std::mutex> hold(mutex);
+        InputState& in = inputs[index];
+        if (!in.aligned) { // Never saw a marker; nothing to merge
+            pendingCount -= in.pending.size();
+            in.pending.clear();
+        }
+        in.finished = true;
+        Merge();
+        for (auto const& i : inputs) {
+            if (!i.finished) {
+                return;
+            }
+        }
+        if (downstream) {
+            downstream->HandleFinish();
+            downstream.reset();
+        }
+    }
+};
+
+
+class DecodedEventMerger::Input final : public DecodedEventProcessor {
+    std::shared_ptr<DecodedEventMerger> merger;
+    std::size_t const index;
+    DecodedEventBatch single; // For events received one at a time
+
+    void HandleSingle() {
+        if (merger) {
+            merger->HandleInputBatch(index, single);
+        }
+        single.Clear();
+    }
+
+public:
+    Input(std::shared_ptr<DecodedEventMerger> merger, std::size_t index) :
+        merger(merger),
+        index(index)
+    {}
+
+    void HandleTimestamp(DecodedEvent const& event) override {
+        single.timestamp = event.macrotime;
+        HandleSingle();
+    }
+
+    void HandleValidPhoton(ValidPhotonEvent const& event) override {
+        single.AppendPhoton(event.macrotime, event.microtime, event.route);
+        HandleSingle();
+    }
+
+    void HandleInvalidPhoton(InvalidPhotonEvent const& event) override {
+        single.invalidPhotons.push_back(event);
+        HandleSingle();
+    }
+
+    void HandleMarker(MarkerEvent const& event) override {
+        single.markers.push_back(event);
+        HandleSingle();
+    }
+
+    void HandleDataLost(DataLostEvent const& event) override {
+        single.dataLost.push_back(event);
+        HandleSingle();
+    }
+
+    void HandleEventBatch(DecodedEventBatch const& batch) override {
+        if (merger) {
+            merger->HandleInputBatch(index, batch);
+        }
+    }
+
+    void HandleError(std::string const& message) override {
+        if (merger) {
+            merger->HandleInputError(index, message);
+            merger.reset();
+        }
+    }
+
+    void HandleFinish() override {
+        if (merger) {
+            merger->HandleInputFinish(index);
+            merger.reset();
+        }
+    }
+};
+
+
+inline std::shared_ptr<DecodedEventProcessor>
+DecodedEventMerger::GetInput(std::size_t index) {
+    if (index >= inputs.size()) {
+        throw std::out_of_range("No such input");
+    }
+    return std::make_shared<Input>(shared_from_this(), index);
+}
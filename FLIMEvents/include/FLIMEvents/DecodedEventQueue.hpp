@@ -0,0 +1,191 @@
+#pragma once
+
+#include "DecodedEvent.hpp"
+#include "LockFreeQueue.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+
+
+/**
+ * \brief Pass decoded events to a downstream processor on another thread.
+ *
+ * This allows a processing graph to be split into stages that run
+ * concurrently (for example, decoding on one thread and pixel assignment and
+ * histogramming on another). Events received are sent, in batches, through a
+ * bounded lock-free queue; Pump(), called on the receiving thread, delivers
+ * them to downstream until the stream is finished.
+ *
+ * Each batch received is sent as a batch (copied, into storage that is
+ * reused). Events received one at a time are collected into a batch, which is
+ * sent when it reaches the maximum size, on a timestamp, or before the next
+ * batch or the end of the stream. Events therefore reach downstream in the
+ * same order (see ForEachEventInBatch()). HandleError() and HandleFinish() are
+ * delivered after all events received before them.
+ *
+ * The sending side blocks when the queue is full, so that a slow downstream
+ * holds up upstream rather than accumulating events without limit.
+ *
+ * User code should normally use DecodedEventQueue, which sends events to a
+ * DecodedEventProcessor via shared_ptr.
+ *
+ * \tparam D downstream holder: std::shared_ptr to DecodedEventProcessor or
+ * StaticDownstream of a concrete processor
+ */
+template <typename D>
+class BasicDecodedEventQueue final : public DecodedEventProcessor {
+public:
+    // Default maximum number of batches in the queue
+    static constexpr std::size_t DefaultCapacity = 64;
+
+    // Events received one at a time are sent when this many are collected
+    static constexpr std::size_t MaxCollectedEvents = 4096;
+
+private:
+    flimevents::internal::BatchQueue<DecodedEventBatch> queue;
+
+    // Sending thread's data
+    std::unique_ptr<DecodedEventBatch> collected; // Events sent one at a time
+    std::size_t collectedCount;
+    bool terminated;
+
+    // Receiving thread's data
+    D downstream;
+
+    void SendCollected() {
+        if (collected) {
+            queue.Send(std::move(collected));
+            collectedCount = 0;
+        }
+    }
+
+    DecodedEventBatch& Collecting() {
+        if (!collected) {
+            collected = queue.GetEmptyBatch();
+        }
+        ++collectedCount;
+        return *collected;
+    }
+
+    void Collected() {
+        if (collectedCount >= MaxCollectedEvents) {
+            SendCollected();
+        }
+    }
+
+public:
+    // capacity must be a power of 2
+    explicit BasicDecodedEventQueue(D downstream,
+        std::size_t capacity = DefaultCapacity) :
+        queue(capacity),
+        collectedCount(0),
+        terminated(false),
+        downstream(std::move(downstream))
+    {}
+
+    /**
+     * \brief Deliver events to downstream until the stream is finished.
+     *
+     * Call once, from the receiving thread. Returns after delivering
+     * HandleFinish() or HandleError() to downstream.
+     */
+    void Pump() {
+        for (;;) {
+            auto batch = queue.ReceiveBlocking();
+            if (!batch) {
+                break;
+            }
+            if (downstream) {
+                downstream->HandleEventBatch(*batch);
+            }
+            queue.Recycle(std::move(batch));
+        }
+
+        if (downstream) {
+            if (queue.IsFailed()) {
+                downstream->HandleError(queue.GetErrorMessage());
+            }
+            else {
+                downstream->HandleFinish();
+            }
+            downstream.reset();
+        }
+    }
+
+    void HandleTimestamp(DecodedEvent const& event) override {
+        if (terminated) {
+            return;
+        }
+        // Sent without delay, as downstream may be waiting for the time to
+        // finish a line or frame
+        auto& batch = Collecting();
+        if (event.macrotime > batch.timestamp) {
+            batch.timestamp = event.macrotime;
+        }
+        SendCollected();
+    }
+
+    void HandleValidPhoton(ValidPhotonEvent const& event) override {
+        if (terminated) {
+            return;
+        }
+        Collecting().AppendPhoton(event.macrotime, event.microtime, event.route);
+        Collected();
+    }
+
+    void HandleInvalidPhoton(InvalidPhotonEvent const& event) override {
+        if (terminated) {
+            return;
+        }
+        Collecting().invalidPhotons.push_back(event);
+        Collected();
+    }
+
+    void HandleMarker(MarkerEvent const& event) override {
+        if (terminated) {
+            return;
+        }
+        Collecting().markers.push_back(event);
+        Collected();
+    }
+
+    void HandleDataLost(DataLostEvent const& event) override {
+        if (terminated) {
+            return;
+        }
+        Collecting().dataLost.push_back(event);
+        Collected();
+    }
+
+    void HandleEventBatch(DecodedEventBatch const& batch) override {
+        if (terminated || batch.IsEmpty()) {
+            return;
+        }
+        SendCollected();
+        auto copy = queue.GetEmptyBatch();
+        *copy = batch; // Reuses the vectors' storage
+        queue.Send(std::move(copy));
+    }
+
+    void HandleError(std::string const& message) override {
+        if (!terminated) {
+            SendCollected();
+            queue.Fail(message);
+            terminated = true;
+        }
+    }
+
+    void HandleFinish() override {
+        if (!terminated) {
+            SendCollected();
+            queue.Finish();
+            terminated = true;
+        }
+    }
+};
+
+
+using DecodedEventQueue =
+    BasicDecodedEventQueue<std::shared_ptr<DecodedEventProcessor>>;
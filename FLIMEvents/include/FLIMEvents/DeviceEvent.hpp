@@ -2,9 +2,11 @@
 
 #include "DecodedEvent.hpp"
 
+#include <cstdint>
 #include <cstdlib>
 #include <memory>
 #include <string>
+#include <utility>
 
 
 class DeviceEventProcessor {
@@ -25,11 +27,33 @@ public:
 };
 
 
-// A DeviceEventProcessor that sends decoded events downstream
-class DeviceEventDecoder : public DeviceEventProcessor {
-    std::shared_ptr<DecodedEventProcessor> downstream;
+/**
+ * \brief A DeviceEventProcessor that sends decoded events downstream.
+ *
+ * \tparam D downstream holder: std::shared_ptr to DecodedEventProcessor (see
+ * DeviceEventDecoder) or StaticDownstream of a concrete processor
+ */
+template <typename D>
+class BasicDeviceEventDecoder : public DeviceEventProcessor {
+    D downstream;
+
+    uint64_t routeMask; // Bit n enables route n
+    bool sendInvalidPhotons;
+    uint64_t invalidPhotonCount;
+
+    static bool IsRouteEnabled(uint64_t mask, uint16_t route) noexcept {
+        return mask == UINT64_MAX || (route < 64 && (mask >> route) & 1);
+    }
 
 protected:
+    bool HasDownstream() const noexcept {
+        return bool(downstream);
+    }
+
+    void AddInvalidPhotonCount(uint64_t count) noexcept {
+        invalidPhotonCount += count;
+    }
+
     void SendTimestamp(DecodedEvent const& event) {
         if (downstream) {
             downstream->HandleTimestamp(event);
@@ -60,6 +84,12 @@ protected:
         }
     }
 
+    void SendEventBatch(DecodedEventBatch const& batch) {
+        if (downstream) {
+            downstream->HandleEventBatch(batch);
+        }
+    }
+
     void SendError(std::string const& message) {
         if (downstream) {
             downstream->HandleError(message);
@@ -74,11 +104,205 @@ protected:
         }
     }
 
+    // Decoders decode each raw record into calls to one of the following
+    // "sink" classes (as a template parameter), so that the same code can
+    // either send events individually or build a batch. The sinks drop
+    // photons on disabled routes and (if so configured) invalid photons.
+
+    // Sends each decoded event downstream immediately
+    class EventSender {
+        BasicDeviceEventDecoder& decoder;
+
+    public:
+        explicit EventSender(BasicDeviceEventDecoder& decoder) : decoder(decoder) {}
+
+        void Timestamp(uint64_t macrotime) {
+            DecodedEvent e;
+            e.macrotime = macrotime;
+            decoder.SendTimestamp(e);
+        }
+
+        void DataLost(uint64_t macrotime) {
+            DataLostEvent e;
+            e.macrotime = macrotime;
+            decoder.SendDataLost(e);
+        }
+
+        void Marker(uint64_t macrotime, uint16_t bits) {
+            MarkerEvent e;
+            e.macrotime = macrotime;
+            e.bits = bits;
+            decoder.SendMarker(e);
+        }
+
+        void InvalidPhoton(uint64_t macrotime, uint16_t microtime, uint16_t route) {
+            ++decoder.invalidPhotonCount;
+            if (!decoder.sendInvalidPhotons) {
+                return;
+            }
+            InvalidPhotonEvent e;
+            e.macrotime = macrotime;
+            e.microtime = microtime;
+            e.route = route;
+            decoder.SendInvalidPhoton(e);
+        }
+
+        void ValidPhoton(uint64_t macrotime, uint16_t microtime, uint16_t route) {
+            if (!IsRouteEnabled(decoder.routeMask, route)) {
+                return;
+            }
+            ValidPhotonEvent e;
+            e.macrotime = macrotime;
+            e.microtime = microtime;
+            e.route = route;
+            decoder.SendValidPhoton(e);
+        }
+    };
+
+    // Appends decoded events to a batch. The batch photon arrays must have
+    // been sized to hold all photons; the photon count is tracked here.
+    // Dropped events advance the batch timestamp so that downstream still
+    // learns that their macro-time has been reached.
+    class BatchAppender {
+        DecodedEventBatch& batch;
+        uint64_t const routeMask;
+        bool const sendInvalidPhotons;
+
+        void Drop(uint64_t macrotime) noexcept {
+            if (macrotime > batch.timestamp) {
+                batch.timestamp = macrotime;
+            }
+        }
+
+    public:
+        std::size_t photonCount;
+        uint64_t invalidPhotonCount; // Not yet added to the decoder's count
+
+        BatchAppender(BasicDeviceEventDecoder const& decoder,
+            DecodedEventBatch& batch) :
+            batch(batch),
+            routeMask(decoder.routeMask),
+            sendInvalidPhotons(decoder.sendInvalidPhotons),
+            photonCount(0),
+            invalidPhotonCount(0)
+        {}
+
+        void Timestamp(uint64_t macrotime) {
+            batch.timestamp = macrotime;
+        }
+
+        void DataLost(uint64_t macrotime) {
+            DataLostEvent e;
+            e.macrotime = macrotime;
+            batch.dataLost.push_back(e);
+        }
+
+        void Marker(uint64_t macrotime, uint16_t bits) {
+            MarkerEvent e;
+            e.macrotime = macrotime;
+            e.bits = bits;
+            batch.markers.push_back(e);
+        }
+
+        void InvalidPhoton(uint64_t macrotime, uint16_t microtime, uint16_t route) {
+            ++invalidPhotonCount;
+            if (!sendInvalidPhotons) {
+                Drop(macrotime);
+                return;
+            }
+            InvalidPhotonEvent e;
+            e.macrotime = macrotime;
+            e.microtime = microtime;
+            e.route = route;
+            batch.invalidPhotons.push_back(e);
+        }
+
+        void ValidPhoton(uint64_t macrotime, uint16_t microtime, uint16_t route) {
+            if (!IsRouteEnabled(routeMask, route)) {
+                Drop(macrotime);
+                return;
+            }
+            batch.photonMacrotimes[photonCount] = macrotime;
+            batch.photonMicrotimes[photonCount] = microtime;
+            batch.photonRoutes[photonCount] = route;
+            ++photonCount;
+        }
+
+        // Accept count photons that have been written directly to the batch
+        // arrays (by a vectorized decoder) at index photonCount, removing any
+        // on disabled routes.
+        void CommitPhotons(std::size_t count) noexcept {
+            if (routeMask == UINT64_MAX || count == 0) {
+                photonCount += count;
+                return;
+            }
+
+            auto* macrotimes = batch.photonMacrotimes.data();
+            auto* microtimes = batch.photonMicrotimes.data();
+            auto* routes = batch.photonRoutes.data();
+            std::size_t const end = photonCount + count;
+            uint64_t const lastMacrotime = macrotimes[end - 1];
+            std::size_t k = photonCount;
+            for (std::size_t j = photonCount; j < end; ++j) {
+                // Branch-free compaction (disabled routes are overwritten)
+                macrotimes[k] = macrotimes[j];
+                microtimes[k] = microtimes[j];
+                routes[k] = routes[j];
+                k += IsRouteEnabled(routeMask, routes[j]);
+            }
+            if (k < end) {
+                Drop(lastMacrotime);
+            }
+            photonCount = k;
+        }
+    };
+
 public:
-    explicit DeviceEventDecoder(std::shared_ptr<DecodedEventProcessor> downstream) :
-        downstream(downstream)
+    explicit BasicDeviceEventDecoder(D downstream) :
+        downstream(std::move(downstream)),
+        routeMask(UINT64_MAX),
+        sendInvalidPhotons(true),
+        invalidPhotonCount(0)
     {}
 
+    /**
+     * \brief Set the routes (channels) for which valid photons are sent.
+     *
+     * Photons on other routes are dropped during decoding, before reaching
+     * any downstream processor. Bit n enables route n; routes 64 and above
+     * are dropped unless all bits are set (the default).
+     */
+    void SetRouteMask(uint64_t mask) noexcept {
+        routeMask = mask;
+    }
+
+    /**
+     * \brief Set whether invalid photons are sent downstream.
+     *
+     * When the downstream processors have no use for invalid photons, not
+     * sending them saves work; they are still counted (see
+     * GetInvalidPhotonCount()).
+     */
+    void SetSendInvalidPhotons(bool send) noexcept {
+        sendInvalidPhotons = send;
+    }
+
+    /**
+     * \brief Whether the decoder ignores further input.
+     *
+     * This is the case after finishing or an error, including when the
+     * decoder finishes by itself (such as at the end of a time window), in
+     * which case the caller can stop reading input.
+     */
+    bool IsFinished() const noexcept {
+        return !HasDownstream();
+    }
+
+    // Number of invalid photons decoded, whether or not sent downstream
+    uint64_t GetInvalidPhotonCount() const noexcept {
+        return invalidPhotonCount;
+    }
+
     void HandleError(std::string const& message) override {
         SendError(message);
     }
@@ -87,3 +311,7 @@ public:
         SendFinish();
     }
 };
+
+
+using DeviceEventDecoder =
+    BasicDeviceEventDecoder<std::shared_ptr<DecodedEventProcessor>>;
@@ -4,9 +4,12 @@
 
 #include <cstring>
 #include <deque>
+#include <functional>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 
@@ -33,7 +36,13 @@ class Histogram {
     std::size_t width;
     std::size_t height;
 
-    std::unique_ptr<T[]> hist;
+public:
+    // Owner of the bins; the deleter may return them to a pool (see
+    // HistogramPool) rather than free them.
+    using Storage = std::unique_ptr<T[], std::function<void(T*)>>;
+
+private:
+    Storage hist;
 
 public:
     ~Histogram() = default;
@@ -47,12 +56,20 @@ public:
 
     // Warning: Newly constructed histogram is not zeroed (for efficiency)
     Histogram(uint32_t timeBits, uint32_t inputTimeBits, bool reverseTime, std::size_t width, std::size_t height) :
+        Histogram(timeBits, inputTimeBits, reverseTime, width, height,
+            Storage(new T[GetNumberOfElements(timeBits, width, height)],
+                [](T* p) { delete[] p; }))
+    {}
+
+    // Construct using existing storage, which must have at least
+    // GetNumberOfElements() elements. Contents are not modified.
+    Histogram(uint32_t timeBits, uint32_t inputTimeBits, bool reverseTime, std::size_t width, std::size_t height, Storage&& storage) :
         timeBits(timeBits),
         inputTimeBits(inputTimeBits),
         reverseTime(reverseTime),
         width(width),
         height(height),
-        hist(std::make_unique<T[]>(GetNumberOfElements()))
+        hist(std::move(storage))
     {
         if (timeBits > inputTimeBits) {
             throw std::invalid_argument("Histogram time bits must not be greater than input bits");
@@ -84,7 +101,11 @@ public:
     }
 
     std::size_t GetNumberOfElements() const noexcept {
-        return GetNumberOfTimeBins() * width * height;
+        return GetNumberOfElements(timeBits, width, height);
+    }
+
+    static std::size_t GetNumberOfElements(uint32_t timeBits, std::size_t width, std::size_t height) noexcept {
+        return (std::size_t(1) << timeBits) * width * height;
     }
 
     void Increment(std::size_t t, std::size_t x, std::size_t y) noexcept {
@@ -131,18 +152,20 @@ public:
 
 
 // Collect pixel-assiend photon events into a series of histograms
-template <typename T>
-class Histogrammer : public PixelPhotonProcessor {
+// D is the downstream holder: std::shared_ptr to HistogramProcessor<T> (the
+// default) or StaticDownstream of a concrete processor.
+template <typename T, typename D = std::shared_ptr<HistogramProcessor<T>>>
+class Histogrammer final : public PixelPhotonProcessor {
     Histogram<T> histogram;
     bool frameInProgress;
 
-    std::shared_ptr<HistogramProcessor<T>> downstream;
+    D downstream;
 
 public:
-    Histogrammer(Histogram<T>&& histogram, std::shared_ptr<HistogramProcessor<T>> downstream) :
+    Histogrammer(Histogram<T>&& histogram, D downstream) :
         histogram(std::move(histogram)),
         frameInProgress(false),
-        downstream(downstream)
+        downstream(std::move(downstream))
     {}
 
     void HandleBeginFrame() override {
@@ -179,16 +202,17 @@ public:
 
 // Accumulate a series of histograms
 // Guarantees complete frame upon finish (all zeros if there was no frame).
-template <typename T>
-class HistogramAccumulator : public HistogramProcessor<T> {
+// D is the downstream holder, as with Histogrammer.
+template <typename T, typename D = std::shared_ptr<HistogramProcessor<T>>>
+class HistogramAccumulator final : public HistogramProcessor<T> {
     Histogram<T> cumulative;
 
-    std::shared_ptr<HistogramProcessor<T>> downstream;
+    D downstream;
 
 public:
-    HistogramAccumulator(Histogram<T>&& histogram, std::shared_ptr<HistogramProcessor<T>> downstream) :
+    HistogramAccumulator(Histogram<T>&& histogram, D downstream) :
         cumulative(std::move(histogram)),
-        downstream(downstream)
+        downstream(std::move(downstream))
     {}
 
     void HandleError(std::string const& message) override {
@@ -0,0 +1,224 @@
+#pragma once
+
+#include "Histogram.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+
+// Recycles histogram storage, so that repeated acquisitions with the same
+// histogram dimensions do not allocate their histograms (nor zero them, if
+// ClearIdle() was called while they were idle). Histograms obtained from the
+// pool return their storage to it when destroyed, which may happen on any
+// thread and after the pool itself has been destroyed.
+template <typename T>
+class HistogramPool {
+public:
+    // ClearIdle() zeroes storage in chunks of this size, so that Get() never
+    // waits long for storage that is being cleared
+    static constexpr std::size_t ClearChunkBytes = 1024 * 1024;
+
+private:
+    struct IdleStorage {
+        std::size_t size;
+        std::size_t zeroedCount; // Leading elements known to be zero
+        // Last used for a histogram that had to start zeroed, so likely to
+        // be requested zeroed again (other storage is not cleared in advance)
+        bool clearInAdvance;
+        std::unique_ptr<T[]> data;
+
+        bool IsZeroed() const noexcept { return zeroedCount == size; }
+    };
+
+    struct State {
+        std::mutex mutex;
+        std::condition_variable chunkCleared;
+        std::vector<IdleStorage> idle;
+        bool clearing = false; // ClearIdle() is running
+        // Size of the storage taken out of idle by ClearIdle(), if any
+        std::size_t clearingSize = 0;
+        std::size_t takeOverCount = 0; // Get() calls waiting for that storage
+        std::size_t allocationCount = 0;
+        std::size_t reuseCount = 0;
+    };
+
+    std::shared_ptr<State> state;
+
+    static void Return(std::weak_ptr<State> const& weakState, std::size_t size,
+        bool clearInAdvance, T* data) noexcept {
+        std::unique_ptr<T[]> owned(data);
+        auto st = weakState.lock();
+        if (!st) {
+            return; // Pool is gone; free
+        }
+        std::lock_guard<std::mutex> hold(st->mutex);
+        try {
+            st->idle.push_back({ size, 0, clearInAdvance, std::move(owned) });
+        }
+        catch (std::bad_alloc const&) {
+            // Free
+        }
+    }
+
+public:
+    HistogramPool() :
+        state(std::make_shared<State>())
+    {}
+
+    HistogramPool(HistogramPool const&) = delete;
+    HistogramPool& operator=(HistogramPool const&) = delete;
+
+    // Obtain a histogram, reusing idle storage of the same size if there is
+    // any. If zeroed is false, the contents are unspecified (as with a newly
+    // constructed Histogram). Newly allocated storage is always zeroed, so
+    // that its pages are faulted in before use. Storage requested zeroed is
+    // cleared in advance by ClearIdle() once it is returned.
+    Histogram<T> Get(uint32_t timeBits, uint32_t inputTimeBits, bool reverseTime,
+        std::size_t width, std::size_t height, bool zeroed) {
+        std::size_t const size = Histogram<T>::GetNumberOfElements(timeBits, width, height);
+
+        std::unique_ptr<T[]> data;
+        std::size_t zeroedCount = 0;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            auto& idle = state->idle;
+            for (;;) {
+                // Prefer storage that is already in the requested state (or,
+                // if zeroed, closest to it), leaving zeroed storage for
+                // requests that need it.
+                auto best = idle.end();
+                for (auto it = idle.begin(); it != idle.end(); ++it) {
+                    if (it->size != size)
+                        continue;
+                    if (best == idle.end() || (zeroed ?
+                        it->zeroedCount > best->zeroedCount :
+                        !it->IsZeroed())) {
+                        best = it;
+                    }
+                    if (it->IsZeroed() == zeroed)
+                        break;
+                }
+                if (best != idle.end()) {
+                    data = std::move(best->data);
+                    zeroedCount = best->zeroedCount;
+                    idle.erase(best);
+                    ++state->reuseCount;
+                    break;
+                }
+                if (state->clearingSize != size) {
+                    ++state->allocationCount;
+                    break;
+                }
+                // Take over the storage being cleared, after its current chunk
+                ++state->takeOverCount;
+                state->chunkCleared.wait(lock, [&] {
+                    return state->clearingSize != size;
+                });
+                --state->takeOverCount;
+                state->chunkCleared.notify_all(); // ClearIdle() may continue
+            }
+        }
+
+        if (!data) {
+            data.reset(new T[size]());
+        }
+        else if (zeroed && zeroedCount < size) {
+            memset(data.get() + zeroedCount, 0, (size - zeroedCount) * sizeof(T));
+        }
+
+        std::weak_ptr<State> weakState = state;
+        typename Histogram<T>::Storage storage(data.release(),
+            [weakState, size, zeroed](T* p) { Return(weakState, size, zeroed, p); });
+        return Histogram<T>(timeBits, inputTimeBits, reverseTime, width,
+            height, std::move(storage));
+    }
+
+    // Zero the idle storage that was last requested zeroed, so that a later
+    // Get() need not. Intended to be run in the background when there is time
+    // to spare (such as after an acquisition); a concurrent Get() takes over
+    // any storage not yet fully cleared. Returns the number of histograms
+    // cleared (0 if already running on another thread).
+    std::size_t ClearIdle() {
+        std::size_t const chunkSize = std::max<std::size_t>(
+            ClearChunkBytes / sizeof(T), 1);
+        std::size_t clearedCount = 0;
+        std::unique_lock<std::mutex> lock(state->mutex);
+        if (state->clearing) {
+            return 0;
+        }
+        state->clearing = true;
+        for (;;) {
+            // Take the storage out of the pool while clearing a chunk, so that
+            // Get() is not held up (except for that storage)
+            auto& idle = state->idle;
+            auto it = std::find_if(idle.begin(), idle.end(),
+                [](IdleStorage const& s) {
+                    return s.clearInAdvance && !s.IsZeroed();
+                });
+            if (it == idle.end()) {
+                break;
+            }
+            IdleStorage s = std::move(*it);
+            idle.erase(it);
+            state->clearingSize = s.size;
+            lock.unlock();
+
+            std::size_t const n = std::min(chunkSize, s.size - s.zeroedCount);
+            memset(s.data.get() + s.zeroedCount, 0, n * sizeof(T));
+            s.zeroedCount += n;
+            if (s.IsZeroed()) {
+                ++clearedCount;
+            }
+
+            lock.lock();
+            state->clearingSize = 0;
+            try {
+                idle.push_back(std::move(s));
+            }
+            catch (std::bad_alloc const&) {
+                // Free
+            }
+            state->chunkCleared.notify_all();
+            // Let waiting Get() calls take the storage first
+            state->chunkCleared.wait(lock, [&] {
+                return state->takeOverCount == 0;
+            });
+        }
+        state->clearing = false;
+        return clearedCount;
+    }
+
+    // Free the idle storage (for example, when the histogram dimensions
+    // change). Returns the number of histograms freed.
+    std::size_t ReleaseIdle() noexcept {
+        std::vector<IdleStorage> idle;
+        {
+            std::lock_guard<std::mutex> hold(state->mutex);
+            idle.swap(state->idle);
+        }
+        return idle.size();
+    }
+
+    std::size_t GetIdleCount() const noexcept {
+        std::lock_guard<std::mutex> hold(state->mutex);
+        return state->idle.size();
+    }
+
+    // Number of Get() calls that allocated new storage
+    std::size_t GetAllocationCount() const noexcept {
+        std::lock_guard<std::mutex> hold(state->mutex);
+        return state->allocationCount;
+    }
+
+    // Number of Get() calls that reused idle storage
+    std::size_t GetReuseCount() const noexcept {
+        std::lock_guard<std::mutex> hold(state->mutex);
+        return state->reuseCount;
+    }
+};
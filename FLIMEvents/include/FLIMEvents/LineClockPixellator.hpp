@@ -1,21 +1,61 @@
 #pragma once
 
 #include "DecodedEvent.hpp"
+#include "LineMapping.hpp"
 #include "PixelPhotonEvent.hpp"
+#include "RingBuffer.hpp"
 
-#include <deque>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <stdexcept>
-
-
-// Assign pixels to photons using line clock only
-class LineClockPixellator : public DecodedEventProcessor {
-    uint32_t const pixelsPerLine;
-    uint32_t const linesPerFrame;
+#include <string>
+#include <utility>
+
+
+/**
+ * \brief Assign pixels to photons using line clock only.
+ *
+ * Within each line, pixels are of equal duration, or are given by a
+ * LineMapping (for example, for a resonant scanner). With a bidirectional
+ * mapping, each line marker starts two image rows.
+ *
+ * Photons that arrive while their line is in progress are emitted
+ * immediately; only photons that arrive ahead of their line's marker are
+ * buffered. Buffered photons and lines are processed on every line marker and
+ * timestamp. When events are decoded one at a time (so that there is a
+ * timestamp for every macro-time overflow), place a TimestampCoalescer
+ * upstream.
+ *
+ * Photons that cannot belong to any future line (because they precede the
+ * earliest time at which the next line could start) are dropped rather than
+ * buffered, so that missing line markers do not cause unbounded buffering.
+ * In addition, the number of buffered photons and line markers, and the time
+ * without line markers, can be limited; exceeding a limit is an error.
+ *
+ * By default, frames are delimited by counting lines from the start of the
+ * acquisition, and data loss (device FIFO overflow) is an error. If a frame
+ * marker is set (SetFrameMarkerBit()), each frame instead starts at the line
+ * marker that accompanies (or first follows) a frame marker, and lines
+ * between frames are ignored. Data loss then discards only the frame in
+ * progress (which is begun but never ended downstream); processing resumes at
+ * the next frame marker, with frame numbers advanced past any frames whose
+ * markers were lost.
+ *
+ * User code should normally use LineClockPixellator, which sends pixel
+ * photons to a PixelPhotonProcessor via shared_ptr.
+ *
+ * \tparam D downstream holder: std::shared_ptr to PixelPhotonProcessor or
+ * StaticDownstream of a concrete processor
+ */
+template <typename D>
+class BasicLineClockPixellator final : public DecodedEventProcessor {
+    LineMapping const mapping;
+    uint32_t const linesPerFrame; // Line markers per frame
     uint32_t const maxFrames;
 
     int32_t const lineDelay; // in macro-time units
-    uint32_t const lineTime; // in macro-time units
+    uint32_t const lineTime; // in macro-time units; from mapping
     decltype(MarkerEvent::bits) const lineMarkerMask;
 
     uint64_t latestTimestamp; // Latest observed macro-time
@@ -32,13 +72,43 @@ class LineClockPixellator : public DecodedEventProcessor {
     // Start time of current line, or -1 if no line started.
     uint64_t lineStartTime;
 
+    // Position of the current line, set when it is started
+    uint32_t lineFrame;
+    uint32_t lineY; // First row of line
+
     // Buffer received photons until we can assign to pixel
-    std::deque<ValidPhotonEvent> pendingPhotons;
+    flimevents::internal::RingBuffer<ValidPhotonEvent> pendingPhotons;
 
-    // Buffer line marks until we are ready to process
-    std::deque<uint64_t> pendingLines; // marker macro-times
+    struct PendingLine {
+        uint64_t markerTime;
+        bool startsFrame; // Only used with frame marker
+    };
 
-    std::shared_ptr<PixelPhotonProcessor> downstream;
+    // Buffer line marks until we are ready to process
+    flimevents::internal::RingBuffer<PendingLine> pendingLines;
+
+    std::size_t maxPendingPhotons;
+    std::size_t maxPendingLines;
+    std::size_t peakPendingPhotons;
+    std::size_t peakPendingLines;
+
+    // Time of the last line marker, or of the first photon seen before any
+    // line marker
+    uint64_t lineMarkerLagStart;
+    bool lineMarkerLagStarted;
+    uint64_t maxLineMarkerLag; // in macro-time units
+    double macrotimeUnitNs; // For messages only; 0 if unknown
+
+    // Frame marker synchronization; frameMarkerMask is 0 if not used
+    decltype(MarkerEvent::bits) frameMarkerMask;
+    bool frameMarkerPending; // Frame marker seen; line marker not yet
+    bool awaitingFrameStart; // Between frames; ignore lines until frame marker
+    bool resyncing; // Data was lost since the last frame started
+    uint64_t lastFrameMarkerTime; // Marker time of first line of last frame
+    uint64_t framePeriod; // Between last two consecutive frames; 0 if unknown
+    uint64_t discardedFrameCount;
+
+    D downstream;
 
     struct Error {
         std::string message;
@@ -50,18 +120,89 @@ private:
         latestTimestamp = macrotime;
     }
 
+    // Report error downstream and release buffers
+    void Fail(std::string const& message) {
+        pendingPhotons = {};
+        pendingLines = {};
+        if (downstream) {
+            downstream->HandleError(message);
+            downstream.reset();
+        }
+    }
+
+    // The next line marker cannot precede the latest timestamp
+    uint64_t EarliestNextLineStart() const noexcept {
+        if (lineDelay >= 0) {
+            return latestTimestamp + lineDelay;
+        }
+        uint64_t minusDelay = -static_cast<int64_t>(lineDelay);
+        return latestTimestamp > minusDelay ? latestTimestamp - minusDelay : 0;
+    }
+
+    std::string FormatMacrotime(uint64_t duration) const {
+        if (macrotimeUnitNs > 0.0) {
+            return std::to_string(static_cast<uint64_t>(
+                duration * macrotimeUnitNs / 1e6)) + " ms";
+        }
+        return std::to_string(duration) + " macro-time units";
+    }
+
     void EnqueuePhoton(ValidPhotonEvent const& event) {
         if (!downstream) {
             return; // Avoid buffering post-error
         }
-        pendingPhotons.emplace_back(event);
+
+        if (nextLine == currentLine && pendingLines.empty()) {
+            // Waiting for a line marker: drop the photons that would be
+            // discarded (as before their line) anyway.
+            uint64_t const earliest = EarliestNextLineStart();
+            while (!pendingPhotons.empty() &&
+                pendingPhotons.front().macrotime < earliest) {
+                pendingPhotons.pop_front();
+            }
+
+            if (!lineMarkerLagStarted) {
+                lineMarkerLagStart = event.macrotime;
+                lineMarkerLagStarted = true;
+            }
+            else if (event.macrotime > lineMarkerLagStart &&
+                event.macrotime - lineMarkerLagStart > maxLineMarkerLag) {
+                Fail("No line markers seen in " +
+                    FormatMacrotime(event.macrotime - lineMarkerLagStart) +
+                    " (check line marker connection and setting)");
+                return;
+            }
+
+            if (event.macrotime < earliest) {
+                return;
+            }
+        }
+
+        pendingPhotons.push_back(event);
+        std::size_t const count = pendingPhotons.size();
+        if (count > peakPendingPhotons) {
+            peakPendingPhotons = count;
+        }
+        if (count > maxPendingPhotons) {
+            Fail("Too many photons (" + std::to_string(count) +
+                ") buffered waiting for line markers");
+        }
     }
 
-    void EnqueueLineMarker(uint64_t macrotime) {
+    void EnqueueLineMarker(uint64_t macrotime, bool startsFrame) {
         if (!downstream) {
             return; // Avoid buffering post-error
         }
-        pendingLines.emplace_back(macrotime);
+        lineMarkerLagStart = macrotime;
+        lineMarkerLagStarted = true;
+        pendingLines.push_back({ macrotime, startsFrame });
+        if (pendingLines.size() > peakPendingLines) {
+            peakPendingLines = pendingLines.size();
+        }
+        if (pendingLines.size() > maxPendingLines) {
+            Fail("Too many line markers (" + std::to_string(pendingLines.size()) +
+                ") buffered (line delay may be too long)");
+        }
     }
 
     uint64_t CheckLineStart(uint64_t lineMarkerTime) {
@@ -82,14 +223,83 @@ private:
         return startTime;
     }
 
+    // Skip the line numbers of the rest of the current frame. The frame has
+    // been begun downstream, but will not be ended.
+    void DiscardFrame() {
+        currentLine = (currentLine / linesPerFrame + 1) * linesPerFrame;
+        nextLine = currentLine;
+        ++discardedFrameCount;
+        awaitingFrameStart = true;
+
+        if (currentLine / linesPerFrame >= maxFrames) {
+            if (downstream) {
+                downstream->HandleFinish();
+                downstream.reset();
+            }
+        }
+    }
+
+    // With frame marker synchronization, determine whether the line should
+    // be started (returning false if it is to be ignored), moving to the
+    // next frame if it starts a frame.
+    bool SyncLineToFrame(PendingLine const& line) {
+        if (!line.startsFrame) {
+            return !awaitingFrameStart;
+        }
+
+        if (!awaitingFrameStart) {
+            // Frame marker before the last line of the frame
+            DiscardFrame();
+            if (!downstream) {
+                return false;
+            }
+        }
+
+        if (lastFrameMarkerTime != uint64_t(-1)) {
+            uint64_t const interval = line.markerTime - lastFrameMarkerTime;
+            if (!resyncing) {
+                framePeriod = interval;
+            }
+            else if (framePeriod > 0) {
+                // Frame markers may have been lost with the data; keep frame
+                // numbers in step with the scanner
+                uint64_t const frames = (interval + framePeriod / 2) / framePeriod;
+                if (frames > 1) {
+                    currentLine += (frames - 1) * linesPerFrame;
+                    nextLine = currentLine;
+                    discardedFrameCount += frames - 1;
+                }
+            }
+        }
+        lastFrameMarkerTime = line.markerTime;
+        awaitingFrameStart = false;
+        resyncing = false;
+        return true;
+    }
+
+    // Abandon the frame in progress and any buffered data, which may be
+    // incomplete
+    void ResyncAfterDataLost() {
+        pendingPhotons.clear();
+        pendingLines.clear();
+        frameMarkerPending = false;
+        resyncing = true;
+        if (!awaitingFrameStart) {
+            DiscardFrame();
+        }
+    }
+
     void StartLine(uint64_t lineMarkerTime) {
         lineStartTime = CheckLineStart(lineMarkerTime);
+        lineFrame = static_cast<uint32_t>(currentLine / linesPerFrame);
+        lineY = static_cast<uint32_t>(currentLine % linesPerFrame) *
+            mapping.GetRowsPerLine();
         ++nextLine;
 
         bool newFrame = currentLine % linesPerFrame == 0;
         if (newFrame) {
             // Check for last frame here in case maxFrames == 0.
-            if (currentLine / linesPerFrame == maxFrames) {
+            if (currentLine / linesPerFrame >= maxFrames) {
                 if (downstream) {
                     downstream->HandleFinish();
                     downstream.reset();
@@ -110,10 +320,13 @@ private:
             if (downstream) {
                 downstream->HandleEndFrame();
             }
+            if (frameMarkerMask != 0) {
+                awaitingFrameStart = true;
+            }
 
             // Check for last frame here to send finish as soon as possible.
             // (The case of maxFrames == 0 is not handled here.)
-            if (currentLine / linesPerFrame == maxFrames) {
+            if (currentLine / linesPerFrame >= maxFrames) {
                 if (downstream) {
                     downstream->HandleFinish();
                     downstream.reset();
@@ -122,12 +335,19 @@ private:
         }
     }
 
+    // The photon must be within the current line
     void EmitPhoton(ValidPhotonEvent const& event) {
+        auto const timeInLine = static_cast<uint32_t>(event.macrotime - lineStartTime);
+        uint32_t x;
+        uint32_t row;
+        if (!mapping.Map(timeInLine, x, row)) {
+            return; // Between pixels (e.g. scanner turnaround)
+        }
+
         PixelPhotonEvent newEvent;
-        newEvent.frame = static_cast<uint32_t>(currentLine / linesPerFrame);
-        newEvent.y = static_cast<uint32_t>(currentLine % linesPerFrame);
-        auto timeInLine = event.macrotime - lineStartTime;
-        newEvent.x = static_cast<uint32_t>(pixelsPerLine * timeInLine / lineTime);
+        newEvent.frame = lineFrame;
+        newEvent.y = lineY + row;
+        newEvent.x = x;
         newEvent.route = event.route;
         newEvent.microtime = event.microtime;
         if (downstream) {
@@ -145,10 +365,13 @@ private:
                 // Nothing to do until a new line can be started
                 return false;
             }
-            uint64_t lineMarkerTime = pendingLines.front();
+            PendingLine const line = pendingLines.front();
             pendingLines.pop_front();
 
-            StartLine(lineMarkerTime);
+            if (frameMarkerMask != 0 && !SyncLineToFrame(line)) {
+                return static_cast<bool>(downstream); // Ignore line
+            }
+            StartLine(line.markerTime);
         }
         // Else we are already in a line
 
@@ -194,91 +417,219 @@ private:
                 ;
         }
         catch (Error const& e) {
+            Fail(e.message);
+        }
+    }
+
+    void OnTimestamp(DecodedEvent const& event) {
+        UpdateTimeRange(event.macrotime);
+        // Emit all lines that are complete. This is needed because we don't
+        // receive a "finish" event from OpenScanLib when doing a finite-frame
+        // acquisition, so the last frame must be completed based on time
+        // stamps only. Upstream limits the rate of timestamps (one per batch,
+        // or see TimestampCoalescer).
+        ProcessPhotonsAndLines();
+    }
+
+    void OnDataLost(DataLostEvent const& event) {
+        UpdateTimeRange(event.macrotime);
+        ProcessPhotonsAndLines();
+        if (frameMarkerMask != 0) {
             if (downstream) {
-                downstream->HandleError(e.message);
-                downstream.reset();
+                ResyncAfterDataLost();
+            }
+            return;
+        }
+        if (downstream) {
+            downstream->HandleError("Data lost due to device buffer (FIFO) overflow");
+            downstream.reset();
+        }
+    }
+
+    void OnValidPhoton(ValidPhotonEvent const& event) {
+        UpdateTimeRange(event.macrotime);
+
+        bool const inLine = nextLine > currentLine;
+        if (inLine && pendingPhotons.empty()) {
+            // Fast path: the photon's line is in progress, so it can be
+            // emitted (or discarded) without buffering. (When in a line,
+            // ProcessPhotonsAndLines() leaves no photons pending, so this is
+            // the common case.)
+            if (event.macrotime < lineStartTime) {
+                return; // Before the line; discard
             }
+            if (event.macrotime < lineStartTime + lineTime) {
+                EmitPhoton(event);
+                return;
+            }
+        }
+
+        EnqueuePhoton(event);
+        if (inLine) {
+            // The photon is past the end of the current line, which can
+            // therefore be finished (and the next line started, if its
+            // marker has been received).
+            ProcessPhotonsAndLines();
+        }
+    }
+
+    void OnInvalidPhoton(InvalidPhotonEvent const& event) {
+        UpdateTimeRange(event.macrotime);
+        // We could call ProcessPhotonsAndLines() to emit all lines that are
+        // complete, but deferring can improve performance.
+    }
+
+    void OnMarker(MarkerEvent const& event) {
+        UpdateTimeRange(event.macrotime);
+        if (event.bits & frameMarkerMask) {
+            frameMarkerPending = true;
+        }
+        if (event.bits & lineMarkerMask) {
+            EnqueueLineMarker(event.macrotime, frameMarkerPending);
+            frameMarkerPending = false;
+            // We could call ProcessPhotonsAndLines() for all markers, but that
+            // may degrade performance if a non-line marker (e.g. an unused
+            // pixel marker) is frequent.
+            ProcessPhotonsAndLines();
         }
     }
 
 public:
-    LineClockPixellator(uint32_t pixelsPerLine, uint32_t linesPerFrame,
+    BasicLineClockPixellator(uint32_t pixelsPerLine, uint32_t linesPerFrame,
         uint32_t maxFrames,
         int32_t lineDelay, uint32_t lineTime, uint32_t lineMarkerBit,
-        std::shared_ptr<PixelPhotonProcessor> downstream) :
-        pixelsPerLine(pixelsPerLine),
+        D downstream) :
+        BasicLineClockPixellator(LineMapping::Linear(pixelsPerLine, lineTime),
+            linesPerFrame, maxFrames, lineDelay, lineMarkerBit,
+            std::move(downstream))
+    {}
+
+    // The number of image rows per frame is linesPerFrame times the
+    // mapping's rows per line. The line time is that of the mapping.
+    BasicLineClockPixellator(LineMapping mapping, uint32_t linesPerFrame,
+        uint32_t maxFrames, int32_t lineDelay, uint32_t lineMarkerBit,
+        D downstream) :
+        mapping(std::move(mapping)),
         linesPerFrame(linesPerFrame),
         maxFrames(maxFrames),
         lineDelay(lineDelay),
-        lineTime(lineTime),
+        lineTime(this->mapping.GetLineTime()),
         lineMarkerMask(1 << lineMarkerBit),
         latestTimestamp(0),
         nextLine(0),
         currentLine(0),
         lineStartTime(-1),
-        downstream(downstream)
+        lineFrame(0),
+        lineY(0),
+        maxPendingPhotons(std::size_t(1) << 22),
+        maxPendingLines(std::size_t(1) << 16),
+        peakPendingPhotons(0),
+        peakPendingLines(0),
+        lineMarkerLagStart(0),
+        lineMarkerLagStarted(false),
+        maxLineMarkerLag(UINT64_MAX),
+        macrotimeUnitNs(0.0),
+        frameMarkerMask(0),
+        frameMarkerPending(false),
+        awaitingFrameStart(false),
+        resyncing(false),
+        lastFrameMarkerTime(-1),
+        framePeriod(0),
+        discardedFrameCount(0),
+        downstream(std::move(downstream))
     {
-        if (pixelsPerLine < 1) {
-            throw std::invalid_argument("pixelsPerLine must be positive");
-        }
         if (linesPerFrame < 1) {
             throw std::invalid_argument("linesPerFrame must be positive");
         }
-        if (lineTime < 1) {
-            throw std::invalid_argument("lineTime must be positive");
+    }
+
+    // Limit on photons buffered because they may belong to a line whose
+    // marker has not yet been received
+    void SetMaxPendingPhotons(std::size_t count) {
+        maxPendingPhotons = count;
+    }
+
+    // Limit on line markers buffered because their line has not yet started
+    // (which depends on the line delay)
+    void SetMaxPendingLines(std::size_t count) {
+        maxPendingLines = count;
+    }
+
+    // Limit on the time for which photons are received without line markers
+    // (no limit by default)
+    void SetMaxLineMarkerLag(uint64_t macrotimeLag) {
+        maxLineMarkerLag = macrotimeLag;
+    }
+
+    // Used to report times in error messages
+    void SetMacrotimeUnitNs(double unitNs) {
+        macrotimeUnitNs = unitNs;
+    }
+
+    // Start each frame on a frame marker, and recover from data loss by
+    // discarding the frame in progress (see class description). The frame
+    // marker must arrive with or before the line marker of the frame's first
+    // line. Must be called before any events are sent.
+    void SetFrameMarkerBit(uint32_t frameMarkerBit) {
+        frameMarkerMask = 1 << frameMarkerBit;
+        if (frameMarkerMask & lineMarkerMask) {
+            throw std::invalid_argument("Frame marker must differ from line marker");
         }
+        awaitingFrameStart = true;
+    }
+
+    // The current and peak numbers of buffered photons and line markers.
+    // Must be called on the thread sending events.
+    std::size_t GetPendingPhotonCount() const noexcept {
+        return pendingPhotons.size();
+    }
+
+    std::size_t GetPeakPendingPhotonCount() const noexcept {
+        return peakPendingPhotons;
+    }
+
+    std::size_t GetPendingLineCount() const noexcept {
+        return pendingLines.size();
+    }
+
+    std::size_t GetPeakPendingLineCount() const noexcept {
+        return peakPendingLines;
+    }
+
+    // Frames begun but not ended, or skipped, due to data loss or misplaced
+    // frame markers (only with frame marker)
+    uint64_t GetDiscardedFrameCount() const noexcept {
+        return discardedFrameCount;
     }
 
     void HandleTimestamp(DecodedEvent const& event) override {
-        auto prevTimestamp = latestTimestamp;
-        UpdateTimeRange(event.macrotime);
-        // We could call ProcessPhotonsAndLines() to emit all lines that are
-        // complete, but deferring can significantly improve performance when a
-        // timestamp is sent for every macro-time overflow.
-
-        // Temporary: we need to process all buffered data based on time stamps
-        // only, because currently we don't receive a "finish" event from
-        // OpenScanLib when doing a finite-frame acquisition.
-        // To avoid inefficiency, limit the rate (arbitrary for now).
-        if (latestTimestamp > prevTimestamp + 800000) {
-            ProcessPhotonsAndLines();
-        }
+        OnTimestamp(event);
     }
 
     void HandleDataLost(DataLostEvent const& event) override {
-        UpdateTimeRange(event.macrotime);
-        ProcessPhotonsAndLines();
-        if (downstream) {
-            downstream->HandleError("Data lost due to device buffer (FIFO) overflow");
-            downstream.reset();
-        }
+        OnDataLost(event);
     }
 
     void HandleValidPhoton(ValidPhotonEvent const& event) override {
-        UpdateTimeRange(event.macrotime);
-        EnqueuePhoton(event);
-        // A small amount of buffering can improve performance (buffering
-        // larger numbers is less effective)
-        if (pendingPhotons.size() > 64) {
-            ProcessPhotonsAndLines();
-        }
+        OnValidPhoton(event);
     }
 
     void HandleInvalidPhoton(InvalidPhotonEvent const& event) override {
-        UpdateTimeRange(event.macrotime);
-        // We could call ProcessPhotonsAndLines() to emit all lines that are
-        // complete, but deferring can improve performance.
+        OnInvalidPhoton(event);
     }
 
     void HandleMarker(MarkerEvent const& event) override {
-        UpdateTimeRange(event.macrotime);
-        if (event.bits & lineMarkerMask) {
-            EnqueueLineMarker(event.macrotime);
-            // We could call ProcessPhotonsAndLines() for all markers, but that
-            // may degrade performance if a non-line marker (e.g. an unused
-            // pixel marker) is frequent.
-            ProcessPhotonsAndLines();
-        }
+        OnMarker(event);
+    }
+
+    void HandleEventBatch(DecodedEventBatch const& batch) override {
+        // Same as the default, but without virtual calls per event
+        ForEachEventInBatch(batch,
+            [this](ValidPhotonEvent const& e) { OnValidPhoton(e); },
+            [this](InvalidPhotonEvent const& e) { OnInvalidPhoton(e); },
+            [this](MarkerEvent const& e) { OnMarker(e); },
+            [this](DataLostEvent const& e) { OnDataLost(e); },
+            [this](DecodedEvent const& e) { OnTimestamp(e); });
     }
 
     void HandleError(std::string const& message) override {
@@ -306,3 +657,7 @@ public:
         ProcessPhotonsAndLines();
     }
 };
+
+
+using LineClockPixellator =
+    BasicLineClockPixellator<std::shared_ptr<PixelPhotonProcessor>>;
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+
+/**
+ * \brief Mapping from time within a line to pixel, for LineClockPixellator.
+ *
+ * The line (the span of time following each line marker, after the line
+ * delay) is divided into intervals, each of which belongs to a pixel or to no
+ * pixel (e.g. the turnaround of a resonant scanner). A line may cover one
+ * image row or, for bidirectional scanning with one line marker per scan
+ * period, two rows (the forward and reverse sweeps); see GetRowsPerLine().
+ *
+ * Linear() is the plain unidirectional mapping, in which the pixel is
+ * computed (exactly as pixelsPerLine * timeInLine / lineTime) using a
+ * fixed-point reciprocal. Other mappings are given as tables of pixel
+ * boundary times, and the interval is found using a coarse index by time
+ * followed by (usually at most one) comparison with the next boundary, so
+ * that the per-photon cost does not depend on the number of pixels.
+ */
+class LineMapping {
+public:
+    static constexpr uint32_t NoPixel = UINT32_MAX;
+
+private:
+    uint32_t pixelsPerLine;
+    uint32_t rowsPerLine;
+    bool linear;
+
+    // Interval i is [starts[i], starts[i + 1]); the last element is the line
+    // time. For linear mapping, interval i is pixel i.
+    std::vector<uint32_t> starts;
+    // Pixel of each interval: x, plus RowBit if in the second row; or
+    // NoPixel. (Kept in one table so that a lookup touches less memory.)
+    static constexpr uint32_t RowBit = 1u << 31;
+    std::vector<uint32_t> pixels;
+
+    // Linear: 2^32 * pixelsPerLine / lineTime, rounded down
+    uint64_t pixelsPerTime32;
+
+    // Nonlinear: interval containing time (b << coarseShift), for each b
+    std::vector<uint32_t> coarseIndex;
+    uint32_t coarseShift;
+
+    LineMapping() :
+        pixelsPerLine(0),
+        rowsPerLine(1),
+        linear(false),
+        pixelsPerTime32(0),
+        coarseShift(0)
+    {}
+
+    void AppendInterval(uint32_t start, uint32_t x, uint32_t row) {
+        if (!starts.empty() && start < starts.back()) {
+            throw std::invalid_argument("Pixel boundaries must not decrease");
+        }
+        uint32_t const pixel = x == NoPixel ? NoPixel : x | (row << 31);
+        if (!starts.empty() && start == starts.back()) {
+            pixels.back() = pixel; // Drop the previous, empty, interval
+            return;
+        }
+        starts.push_back(start);
+        pixels.push_back(pixel);
+    }
+
+    // Append the pixels given by boundaries (size pixelsPerLine + 1), in
+    // time order, preceded by a gap if there is one
+    void AppendPixels(std::vector<uint32_t> const& boundaries, bool reverse,
+        uint32_t row) {
+        if (boundaries.size() != std::size_t(pixelsPerLine) + 1) {
+            throw std::invalid_argument("Pixel boundaries must number pixelsPerLine + 1");
+        }
+        uint32_t const gapStart = starts.empty() ? 0 : starts.back();
+        if (boundaries[0] > gapStart) {
+            if (starts.empty()) {
+                AppendInterval(0, NoPixel, 0);
+            }
+            else {
+                // Overwrite the end marker of the previous sweep with a gap
+                pixels.back() = NoPixel;
+            }
+        }
+        else if (!starts.empty()) {
+            if (boundaries[0] < gapStart) {
+                throw std::invalid_argument("Reverse sweep must not overlap forward sweep");
+            }
+            starts.pop_back();
+            pixels.pop_back();
+        }
+        for (uint32_t k = 0; k < pixelsPerLine; ++k) {
+            AppendInterval(boundaries[k], reverse ? pixelsPerLine - 1 - k : k, row);
+        }
+        AppendInterval(boundaries[pixelsPerLine], NoPixel, 0); // End
+    }
+
+    void BuildCoarseIndex() {
+        uint32_t const lineTime = starts.back();
+        if (lineTime < 1) {
+            throw std::invalid_argument("Line time must be positive");
+        }
+
+        // Bins no wider than the narrowest interval, so that a lookup
+        // usually needs at most one step; but not too many bins
+        uint32_t minWidth = lineTime;
+        for (std::size_t i = 0; i + 1 < starts.size(); ++i) {
+            uint32_t const width = starts[i + 1] - starts[i];
+            if (width < minWidth) { // Empty intervals are not stored
+                minWidth = width;
+            }
+        }
+        coarseShift = 0;
+        while ((2u << coarseShift) <= minWidth && coarseShift < 31) {
+            ++coarseShift;
+        }
+        while ((lineTime >> coarseShift) >= (1u << 20)) {
+            ++coarseShift;
+        }
+
+        coarseIndex.resize((std::size_t(lineTime - 1) >> coarseShift) + 1);
+        uint32_t i = 0;
+        for (std::size_t b = 0; b < coarseIndex.size(); ++b) {
+            uint64_t const t = uint64_t(b) << coarseShift;
+            while (t >= starts[i + 1]) {
+                ++i;
+            }
+            coarseIndex[b] = i;
+        }
+    }
+
+public:
+    /**
+     * \brief Pixels of equal duration over one sweep.
+     *
+     * \param pixelsPerLine number of pixels
+     * \param lineTime duration of the line, in macro-time units
+     */
+    static LineMapping Linear(uint32_t pixelsPerLine, uint32_t lineTime) {
+        if (pixelsPerLine < 1) {
+            throw std::invalid_argument("pixelsPerLine must be positive");
+        }
+        if (lineTime < 1) {
+            throw std::invalid_argument("lineTime must be positive");
+        }
+        LineMapping m;
+        m.pixelsPerLine = pixelsPerLine;
+        m.linear = true;
+        m.pixelsPerTime32 = (uint64_t(pixelsPerLine) << 32) / lineTime;
+        m.starts.resize(std::size_t(pixelsPerLine) + 1);
+        for (uint32_t x = 0; x <= pixelsPerLine; ++x) {
+            m.starts[x] = static_cast<uint32_t>(
+                (uint64_t(x) * lineTime + pixelsPerLine - 1) / pixelsPerLine);
+        }
+        return m;
+    }
+
+    /**
+     * \brief Mapping given by pixel boundary times.
+     *
+     * Times before the first forward boundary, and between the sweeps, belong
+     * to no pixel. The line ends at the last boundary.
+     *
+     * \param forwardBoundaries start times of pixels x = 0, 1, ..., and the
+     * end of the last pixel (pixelsPerLine + 1 nondecreasing times)
+     * \param reverseBoundaries empty (unidirectional) or, for the reverse
+     * sweep, which forms a second row in which x decreases with time, the
+     * start times of pixels x = pixelsPerLine - 1, ..., 0 and the end of
+     * pixel 0
+     */
+    static LineMapping FromBoundaries(
+        std::vector<uint32_t> const& forwardBoundaries,
+        std::vector<uint32_t> const& reverseBoundaries = {}) {
+        if (forwardBoundaries.size() < 2) {
+            throw std::invalid_argument("pixelsPerLine must be positive");
+        }
+        LineMapping m;
+        m.pixelsPerLine = static_cast<uint32_t>(forwardBoundaries.size() - 1);
+        m.rowsPerLine = reverseBoundaries.empty() ? 1 : 2;
+        m.AppendPixels(forwardBoundaries, false, 0);
+        if (!reverseBoundaries.empty()) {
+            m.AppendPixels(reverseBoundaries, true, 1);
+        }
+        m.BuildCoarseIndex();
+        return m;
+    }
+
+    /**
+     * \brief Mapping for a resonant (sinusoidal) scanner.
+     *
+     * Position is taken to be -cos(2 pi t / scanPeriod) relative to the line
+     * start, so that the forward sweep is centered at a quarter period and
+     * the reverse sweep at three quarters. Pixels are of equal size in
+     * position, over the central fillFraction of the time of each sweep.
+     * (The line delay can be used to adjust the phase.)
+     *
+     * \param pixelsPerLine number of pixels
+     * \param scanPeriod period of the scanner (interval between line
+     * markers), in macro-time units
+     * \param fillFraction fraction (greater than 0 and at most 1) of each
+     * sweep used for pixels; less than 1 leaves a margin for variation in the
+     * scan period
+     * \param bidirectional whether to use the reverse sweep as a second row
+     */
+    static LineMapping Sinusoidal(uint32_t pixelsPerLine, uint32_t scanPeriod,
+        double fillFraction, bool bidirectional) {
+        if (pixelsPerLine < 1) {
+            throw std::invalid_argument("pixelsPerLine must be positive");
+        }
+        if (!(fillFraction > 0.0 && fillFraction <= 1.0)) {
+            throw std::invalid_argument("fillFraction must be in (0, 1]");
+        }
+        double const pi = std::acos(-1.0);
+        double const amplitude = std::sin(0.5 * pi * fillFraction);
+        auto timeAt = [&](uint32_t x) { // Forward sweep
+            double const position = amplitude * (2.0 * x / pixelsPerLine - 1.0);
+            return scanPeriod / (2.0 * pi) * std::acos(-position);
+        };
+
+        std::vector<uint32_t> forward(std::size_t(pixelsPerLine) + 1);
+        std::vector<uint32_t> reverse;
+        for (uint32_t x = 0; x <= pixelsPerLine; ++x) {
+            forward[x] = static_cast<uint32_t>(std::round(timeAt(x)));
+        }
+        if (bidirectional) {
+            reverse.resize(std::size_t(pixelsPerLine) + 1);
+            for (uint32_t k = 0; k <= pixelsPerLine; ++k) {
+                reverse[k] = static_cast<uint32_t>(std::round(
+                    scanPeriod - timeAt(pixelsPerLine - k)));
+            }
+        }
+        return FromBoundaries(forward, reverse);
+    }
+
+    uint32_t GetPixelsPerLine() const noexcept {
+        return pixelsPerLine;
+    }
+
+    // Image rows covered by each line (1, or 2 if bidirectional)
+    uint32_t GetRowsPerLine() const noexcept {
+        return rowsPerLine;
+    }
+
+    // Time from line start to end of the last pixel
+    uint32_t GetLineTime() const noexcept {
+        return starts.back();
+    }
+
+    // Find the pixel at timeInLine, which must be less than the line time.
+    // Returns false if the time is not in a pixel.
+    bool Map(uint32_t timeInLine, uint32_t& x, uint32_t& row) const noexcept {
+        if (linear) {
+            // timeInLine < lineTime < 2^32, so the product does not overflow
+            // and is less than 1 short of the exact quotient; the result is
+            // therefore x or x - 1, and comparing with the start of the next
+            // pixel corrects it.
+            auto i = static_cast<uint32_t>((timeInLine * pixelsPerTime32) >> 32);
+            if (timeInLine >= starts[i + 1]) {
+                ++i;
+            }
+            x = i;
+            row = 0;
+            return true;
+        }
+
+        // Unless the index is capped in size, a bin contains at most one
+        // boundary, so the loop is not usually entered
+        uint32_t i = coarseIndex[timeInLine >> coarseShift];
+        i += timeInLine >= starts[i + 1];
+        while (timeInLine >= starts[i + 1]) {
+            ++i;
+        }
+        uint32_t const pixel = pixels[i];
+        x = pixel & ~RowBit;
+        row = pixel >> 31;
+        return pixel != NoPixel;
+    }
+};
@@ -0,0 +1,438 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#if defined(_WIN32)
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#       define FLIMEVENTS_UNDEF_NOMINMAX
+#   endif
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#       define FLIMEVENTS_UNDEF_WIN32_LEAN_AND_MEAN
+#   endif
+#   include <Windows.h>
+#   ifdef FLIMEVENTS_UNDEF_NOMINMAX
+#       undef NOMINMAX
+#       undef FLIMEVENTS_UNDEF_NOMINMAX
+#   endif
+#   ifdef FLIMEVENTS_UNDEF_WIN32_LEAN_AND_MEAN
+#       undef WIN32_LEAN_AND_MEAN
+#       undef FLIMEVENTS_UNDEF_WIN32_LEAN_AND_MEAN
+#   endif
+#   ifdef _MSC_VER
+#       pragma comment(lib, "Synchronization.lib") // WaitOnAddress()
+#   endif
+#elif defined(__linux__)
+#   include <climits>
+#   include <linux/futex.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#else
+#   include <chrono>
+#endif
+
+
+// Lock-free queues used to pass event buffers and batches between threads
+// (see StreamBuffer.hpp, DecodedEventQueue.hpp, and PixelPhotonQueue.hpp).
+// These are internal to FLIMEvents.
+
+namespace flimevents {
+namespace internal {
+
+    // Padding between data written by different threads avoids false
+    // sharing (without requiring over-aligned allocation, which C++14 lacks)
+    constexpr std::size_t CacheLineSize = 64;
+
+    inline bool IsPowerOfTwo(std::size_t n) noexcept {
+        return n > 0 && (n & (n - 1)) == 0;
+    }
+
+    inline std::size_t RoundUpToPowerOfTwo(std::size_t n) noexcept {
+        std::size_t p = 1;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    // Block until the value at word may differ from expected (spurious
+    // returns are possible). Uses the OS facility (futex, WaitOnAddress)
+    // where available.
+    inline void WaitOnWord(std::atomic<uint32_t>& word, uint32_t expected) noexcept {
+        static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+            "atomic<uint32_t> must be usable as a futex word");
+#if defined(_WIN32)
+        WaitOnAddress(reinterpret_cast<volatile VOID*>(&word), &expected,
+            sizeof(expected), INFINITE);
+#elif defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word),
+            FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+        while (word.load(std::memory_order_acquire) == expected) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+#endif
+    }
+
+    inline void WakeAllOnWord(std::atomic<uint32_t>& word) noexcept {
+#if defined(_WIN32)
+        WakeByAddressAll(reinterpret_cast<PVOID>(&word));
+#elif defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word),
+            FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+        (void)word;
+#endif
+    }
+
+    // Lets threads wait for a condition that other threads make true
+    // (an "event count"). A waiter calls PrepareWait(), checks the
+    // condition, and then either CancelWait() or Wait(). A notifier makes the
+    // condition true, then calls NotifyAll(), which only makes a system call
+    // if a thread may be waiting.
+    class WaitSignal {
+        std::atomic<uint32_t> sequence;
+        std::atomic<uint32_t> waiterCount;
+
+    public:
+        WaitSignal() noexcept : sequence(0), waiterCount(0) {}
+
+        WaitSignal(WaitSignal const&) = delete;
+        WaitSignal& operator=(WaitSignal const&) = delete;
+
+        uint32_t PrepareWait() noexcept {
+            waiterCount.fetch_add(1, std::memory_order_seq_cst);
+            return sequence.load(std::memory_order_seq_cst);
+        }
+
+        void CancelWait() noexcept {
+            waiterCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        void Wait(uint32_t key) noexcept {
+            while (sequence.load(std::memory_order_seq_cst) == key) {
+                WaitOnWord(sequence, key);
+            }
+            waiterCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        void NotifyAll() noexcept {
+            sequence.fetch_add(1, std::memory_order_seq_cst);
+            if (waiterCount.load(std::memory_order_seq_cst) > 0) {
+                WakeAllOnWord(sequence);
+            }
+        }
+    };
+
+    // Spin briefly, then block, until tryFunc() returns true. Spinning
+    // avoids the cost of a system call when the wait is short.
+    template <typename F>
+    inline void SpinThenWait(WaitSignal& signal, F tryFunc) {
+        for (int i = 0; i < 64; ++i) {
+            if (tryFunc()) {
+                return;
+            }
+            if (i >= 16) {
+                std::this_thread::yield();
+            }
+        }
+        for (;;) {
+            uint32_t key = signal.PrepareWait();
+            if (tryFunc()) {
+                signal.CancelWait();
+                return;
+            }
+            signal.Wait(key);
+            if (tryFunc()) {
+                return;
+            }
+        }
+    }
+
+
+    /**
+     * \brief Bounded single-producer, single-consumer queue.
+     *
+     * TryPush() must only be called from one thread at a time, and likewise
+     * TryPop(). Capacity must be a power of 2.
+     *
+     * \tparam T element type (movable and default-constructible)
+     */
+    template <typename T>
+    class SPSCQueue {
+        std::size_t const mask;
+        std::unique_ptr<T[]> slots;
+
+        // Producer's data
+        char padding0[CacheLineSize];
+        std::atomic<std::size_t> tail; // Next push
+        std::size_t cachedHead;
+
+        // Consumer's data
+        char padding1[CacheLineSize];
+        std::atomic<std::size_t> head; // Next pop
+        std::size_t cachedTail;
+        char padding2[CacheLineSize];
+
+    public:
+        explicit SPSCQueue(std::size_t capacity) :
+            mask(capacity - 1),
+            slots(new T[capacity]),
+            tail(0),
+            cachedHead(0),
+            head(0),
+            cachedTail(0)
+        {
+            if (!IsPowerOfTwo(capacity)) {
+                throw std::invalid_argument("Queue capacity must be a power of 2");
+            }
+        }
+
+        SPSCQueue(SPSCQueue const&) = delete;
+        SPSCQueue& operator=(SPSCQueue const&) = delete;
+
+        std::size_t GetCapacity() const noexcept {
+            return mask + 1;
+        }
+
+        // Approximate when called concurrently with push or pop
+        std::size_t GetSize() const noexcept {
+            return tail.load(std::memory_order_acquire) -
+                head.load(std::memory_order_acquire);
+        }
+
+        // Returns false (leaving item unmoved) if full
+        bool TryPush(T&& item) {
+            std::size_t const t = tail.load(std::memory_order_relaxed);
+            if (t - cachedHead > mask) {
+                cachedHead = head.load(std::memory_order_seq_cst);
+                if (t - cachedHead > mask) {
+                    return false;
+                }
+            }
+            slots[t & mask] = std::move(item);
+            tail.store(t + 1, std::memory_order_seq_cst);
+            return true;
+        }
+
+        // Returns false if empty
+        bool TryPop(T& item) {
+            std::size_t const h = head.load(std::memory_order_relaxed);
+            if (h == cachedTail) {
+                cachedTail = tail.load(std::memory_order_seq_cst);
+                if (h == cachedTail) {
+                    return false;
+                }
+            }
+            item = std::move(slots[h & mask]);
+            slots[h & mask] = T();
+            head.store(h + 1, std::memory_order_seq_cst);
+            return true;
+        }
+    };
+
+
+    /**
+     * \brief Bounded multi-producer, multi-consumer queue.
+     *
+     * This is Dmitry Vyukov's bounded MPMC queue: each slot has a sequence
+     * number that tells producers and consumers whether it is ready for
+     * them, so that each operation takes a single compare-and-swap in the
+     * absence of contention. Capacity must be a power of 2.
+     *
+     * \tparam T element type (trivially copyable, such as a pointer)
+     */
+    template <typename T>
+    class MPMCQueue {
+        struct Slot {
+            std::atomic<std::size_t> sequence;
+            T value;
+        };
+
+        std::size_t const mask;
+        std::unique_ptr<Slot[]> slots;
+
+        char padding0[CacheLineSize];
+        std::atomic<std::size_t> enqueuePos;
+        char padding1[CacheLineSize];
+        std::atomic<std::size_t> dequeuePos;
+        char padding2[CacheLineSize];
+
+    public:
+        explicit MPMCQueue(std::size_t capacity) :
+            mask(capacity - 1),
+            slots(new Slot[capacity]),
+            enqueuePos(0),
+            dequeuePos(0)
+        {
+            if (!IsPowerOfTwo(capacity)) {
+                throw std::invalid_argument("Queue capacity must be a power of 2");
+            }
+            for (std::size_t i = 0; i < capacity; ++i) {
+                slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MPMCQueue(MPMCQueue const&) = delete;
+        MPMCQueue& operator=(MPMCQueue const&) = delete;
+
+        std::size_t GetCapacity() const noexcept {
+            return mask + 1;
+        }
+
+        // Returns false if full
+        bool TryPush(T value) noexcept {
+            std::size_t pos = enqueuePos.load(std::memory_order_relaxed);
+            Slot* slot;
+            for (;;) {
+                slot = &slots[pos & mask];
+                std::size_t seq = slot->sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+                if (diff == 0) {
+                    if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+                        std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                else if (diff < 0) {
+                    return false;
+                }
+                else {
+                    pos = enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+            slot->value = value;
+            slot->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Returns false if empty
+        bool TryPop(T& value) noexcept {
+            std::size_t pos = dequeuePos.load(std::memory_order_relaxed);
+            Slot* slot;
+            for (;;) {
+                slot = &slots[pos & mask];
+                std::size_t seq = slot->sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+                if (diff == 0) {
+                    if (dequeuePos.compare_exchange_weak(pos, pos + 1,
+                        std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                else if (diff < 0) {
+                    return false;
+                }
+                else {
+                    pos = dequeuePos.load(std::memory_order_relaxed);
+                }
+            }
+            value = slot->value;
+            slot->sequence.store(pos + mask + 1, std::memory_order_release);
+            return true;
+        }
+    };
+
+
+    /**
+     * \brief Bounded queue passing batches from one thread to another.
+     *
+     * Batches are passed by pointer, and the receiver returns them (with
+     * Recycle()) so that, once enough batches exist, the sender reuses them
+     * without allocation. The stream is terminated by Finish() or Fail(), and
+     * the receiver sees the termination after all batches sent before it.
+     * Both ends spin briefly and then block, as with EventStream.
+     *
+     * \tparam B batch type (default-constructible, with Clear())
+     */
+    template <typename B>
+    class BatchQueue {
+        SPSCQueue<std::unique_ptr<B>> sent;
+        SPSCQueue<std::unique_ptr<B>> recycled;
+        WaitSignal notEmpty;
+        WaitSignal notFull;
+        bool failed; // Written before the terminating null
+        std::string errorMessage;
+
+        void Push(std::unique_ptr<B> batch) {
+            SpinThenWait(notFull, [&] {
+                return sent.TryPush(std::move(batch));
+            });
+            notEmpty.NotifyAll();
+        }
+
+    public:
+        // capacity (a power of 2) limits the batches in flight; Send() blocks
+        // when it is reached
+        explicit BatchQueue(std::size_t capacity) :
+            sent(capacity),
+            recycled(capacity),
+            failed(false)
+        {}
+
+        BatchQueue(BatchQueue const&) = delete;
+        BatchQueue& operator=(BatchQueue const&) = delete;
+
+        // Sender: an empty batch, reused if one has been recycled
+        std::unique_ptr<B> GetEmptyBatch() {
+            std::unique_ptr<B> batch;
+            if (recycled.TryPop(batch)) {
+                batch->Clear();
+                return batch;
+            }
+            return std::unique_ptr<B>(new B());
+        }
+
+        // Sender: batch must not be null
+        void Send(std::unique_ptr<B> batch) {
+            Push(std::move(batch));
+        }
+
+        // Sender: terminate the stream
+        void Finish() {
+            Push({});
+        }
+
+        // Sender: terminate the stream with an error
+        void Fail(std::string const& message) {
+            errorMessage = message;
+            failed = true;
+            Push({});
+        }
+
+        // Receiver: a null return value indicates that the stream has been
+        // terminated (see IsFailed()). Subsequent calls will block forever.
+        std::unique_ptr<B> ReceiveBlocking() {
+            std::unique_ptr<B> batch;
+            SpinThenWait(notEmpty, [&] {
+                return sent.TryPop(batch);
+            });
+            notFull.NotifyAll();
+            return batch;
+        }
+
+        // Receiver: return a batch for reuse (discarded if enough are kept)
+        void Recycle(std::unique_ptr<B> batch) {
+            recycled.TryPush(std::move(batch));
+        }
+
+        // Receiver: after termination, whether it was by Fail()
+        bool IsFailed() const noexcept {
+            return failed;
+        }
+
+        std::string const& GetErrorMessage() const noexcept {
+            return errorMessage;
+        }
+    };
+
+}
+}
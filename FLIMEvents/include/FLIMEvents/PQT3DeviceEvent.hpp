@@ -1,10 +1,7 @@
 #pragma once
 
 #include "DeviceEvent.hpp"
-
-// I implemented PicoQuant event types to verify that the framework can handle
-// a good range of raw event stream formats. But it has not been excercised.
-#error "This code is untested; use only after testing"
+#include "PQT3EventSIMD.hpp"
 
 // PicoQuant raw photon event ("TTTR") formats are documented in the html files
 // contained in this repository:
@@ -21,6 +18,10 @@
 // names for static polymorphism. This allows PQT3EventDecoder<E> to handle 3
 // different formats with the same code.
 
+// Unlike BH macro-times, nsync values are not unique to each record: several
+// photons (on different channels) and markers can occur in the same sync
+// period. The decoders therefore only require nsync to be non-decreasing.
+
 
 /**
  * \brief Binary record interpretation for PicoHarp T3 Format.
@@ -28,12 +29,12 @@
  * RecType 0x00010303.
  */
 struct PicoT3Event {
-    char bytes[4];
+    uint8_t bytes[4];
 
-    static uint64_t const NSyncOverflowPeriod = 65536;
+    static constexpr uint64_t NSyncOverflowPeriod = 65536;
 
     uint8_t GetChannel() const noexcept {
-        return uint8_t(bytes[3]) >> 4;
+        return bytes[3] >> 4;
     }
 
     uint16_t GetDTime() const noexcept {
@@ -63,7 +64,7 @@ struct PicoT3Event {
     }
 
     uint16_t GetExternalMarkerBits() const noexcept {
-        return GetDTime();
+        return GetDTime() & 0x0f;
     }
 };
 
@@ -79,7 +80,7 @@ template <bool IsHydraV1>
 struct HydraT3Event {
     uint8_t bytes[4];
 
-    static uint64_t const NSyncOverflowPeriod = 1024;
+    static constexpr uint64_t NSyncOverflowPeriod = 1024;
 
     bool GetSpecialFlag() const noexcept {
         return bytes[3] & (1 << 7);
@@ -90,7 +91,7 @@ struct HydraT3Event {
     }
 
     uint16_t GetDTime() const noexcept {
-        uint8_t lo6 = uint8_t(bytes[1]) >> 2;
+        uint8_t lo6 = bytes[1] >> 2;
         uint8_t mid8 = bytes[2];
         uint8_t hi1 = bytes[3] & 0x01;
         return lo6 | (uint16_t(mid8) << 6) | (uint16_t(hi1) << 14);
@@ -111,7 +112,7 @@ struct HydraT3Event {
     }
 
     uint16_t GetNSyncOverflowCount() const noexcept {
-        if (IsHydraHarpV1 || GetNSync() == 0) {
+        if (IsHydraV1 || GetNSync() == 0) {
             return 1;
         }
         return GetNSync();
@@ -127,66 +128,157 @@ struct HydraT3Event {
 };
 
 
+// Bit field layout of each T3 format, for vectorized decoding (see
+// PQT3EventSIMD.hpp)
+template <typename E>
+struct PQT3RecordLayout;
+
+template <>
+struct PQT3RecordLayout<PicoT3Event> {
+    static constexpr uint32_t NSyncMask = 0xffff;
+    static constexpr unsigned DTimeShift = 16;
+    static constexpr uint32_t DTimeMask = 0x0fff;
+    static constexpr unsigned ChannelShift = 28;
+    static constexpr uint32_t ChannelMask = 0x0f;
+    static constexpr uint32_t SpecialMask = 0xf0000000; // Channel 15
+};
+
+template <bool IsHydraV1>
+struct PQT3RecordLayout<HydraT3Event<IsHydraV1>> {
+    static constexpr uint32_t NSyncMask = 0x03ff;
+    static constexpr unsigned DTimeShift = 10;
+    static constexpr uint32_t DTimeMask = 0x7fff;
+    static constexpr unsigned ChannelShift = 25;
+    static constexpr uint32_t ChannelMask = 0x3f;
+    static constexpr uint32_t SpecialMask = 0x80000000; // Special flag
+};
+
+
 /**
- * \brief Decode PicoQuant T3 event stream. 
+ * \brief Decode PicoQuant T3 event stream.
+ *
+ * As with BHEventDecoder, events can be decoded one at a time
+ * (HandleDeviceEvent()) or a buffer at a time (HandleDeviceEvents(), which
+ * sends a single DecodedEventBatch, using vectorized code for runs of photon
+ * records where available).
+ *
+ * Since photons and markers can share an nsync value, a batch may deliver a
+ * marker before photons with the same nsync that preceded it in the raw
+ * stream (see DecodedEventBatch).
  *
  * User code should normally use one of the following concrete classes:
  * PQPicoT3EventDecoder, PQHydraV1T3EventDecoder, PQHydraV2T3EventDecoder.
  *
  * \tparam E binary record interpreter class
+ * \tparam D downstream holder (see BasicDeviceEventDecoder)
  */
-template <typename E>
-class PQT3EventDecoder : public DeviceEventDecoder {
+template <typename E,
+    typename D = std::shared_ptr<DecodedEventProcessor>>
+class PQT3EventDecoder : public BasicDeviceEventDecoder<D> {
     uint64_t nSyncBase;
     uint64_t lastNSync;
 
+    DecodedEventBatch batch; // Reused to avoid reallocation
+    PQT3FastDecodeFunction fastDecode; // Null if not available
+
+    using EventSender = typename BasicDeviceEventDecoder<D>::EventSender;
+    using BatchAppender = typename BasicDeviceEventDecoder<D>::BatchAppender;
+
+    // Decode a single record, passing the result to sink. Returns false if
+    // the record is invalid (in which case the sink is not called).
+    template <typename S>
+    bool DecodeEvent(E const* devEvt, S& sink) {
+        if (devEvt->IsNSyncOverflow()) {
+            nSyncBase += E::NSyncOverflowPeriod * devEvt->GetNSyncOverflowCount();
+            sink.Timestamp(nSyncBase);
+            return true;
+        }
+
+        uint64_t nSync = nSyncBase + devEvt->GetNSync();
+
+        // Validate input: ensure nSync does not decrease (a common assumption
+        // made by downstream processors)
+        if (nSync < lastNSync) {
+            return false;
+        }
+        lastNSync = nSync;
+
+        if (devEvt->IsExternalMarker()) {
+            sink.Marker(nSync, devEvt->GetExternalMarkerBits());
+            return true;
+        }
+
+        sink.ValidPhoton(nSync, devEvt->GetDTime(), devEvt->GetChannel());
+        return true;
+    }
+
 public:
-    PQT3EventDecoder(std::shared_ptr<DecodedEventProcessor> downstream) :
-        DeviceEventDecoder(downstream),
+    PQT3EventDecoder(D downstream) :
+        BasicDeviceEventDecoder<D>(std::move(downstream)),
         nSyncBase(0),
-        lastNSync(0)
+        lastNSync(0),
+        fastDecode(GetPQT3FastDecodeFunction<PQT3RecordLayout<E>>(SIMDLevel::AVX2))
     {}
 
-    std::size_t GetEventSize() const override {
+    // Limit the SIMD instruction set used (mainly for testing). The level is
+    // further limited to what the CPU supports.
+    void SetSIMDLevel(SIMDLevel level) noexcept {
+        fastDecode = GetPQT3FastDecodeFunction<PQT3RecordLayout<E>>(level);
+    }
+
+    std::size_t GetEventSize() const noexcept override {
         return sizeof(E);
     }
 
     void HandleDeviceEvent(char const* event) override {
-        E const* devEvt = reinterpret_cast<E const*>(event);
-
-        if (devEvt->IsNSyncOverflow()) {
-            nSyncBase += E::NSyncOverflowPeriod * devEvt->GetNSyncOverflowCount();
-
-            DecodedEvent e;
-            e.macrotime = nSyncBase;
-            SendTimestamp(e);
+        if (!this->HasDownstream()) {
             return;
         }
 
-        uint64_t nSync = nSyncBase + devEvt->GetNSync();
+        E const* devEvt = reinterpret_cast<E const*>(event);
+        EventSender sender(*this);
+        if (!DecodeEvent(devEvt, sender)) {
+            this->SendError("Non-monotonic nsync encountered");
+        }
+    }
 
-        // Validate input: ensure nSync increases monotonically (a common
-        // assumption made by downstream processors)
-        if (nSync <= lastNSync) {
-            SendError("Non-monotonic nsync encountered");
+    void HandleDeviceEvents(char const* events, std::size_t count) override {
+        if (!this->HasDownstream()) {
             return;
         }
-        lastNSync = nSync;
 
-        if (devEvt->IsExternalMarker()) {
-            MarkerEvent e;
-            e.macrotime = nSync;
-            e.bits = devEvt->GetExternalMarkerBits();
-            SendMarker(e);
-            return;
+        E const* devEvts = reinterpret_cast<E const*>(events);
+        batch.ClearForDecoding(count);
+        BatchAppender appender(*this, batch);
+        bool ok = true;
+        std::size_t i = 0;
+        while (ok && i < count) {
+            if (fastDecode) {
+                auto n = fastDecode(devEvts + i, count - i,
+                    nSyncBase, lastNSync,
+                    batch.photonMacrotimes.data() + appender.photonCount,
+                    batch.photonMicrotimes.data() + appender.photonCount,
+                    batch.photonRoutes.data() + appender.photonCount);
+                i += n;
+                appender.CommitPhotons(n);
+            }
+
+            // Records that the fast path could not handle (at least a block)
+            std::size_t blockEnd = i + 8 < count ? i + 8 : count;
+            for (; i < blockEnd; ++i) {
+                if (!DecodeEvent(devEvts + i, appender)) {
+                    ok = false;
+                    break;
+                }
+            }
         }
+        batch.ResizePhotons(appender.photonCount);
 
-        PhotonEvent e;
-        e.macrotime = nSync;
-        e.microtime = devEvt->GetDTime();
-        e.route = devEvt->GetChannel();
-        e.valid = true;
-        SendPhoton(e);
+        // Events preceding an error are sent, as with HandleDeviceEvent()
+        this->SendEventBatch(batch);
+        if (!ok) {
+            this->SendError("Non-monotonic nsync encountered");
+        }
     }
 };
 
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "SIMDSupport.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+
+// Vectorized decoding of PicoQuant T3 records (PicoT3Event, HydraT3Event).
+//
+// As with the BH decoder, the kernels only handle the common case: blocks of
+// 8 records that are all photons (not special records), with non-decreasing
+// nsync. Since nsync overflows are always separate (special) records, the
+// nsync base is constant within such a block. The kernels stop at the first
+// block that does not meet these conditions, leaving it to the scalar decoder.
+//
+// Each 4-byte record is viewed as a little-endian 32-bit word. The formats
+// differ only in the positions of the bit fields, which are given by a layout
+// class with the following members:
+//   NSyncMask: nsync field (at bit 0)
+//   DTimeShift, DTimeMask: dtime (micro-time) field
+//   ChannelShift, ChannelMask: channel (route) field
+//   SpecialMask: the record is special if all of these bits are set
+
+
+// Decode leading blocks of photon records. Returns the number of records
+// decoded (a multiple of 8), each of which produced a photon written to the
+// output arrays. lastNSync is updated as it would be by the scalar decoder.
+using PQT3FastDecodeFunction = std::size_t (*)(void const* events,
+    std::size_t count, uint64_t& nSyncBase, uint64_t& lastNSync,
+    uint64_t* macrotimes, uint16_t* microtimes, uint16_t* routes);
+
+
+namespace flimevents {
+namespace internal {
+
+#ifdef FLIMEVENTS_X86_64
+
+    template <typename L>
+    FLIMEVENTS_TARGET_SSE41
+    inline std::size_t DecodePQT3FastSSE41(void const* events,
+        std::size_t count, uint64_t& nSyncBase, uint64_t& lastNSync,
+        uint64_t* macrotimes, uint16_t* microtimes, uint16_t* routes) {
+        auto const* src = static_cast<char const*>(events);
+        __m128i const special = _mm_set1_epi32(int(L::SpecialMask));
+        __m128i const nsyncMask = _mm_set1_epi32(int(L::NSyncMask));
+        __m128i const dtimeMask = _mm_set1_epi32(int(L::DTimeMask));
+        __m128i const channelMask = _mm_set1_epi32(int(L::ChannelMask));
+
+        uint64_t const base = nSyncBase;
+        uint64_t last = lastNSync;
+        __m128i const vbase = _mm_set1_epi64x(int64_t(base));
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i w0 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + 4 * i));
+            __m128i w1 = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src + 4 * i + 16));
+
+            __m128i isSpecial = _mm_or_si128(
+                _mm_cmpeq_epi32(_mm_and_si128(w0, special), special),
+                _mm_cmpeq_epi32(_mm_and_si128(w1, special), special));
+            if (!_mm_testz_si128(isSpecial, isSpecial)) {
+                break;
+            }
+
+            // nsync fields are at most 16 bits, so signed comparison is safe
+            __m128i t0 = _mm_and_si128(w0, nsyncMask);
+            __m128i t1 = _mm_and_si128(w1, nsyncMask);
+
+            // Non-decreasing within block (lane 0 checked below)
+            __m128i prev0 = _mm_slli_si128(t0, 4);
+            __m128i prev1 = _mm_alignr_epi8(t1, t0, 12);
+            __m128i decreasing = _mm_or_si128(_mm_cmpgt_epi32(prev0, t0),
+                _mm_cmpgt_epi32(prev1, t1));
+            uint64_t const first = base + uint32_t(_mm_cvtsi128_si32(t0));
+            if (!_mm_testz_si128(decreasing, decreasing) || first < last) {
+                break;
+            }
+
+            auto* mtDst = reinterpret_cast<__m128i*>(macrotimes + i);
+            _mm_storeu_si128(mtDst + 0, _mm_add_epi64(vbase, _mm_cvtepu32_epi64(t0)));
+            _mm_storeu_si128(mtDst + 1, _mm_add_epi64(vbase, _mm_cvtepu32_epi64(_mm_srli_si128(t0, 8))));
+            _mm_storeu_si128(mtDst + 2, _mm_add_epi64(vbase, _mm_cvtepu32_epi64(t1)));
+            _mm_storeu_si128(mtDst + 3, _mm_add_epi64(vbase, _mm_cvtepu32_epi64(_mm_srli_si128(t1, 8))));
+
+            __m128i dtime = _mm_packus_epi32(
+                _mm_and_si128(_mm_srli_epi32(w0, L::DTimeShift), dtimeMask),
+                _mm_and_si128(_mm_srli_epi32(w1, L::DTimeShift), dtimeMask));
+            __m128i channel = _mm_packus_epi32(
+                _mm_and_si128(_mm_srli_epi32(w0, L::ChannelShift), channelMask),
+                _mm_and_si128(_mm_srli_epi32(w1, L::ChannelShift), channelMask));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(microtimes + i), dtime);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(routes + i), channel);
+
+            last = base + uint32_t(_mm_extract_epi32(t1, 3));
+        }
+
+        lastNSync = last;
+        return i;
+    }
+
+    template <typename L>
+    FLIMEVENTS_TARGET_AVX2
+    inline std::size_t DecodePQT3FastAVX2(void const* events,
+        std::size_t count, uint64_t& nSyncBase, uint64_t& lastNSync,
+        uint64_t* macrotimes, uint16_t* microtimes, uint16_t* routes) {
+        auto const* src = static_cast<char const*>(events);
+        __m256i const special = _mm256_set1_epi32(int(L::SpecialMask));
+        __m256i const nsyncMask = _mm256_set1_epi32(int(L::NSyncMask));
+        __m256i const dtimeMask = _mm256_set1_epi32(int(L::DTimeMask));
+        __m256i const channelMask = _mm256_set1_epi32(int(L::ChannelMask));
+        __m256i const previousLane = _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6);
+
+        uint64_t const base = nSyncBase;
+        uint64_t last = lastNSync;
+        __m256i const vbase = _mm256_set1_epi64x(int64_t(base));
+        std::size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256i w = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src + 4 * i));
+
+            __m256i isSpecial = _mm256_cmpeq_epi32(
+                _mm256_and_si256(w, special), special);
+            if (!_mm256_testz_si256(isSpecial, isSpecial)) {
+                break;
+            }
+
+            __m256i t = _mm256_and_si256(w, nsyncMask);
+
+            // Non-decreasing within block (lane 0 compares with itself)
+            __m256i prev = _mm256_permutevar8x32_epi32(t, previousLane);
+            __m256i decreasing = _mm256_cmpgt_epi32(prev, t);
+            __m128i const tLow = _mm256_castsi256_si128(t);
+            __m128i const tHigh = _mm256_extracti128_si256(t, 1);
+            uint64_t const first = base + uint32_t(_mm_cvtsi128_si32(tLow));
+            if (!_mm256_testz_si256(decreasing, decreasing) || first < last) {
+                break;
+            }
+
+            auto* mtDst = reinterpret_cast<__m256i*>(macrotimes + i);
+            _mm256_storeu_si256(mtDst + 0, _mm256_add_epi64(vbase, _mm256_cvtepu32_epi64(tLow)));
+            _mm256_storeu_si256(mtDst + 1, _mm256_add_epi64(vbase, _mm256_cvtepu32_epi64(tHigh)));
+
+            // Pack dtime and channel to 16 bits; packus interleaves the
+            // 128-bit halves, which the permute undoes.
+            __m256i packed = _mm256_packus_epi32(
+                _mm256_and_si256(_mm256_srli_epi32(w, L::DTimeShift), dtimeMask),
+                _mm256_and_si256(_mm256_srli_epi32(w, L::ChannelShift), channelMask));
+            packed = _mm256_permute4x64_epi64(packed, 0xd8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(microtimes + i),
+                _mm256_castsi256_si128(packed));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(routes + i),
+                _mm256_extracti128_si256(packed, 1));
+
+            last = base + uint32_t(_mm_extract_epi32(tHigh, 3));
+        }
+
+        lastNSync = last;
+        return i;
+    }
+
+#endif // FLIMEVENTS_X86_64
+}
+}
+
+
+// Get the fast decoding function for record layout L at the given SIMD level,
+// which is reduced to what the CPU supports. Returns null if there is no
+// vectorized decoder at that level.
+template <typename L>
+inline PQT3FastDecodeFunction GetPQT3FastDecodeFunction(SIMDLevel level) noexcept {
+#ifdef FLIMEVENTS_X86_64
+    SIMDLevel const supported = GetSupportedSIMDLevel();
+    if (level > supported) {
+        level = supported;
+    }
+    switch (level) {
+    case SIMDLevel::AVX2:
+        return flimevents::internal::DecodePQT3FastAVX2<L>;
+    case SIMDLevel::SSE41:
+        return flimevents::internal::DecodePQT3FastSSE41<L>;
+    default:
+        break;
+    }
+#endif
+    return nullptr;
+}
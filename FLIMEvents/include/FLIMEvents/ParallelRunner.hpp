@@ -0,0 +1,141 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Persistent worker threads for splitting a computation into independent
+// parts (see BHDeviceEvent.hpp). Internal to FLIMEvents.
+
+namespace flimevents {
+namespace internal {
+
+    /**
+     * \brief Runs a function for each of a number of indices, on the calling
+     * thread and a set of worker threads that are kept between calls.
+     *
+     * Starting threads for each call would cost more than decoding a
+     * moderately sized buffer, so the workers are started on first use (as
+     * many as the largest call needs) and wait for the next call until the
+     * runner is destroyed.
+     *
+     * Run() may only be called from one thread at a time.
+     */
+    class ParallelRunner {
+        std::mutex mutex;
+        std::condition_variable jobReady;
+        std::condition_variable jobDone;
+        std::vector<std::thread> threads;
+
+        // The current job; protected by mutex
+        std::function<void(std::size_t)> job;
+        uint64_t jobNumber = 0; // Incremented for each job
+        std::size_t indexCount = 0;
+        std::size_t nextIndex = 0;
+        std::size_t unfinishedCount = 0;
+        std::exception_ptr exception;
+        bool stopping = false;
+
+        // Run indices of the current job until none remain unclaimed. Called
+        // with lock held; returns with lock held.
+        void RunClaimedIndices(std::unique_lock<std::mutex>& lock) {
+            while (nextIndex < indexCount) {
+                std::size_t const index = nextIndex++;
+                lock.unlock();
+                std::exception_ptr e;
+                try {
+                    job(index);
+                }
+                catch (...) {
+                    e = std::current_exception();
+                }
+                lock.lock();
+                if (e && !exception) {
+                    exception = e;
+                }
+                if (--unfinishedCount == 0) {
+                    jobDone.notify_one();
+                }
+            }
+        }
+
+        void WorkerLoop(uint64_t lastJobNumber) {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;) {
+                jobReady.wait(lock, [&] {
+                    return stopping || jobNumber != lastJobNumber;
+                });
+                if (stopping) {
+                    return;
+                }
+                lastJobNumber = jobNumber;
+                RunClaimedIndices(lock);
+            }
+        }
+
+    public:
+        ParallelRunner() = default;
+        ParallelRunner(ParallelRunner const&) = delete;
+        ParallelRunner& operator=(ParallelRunner const&) = delete;
+
+        ~ParallelRunner() {
+            {
+                std::lock_guard<std::mutex> hold(mutex);
+                stopping = true;
+            }
+            jobReady.notify_all();
+            for (auto& t : threads) {
+                t.join();
+            }
+        }
+
+        std::size_t GetThreadCount() const noexcept {
+            return threads.size();
+        }
+
+        /**
+         * \brief Call func(k) for k in [0, n), concurrently, and wait for all
+         * calls to return.
+         *
+         * The calling thread takes part. If any call throws, the first
+         * exception is rethrown once all calls have returned.
+         */
+        template <typename F>
+        void Run(std::size_t n, F func) {
+            if (n < 2) {
+                if (n == 1) {
+                    func(0);
+                }
+                return;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            while (threads.size() < n - 1) {
+                // Started before the job is posted, so it takes part
+                threads.emplace_back([this, j = jobNumber] { WorkerLoop(j); });
+            }
+            job = std::ref(func);
+            ++jobNumber;
+            indexCount = n;
+            nextIndex = 0;
+            unfinishedCount = n;
+            exception = nullptr;
+            jobReady.notify_all();
+
+            RunClaimedIndices(lock);
+            jobDone.wait(lock, [&] { return unfinishedCount == 0; });
+            job = nullptr;
+            if (exception) {
+                std::rethrow_exception(exception);
+            }
+        }
+    };
+
+} // namespace internal
+} // namespace flimevents
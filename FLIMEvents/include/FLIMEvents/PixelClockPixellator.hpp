@@ -0,0 +1,480 @@
+#pragma once
+
+#include "DecodedEvent.hpp"
+#include "PixelPhotonEvent.hpp"
+#include "RingBuffer.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+
+/**
+ * \brief Assign pixels to photons using pixel clock (pixel markers).
+ *
+ * Each pixel marker starts the next pixel, in raster order; there are no line
+ * or frame markers. A pixel starts at its marker's macro-time plus the pixel
+ * delay, and ends at the start of the next pixel or after maxPixelTime,
+ * whichever is earlier (so that the last pixel of a line does not include the
+ * scanner's flyback). This allows for scanners whose pixel dwell time is not
+ * uniform.
+ *
+ * As with BasicLineClockPixellator, photons that arrive while their pixel is
+ * in progress are emitted immediately, and only photons that arrive ahead of
+ * their pixel's marker (if the delay is negative) are buffered. Buffered
+ * photons and pixels are processed on every pixel marker and timestamp. The
+ * assignment of a photon whose macro-time equals the start of a pixel may
+ * depend on the order in which the photon and the marker are received.
+ *
+ * User code should normally use PixelClockPixellator, which sends pixel
+ * photons to a PixelPhotonProcessor via shared_ptr.
+ *
+ * \tparam D downstream holder: std::shared_ptr to PixelPhotonProcessor or
+ * StaticDownstream of a concrete processor
+ */
+template <typename D>
+class BasicPixelClockPixellator final : public DecodedEventProcessor {
+    uint32_t const pixelsPerLine;
+    uint32_t const linesPerFrame;
+    uint64_t const pixelsPerFrame;
+    uint32_t const maxFrames;
+
+    int32_t const pixelDelay; // in macro-time units
+    uint32_t const maxPixelTime; // in macro-time units
+    decltype(MarkerEvent::bits) const pixelMarkerMask;
+
+    uint64_t latestTimestamp; // Latest observed macro-time
+
+    // Cumulative pixel numbers (no reset on new line or frame), with the same
+    // meaning as the line numbers of BasicLineClockPixellator
+    uint64_t nextPixel; // Incremented on pixel start
+    uint64_t currentPixel; // Incremented on pixel finish
+
+    // Start time of current pixel, or -1 if no pixel started.
+    uint64_t pixelStartTime;
+
+    // Coordinates of current pixel, so that they need not be computed for
+    // every photon
+    uint32_t pixelX;
+    uint32_t pixelY;
+    uint32_t pixelFrame;
+
+    // Buffer received photons until we can assign to pixel
+    flimevents::internal::RingBuffer<ValidPhotonEvent> pendingPhotons;
+
+    // Buffer pixel marks until we are ready to process
+    flimevents::internal::RingBuffer<uint64_t> pendingPixels; // marker macro-times
+
+    std::size_t maxPendingPhotons;
+    std::size_t maxPendingPixels;
+    std::size_t peakPendingPhotons;
+
+    D downstream;
+
+    struct Error {
+        std::string message;
+        explicit Error(std::string m) : message(m) {}
+    };
+
+private:
+    void UpdateTimeRange(uint64_t macrotime) {
+        latestTimestamp = macrotime;
+    }
+
+    // Report error downstream and release buffers
+    void Fail(std::string const& message) {
+        pendingPhotons = {};
+        pendingPixels = {};
+        if (downstream) {
+            downstream->HandleError(message);
+            downstream.reset();
+        }
+    }
+
+    // Photons before this time cannot belong to a pixel whose marker has not
+    // yet been received (the next pixel marker cannot precede the latest
+    // timestamp; if the delay is not negative, a photon received before a
+    // marker with the same macro-time belongs to the earlier pixel).
+    uint64_t EarliestNextPixelStart() const noexcept {
+        if (pixelDelay >= 0) {
+            return UINT64_MAX;
+        }
+        uint64_t minusDelay = -static_cast<int64_t>(pixelDelay);
+        return latestTimestamp > minusDelay ? latestTimestamp - minusDelay : 0;
+    }
+
+    // Start of the pixel with the given marker, or 0 if negative (which is
+    // detected by StartPixel())
+    uint64_t PixelStartOrZero(uint64_t pixelMarkerTime) const noexcept {
+        if (pixelDelay >= 0) {
+            return pixelMarkerTime + pixelDelay;
+        }
+        uint64_t minusDelay = -static_cast<int64_t>(pixelDelay);
+        return pixelMarkerTime > minusDelay ? pixelMarkerTime - minusDelay : 0;
+    }
+
+    // End of current pixel, as far as is known: the next pixel may start
+    // earlier if its marker has not been received
+    uint64_t CurrentPixelEnd() const noexcept {
+        uint64_t end = pixelStartTime + maxPixelTime;
+        uint64_t const next = pendingPixels.empty() ?
+            EarliestNextPixelStart() : PixelStartOrZero(pendingPixels.front());
+        return next < end ? next : end;
+    }
+
+    void EnqueuePhoton(ValidPhotonEvent const& event) {
+        if (!downstream) {
+            return; // Avoid buffering post-error
+        }
+
+        if (nextPixel == currentPixel && pendingPixels.empty()) {
+            // Waiting for a pixel marker: drop the photons that would be
+            // discarded (as before their pixel) anyway.
+            uint64_t const earliest = pixelDelay >= 0 ?
+                latestTimestamp + 1 : EarliestNextPixelStart();
+            while (!pendingPhotons.empty() &&
+                pendingPhotons.front().macrotime < earliest) {
+                pendingPhotons.pop_front();
+            }
+            if (event.macrotime < earliest) {
+                return;
+            }
+        }
+
+        pendingPhotons.push_back(event);
+        std::size_t const count = pendingPhotons.size();
+        if (count > peakPendingPhotons) {
+            peakPendingPhotons = count;
+        }
+        if (count > maxPendingPhotons) {
+            Fail("Too many photons (" + std::to_string(count) +
+                ") buffered waiting for pixel markers");
+        }
+    }
+
+    void EnqueuePixelMarker(uint64_t macrotime) {
+        if (!downstream) {
+            return; // Avoid buffering post-error
+        }
+        pendingPixels.push_back(macrotime);
+        if (pendingPixels.size() > maxPendingPixels) {
+            Fail("Too many pixel markers (" + std::to_string(pendingPixels.size()) +
+                ") buffered (pixel delay may be too long)");
+        }
+    }
+
+    uint64_t CheckPixelStart(uint64_t pixelMarkerTime) {
+        uint64_t startTime;
+        if (pixelDelay >= 0) {
+            startTime = pixelMarkerTime + pixelDelay;
+        }
+        else {
+            uint64_t minusDelay = -static_cast<int64_t>(pixelDelay);
+            if (pixelMarkerTime < minusDelay) {
+                throw Error("Pixel at negative time");
+            }
+            startTime = pixelMarkerTime - minusDelay;
+        }
+        if (startTime < pixelStartTime && pixelStartTime != uint64_t(-1)) {
+            throw Error("Pixel markers out of order");
+        }
+        return startTime;
+    }
+
+    void StartPixel(uint64_t pixelMarkerTime) {
+        pixelStartTime = CheckPixelStart(pixelMarkerTime);
+        ++nextPixel;
+
+        uint64_t const pixelInFrame = currentPixel % pixelsPerFrame;
+        pixelFrame = static_cast<uint32_t>(currentPixel / pixelsPerFrame);
+        pixelY = static_cast<uint32_t>(pixelInFrame / pixelsPerLine);
+        pixelX = static_cast<uint32_t>(pixelInFrame % pixelsPerLine);
+
+        bool newFrame = pixelInFrame == 0;
+        if (newFrame) {
+            // Check for last frame here in case maxFrames == 0.
+            if (pixelFrame == maxFrames) {
+                if (downstream) {
+                    downstream->HandleFinish();
+                    downstream.reset();
+                }
+            }
+
+            if (downstream) {
+                downstream->HandleBeginFrame();
+            }
+        }
+    }
+
+    void FinishPixel() {
+        ++currentPixel;
+
+        bool endFrame = currentPixel % pixelsPerFrame == 0;
+        if (endFrame) {
+            if (downstream) {
+                downstream->HandleEndFrame();
+            }
+
+            // Check for last frame here to send finish as soon as possible.
+            // (The case of maxFrames == 0 is not handled here.)
+            if (currentPixel / pixelsPerFrame == maxFrames) {
+                if (downstream) {
+                    downstream->HandleFinish();
+                    downstream.reset();
+                }
+            }
+        }
+    }
+
+    void EmitPhoton(ValidPhotonEvent const& event) {
+        PixelPhotonEvent newEvent;
+        newEvent.frame = pixelFrame;
+        newEvent.y = pixelY;
+        newEvent.x = pixelX;
+        newEvent.route = event.route;
+        newEvent.microtime = event.microtime;
+        if (downstream) {
+            downstream->HandlePixelPhoton(newEvent);
+        }
+    }
+
+    // If in pixel, process photons in current pixel.
+    // If between pixels, start pixel if possible and do same.
+    // Finish pixel if possible.
+    // Return false if nothing more to process.
+    bool ProcessPixelPhotons() {
+        if (nextPixel == currentPixel) { // Between pixels
+            if (pendingPixels.empty()) {
+                // Nothing to do until a new pixel can be started
+                return false;
+            }
+            uint64_t pixelMarkerTime = pendingPixels.front();
+            pendingPixels.pop_front();
+
+            StartPixel(pixelMarkerTime);
+        }
+        // Else we are already in a pixel
+
+        // Discard all photons before current pixel
+        while (!pendingPhotons.empty()) {
+            auto const& photon = pendingPhotons.front();
+            if (photon.macrotime >= pixelStartTime) {
+                break;
+            }
+            pendingPhotons.pop_front();
+        }
+
+        // Emit all buffered photons for current pixel
+        uint64_t const maxEnd = pixelStartTime + maxPixelTime;
+        uint64_t const pixelEnd = CurrentPixelEnd();
+        while (!pendingPhotons.empty()) {
+            auto const& photon = pendingPhotons.front();
+            if (photon.macrotime >= pixelEnd) {
+                break;
+            }
+            EmitPhoton(photon);
+            pendingPhotons.pop_front();
+        }
+
+        // Finish pixel if its end is known and we have seen all photons
+        // within it
+        bool const endKnown = !pendingPixels.empty() || pixelEnd == maxEnd;
+        if (endKnown && latestTimestamp >= pixelEnd) {
+            FinishPixel();
+            return true; // There may be more pixels to process
+        }
+        else {
+            return false; // Still in pixel but no more photons
+        }
+    }
+
+    // When this function returns, all photons that can be emitted have been
+    // emitted and all frames (and, internally, pixels) for which we have
+    // seen all photons have been finished.
+    void ProcessPhotonsAndPixels() {
+        if (!downstream) {
+            return;
+        }
+        try {
+            while (ProcessPixelPhotons())
+                ;
+        }
+        catch (Error const& e) {
+            Fail(e.message);
+        }
+    }
+
+    void OnTimestamp(DecodedEvent const& event) {
+        UpdateTimeRange(event.macrotime);
+        // Needed to complete the last frame (see BasicLineClockPixellator)
+        ProcessPhotonsAndPixels();
+    }
+
+    void OnDataLost(DataLostEvent const& event) {
+        UpdateTimeRange(event.macrotime);
+        ProcessPhotonsAndPixels();
+        if (downstream) {
+            downstream->HandleError("Data lost due to device buffer (FIFO) overflow");
+            downstream.reset();
+        }
+    }
+
+    void OnValidPhoton(ValidPhotonEvent const& event) {
+        UpdateTimeRange(event.macrotime);
+
+        bool const inPixel = nextPixel > currentPixel;
+        if (inPixel && pendingPhotons.empty()) {
+            // Fast path: the photon's pixel is in progress, so it can be
+            // emitted (or discarded) without buffering.
+            if (event.macrotime < pixelStartTime) {
+                return; // Before the pixel; discard
+            }
+            if (event.macrotime < CurrentPixelEnd()) {
+                EmitPhoton(event);
+                return;
+            }
+        }
+
+        EnqueuePhoton(event);
+        if (inPixel) {
+            // The photon is past the (known) end of the current pixel, which
+            // may therefore be finished.
+            ProcessPhotonsAndPixels();
+        }
+    }
+
+    void OnInvalidPhoton(InvalidPhotonEvent const& event) {
+        UpdateTimeRange(event.macrotime);
+    }
+
+    void OnMarker(MarkerEvent const& event) {
+        UpdateTimeRange(event.macrotime);
+        if (event.bits & pixelMarkerMask) {
+            EnqueuePixelMarker(event.macrotime);
+            ProcessPhotonsAndPixels();
+        }
+    }
+
+public:
+    BasicPixelClockPixellator(uint32_t pixelsPerLine, uint32_t linesPerFrame,
+        uint32_t maxFrames,
+        int32_t pixelDelay, uint32_t maxPixelTime, uint32_t pixelMarkerBit,
+        D downstream) :
+        pixelsPerLine(pixelsPerLine),
+        linesPerFrame(linesPerFrame),
+        pixelsPerFrame(uint64_t(pixelsPerLine) * linesPerFrame),
+        maxFrames(maxFrames),
+        pixelDelay(pixelDelay),
+        maxPixelTime(maxPixelTime),
+        pixelMarkerMask(1 << pixelMarkerBit),
+        latestTimestamp(0),
+        nextPixel(0),
+        currentPixel(0),
+        pixelStartTime(-1),
+        pixelX(0),
+        pixelY(0),
+        pixelFrame(0),
+        maxPendingPhotons(std::size_t(1) << 22),
+        maxPendingPixels(std::size_t(1) << 20),
+        peakPendingPhotons(0),
+        downstream(std::move(downstream))
+    {
+        if (pixelsPerLine < 1) {
+            throw std::invalid_argument("pixelsPerLine must be positive");
+        }
+        if (linesPerFrame < 1) {
+            throw std::invalid_argument("linesPerFrame must be positive");
+        }
+        if (maxPixelTime < 1) {
+            throw std::invalid_argument("maxPixelTime must be positive");
+        }
+    }
+
+    // Limit on photons buffered because they may belong to a pixel whose
+    // marker has not yet been received
+    void SetMaxPendingPhotons(std::size_t count) {
+        maxPendingPhotons = count;
+    }
+
+    // Limit on pixel markers buffered because their pixel has not yet
+    // started (which depends on the pixel delay)
+    void SetMaxPendingPixels(std::size_t count) {
+        maxPendingPixels = count;
+    }
+
+    // The current and peak number of buffered photons, and the number of
+    // buffered pixel markers. Must be called on the thread sending events.
+    std::size_t GetPendingPhotonCount() const noexcept {
+        return pendingPhotons.size();
+    }
+
+    std::size_t GetPeakPendingPhotonCount() const noexcept {
+        return peakPendingPhotons;
+    }
+
+    std::size_t GetPendingPixelCount() const noexcept {
+        return pendingPixels.size();
+    }
+
+    void HandleTimestamp(DecodedEvent const& event) override {
+        OnTimestamp(event);
+    }
+
+    void HandleDataLost(DataLostEvent const& event) override {
+        OnDataLost(event);
+    }
+
+    void HandleValidPhoton(ValidPhotonEvent const& event) override {
+        OnValidPhoton(event);
+    }
+
+    void HandleInvalidPhoton(InvalidPhotonEvent const& event) override {
+        OnInvalidPhoton(event);
+    }
+
+    void HandleMarker(MarkerEvent const& event) override {
+        OnMarker(event);
+    }
+
+    void HandleEventBatch(DecodedEventBatch const& batch) override {
+        // Same as the default, but without virtual calls per event
+        ForEachEventInBatch(batch,
+            [this](ValidPhotonEvent const& e) { OnValidPhoton(e); },
+            [this](InvalidPhotonEvent const& e) { OnInvalidPhoton(e); },
+            [this](MarkerEvent const& e) { OnMarker(e); },
+            [this](DataLostEvent const& e) { OnDataLost(e); },
+            [this](DecodedEvent const& e) { OnTimestamp(e); });
+    }
+
+    void HandleError(std::string const& message) override {
+        ProcessPhotonsAndPixels(); // Emit any buffered data
+        if (downstream) {
+            downstream->HandleError(message);
+            downstream.reset();
+        }
+    }
+
+    void HandleFinish() override {
+        ProcessPhotonsAndPixels(); // Emit any buffered data
+
+        // Note we do _not_ end the current frame: if it is incomplete,
+        // downstream decides what to do with it.
+
+        if (downstream) {
+            downstream->HandleFinish();
+            downstream.reset();
+        }
+    }
+
+    // Emit all buffered data (for testing)
+    void Flush() {
+        ProcessPhotonsAndPixels();
+    }
+};
+
+
+using PixelClockPixellator =
+    BasicPixelClockPixellator<std::shared_ptr<PixelPhotonProcessor>>;
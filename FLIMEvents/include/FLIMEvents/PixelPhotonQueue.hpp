@@ -0,0 +1,204 @@
+#pragma once
+
+#include "LockFreeQueue.hpp"
+#include "PixelPhotonEvent.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/**
+ * \brief A batch of pixel photons and frame boundaries, in their original
+ * order.
+ */
+struct PixelPhotonBatch {
+    std::vector<PixelPhotonEvent> photons;
+
+    // Beginning or end of a frame, which comes after the first photonIndex
+    // photons (and after any earlier frame events with the same index)
+    struct FrameEvent {
+        std::size_t photonIndex;
+        bool isBegin;
+    };
+    std::vector<FrameEvent> frameEvents;
+
+    void Clear() noexcept {
+        photons.clear();
+        frameEvents.clear();
+    }
+
+    bool IsEmpty() const noexcept {
+        return photons.empty() && frameEvents.empty();
+    }
+};
+
+
+/**
+ * \brief Pass pixel photons to a downstream processor on another thread.
+ *
+ * The counterpart of BasicDecodedEventQueue for pixel photons, allowing
+ * histogramming to run concurrently with pixel assignment (and histograms of
+ * different channels concurrently with each other). Photons and frame events
+ * are collected into batches, which are sent when they reach the maximum size
+ * and at the end of each frame; Pump(), called on the receiving thread,
+ * delivers them to downstream in their original order. HandleError() and
+ * HandleFinish() are delivered after all events received before them.
+ *
+ * The sending side blocks when the queue is full.
+ *
+ * User code should normally use PixelPhotonQueue, which sends events to a
+ * PixelPhotonProcessor via shared_ptr.
+ *
+ * \tparam D downstream holder: std::shared_ptr to PixelPhotonProcessor or
+ * StaticDownstream of a concrete processor
+ */
+template <typename D>
+class BasicPixelPhotonQueue final : public PixelPhotonProcessor {
+public:
+    // Default maximum number of batches in the queue
+    static constexpr std::size_t DefaultCapacity = 64;
+
+    // Photons per batch (unless a frame ends first)
+    static constexpr std::size_t MaxBatchPhotons = 4096;
+
+private:
+    flimevents::internal::BatchQueue<PixelPhotonBatch> queue;
+
+    // Sending thread's data
+    std::unique_ptr<PixelPhotonBatch> collected;
+    bool terminated;
+
+    // Receiving thread's data
+    D downstream;
+
+    PixelPhotonBatch& Collecting() {
+        if (!collected) {
+            collected = queue.GetEmptyBatch();
+            collected->photons.reserve(MaxBatchPhotons);
+        }
+        return *collected;
+    }
+
+    void SendCollected() {
+        if (collected) {
+            queue.Send(std::move(collected));
+        }
+    }
+
+    void AddFrameEvent(bool isBegin) {
+        auto& batch = Collecting();
+        batch.frameEvents.push_back({ batch.photons.size(), isBegin });
+    }
+
+    void Deliver(PixelPhotonBatch const& batch) {
+        auto frameEvent = batch.frameEvents.begin();
+        auto const frameEventsEnd = batch.frameEvents.end();
+        std::size_t const photonCount = batch.photons.size();
+        std::size_t i = 0;
+        for (;;) {
+            std::size_t const next = frameEvent != frameEventsEnd ?
+                frameEvent->photonIndex : photonCount;
+            for (; i < next; ++i) {
+                downstream->HandlePixelPhoton(batch.photons[i]);
+            }
+            if (frameEvent == frameEventsEnd) {
+                break;
+            }
+            if (frameEvent->isBegin) {
+                downstream->HandleBeginFrame();
+            }
+            else {
+                downstream->HandleEndFrame();
+            }
+            ++frameEvent;
+        }
+    }
+
+public:
+    // capacity must be a power of 2
+    explicit BasicPixelPhotonQueue(D downstream,
+        std::size_t capacity = DefaultCapacity) :
+        queue(capacity),
+        terminated(false),
+        downstream(std::move(downstream))
+    {}
+
+    /**
+     * \brief Deliver events to downstream until the stream is finished.
+     *
+     * Call once, from the receiving thread. Returns after delivering
+     * HandleFinish() or HandleError() to downstream.
+     */
+    void Pump() {
+        for (;;) {
+            auto batch = queue.ReceiveBlocking();
+            if (!batch) {
+                break;
+            }
+            if (downstream) {
+                Deliver(*batch);
+            }
+            queue.Recycle(std::move(batch));
+        }
+
+        if (downstream) {
+            if (queue.IsFailed()) {
+                downstream->HandleError(queue.GetErrorMessage());
+            }
+            else {
+                downstream->HandleFinish();
+            }
+            downstream.reset();
+        }
+    }
+
+    void HandleBeginFrame() override {
+        if (terminated) {
+            return;
+        }
+        AddFrameEvent(true);
+    }
+
+    void HandleEndFrame() override {
+        if (terminated) {
+            return;
+        }
+        // Sent without delay, so that the frame is finished downstream
+        AddFrameEvent(false);
+        SendCollected();
+    }
+
+    void HandlePixelPhoton(PixelPhotonEvent const& event) override {
+        if (terminated) {
+            return;
+        }
+        auto& batch = Collecting();
+        batch.photons.push_back(event);
+        if (batch.photons.size() >= MaxBatchPhotons) {
+            SendCollected();
+        }
+    }
+
+    void HandleError(std::string const& message) override {
+        if (!terminated) {
+            SendCollected();
+            queue.Fail(message);
+            terminated = true;
+        }
+    }
+
+    void HandleFinish() override {
+        if (!terminated) {
+            SendCollected();
+            queue.Finish();
+            terminated = true;
+        }
+    }
+};
+
+
+using PixelPhotonQueue =
+    BasicPixelPhotonQueue<std::shared_ptr<PixelPhotonProcessor>>;
@@ -2,69 +2,78 @@
 
 #include "PixelPhotonEvent.hpp"
 
+#include <algorithm>
 #include <memory>
-#include <stdexcept>
 #include <vector>
 
 
+// Route photons by channel. A downstream may be given for more than one
+// channel (e.g. to process a group of channels on one thread); it receives
+// frame events, HandleError(), and HandleFinish() once.
 class PixelPhotonRouter : public PixelPhotonProcessor {
     // Indexed by channel number
     std::vector<std::shared_ptr<PixelPhotonProcessor>> downstreams;
 
+    // Distinct non-null downstreams
+    std::vector<std::shared_ptr<PixelPhotonProcessor>> distinctDownstreams;
+
+    void FindDistinctDownstreams() {
+        for (auto const& d : downstreams) {
+            if (d && std::find(distinctDownstreams.begin(),
+                distinctDownstreams.end(), d) == distinctDownstreams.end()) {
+                distinctDownstreams.push_back(d);
+            }
+        }
+    }
+
 public:
     // Downstreams indexed by channel number; may be null
     template <typename... T>
     explicit PixelPhotonRouter(T... downstreams) :
         downstreams{ {downstreams...} }
-    {}
+    {
+        FindDistinctDownstreams();
+    }
 
     explicit PixelPhotonRouter(std::vector<std::shared_ptr<PixelPhotonProcessor>> downstreams) :
         downstreams(downstreams)
-    {}
+    {
+        FindDistinctDownstreams();
+    }
 
     void HandleBeginFrame() override {
-        for (auto& d : downstreams) {
-            if (d) {
-                d->HandleBeginFrame();
-            }
+        for (auto& d : distinctDownstreams) {
+            d->HandleBeginFrame();
         }
     }
 
     void HandleEndFrame() override {
-        for (auto& d : downstreams) {
-            if (d) {
-                d->HandleEndFrame();
-            }
+        for (auto& d : distinctDownstreams) {
+            d->HandleEndFrame();
         }
     }
 
     void HandlePixelPhoton(PixelPhotonEvent const& event) override {
         auto channel = event.route;
-        std::shared_ptr<PixelPhotonProcessor> d;
-        try {
-            d = downstreams.at(channel);
-        }
-        catch (std::out_of_range const&) {
+        if (channel >= downstreams.size()) {
             return;
         }
+        auto const& d = downstreams[channel];
         if (d) {
             d->HandlePixelPhoton(event);
         }
     }
 
     void HandleError(std::string const& message) override {
-        for (auto& d : downstreams) {
-            if (d) {
-                d->HandleError(message);
-            }
+        for (auto& d : distinctDownstreams) {
+            d->HandleError(message);
         }
     }
 
     void HandleFinish() override {
-        for (auto& d : downstreams) {
-            if (d) {
-                d->HandleFinish();
-            }
+        for (auto& d : distinctDownstreams) {
+            d->HandleFinish();
         }
     }
 };
+
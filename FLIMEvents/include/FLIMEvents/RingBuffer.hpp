@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+
+namespace flimevents {
+namespace internal {
+
+    /**
+     * \brief FIFO queue in contiguous storage that grows as needed.
+     *
+     * Used in place of std::deque for the pending-event queues of the
+     * pixellators, which are pushed and popped once per event: the storage is
+     * reused in place (no allocation once the queue has reached its working
+     * size), and elements are adjacent in memory.
+     *
+     * \tparam T element type; must be default constructible and move
+     * assignable
+     */
+    template <typename T>
+    class RingBuffer {
+        std::unique_ptr<T[]> data;
+        std::size_t capacity = 0; // Zero or a power of 2
+        std::size_t head = 0; // Index of front
+        std::size_t count = 0;
+
+        void Grow() {
+            std::size_t const newCapacity = capacity > 0 ? 2 * capacity : 16;
+            std::unique_ptr<T[]> newData(new T[newCapacity]);
+            for (std::size_t i = 0; i < count; ++i) {
+                newData[i] = std::move(data[(head + i) & (capacity - 1)]);
+            }
+            data = std::move(newData);
+            capacity = newCapacity;
+            head = 0;
+        }
+
+    public:
+        RingBuffer() = default;
+
+        // Start with room for at least n elements
+        explicit RingBuffer(std::size_t n) {
+            if (n > 0) {
+                capacity = 16;
+                while (capacity < n) {
+                    capacity <<= 1;
+                }
+                data.reset(new T[capacity]);
+            }
+        }
+
+        bool empty() const noexcept { return count == 0; }
+        std::size_t size() const noexcept { return count; }
+
+        T& front() noexcept { return data[head]; }
+        T const& front() const noexcept { return data[head]; }
+
+        void push_back(T const& value) {
+            if (count == capacity) {
+                Grow();
+            }
+            data[(head + count) & (capacity - 1)] = value;
+            ++count;
+        }
+
+        void pop_front() noexcept {
+            head = (head + 1) & (capacity - 1);
+            --count;
+        }
+
+        // Keeps the storage
+        void clear() noexcept {
+            head = 0;
+            count = 0;
+        }
+    };
+
+} // namespace internal
+} // namespace flimevents
@@ -0,0 +1,82 @@
+#pragma once
+
+// Runtime detection of x86 SIMD instruction sets, so that vectorized code
+// paths can be selected while the same binary runs on any x86-64 host.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FLIMEVENTS_X86_64 1
+#endif
+
+#ifdef FLIMEVENTS_X86_64
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// Functions using instructions beyond the baseline must be marked with these
+// (GCC and Clang require it; MSVC allows any intrinsics in any function).
+#if defined(FLIMEVENTS_X86_64) && (defined(__GNUC__) || defined(__clang__))
+#define FLIMEVENTS_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define FLIMEVENTS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define FLIMEVENTS_TARGET_SSE41
+#define FLIMEVENTS_TARGET_AVX2
+#endif
+
+
+enum class SIMDLevel {
+    None,
+    SSE41,
+    AVX2,
+};
+
+
+namespace flimevents {
+namespace internal {
+    inline SIMDLevel DetectSIMDLevel() noexcept {
+#if defined(FLIMEVENTS_X86_64) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int const maxLeaf = info[0];
+
+        __cpuid(info, 1);
+        bool const sse41 = info[2] & (1 << 19);
+        bool const osxsave = info[2] & (1 << 27);
+        bool const avx = info[2] & (1 << 28);
+        bool avx2 = false;
+        if (maxLeaf >= 7 && osxsave && avx) {
+            // Check that the OS saves YMM registers
+            bool const ymmEnabled = (_xgetbv(0) & 0x6) == 0x6;
+            __cpuidex(info, 7, 0);
+            avx2 = ymmEnabled && (info[1] & (1 << 5));
+        }
+        if (avx2) {
+            return SIMDLevel::AVX2;
+        }
+        if (sse41) {
+            return SIMDLevel::SSE41;
+        }
+        return SIMDLevel::None;
+#elif defined(FLIMEVENTS_X86_64)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return SIMDLevel::AVX2;
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return SIMDLevel::SSE41;
+        }
+        return SIMDLevel::None;
+#else
+        return SIMDLevel::None;
+#endif
+    }
+}
+}
+
+
+// The highest SIMD level supported by the CPU we are running on
+inline SIMDLevel GetSupportedSIMDLevel() noexcept {
+    static SIMDLevel const level = flimevents::internal::DetectSIMDLevel();
+    return level;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+
+/**
+ * \brief Holder for a downstream processor that is owned by value.
+ *
+ * Processors that are templated on their downstream type (such as
+ * BasicLineClockPixellator, Histogrammer, or BHEventDecoder) use the
+ * downstream through the same operations as a std::shared_ptr: contextual
+ * conversion to bool, operator->(), and reset(). They can therefore be given
+ * either a shared_ptr to an abstract processor (dynamic composition, where
+ * the processing graph is decided at run time) or a StaticDownstream of a
+ * concrete processor (static composition).
+ *
+ * With static composition, the type of each stage is known at compile time,
+ * so that the compiler can inline the per-event calls between stages and
+ * fuse them into a single loop. For this to work the concrete processor
+ * classes are declared final.
+ *
+ * Unlike with shared_ptr, reset() does not destroy the held processor; it
+ * only marks it as detached, so that it receives no further events. The
+ * processor can still be accessed with Get() (e.g. to inspect results).
+ *
+ * \tparam P the concrete downstream processor type
+ */
+template <typename P>
+class StaticDownstream {
+    P processor;
+    bool attached;
+
+public:
+    explicit StaticDownstream(P processor) :
+        processor(std::move(processor)),
+        attached(true)
+    {}
+
+    explicit operator bool() const noexcept {
+        return attached;
+    }
+
+    P* operator->() noexcept {
+        return &processor;
+    }
+
+    P const* operator->() const noexcept {
+        return &processor;
+    }
+
+    void reset() noexcept {
+        attached = false;
+    }
+
+    P& Get() noexcept {
+        return processor;
+    }
+
+    P const& Get() const noexcept {
+        return processor;
+    }
+};
+
+
+/**
+ * \brief Wrap a processor for use as a statically composed downstream.
+ */
+template <typename P>
+inline StaticDownstream<std::decay_t<P>> MakeStaticDownstream(P&& processor) {
+    return StaticDownstream<std::decay_t<P>>(std::forward<P>(processor));
+}
@@ -1,11 +1,13 @@
 #pragma once
 
-#include <condition_variable>
-#include <deque>
+#include "LockFreeQueue.hpp"
+
+#include <atomic>
 #include <exception>
 #include <memory>
-#include <mutex>
-#include <vector>
+#include <stdexcept>
+#include <string>
+#include <utility>
 
 
 // Fixed-capacity reusable memory to hold a bunch of photon events
@@ -45,101 +47,354 @@ public:
 };
 
 
+template <typename E> class EventBufferPool;
+
+
+// Move-only handle to an EventBuffer checked out from an EventBufferPool. The
+// buffer is checked back in when the handle is destroyed or reset. A
+// default-constructed handle is null.
+template <typename E>
+class EventBufferHandle {
+    EventBuffer<E>* buffer;
+    EventBufferPool<E>* pool;
+
+    friend class EventBufferPool<E>;
+
+    EventBufferHandle(EventBuffer<E>* buffer, EventBufferPool<E>* pool) noexcept :
+        buffer(buffer),
+        pool(pool)
+    {}
+
+public:
+    EventBufferHandle() noexcept :
+        buffer(nullptr),
+        pool(nullptr)
+    {}
+
+    EventBufferHandle(std::nullptr_t) noexcept :
+        EventBufferHandle()
+    {}
+
+    EventBufferHandle(EventBufferHandle const&) = delete;
+    EventBufferHandle& operator=(EventBufferHandle const&) = delete;
+
+    EventBufferHandle(EventBufferHandle&& other) noexcept :
+        buffer(other.buffer),
+        pool(other.pool)
+    {
+        other.buffer = nullptr;
+        other.pool = nullptr;
+    }
+
+    EventBufferHandle& operator=(EventBufferHandle&& rhs) noexcept {
+        if (&rhs != this) {
+            reset();
+            buffer = rhs.buffer;
+            pool = rhs.pool;
+            rhs.buffer = nullptr;
+            rhs.pool = nullptr;
+        }
+        return *this;
+    }
+
+    ~EventBufferHandle() {
+        reset();
+    }
+
+    // Check in the buffer (if any)
+    void reset() noexcept {
+        if (buffer) {
+            pool->CheckIn(buffer);
+            buffer = nullptr;
+            pool = nullptr;
+        }
+    }
+
+    explicit operator bool() const noexcept {
+        return buffer != nullptr;
+    }
+
+    EventBuffer<E>* get() const noexcept {
+        return buffer;
+    }
+
+    EventBuffer<E>* operator->() const noexcept {
+        return buffer;
+    }
+
+    EventBuffer<E>& operator*() const noexcept {
+        return *buffer;
+    }
+};
+
+
+// What EventBufferPool::CheckOut() does when the maximum number of buffers
+// are already checked out
+enum class EventBufferPoolPolicy {
+    Block, // Wait until a buffer is checked in
+    Fail, // Throw std::runtime_error
+    Report, // Return a null handle and count the overflow
+};
+
+
+// A pool of EventBuffer<E> of a given capacity. Buffers can be checked out
+// and in from any thread without locking or (once enough buffers have been
+// allocated) memory allocation.
+//
+// The number of buffers checked out at a time may be limited (see
+// SetMaxBufferCount()), which bounds the pool's memory use when consumers fall
+// behind.
 template <typename E>
 class EventBufferPool {
     std::size_t const bufferSize;
 
-    std::mutex mutex;
-    std::vector<std::unique_ptr<EventBuffer<E>>> buffers;
+    // Idle buffers (owned by the pool); replaced only while no buffers are
+    // checked out
+    std::unique_ptr<flimevents::internal::MPMCQueue<EventBuffer<E>*>> buffers;
+
+    std::size_t maxBufferCount; // 0 = unlimited
+    EventBufferPoolPolicy policy;
+
+    std::atomic<std::size_t> checkedOutCount;
+    std::atomic<std::size_t> highWaterCount;
+    std::atomic<std::size_t> overflowCount;
+    flimevents::internal::WaitSignal bufferCheckedIn;
+
+    friend class EventBufferHandle<E>;
+
+    void CheckIn(EventBuffer<E>* buffer) noexcept {
+        if (!buffers->TryPush(buffer)) {
+            delete buffer; // Already keeping the maximum idle buffers
+        }
+        checkedOutCount.fetch_sub(1, std::memory_order_seq_cst);
+        if (maxBufferCount > 0 && policy == EventBufferPoolPolicy::Block) {
+            bufferCheckedIn.NotifyAll();
+        }
+    }
 
-    std::unique_ptr<EventBuffer<E>> MakeBuffer() {
-        return std::make_unique<EventBuffer<E>>(bufferSize);
+    // Count a checkout, unless the maximum is reached
+    bool TryReserve() noexcept {
+        std::size_t count = checkedOutCount.load(std::memory_order_relaxed);
+        do {
+            if (maxBufferCount > 0 && count >= maxBufferCount) {
+                return false;
+            }
+        } while (!checkedOutCount.compare_exchange_weak(count, count + 1,
+            std::memory_order_seq_cst));
+
+        std::size_t high = highWaterCount.load(std::memory_order_relaxed);
+        while (count + 1 > high && !highWaterCount.compare_exchange_weak(high,
+            count + 1, std::memory_order_relaxed))
+            ;
+        return true;
     }
 
 public:
-    explicit EventBufferPool(std::size_t size, std::size_t initialCount = 0) :
-        bufferSize(size)
+    // Default maximum number of idle buffers kept for reuse
+    static constexpr std::size_t DefaultMaxIdleCount = 256;
+
+    // maxIdleCount (rounded up to a power of 2) limits the number of idle
+    // buffers kept for reuse; any more are freed when checked in.
+    explicit EventBufferPool(std::size_t size, std::size_t initialCount = 0,
+        std::size_t maxIdleCount = DefaultMaxIdleCount) :
+        bufferSize(size),
+        buffers(std::make_unique<flimevents::internal::MPMCQueue<EventBuffer<E>*>>(
+            flimevents::internal::RoundUpToPowerOfTwo(maxIdleCount))),
+        maxBufferCount(0),
+        policy(EventBufferPoolPolicy::Block),
+        checkedOutCount(0),
+        highWaterCount(0),
+        overflowCount(0)
     {
-        buffers.reserve(initialCount);
         for (std::size_t i = 0; i < initialCount; ++i) {
-            buffers.emplace_back(MakeBuffer());
+            EventBuffer<E>* buffer = new EventBuffer<E>(bufferSize);
+            if (!buffers->TryPush(buffer)) {
+                delete buffer;
+                break;
+            }
         }
     }
 
-    // Obtain a buffer for use. Returns a shared pointer which automatically
-    // checks in the buffer when the calling code is finished with it.
+    EventBufferPool(EventBufferPool const&) = delete;
+    EventBufferPool& operator=(EventBufferPool const&) = delete;
+
+    ~EventBufferPool() {
+        ReleaseIdleBuffers();
+    }
+
+    // Limit the number of buffers that can be checked out at the same time
+    // (0 = unlimited, the default) and choose what CheckOut() does when the
+    // limit is reached. The maximum idle count is raised, if necessary, so
+    // that all of the buffers can be kept for reuse. Must be called when no
+    // buffers are checked out.
+    void SetMaxBufferCount(std::size_t count,
+        EventBufferPoolPolicy whenFull = EventBufferPoolPolicy::Block) {
+        if (count > buffers->GetCapacity()) {
+            auto larger = std::make_unique<
+                flimevents::internal::MPMCQueue<EventBuffer<E>*>>(
+                    flimevents::internal::RoundUpToPowerOfTwo(count));
+            EventBuffer<E>* buffer;
+            while (buffers->TryPop(buffer)) {
+                larger->TryPush(buffer);
+            }
+            buffers = std::move(larger);
+        }
+        maxBufferCount = count;
+        policy = whenFull;
+    }
+
+    std::size_t GetMaxBufferCount() const noexcept {
+        return maxBufferCount;
+    }
+
+    // Number of idle buffers that can be kept for reuse
+    std::size_t GetMaxIdleCount() const noexcept {
+        return buffers->GetCapacity();
+    }
+
+    // Capacity (number of events) of each buffer
+    std::size_t GetBufferSize() const noexcept {
+        return bufferSize;
+    }
+
+    EventBufferPoolPolicy GetPolicy() const noexcept {
+        return policy;
+    }
+
+    // Obtain a buffer for use. Returns a handle which automatically checks
+    // in the buffer when the calling code is finished with it.
+    // If the maximum number of buffers are checked out, blocks, throws
+    // std::runtime_error, or returns a null handle, according to the policy.
     // Note: all checked out buffers must be released before the pool is
     // destroyed.
-    std::shared_ptr<EventBuffer<E>> CheckOut() {
-        std::unique_ptr<EventBuffer<E>> uptr;
-
-        {
-            std::lock_guard<std::mutex> hold(mutex);
-            if (!buffers.empty()) {
-                uptr = std::move(buffers.back());
-                buffers.pop_back();
+    EventBufferHandle<E> CheckOut() {
+        if (!TryReserve()) {
+            overflowCount.fetch_add(1, std::memory_order_relaxed);
+            switch (policy) {
+            case EventBufferPoolPolicy::Block:
+                flimevents::internal::SpinThenWait(bufferCheckedIn, [&] {
+                    return TryReserve();
+                });
+                break;
+            case EventBufferPoolPolicy::Fail:
+                throw std::runtime_error("Event buffer pool exhausted (" +
+                    std::to_string(maxBufferCount) +
+                    " buffers in use); data is not being processed fast enough");
+            case EventBufferPoolPolicy::Report:
+                return {};
             }
         }
 
-        if (!uptr) {
-            uptr = MakeBuffer();
+        EventBuffer<E>* buffer;
+        if (!buffers->TryPop(buffer)) {
+            try {
+                buffer = new EventBuffer<E>(bufferSize);
+            }
+            catch (...) {
+                checkedOutCount.fetch_sub(1, std::memory_order_seq_cst);
+                throw;
+            }
         }
+        buffer->SetSize(0);
+        return EventBufferHandle<E>(buffer, this);
+    }
 
-        uptr->SetSize(0);
+    // Number of buffers currently checked out (approximate)
+    std::size_t GetCheckedOutCount() const noexcept {
+        return checkedOutCount.load(std::memory_order_relaxed);
+    }
 
-        return { uptr.release(),
-            [this](auto ptr) {
-                if (!ptr)
-                    return;
+    // Maximum number of buffers that have been checked out at the same time
+    std::size_t GetHighWaterCount() const noexcept {
+        return highWaterCount.load(std::memory_order_relaxed);
+    }
 
-                std::lock_guard<std::mutex> hold(mutex);
-                buffers.emplace_back(std::unique_ptr<EventBuffer<E>>(ptr));
-            }
-        };
+    // Number of times CheckOut() found the maximum number of buffers checked
+    // out (and blocked, threw, or returned null)
+    std::size_t GetOverflowCount() const noexcept {
+        return overflowCount.load(std::memory_order_relaxed);
+    }
+
+    // Reset the high-water and overflow counts, so that they can be reported
+    // for each use of a pool that is kept across acquisitions. Should be
+    // called when no buffers are checked out.
+    void ResetStatistics() noexcept {
+        highWaterCount.store(checkedOutCount.load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+        overflowCount.store(0, std::memory_order_relaxed);
+    }
+
+    // Free the buffers that are not checked out (for example, after an
+    // acquisition has ended). Returns the number freed.
+    std::size_t ReleaseIdleBuffers() noexcept {
+        std::size_t count = 0;
+        EventBuffer<E>* buffer;
+        while (buffers->TryPop(buffer)) {
+            delete buffer;
+            ++count;
+        }
+        return count;
     }
 };
 
 
-// A thread-safe queue of EventBuffer<E>, with non-blocking enqueue and
-// blocking dequeue.
+// A thread-safe bounded queue of EventBuffer<E> handles, for one sending
+// thread and one receiving thread. Both ends spin briefly and then block
+// (using the OS's futex or WaitOnAddress) when the queue is empty (receive)
+// or full (send), so that an idle stream costs no CPU time and a busy one
+// makes no system calls.
 template <typename E>
 class EventStream {
-    std::mutex mutex;
-    std::condition_variable queueNotEmptyCondition;
-    std::deque<std::shared_ptr<EventBuffer<E>>> queue;
-    std::exception_ptr exception;
+    flimevents::internal::SPSCQueue<EventBufferHandle<E>> queue;
+    flimevents::internal::WaitSignal notEmpty;
+    flimevents::internal::WaitSignal notFull;
+    std::exception_ptr exception; // Written before the terminating null
 
 public:
-    // Sending a null will terminate the stream
-    void Send(std::shared_ptr<EventBuffer<E>> buffer) {
-        {
-            std::lock_guard<std::mutex> hold(mutex);
-            queue.emplace_back(buffer);
-        }
-        queueNotEmptyCondition.notify_one();
+    // Default maximum number of buffers in the stream
+    static constexpr std::size_t DefaultCapacity = 1024;
+
+    // capacity must be a power of 2
+    explicit EventStream(std::size_t capacity = DefaultCapacity) :
+        queue(capacity)
+    {}
+
+    EventStream(EventStream const&) = delete;
+    EventStream& operator=(EventStream const&) = delete;
+
+    // Sending a null will terminate the stream. Blocks if the stream is
+    // full, until the receiver has caught up.
+    void Send(EventBufferHandle<E> buffer) {
+        flimevents::internal::SpinThenWait(notFull, [&] {
+            return queue.TryPush(std::move(buffer));
+        });
+        notEmpty.NotifyAll();
     }
 
+    // Terminate the stream with an exception, which is thrown from
+    // ReceiveBlocking() after all buffers sent before it have been received.
     void SendException(std::exception_ptr e) {
-        {
-            std::lock_guard<std::mutex> hold(mutex);
-            queue.emplace_back(std::shared_ptr<EventBuffer<E>>());
-            exception = e;
-        }
+        exception = e;
+        Send({});
     }
 
-    // A null shared pointer return value indicates that the stream has been
-    // terminated. Subsequent calls will block forever.
+    // A null return value indicates that the stream has been terminated.
+    // Subsequent calls will block forever.
     // Throws if upstream sent an exception.
-    std::shared_ptr<EventBuffer<E>> ReceiveBlocking() {
-        std::unique_lock<std::mutex> lock(mutex);
-        while (queue.empty()) {
-            queueNotEmptyCondition.wait(lock);
-        }
-        auto ret = queue.front();
-        queue.pop_front();
+    EventBufferHandle<E> ReceiveBlocking() {
+        EventBufferHandle<E> ret;
+        flimevents::internal::SpinThenWait(notEmpty, [&] {
+            return queue.TryPop(ret);
+        });
+        notFull.NotifyAll();
         if (!ret && exception) {
             std::rethrow_exception(exception);
         }
         return ret;
     }
+
+    // Number of buffers waiting to be received (approximate)
+    std::size_t GetQueuedCount() const noexcept {
+        return queue.GetSize();
+    }
 };
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "DecodedEvent.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+
+/**
+ * \brief Limit the rate of timestamps sent downstream.
+ *
+ * Decoders send a timestamp for every macro-time overflow record when
+ * decoding events one at a time. At low photon rates these make up most of
+ * the event stream, and a downstream processor that does work on each
+ * timestamp (such as LineClockPixellator, which uses them to finish lines and
+ * frames) would be flooded.
+ *
+ * This processor forwards all other events unchanged, and forwards a
+ * timestamp only if its macro-time is at least the given interval past the
+ * latest macro-time already known downstream (from a timestamp or any other
+ * event). A withheld timestamp is sent before finishing. Batches are passed
+ * through unchanged, since they carry at most one timestamp each.
+ *
+ * User code should normally use TimestampCoalescer, which sends events to a
+ * DecodedEventProcessor via shared_ptr.
+ *
+ * \tparam D downstream holder: std::shared_ptr to DecodedEventProcessor or
+ * StaticDownstream of a concrete processor
+ */
+template <typename D>
+class BasicTimestampCoalescer final : public DecodedEventProcessor {
+    uint64_t const interval; // in macro-time units
+
+    uint64_t latestSent; // Latest macro-time known downstream
+    uint64_t pendingTimestamp; // Latest withheld timestamp, or 0
+
+    D downstream;
+
+    void Sent(uint64_t macrotime) noexcept {
+        latestSent = macrotime;
+        pendingTimestamp = 0;
+    }
+
+public:
+    BasicTimestampCoalescer(uint64_t interval, D downstream) :
+        interval(interval),
+        latestSent(0),
+        pendingTimestamp(0),
+        downstream(std::move(downstream))
+    {}
+
+    void HandleTimestamp(DecodedEvent const& event) override {
+        if (event.macrotime < latestSent + interval) {
+            pendingTimestamp = event.macrotime;
+            return;
+        }
+        if (downstream) {
+            downstream->HandleTimestamp(event);
+        }
+        Sent(event.macrotime);
+    }
+
+    void HandleValidPhoton(ValidPhotonEvent const& event) override {
+        if (downstream) {
+            downstream->HandleValidPhoton(event);
+        }
+        Sent(event.macrotime);
+    }
+
+    void HandleInvalidPhoton(InvalidPhotonEvent const& event) override {
+        if (downstream) {
+            downstream->HandleInvalidPhoton(event);
+        }
+        Sent(event.macrotime);
+    }
+
+    void HandleMarker(MarkerEvent const& event) override {
+        if (downstream) {
+            downstream->HandleMarker(event);
+        }
+        Sent(event.macrotime);
+    }
+
+    void HandleDataLost(DataLostEvent const& event) override {
+        if (downstream) {
+            downstream->HandleDataLost(event);
+        }
+        Sent(event.macrotime);
+    }
+
+    void HandleEventBatch(DecodedEventBatch const& batch) override {
+        if (downstream) {
+            downstream->HandleEventBatch(batch);
+        }
+        uint64_t last = batch.GetLastEventMacrotime();
+        if (batch.timestamp > last) {
+            last = batch.timestamp;
+        }
+        if (last > 0) {
+            Sent(last);
+        }
+    }
+
+    void HandleError(std::string const& message) override {
+        if (downstream) {
+            downstream->HandleError(message);
+            downstream.reset();
+        }
+    }
+
+    void HandleFinish() override {
+        if (downstream) {
+            if (pendingTimestamp > latestSent) {
+                DecodedEvent e;
+                e.macrotime = pendingTimestamp;
+                downstream->HandleTimestamp(e);
+            }
+            downstream->HandleFinish();
+            downstream.reset();
+        }
+    }
+};
+
+
+using TimestampCoalescer =
+    BasicTimestampCoalescer<std::shared_ptr<DecodedEventProcessor>>;
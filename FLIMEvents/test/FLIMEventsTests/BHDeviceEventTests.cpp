@@ -1,5 +1,9 @@
 #include <catch2/catch.hpp>
 #include "FLIMEvents/BHDeviceEvent.hpp"
+#include "DecodedEventRecorder.hpp"
+
+#include <algorithm>
+#include <random>
 
 
 TEST_CASE("ADCValue", "[BHSPCEvent]") {
@@ -173,3 +177,405 @@ TEST_CASE("MacroTimeOverflowCount", "[BHSPCEvent]") {
     REQUIRE(u.event.GetMultipleMacroTimeOverflowCount() == 134217728);
     u.bytes[3] = 0;
 }
+
+
+namespace {
+    BHSPCEvent MakeBHSPCEvent(uint16_t macrotime, uint16_t adc, uint8_t route,
+        uint8_t flags) {
+        BHSPCEvent e;
+        e.bytes[0] = macrotime & 0xff;
+        e.bytes[1] = ((macrotime >> 8) & 0x0f) | ((route & 0x0f) << 4);
+        e.bytes[2] = adc & 0xff;
+        e.bytes[3] = ((adc >> 8) & 0x0f) | (flags << 4);
+        return e;
+    }
+
+    BHSPCEvent MakeBHSPCMultipleOverflow(uint32_t count) {
+        BHSPCEvent e;
+        e.bytes[0] = count & 0xff;
+        e.bytes[1] = (count >> 8) & 0xff;
+        e.bytes[2] = (count >> 16) & 0xff;
+        e.bytes[3] = ((count >> 24) & 0x0f) | 0xc0; // INVALID | MTOV
+        return e;
+    }
+
+    // Flags in upper nibble of byte 3
+    uint8_t const INVALID = 1 << 3;
+    uint8_t const MTOV = 1 << 2;
+    uint8_t const GAP = 1 << 1;
+    uint8_t const MARK = 1 << 0;
+
+    // Mostly valid photons (so that the vectorized path is exercised), with
+    // occasional other records. If errorRate > 0, some records will have
+    // non-monotonic macro-time.
+    std::vector<BHSPCEvent> MakeRandomEventStream(std::size_t count,
+        unsigned seed, double errorRate) {
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<double> u(0.0, 1.0);
+        std::uniform_int_distribution<int> adc(0, 4095);
+        std::uniform_int_distribution<int> route(0, 15);
+        std::uniform_int_distribution<int> step(1, 300);
+
+        std::vector<BHSPCEvent> events;
+        uint16_t t = 0;
+        while (events.size() < count) {
+            double r = u(gen);
+            if (r < 0.01) {
+                events.emplace_back(MakeBHSPCMultipleOverflow(route(gen) + 1));
+                t = 0;
+                continue;
+            }
+
+            uint8_t flags = 0;
+            t += step(gen);
+            if (t >= 4096 || u(gen) < 0.02) {
+                flags |= MTOV;
+                t %= 4096;
+                t /= 2;
+            }
+            if (u(gen) < errorRate) {
+                t /= 2;
+            }
+
+            if (r < 0.02) {
+                flags |= INVALID | MARK;
+            }
+            else if (r < 0.03 && !(flags & MTOV)) {
+                flags |= INVALID; // INVALID | MTOV is multiple overflow
+            }
+            else if (r < 0.031) {
+                flags |= GAP;
+            }
+            events.emplace_back(MakeBHSPCEvent(t, adc(gen), route(gen), flags));
+        }
+        return events;
+    }
+
+    // Decode with a decoder set up by configure(decoder)
+    template <typename F>
+    std::vector<std::string> DecodeInBuffersWith(std::vector<BHSPCEvent> const& events,
+        std::size_t bufferSize, F configure) {
+        auto output = std::make_shared<DecodedEventRecorder>();
+        BHSPCEventDecoder decoder(output);
+        configure(decoder);
+        for (std::size_t i = 0; i < events.size(); i += bufferSize) {
+            auto n = std::min(bufferSize, events.size() - i);
+            decoder.HandleDeviceEvents(
+                reinterpret_cast<char const*>(events.data() + i), n);
+        }
+        decoder.HandleFinish();
+        return output->events;
+    }
+
+    std::vector<std::string> DecodeInBuffers(std::vector<BHSPCEvent> const& events,
+        std::size_t bufferSize, SIMDLevel simd, unsigned maxThreads = 1,
+        std::size_t minChunkSize = 1, uint64_t routeMask = UINT64_MAX,
+        bool sendInvalidPhotons = true) {
+        return DecodeInBuffersWith(events, bufferSize,
+            [&](BHSPCEventDecoder& decoder) {
+                decoder.SetSIMDLevel(simd);
+                decoder.SetParallelism(maxThreads, minChunkSize);
+                decoder.SetRouteMask(routeMask);
+                decoder.SetSendInvalidPhotons(sendInvalidPhotons);
+            });
+    }
+
+    std::vector<BHSPCEvent> MakeTestEventStream() {
+        return {
+            MakeBHSPCEvent(10, 100, 0, 0),
+            MakeBHSPCEvent(20, 200, 3, 0),
+            MakeBHSPCEvent(30, 0, 2, INVALID | MARK),
+            MakeBHSPCEvent(5, 300, 1, MTOV),
+            MakeBHSPCEvent(6, 400, 1, INVALID),
+            MakeBHSPCMultipleOverflow(3),
+            MakeBHSPCEvent(7, 500, 15, GAP),
+            MakeBHSPCEvent(8, 0, 1, INVALID | MARK | GAP),
+            MakeBHSPCEvent(9, 600, 4, 0),
+            MakeBHSPCEvent(1, 0, 2, INVALID | MTOV | MARK),
+            MakeBHSPCMultipleOverflow(1),
+        };
+    }
+}
+
+
+TEST_CASE("Batch decoding matches per-event decoding", "[BHEventDecoder]") {
+    auto events = MakeTestEventStream();
+
+    auto perEvent = std::make_shared<DecodedEventRecorder>();
+    BHSPCEventDecoder perEventDecoder(perEvent);
+    for (auto const& e : events) {
+        perEventDecoder.HandleDeviceEvent(reinterpret_cast<char const*>(&e));
+    }
+    perEventDecoder.HandleFinish();
+
+    auto batched = std::make_shared<DecodedEventRecorder>();
+    BHSPCEventDecoder batchDecoder(batched);
+    batchDecoder.HandleDeviceEvents(
+        reinterpret_cast<char const*>(events.data()), events.size());
+    batchDecoder.HandleFinish();
+
+    // The batch carries only the final timestamp
+    std::vector<std::string> expected;
+    for (auto const& s : perEvent->events) {
+        if (s[0] != 'T') {
+            expected.emplace_back(s);
+        }
+    }
+    expected.insert(expected.end() - 1, perEvent->events[perEvent->events.size() - 2]);
+
+    REQUIRE(perEvent->events.size() == 14);
+    REQUIRE(perEvent->events[0] == "P 10 100 0");
+    REQUIRE(perEvent->events[2] == "M 30 2");
+    REQUIRE(perEvent->events[3] == "P 4101 300 1");
+    REQUIRE(perEvent->events[4] == "I 4102 400 1");
+    REQUIRE(perEvent->events[5] == "T 16384");
+    REQUIRE(perEvent->events[6] == "D 16391");
+    REQUIRE(perEvent->events[7] == "P 16391 500 15");
+    REQUIRE(perEvent->events[8] == "D 16392");
+    REQUIRE(perEvent->events[9] == "M 16392 1");
+    REQUIRE(perEvent->events[11] == "M 20481 2");
+    REQUIRE(perEvent->events[12] == "T 24576");
+    REQUIRE(perEvent->events[13] == "F");
+    REQUIRE(batched->events == expected);
+}
+
+
+TEST_CASE("Batch decoding reports non-monotonic macro-time", "[BHEventDecoder]") {
+    std::vector<BHSPCEvent> events{
+        MakeBHSPCEvent(10, 100, 0, 0),
+        MakeBHSPCEvent(20, 200, 0, 0),
+        MakeBHSPCEvent(20, 300, 0, 0),
+        MakeBHSPCEvent(30, 400, 0, 0),
+    };
+
+    auto output = std::make_shared<DecodedEventRecorder>();
+    BHSPCEventDecoder decoder(output);
+    decoder.HandleDeviceEvents(
+        reinterpret_cast<char const*>(events.data()), events.size());
+    decoder.HandleFinish();
+
+    REQUIRE(output->events.size() == 3);
+    REQUIRE(output->events[0] == "P 10 100 0");
+    REQUIRE(output->events[1] == "P 20 200 0");
+    REQUIRE(output->events[2] == "E Non-monotonic macro-time encountered");
+}
+
+
+TEST_CASE("Vectorized decoding matches scalar decoding", "[BHEventDecoder]") {
+    for (unsigned seed : { 1u, 2u, 3u }) {
+        for (double errorRate : { 0.0, 0.0002 }) {
+            auto events = MakeRandomEventStream(10000, seed, errorRate);
+            for (std::size_t bufferSize : { 7, 64, 1000, 10000 }) {
+                auto scalar = DecodeInBuffers(events, bufferSize, SIMDLevel::None);
+                if (errorRate > 0.0) {
+                    REQUIRE(scalar[scalar.size() - 1][0] == 'E');
+                }
+                else {
+                    REQUIRE(scalar.size() > 9000);
+                }
+                REQUIRE(DecodeInBuffers(events, bufferSize, SIMDLevel::SSE41) == scalar);
+                REQUIRE(DecodeInBuffers(events, bufferSize, SIMDLevel::AVX2) == scalar);
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Parallel decoding matches serial decoding", "[BHEventDecoder]") {
+    auto withoutTimestamps = [](std::vector<std::string> events) {
+        events.erase(std::remove_if(events.begin(), events.end(),
+            [](std::string const& e) { return e[0] == 'T'; }), events.end());
+        return events;
+    };
+
+    for (unsigned seed : { 1u, 2u, 3u }) {
+        for (double errorRate : { 0.0, 0.0002, 0.002 }) {
+            auto events = MakeRandomEventStream(10000, seed, errorRate);
+            for (SIMDLevel simd : { SIMDLevel::None, SIMDLevel::AVX2 }) {
+                // With 4 equal chunks of 1000, the result is identical to
+                // decoding serially in buffers of 1000 (including the batch
+                // timestamps at the end of each chunk).
+                auto serial = DecodeInBuffers(events, 1000, simd);
+                REQUIRE(DecodeInBuffers(events, 4000, simd, 4, 1000) == serial);
+
+                // Otherwise, identical except for batch timestamps
+                auto serialWhole = withoutTimestamps(
+                    DecodeInBuffers(events, 10000, simd));
+                REQUIRE(withoutTimestamps(DecodeInBuffers(events, 10000, simd,
+                    3, 1000)) == serialWhole);
+                REQUIRE(withoutTimestamps(DecodeInBuffers(events, 10000, simd,
+                    16, 7)) == serialWhole);
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Parallel decoding detects non-monotonic macro-time between chunks", "[BHEventDecoder]") {
+    // Each chunk of 1000 is monotonic by itself
+    std::vector<BHSPCEvent> events;
+    for (uint16_t i = 0; i < 1000; ++i) {
+        events.emplace_back(MakeBHSPCEvent(1 + i, 100, 0, 0));
+    }
+    for (uint16_t i = 0; i < 1000; ++i) {
+        events.emplace_back(MakeBHSPCEvent(500 + i, 200, 0, 0));
+    }
+
+    auto serial = DecodeInBuffers(events, 2000, SIMDLevel::None);
+    REQUIRE(serial.size() == 1001);
+    REQUIRE(serial[1000] == "E Non-monotonic macro-time encountered");
+    REQUIRE(DecodeInBuffers(events, 2000, SIMDLevel::None, 2, 1000) == serial);
+}
+
+
+TEST_CASE("Parallel decoding checks the first in-window macro-time of each chunk", "[BHEventDecoder]") {
+    // The second chunk starts with a record before the window, followed by
+    // records that are in the window but earlier than the end of the first
+    // chunk
+    std::vector<BHSPCEvent> events;
+    for (uint16_t i = 0; i < 1000; ++i) {
+        events.emplace_back(MakeBHSPCEvent(1 + i, 100, 0, 0));
+    }
+    events.emplace_back(MakeBHSPCEvent(10, 200, 0, 0));
+    for (uint16_t i = 0; i < 999; ++i) {
+        events.emplace_back(MakeBHSPCEvent(500 + i, 200, 0, 0));
+    }
+
+    auto decode = [&](unsigned maxThreads) {
+        return DecodeInBuffersWith(events, 2000, [&](BHSPCEventDecoder& d) {
+            d.SetSIMDLevel(SIMDLevel::None);
+            d.SetParallelism(maxThreads, 1000);
+            d.SetMacrotimeWindow(50, 10000);
+        });
+    };
+
+    auto serial = decode(1);
+    REQUIRE(serial.size() == 952);
+    REQUIRE(serial[951] == "E Non-monotonic macro-time encountered");
+    REQUIRE(decode(2) == serial);
+}
+
+
+TEST_CASE("Route mask drops photons on disabled routes", "[BHEventDecoder]") {
+    auto withoutTimestamps = [](std::vector<std::string> events) {
+        events.erase(std::remove_if(events.begin(), events.end(),
+            [](std::string const& e) { return e[0] == 'T'; }), events.end());
+        return events;
+    };
+
+    uint64_t const routeMask = 0x5; // Routes 0 and 2
+    for (unsigned seed : { 1u, 2u }) {
+        for (double errorRate : { 0.0, 0.0002 }) {
+            auto events = MakeRandomEventStream(10000, seed, errorRate);
+
+            auto all = std::make_shared<DecodedEventRecorder>();
+            auto masked = std::make_shared<DecodedEventRecorder>();
+            BHSPCEventDecoder allDecoder(all);
+            BHSPCEventDecoder maskedDecoder(masked);
+            maskedDecoder.SetRouteMask(routeMask);
+            maskedDecoder.SetSendInvalidPhotons(false);
+            for (auto const& e : events) {
+                allDecoder.HandleDeviceEvent(reinterpret_cast<char const*>(&e));
+                maskedDecoder.HandleDeviceEvent(reinterpret_cast<char const*>(&e));
+            }
+            allDecoder.HandleFinish();
+            maskedDecoder.HandleFinish();
+
+            std::vector<std::string> expected;
+            uint64_t invalidCount = 0;
+            for (auto const& s : all->events) {
+                if (s[0] == 'I') {
+                    ++invalidCount;
+                    continue;
+                }
+                if (s[0] == 'P') {
+                    auto route = std::stoi(s.substr(s.rfind(' ') + 1));
+                    if (!((routeMask >> route) & 1)) {
+                        continue;
+                    }
+                }
+                expected.emplace_back(s);
+            }
+            REQUIRE(invalidCount > 0);
+            REQUIRE(masked->events == expected);
+            REQUIRE(maskedDecoder.GetInvalidPhotonCount() == invalidCount);
+            REQUIRE(allDecoder.GetInvalidPhotonCount() == invalidCount);
+
+            // Batches may carry additional timestamps for dropped events
+            for (SIMDLevel simd : { SIMDLevel::None, SIMDLevel::SSE41, SIMDLevel::AVX2 }) {
+                for (std::size_t bufferSize : { 7, 1000 }) {
+                    REQUIRE(withoutTimestamps(DecodeInBuffers(events,
+                        bufferSize, simd, 1, 1, routeMask, false)) ==
+                        withoutTimestamps(expected));
+                }
+                REQUIRE(withoutTimestamps(DecodeInBuffers(events, 10000,
+                    simd, 3, 1000, routeMask, false)) ==
+                    withoutTimestamps(expected));
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Macro-time window limits decoded events", "[BHEventDecoder]") {
+    auto withoutTimestamps = [](std::vector<std::string> events) {
+        events.erase(std::remove_if(events.begin(), events.end(),
+            [](std::string const& e) { return e[0] == 'T'; }), events.end());
+        return events;
+    };
+    auto macrotimeOf = [](std::string const& e) {
+        return std::stoull(e.substr(2));
+    };
+
+    auto events = MakeRandomEventStream(10000, 1, 0.0);
+    auto all = DecodeInBuffers(events, 1, SIMDLevel::None);
+    uint64_t const lastMacrotime = macrotimeOf(all[all.size() - 2]);
+    uint64_t const start = lastMacrotime / 3;
+    uint64_t const stop = 2 * lastMacrotime / 3;
+
+    std::vector<std::string> expected;
+    for (auto const& e : all) {
+        if (e[0] == 'F') {
+            continue;
+        }
+        auto t = macrotimeOf(e);
+        if (t >= start && t < stop) {
+            expected.emplace_back(e);
+        }
+    }
+    expected.emplace_back("F");
+    REQUIRE(expected.size() > 1000);
+
+    // Per-event decoding finishes at stop
+    auto output = std::make_shared<DecodedEventRecorder>();
+    BHSPCEventDecoder decoder(output);
+    decoder.SetMacrotimeWindow(start, stop);
+    std::size_t consumed = 0;
+    for (auto const& e : events) {
+        if (decoder.IsFinished()) {
+            break;
+        }
+        decoder.HandleDeviceEvent(reinterpret_cast<char const*>(&e));
+        ++consumed;
+    }
+    REQUIRE(decoder.IsFinished());
+    REQUIRE(consumed < events.size());
+    REQUIRE(output->events == expected);
+
+    // Batch decoding may differ only in timestamps
+    for (SIMDLevel simd : { SIMDLevel::None, SIMDLevel::AVX2 }) {
+        for (std::size_t bufferSize : { 7, 1000, 10000 }) {
+            REQUIRE(withoutTimestamps(DecodeInBuffersWith(events, bufferSize,
+                [&](BHSPCEventDecoder& d) {
+                    d.SetSIMDLevel(simd);
+                    d.SetMacrotimeWindow(start, stop);
+                })) == withoutTimestamps(expected));
+        }
+        REQUIRE(withoutTimestamps(DecodeInBuffersWith(events, 10000,
+            [&](BHSPCEventDecoder& d) {
+                d.SetSIMDLevel(simd);
+                d.SetParallelism(4, 1000);
+                d.SetMacrotimeWindow(start, stop);
+            })) == withoutTimestamps(expected));
+    }
+}
@@ -0,0 +1,93 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/BroadcastStream.hpp"
+
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+
+TEST_CASE("Buffer is shared until last consumer releases it", "[BroadcastEventStream]") {
+    EventBufferPool<int> pool(1);
+    BroadcastEventStream<int> stream(2, 4);
+    REQUIRE(stream.GetConsumerCount() == 2);
+
+    auto buf = pool.CheckOut();
+    buf->GetData()[0] = 42;
+    buf->SetSize(1);
+    stream.Send(std::move(buf));
+    REQUIRE(stream.GetConsumerLag(0) == 1);
+    REQUIRE(stream.GetConsumerLag(1) == 1);
+    REQUIRE(pool.GetCheckedOutCount() == 1);
+
+    auto a = stream.ReceiveBlocking(0);
+    REQUIRE(a);
+    REQUIRE(a->GetData()[0] == 42);
+    REQUIRE(stream.GetConsumerLag(0) == 0);
+    REQUIRE(stream.GetConsumerLag(1) == 1);
+    a.reset();
+    REQUIRE(pool.GetCheckedOutCount() == 1);
+
+    auto b = stream.ReceiveBlocking(1);
+    REQUIRE(b.get() != nullptr);
+    REQUIRE(b->GetData()[0] == 42);
+    b.reset();
+    REQUIRE(pool.GetCheckedOutCount() == 0);
+}
+
+
+TEST_CASE("Each consumer receives every buffer in order", "[BroadcastEventStream]") {
+    EventBufferPool<int> pool(1);
+    BroadcastEventStream<int> stream(3, 8);
+    int const count = 5000;
+
+    std::vector<std::vector<int>> received(3);
+    std::vector<std::thread> consumers;
+    for (std::size_t c = 0; c < 3; ++c) {
+        consumers.emplace_back([&, c] {
+            while (auto buf = stream.ReceiveBlocking(c)) {
+                received[c].push_back(buf->GetData()[0]);
+                if (c == 2 && received[c].size() % 500 == 0) { // Slow consumer
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < count; ++i) {
+        auto buf = pool.CheckOut();
+        buf->GetData()[0] = i;
+        buf->SetSize(1);
+        stream.Send(std::move(buf));
+    }
+    stream.Send({});
+    for (auto& t : consumers) {
+        t.join();
+    }
+
+    std::vector<int> expected(count);
+    for (int i = 0; i < count; ++i) {
+        expected[i] = i;
+    }
+    for (auto const& r : received) {
+        REQUIRE(r == expected);
+    }
+    REQUIRE(stream.GetPeakConsumerLag(2) <= 8);
+    REQUIRE(pool.GetCheckedOutCount() == 0);
+    REQUIRE(pool.GetHighWaterCount() <= 9);
+}
+
+
+TEST_CASE("Every consumer receives the exception", "[BroadcastEventStream]") {
+    EventBufferPool<int> pool(1);
+    BroadcastEventStream<int> stream(2);
+
+    stream.Send(pool.CheckOut());
+    stream.SendException(std::make_exception_ptr(std::runtime_error("test")));
+
+    for (std::size_t c = 0; c < 2; ++c) {
+        REQUIRE(stream.ReceiveBlocking(c));
+        REQUIRE_THROWS_AS(stream.ReceiveBlocking(c), std::runtime_error);
+    }
+    REQUIRE(pool.GetCheckedOutCount() == 0);
+}
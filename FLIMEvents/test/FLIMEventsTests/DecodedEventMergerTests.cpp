@@ -0,0 +1,238 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/DecodedEventMerger.hpp"
+#include "DecodedEventRecorder.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+    ValidPhotonEvent MakePhoton(uint64_t macrotime, uint16_t route = 0) {
+        ValidPhotonEvent e;
+        e.macrotime = macrotime;
+        e.microtime = 0;
+        e.route = route;
+        return e;
+    }
+
+    MarkerEvent MakeMarker(uint64_t macrotime, uint16_t bits) {
+        MarkerEvent e;
+        e.macrotime = macrotime;
+        e.bits = bits;
+        return e;
+    }
+
+    DecodedEvent MakeTimestamp(uint64_t macrotime) {
+        DecodedEvent e;
+        e.macrotime = macrotime;
+        return e;
+    }
+}
+
+
+TEST_CASE("Events from two inputs are merged in macro-time order", "[DecodedEventMerger]") {
+    auto output = std::make_shared<DecodedEventRecorder>();
+    auto merger = std::make_shared<DecodedEventMerger>(2, 4, output);
+    auto in0 = merger->GetInput(0);
+    auto in1 = merger->GetInput(1);
+
+    in0->HandleValidPhoton(MakePhoton(10, 1));
+    in0->HandleValidPhoton(MakePhoton(30, 2));
+    CHECK(output->events.empty()); // Input 1 not yet seen
+
+    in1->HandleValidPhoton(MakePhoton(20, 3));
+    in1->HandleValidPhoton(MakePhoton(40, 0));
+    in0->HandleFinish();
+    in1->HandleFinish();
+
+    CHECK(output->NonTimestampEvents() == std::vector<std::string>{
+        "P 10 0 1", "P 20 0 19", "P 30 0 2", "P 40 0 16", "F",
+    });
+}
+
+
+TEST_CASE("Timestamps release events held for other inputs", "[DecodedEventMerger]") {
+    auto output = std::make_shared<DecodedEventRecorder>();
+    auto merger = std::make_shared<DecodedEventMerger>(2, 4, output);
+    auto in0 = merger->GetInput(0);
+    auto in1 = merger->GetInput(1);
+
+    in0->HandleValidPhoton(MakePhoton(100));
+    in0->HandleValidPhoton(MakePhoton(200));
+    in1->HandleTimestamp(MakeTimestamp(150));
+    CHECK(output->events == std::vector<std::string>{ "P 100 0 0", "T 150" });
+
+    in1->HandleTimestamp(MakeTimestamp(4096));
+    CHECK(output->events == std::vector<std::string>{
+        "P 100 0 0", "T 150", "P 200 0 0",
+    });
+
+    // Both inputs have reached 300
+    in0->HandleTimestamp(MakeTimestamp(300));
+    CHECK(output->events.back() == "T 300");
+}
+
+
+TEST_CASE("Timestamps do not pass events that share a macro-time", "[DecodedEventMerger]") {
+    auto output = std::make_shared<DecodedEventRecorder>();
+    auto merger = std::make_shared<DecodedEventMerger>(2, 4, output);
+    auto in0 = merger->GetInput(0);
+    auto in1 = merger->GetInput(1);
+
+    in1->HandleTimestamp(MakeTimestamp(200));
+    in0->HandleValidPhoton(MakePhoton(100));
+    CHECK(output->events == std::vector<std::string>{ "P 100 0 0" });
+
+    // Input 0 may still send events at 100
+    in0->HandleValidPhoton(MakePhoton(100));
+    in0->HandleTimestamp(MakeTimestamp(200));
+    CHECK(output->events == std::vector<std::string>{
+        "P 100 0 0", "P 100 0 0", "T 200",
+    });
+}
+
+
+TEST_CASE("Batches are merged", "[DecodedEventMerger]") {
+    auto output = std::make_shared<DecodedEventRecorder>();
+    auto merger = std::make_shared<DecodedEventMerger>(2, 4, output);
+    auto in0 = merger->GetInput(0);
+    auto in1 = merger->GetInput(1);
+
+    DecodedEventBatch b0;
+    b0.AppendPhoton(1, 5, 0);
+    b0.AppendPhoton(3, 5, 0);
+    b0.markers.push_back(MakeMarker(4, 2));
+    b0.timestamp = 8192;
+    DecodedEventBatch b1;
+    b1.AppendPhoton(2, 7, 1);
+    DataLostEvent d;
+    d.macrotime = 5;
+    b1.dataLost.push_back(d);
+    b1.timestamp = 4096;
+
+    in0->HandleEventBatch(b0);
+    in1->HandleEventBatch(b1);
+    CHECK(output->events == std::vector<std::string>{
+        "P 1 5 0", "P 2 7 17", "P 3 5 0", "M 4 2", "D 5", "T 4096",
+    });
+}
+
+
+TEST_CASE("Only markers from input 0 are passed on", "[DecodedEventMerger]") {
+    auto output = std::make_shared<DecodedEventRecorder>();
+    auto merger = std::make_shared<DecodedEventMerger>(3, 4, output);
+    auto in0 = merger->GetInput(0);
+    auto in1 = merger->GetInput(1);
+    auto in2 = merger->GetInput(2);
+
+    in0->HandleMarker(MakeMarker(10, 2));
+    in1->HandleMarker(MakeMarker(11, 2));
+    in2->HandleMarker(MakeMarker(12, 2));
+    in0->HandleFinish();
+    in1->HandleFinish();
+    in2->HandleFinish();
+
+    CHECK(output->NonTimestampEvents() == std::vector<std::string>{
+        "M 10 2", "F",
+    });
+}
+
+
+TEST_CASE("Inputs can be aligned on their first marker", "[DecodedEventMerger]") {
+    auto output = std::make_shared<DecodedEventRecorder>();
+    auto merger = std::make_shared<DecodedEventMerger>(2, 4, output);
+    merger->SetAlignOnFirstMarker(true);
+    auto in0 = merger->GetInput(0);
+    auto in1 = merger->GetInput(1);
+
+    in1->HandleValidPhoton(MakePhoton(900)); // Before first marker; discarded
+    in1->HandleMarker(MakeMarker(1000, 2));
+    in1->HandleValidPhoton(MakePhoton(1005));
+    in0->HandleValidPhoton(MakePhoton(50)); // Before first marker; discarded
+    CHECK(output->events.empty());
+
+    in0->HandleMarker(MakeMarker(100, 2));
+    in0->HandleValidPhoton(MakePhoton(103));
+    in0->HandleValidPhoton(MakePhoton(110));
+    in1->HandleValidPhoton(MakePhoton(1020));
+    in0->HandleFinish();
+    in1->HandleFinish();
+
+    CHECK(output->NonTimestampEvents() == std::vector<std::string>{
+        "M 100 2", "P 103 0 0", "P 105 0 16", "P 110 0 0", "P 120 0 16", "F",
+    });
+}
+
+
+TEST_CASE("Merger reports errors once", "[DecodedEventMerger]") {
+    auto output = std::make_shared<DecodedEventRecorder>();
+    auto merger = std::make_shared<DecodedEventMerger>(2, 4, output);
+    auto in0 = merger->GetInput(0);
+    auto in1 = merger->GetInput(1);
+
+    in0->HandleValidPhoton(MakePhoton(10));
+    in1->HandleError("test");
+    in0->HandleValidPhoton(MakePhoton(20));
+    in0->HandleError("other");
+    CHECK(output->events == std::vector<std::string>{ "E test" });
+}
+
+
+TEST_CASE("Merger fails if an input never advances", "[DecodedEventMerger]") {
+    auto output = std::make_shared<DecodedEventRecorder>();
+    auto merger = std::make_shared<DecodedEventMerger>(2, 4, output);
+    merger->SetMaxPendingEvents(100);
+    auto in0 = merger->GetInput(0);
+    auto in1 = merger->GetInput(1);
+
+    for (uint64_t t = 1; t <= 101; ++t) {
+        in0->HandleValidPhoton(MakePhoton(t));
+    }
+    REQUIRE(output->events.size() == 1);
+    CHECK(output->events[0] == "E Cannot merge event streams: no events from input 1");
+
+    in1->HandleFinish();
+    in0->HandleFinish();
+    CHECK(output->events.size() == 1);
+}
+
+
+TEST_CASE("Inputs on separate threads are merged in order", "[DecodedEventMerger]") {
+    auto output = std::make_shared<DecodedEventRecorder>();
+    auto merger = std::make_shared<DecodedEventMerger>(4, 4, output);
+
+    std::size_t const batchCount = 200;
+    std::size_t const batchSize = 100;
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < merger->GetInputCount(); ++i) {
+        threads.emplace_back([input = merger->GetInput(i), i, batchCount, batchSize] {
+            DecodedEventBatch batch;
+            uint64_t t = i;
+            for (std::size_t b = 0; b < batchCount; ++b) {
+                batch.Clear();
+                for (std::size_t n = 0; n < batchSize; ++n) {
+                    t += 1 + (n * 7 + i * 3) % 5;
+                    batch.AppendPhoton(t, 0, 0);
+                }
+                input->HandleEventBatch(batch);
+            }
+            input->HandleFinish();
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    REQUIRE(output->events.back() == "F");
+    std::vector<uint64_t> times;
+    for (auto const& e : output->events) {
+        if (e[0] == 'P') {
+            times.push_back(std::stoull(e.substr(2)));
+        }
+    }
+    CHECK(times.size() == merger->GetInputCount() * batchCount * batchSize);
+    CHECK(std::is_sorted(times.begin(), times.end()));
+}
@@ -0,0 +1,103 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/DecodedEventQueue.hpp"
+#include "DecodedEventRecorder.hpp"
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+    // Records events (as delivered by the default HandleEventBatch()) and
+    // the thread they were delivered on
+    class ThreadRecorder : public DecodedEventRecorder {
+    public:
+        std::thread::id threadId;
+        bool slow = false;
+
+        void HandleEventBatch(DecodedEventBatch const& batch) override {
+            threadId = std::this_thread::get_id();
+            if (slow) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            DecodedEventRecorder::HandleEventBatch(batch);
+        }
+    };
+
+    DecodedEventBatch MakeBatch(uint64_t start, uint64_t count) {
+        DecodedEventBatch batch;
+        for (uint64_t t = start; t < start + count; ++t) {
+            if (t % 7 == 0) {
+                MarkerEvent marker;
+                marker.macrotime = t;
+                marker.bits = 1;
+                batch.markers.push_back(marker);
+            }
+            else {
+                batch.AppendPhoton(t, 0, 0);
+            }
+        }
+        batch.timestamp = start + count + 5;
+        return batch;
+    }
+}
+
+
+TEST_CASE("Decoded events are delivered in order on receiving thread", "[DecodedEventQueue]") {
+    auto output = std::make_shared<ThreadRecorder>();
+    auto queue = std::make_shared<DecodedEventQueue>(output, 2);
+    std::thread receiver([queue] { queue->Pump(); });
+
+    // The same events, directly
+    DecodedEventRecorder expected;
+
+    SECTION("Batches and single events") {
+        output->slow = true; // Sender must wait for queue to drain
+        uint64_t t = 0;
+        for (int i = 0; i < 20; ++i) {
+            auto batch = MakeBatch(t, 100);
+            queue->HandleEventBatch(batch);
+            expected.HandleEventBatch(batch);
+            t += 200;
+
+            ValidPhotonEvent photon;
+            photon.macrotime = t++;
+            queue->HandleValidPhoton(photon);
+            expected.HandleValidPhoton(photon);
+            MarkerEvent marker;
+            marker.macrotime = t++;
+            queue->HandleMarker(marker);
+            expected.HandleMarker(marker);
+        }
+        DecodedEvent timestamp;
+        timestamp.macrotime = t + 10;
+        queue->HandleTimestamp(timestamp);
+        expected.HandleTimestamp(timestamp);
+        queue->HandleFinish();
+        expected.HandleFinish();
+        receiver.join();
+
+        REQUIRE(output->threadId != std::this_thread::get_id());
+        REQUIRE(output->events == expected.events);
+    }
+
+    SECTION("Error follows preceding events") {
+        auto batch = MakeBatch(0, 10);
+        queue->HandleEventBatch(batch);
+        expected.HandleEventBatch(batch);
+        ValidPhotonEvent photon;
+        photon.macrotime = 100;
+        queue->HandleValidPhoton(photon);
+        expected.HandleValidPhoton(photon);
+        queue->HandleError("test");
+        expected.HandleError("test");
+        photon.macrotime = 200;
+        queue->HandleValidPhoton(photon); // Ignored
+        queue->HandleFinish(); // Ignored
+        receiver.join();
+
+        REQUIRE(output->events == expected.events);
+        REQUIRE(output->events.back() == "E test");
+    }
+}
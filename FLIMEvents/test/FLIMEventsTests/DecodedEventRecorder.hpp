@@ -0,0 +1,58 @@
+#pragma once
+
+#include "FLIMEvents/DecodedEvent.hpp"
+
+#include <string>
+#include <vector>
+
+
+// Records decoded events as strings, for comparison. Batches are recorded as
+// their events, in order (unless HandleEventBatch() is overridden).
+class DecodedEventRecorder : public DecodedEventProcessor {
+public:
+    std::vector<std::string> events;
+
+    void HandleTimestamp(DecodedEvent const& event) override {
+        events.emplace_back("T " + std::to_string(event.macrotime));
+    }
+
+    void HandleValidPhoton(ValidPhotonEvent const& event) override {
+        events.emplace_back("P " + std::to_string(event.macrotime) + ' ' +
+            std::to_string(event.microtime) + ' ' +
+            std::to_string(event.route));
+    }
+
+    void HandleInvalidPhoton(InvalidPhotonEvent const& event) override {
+        events.emplace_back("I " + std::to_string(event.macrotime) + ' ' +
+            std::to_string(event.microtime) + ' ' +
+            std::to_string(event.route));
+    }
+
+    void HandleMarker(MarkerEvent const& event) override {
+        events.emplace_back("M " + std::to_string(event.macrotime) + ' ' +
+            std::to_string(event.bits));
+    }
+
+    void HandleDataLost(DataLostEvent const& event) override {
+        events.emplace_back("D " + std::to_string(event.macrotime));
+    }
+
+    void HandleError(std::string const& message) override {
+        events.emplace_back("E " + message);
+    }
+
+    void HandleFinish() override {
+        events.emplace_back("F");
+    }
+
+    // Events other than timestamps
+    std::vector<std::string> NonTimestampEvents() const {
+        std::vector<std::string> ret;
+        for (auto const& e : events) {
+            if (e[0] != 'T') {
+                ret.push_back(e);
+            }
+        }
+        return ret;
+    }
+};
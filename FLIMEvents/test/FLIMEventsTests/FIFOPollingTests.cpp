@@ -0,0 +1,160 @@
+#include <catch2/catch.hpp>
+#include "../../../FIFOPolling.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+
+using namespace std::chrono_literals;
+
+
+TEST_CASE("FIFO poller waits briefly before the rate is known", "[AdaptiveFIFOPoller]") {
+    AdaptiveFIFOPoller poller(20ms);
+    CHECK(poller.GetRateEstimate() == 0.0);
+    CHECK(poller.GetSleepInterval(1000000) == 5ms);
+    CHECK(poller.GetTargetEventCount(65536) == 1024); // MinTargetEvents
+}
+
+
+TEST_CASE("FIFO poller adapts to the event rate", "[AdaptiveFIFOPoller]") {
+    auto const start = AdaptiveFIFOPoller::Clock::now();
+    AdaptiveFIFOPoller poller(20ms);
+
+    // Too short a time to make an estimate
+    poller.RecordRead(1000, start + 1ms);
+    CHECK(poller.GetRateEstimate() == 0.0);
+
+    // 10000 events in (just under) 10 ms
+    poller.RecordRead(9000, start + 10ms);
+    REQUIRE(poller.GetRateEstimate() == Approx(1e6).epsilon(0.01));
+
+    SECTION("Buffers are sized to the latency target") {
+        CHECK(poller.GetTargetEventCount(1000000) == Approx(20000).epsilon(0.01));
+        CHECK(poller.GetTargetEventCount(16384) == 16384);
+    }
+
+    SECTION("Sleep is limited by the latency target and the events needed") {
+        CHECK(poller.GetSleepInterval(1000000) == 10ms);
+        auto const sleep = poller.GetSleepInterval(2000);
+        CHECK(sleep >= 1900us);
+        CHECK(sleep <= 2000us);
+    }
+
+    SECTION("Increases are followed immediately") {
+        // 10^8 events/s would fill a quarter of the smallest FIFO in < 1 ms
+        poller.RecordRead(1000000, start + 20ms);
+        CHECK(poller.GetRateEstimate() == Approx(1e8).epsilon(0.01));
+        CHECK(poller.GetSleepInterval(1000000) == 1ms);
+        CHECK(poller.GetTargetEventCount(65536) == 65536);
+    }
+
+    SECTION("Decreases are followed gradually") {
+        poller.RecordRead(0, start + 20ms);
+        CHECK(poller.GetRateEstimate() == Approx(0.75e6).epsilon(0.01));
+        poller.RecordRead(0, start + 30ms);
+        CHECK(poller.GetRateEstimate() == Approx(0.5625e6).epsilon(0.01));
+    }
+
+    SECTION("Under pressure, reads are as large and frequent as possible") {
+        poller.SetUnderPressure(true);
+        CHECK(poller.GetTargetEventCount(65536) == 65536);
+        CHECK(poller.GetSleepInterval(1000000) == 1ms);
+        poller.SetUnderPressure(false);
+        CHECK(poller.GetSleepInterval(1000000) == 10ms);
+    }
+}
+
+
+TEST_CASE("FIFO poller rate hint is a lower bound", "[AdaptiveFIFOPoller]") {
+    double hint = 2e6;
+    AdaptiveFIFOPoller poller(20ms, [&] { return hint; });
+    CHECK(poller.GetRateEstimate() == 2e6);
+    CHECK(poller.GetTargetEventCount(1000000) == 40000);
+
+    hint = 0.0;
+    CHECK(poller.GetRateEstimate() == 0.0);
+}
+
+
+TEST_CASE("FIFO poller latency target has a minimum", "[AdaptiveFIFOPoller]") {
+    AdaptiveFIFOPoller poller(0ms);
+    CHECK(poller.GetLatencyTarget() == 1ms);
+    CHECK(poller.GetSleepInterval(1000) == 1ms);
+}
+
+
+TEST_CASE("Buffer capacity covers the latency target at the maximum rate", "[AdaptiveFIFOPoller]") {
+    CHECK(AdaptiveFIFOPoller::BufferCapacityForLatency(20ms, 1e7) == 200000);
+    CHECK(AdaptiveFIFOPoller::BufferCapacityForLatency(1ms, 1e6) == 16 * 1024);
+    CHECK(AdaptiveFIFOPoller::BufferCapacityForLatency(1000ms, 1e8) == 1024 * 1024);
+}
+
+
+TEST_CASE("FIFO monitor warns once per high-fill episode", "[FIFOMonitor]") {
+    std::size_t warnings = 0;
+    FIFOMonitor monitor([&](std::string const&) { ++warnings; });
+    auto t = FIFOMonitor::Clock::now();
+
+    monitor.RecordFillLevel(0.1, t);
+    CHECK_FALSE(monitor.IsUnderPressure());
+    CHECK(warnings == 0);
+
+    monitor.RecordFillLevel(0.3, t += 1s);
+    CHECK(monitor.IsUnderPressure());
+    CHECK(warnings == 0);
+
+    monitor.RecordFillLevel(0.6, t += 1s);
+    CHECK(warnings == 1);
+    monitor.RecordFillLevel(0.7, t += 1s);
+    CHECK(warnings == 1);
+
+    // Draining below the pressure level ends the episode
+    monitor.RecordFillLevel(0.4, t += 1s);
+    monitor.RecordFillLevel(0.2, t += 1s);
+    CHECK_FALSE(monitor.IsUnderPressure());
+    monitor.RecordFillLevel(0.6, t += 1s);
+    CHECK(warnings == 2);
+
+    CHECK(monitor.GetWarningCount() == 2);
+    CHECK(monitor.GetOverflowCount() == 0);
+    CHECK(monitor.GetPeakFillLevel() == 0.7);
+}
+
+
+TEST_CASE("FIFO monitor warns when overflow is predicted", "[FIFOMonitor]") {
+    std::size_t warnings = 0;
+    FIFOMonitor monitor([&](std::string const&) { ++warnings; });
+    auto t = FIFOMonitor::Clock::now();
+
+    monitor.RecordFillLevel(0.3, t);
+    CHECK(warnings == 0);
+
+    // Filling at 15 per second: full in under 50 ms
+    monitor.RecordFillLevel(0.45, t += 10ms);
+    CHECK(monitor.GetFillRate() == Approx(15.0));
+    CHECK(monitor.GetTimeToOverflow() < FIFOMonitor::WarningHorizon());
+    CHECK(warnings == 1);
+}
+
+
+TEST_CASE("FIFO monitor counts overflow episodes", "[FIFOMonitor]") {
+    std::size_t warnings = 0;
+    FIFOMonitor monitor([&](std::string const&) { ++warnings; });
+    auto t = FIFOMonitor::Clock::now();
+
+    monitor.RecordOverflow();
+    monitor.RecordOverflow();
+    CHECK(monitor.GetOverflowCount() == 1);
+    CHECK(monitor.GetFillLevel() == 1.0);
+    CHECK(warnings == 1);
+
+    monitor.RecordFillLevel(1.0, t += 1ms);
+    CHECK(monitor.GetOverflowCount() == 1);
+
+    monitor.RecordFillLevel(0.1, t += 1ms);
+    monitor.RecordFillLevel(1.0, t += 1ms);
+    CHECK(monitor.GetOverflowCount() == 2);
+    CHECK(monitor.GetWarningCount() == 0); // Overflows are counted separately
+    CHECK(warnings == 2);
+}
@@ -0,0 +1,141 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/HistogramPool.hpp"
+
+#include <algorithm>
+#include <thread>
+
+
+TEST_CASE("Pool reuses storage of the same size", "[HistogramPool]") {
+    HistogramPool<uint16_t> pool;
+
+    uint16_t const* data;
+    {
+        auto h = pool.Get(8, 12, false, 4, 3, true);
+        REQUIRE(h.IsValid());
+        REQUIRE(h.GetNumberOfElements() == 256 * 4 * 3);
+        data = h.Get();
+        REQUIRE(data[0] == 0);
+        REQUIRE(data[h.GetNumberOfElements() - 1] == 0);
+        h.Increment(0, 0, 0);
+    }
+    REQUIRE(pool.GetIdleCount() == 1);
+    REQUIRE(pool.GetAllocationCount() == 1);
+
+    SECTION("Same size is reused and zeroed on request") {
+        // Same number of elements with different dimensions
+        auto h = pool.Get(8, 12, true, 3, 4, true);
+        REQUIRE(h.Get() == data);
+        REQUIRE(data[0] == 0);
+        REQUIRE(pool.GetIdleCount() == 0);
+        REQUIRE(pool.GetReuseCount() == 1);
+    }
+
+    SECTION("Different size is allocated") {
+        auto h = pool.Get(8, 12, false, 4, 4, false);
+        REQUIRE(pool.GetIdleCount() == 1);
+        REQUIRE(pool.GetAllocationCount() == 2);
+        REQUIRE(pool.ReleaseIdle() == 1);
+        REQUIRE(pool.GetIdleCount() == 0);
+    }
+
+    SECTION("Idle storage can be cleared in advance") {
+        REQUIRE(pool.ClearIdle() == 1);
+        REQUIRE(pool.ClearIdle() == 0);
+        REQUIRE(data[0] == 0);
+        auto h = pool.Get(8, 12, false, 4, 3, true);
+        REQUIRE(h.Get() == data);
+    }
+}
+
+
+TEST_CASE("Pool prefers storage in the requested state", "[HistogramPool]") {
+    HistogramPool<uint16_t> pool;
+    uint16_t const* bData;
+    {
+        auto a = pool.Get(0, 12, false, 2, 2, true);
+        auto b = pool.Get(0, 12, false, 2, 2, true);
+        bData = b.Get();
+        a = {};
+        REQUIRE(pool.GetIdleCount() == 1);
+        REQUIRE(pool.ClearIdle() == 1);
+    }
+    REQUIRE(pool.GetIdleCount() == 2);
+
+    // a was cleared while idle; b was returned afterwards
+    auto dirty = pool.Get(0, 12, false, 2, 2, false);
+    REQUIRE(dirty.Get() == bData);
+    auto clean = pool.Get(0, 12, false, 2, 2, true);
+    REQUIRE(clean.Get() != bData);
+    REQUIRE(pool.GetAllocationCount() == 2);
+    REQUIRE(pool.GetReuseCount() == 2);
+}
+
+
+TEST_CASE("Pool clears in advance only storage requested zeroed", "[HistogramPool]") {
+    HistogramPool<uint16_t> pool;
+    uint16_t const* data;
+    {
+        auto h = pool.Get(0, 12, false, 2, 2, false);
+        data = h.Get();
+        h.Increment(0, 1, 1);
+    }
+    REQUIRE(pool.ClearIdle() == 0);
+    REQUIRE(data[3] == 1);
+
+    // Cleared on demand
+    auto h = pool.Get(0, 12, false, 2, 2, true);
+    REQUIRE(h.Get() == data);
+    REQUIRE(data[3] == 0);
+}
+
+
+TEST_CASE("Get takes over storage being cleared", "[HistogramPool]") {
+    HistogramPool<uint16_t> pool;
+    std::size_t size;
+    {
+        // Several chunks
+        auto h = pool.Get(8, 12, false, 128, 128, true);
+        size = h.GetNumberOfElements();
+        REQUIRE(size * sizeof(uint16_t) > 4 * HistogramPool<uint16_t>::ClearChunkBytes);
+        for (std::size_t y = 0; y < 128; ++y) {
+            h.Increment(0, 0, y);
+            h.Increment(255, 127, y);
+        }
+    }
+
+    std::thread t([&] { pool.ClearIdle(); });
+    auto h = pool.Get(8, 12, false, 128, 128, true);
+    t.join();
+
+    REQUIRE(std::all_of(h.Get(), h.Get() + size, [](uint16_t v) { return v == 0; }));
+    REQUIRE(pool.GetAllocationCount() == 1);
+    REQUIRE(pool.GetReuseCount() == 1);
+    REQUIRE(pool.GetIdleCount() == 0);
+}
+
+
+TEST_CASE("Histograms can outlive their pool", "[HistogramPool]") {
+    Histogram<uint16_t> h;
+    {
+        HistogramPool<uint16_t> pool;
+        h = pool.Get(4, 12, false, 8, 8, true);
+    }
+    h.Increment(0, 7, 7);
+    REQUIRE(h.Get()[h.GetNumberOfElements() - 16] == 1);
+    h = {}; // Freed (checked by ASan/LSan)
+}
+
+
+TEST_CASE("Histograms can be returned from another thread", "[HistogramPool]") {
+    HistogramPool<uint32_t> pool;
+    for (int i = 0; i < 10; ++i) {
+        auto h = pool.Get(2, 12, false, 16, 16, true);
+        std::thread t([h = std::move(h)]() mutable {
+            h.Increment(0, 0, 0);
+        });
+        t.join();
+    }
+    REQUIRE(pool.GetAllocationCount() == 1);
+    REQUIRE(pool.GetReuseCount() == 9);
+    REQUIRE(pool.GetIdleCount() == 1);
+}
@@ -135,9 +135,369 @@ TEST_CASE("Frames are produced according to line markers", "[LineClockPixellator
         REQUIRE(output->pixelPhotons[3].x == 1);
     }
 
+    SECTION("Photon placed correctly in 2x1 frame from batch") {
+        auto lcp = std::make_shared<LineClockPixellator>(2, 1, 1, 5, 20, 1, output);
+
+        DecodedEventBatch batch;
+        MarkerEvent lineMarker;
+        lineMarker.bits = 1 << 1;
+        lineMarker.macrotime = 100;
+        batch.markers.emplace_back(lineMarker);
+        for (auto mt : { 104, 105, 114, 115, 124, 125 }) {
+            batch.AppendPhoton(mt, 0, 0);
+        }
+        batch.timestamp = 200;
+        lcp->HandleEventBatch(batch);
+
+        lcp->Flush();
+        REQUIRE(output->beginFrameCount == 1);
+        REQUIRE(output->endFrameCount == 1);
+        REQUIRE(output->pixelPhotons.size() == 4);
+        REQUIRE(output->pixelPhotons[0].x == 0);
+        REQUIRE(output->pixelPhotons[1].x == 0);
+        REQUIRE(output->pixelPhotons[2].x == 1);
+        REQUIRE(output->pixelPhotons[3].x == 1);
+    }
+
+    SECTION("Photons arriving ahead of line marker are placed") {
+        // Delay = -10, time = 20, so pixels range over times [-10, 0) and
+        // [0, 10) relative to the line marker.
+        auto lcp = std::make_shared<LineClockPixellator>(2, 1, 1, -10, 20, 1, output);
+
+        ValidPhotonEvent photon;
+        memset(&photon, 0, sizeof(photon));
+        for (auto mt : { 89, 90, 99 }) {
+            photon.macrotime = mt;
+            lcp->HandleValidPhoton(photon);
+        }
+        REQUIRE(output->pixelPhotons.empty());
+
+        MarkerEvent lineMarker;
+        lineMarker.bits = 1 << 1;
+        lineMarker.macrotime = 100;
+        lcp->HandleMarker(lineMarker);
+        REQUIRE(output->pixelPhotons.size() == 2);
+
+        for (auto mt : { 100, 109, 110 }) {
+            photon.macrotime = mt;
+            lcp->HandleValidPhoton(photon);
+        }
+
+        lcp->Flush();
+        REQUIRE(output->beginFrameCount == 1);
+        REQUIRE(output->endFrameCount == 1);
+        REQUIRE(output->finishCount == 1);
+        REQUIRE(output->pixelPhotons.size() == 4);
+        REQUIRE(output->pixelPhotons[0].x == 0);
+        REQUIRE(output->pixelPhotons[1].x == 0);
+        REQUIRE(output->pixelPhotons[2].x == 1);
+        REQUIRE(output->pixelPhotons[3].x == 1);
+    }
+
+    SECTION("Photons in a started line are emitted without delay") {
+        auto lcp = std::make_shared<LineClockPixellator>(2, 2, 1, 5, 20, 1, output);
+
+        MarkerEvent lineMarker;
+        lineMarker.bits = 1 << 1;
+        lineMarker.macrotime = 100;
+        lcp->HandleMarker(lineMarker);
+
+        ValidPhotonEvent photon;
+        memset(&photon, 0, sizeof(photon));
+        photon.macrotime = 110;
+        lcp->HandleValidPhoton(photon);
+        REQUIRE(output->pixelPhotons.size() == 1);
+        REQUIRE(output->pixelPhotons[0].x == 0);
+        REQUIRE(output->pixelPhotons[0].y == 0);
+
+        // Photons between lines are discarded
+        photon.macrotime = 130;
+        lcp->HandleValidPhoton(photon);
+        lineMarker.macrotime = 200;
+        lcp->HandleMarker(lineMarker);
+        photon.macrotime = 220;
+        lcp->HandleValidPhoton(photon);
+        REQUIRE(output->pixelPhotons.size() == 2);
+        REQUIRE(output->pixelPhotons[1].x == 1);
+        REQUIRE(output->pixelPhotons[1].y == 1);
+    }
+
+    SECTION("Output does not depend on event delivery") {
+        // Many photons per line, including ones ahead of the line marker
+        // (negative delay) and between lines
+        DecodedEventBatch batch;
+        MarkerEvent lineMarker;
+        lineMarker.bits = 1 << 1;
+        for (uint64_t t = 0; t < 2000; ++t) {
+            if (t % 100 == 50) {
+                lineMarker.macrotime = t;
+                batch.markers.emplace_back(lineMarker);
+            }
+            if (t % 3 == 0) {
+                batch.AppendPhoton(t, static_cast<uint16_t>(t % 7), 0);
+            }
+        }
+        batch.timestamp = 2000;
+
+        auto batchLcp = std::make_shared<LineClockPixellator>(4, 3, 10, -15, 60, 1, output);
+        batchLcp->HandleEventBatch(batch);
+        batchLcp->Flush();
+
+        // The same events one at a time, processing after each
+        auto singleOutput = std::make_shared<MockProcessor>();
+        singleOutput->Reset();
+        auto singleLcp = std::make_shared<LineClockPixellator>(4, 3, 10, -15, 60, 1, singleOutput);
+        ForEachEventInBatch(batch,
+            [&](ValidPhotonEvent const& e) { singleLcp->HandleValidPhoton(e); singleLcp->Flush(); },
+            [&](InvalidPhotonEvent const& e) { singleLcp->HandleInvalidPhoton(e); singleLcp->Flush(); },
+            [&](MarkerEvent const& e) { singleLcp->HandleMarker(e); singleLcp->Flush(); },
+            [&](DataLostEvent const& e) { singleLcp->HandleDataLost(e); singleLcp->Flush(); },
+            [&](DecodedEvent const& e) { singleLcp->HandleTimestamp(e); singleLcp->Flush(); });
+
+        REQUIRE(output->beginFrameCount == 7);
+        REQUIRE(output->endFrameCount == 6);
+        REQUIRE(output->errors.empty());
+        REQUIRE(singleOutput->beginFrameCount == output->beginFrameCount);
+        REQUIRE(singleOutput->endFrameCount == output->endFrameCount);
+        REQUIRE(singleOutput->pixelPhotons.size() == output->pixelPhotons.size());
+        // 20 lines of 20 photons each (one third of each line's 60 units)
+        REQUIRE(output->pixelPhotons.size() == 20 * 20);
+        for (std::size_t i = 0; i < output->pixelPhotons.size(); ++i) {
+            auto const& a = output->pixelPhotons[i];
+            auto const& b = singleOutput->pixelPhotons[i];
+            REQUIRE(a.x == b.x);
+            REQUIRE(a.y == b.y);
+            REQUIRE(a.frame == b.frame);
+            REQUIRE(a.microtime == b.microtime);
+        }
+    }
+
+    SECTION("Pixel is the same as by integer division") {
+        struct Case { uint32_t pixels; uint32_t lineTime; };
+        for (auto c : { Case{ 7, 100 }, Case{ 256, 1000 }, Case{ 100, 7 },
+            Case{ 3, 3 }, Case{ 1, 50 } }) {
+            output->Reset();
+            LineClockPixellator lcp(c.pixels, 1, 1, 0, c.lineTime, 1, output);
+
+            MarkerEvent lineMarker;
+            lineMarker.bits = 1 << 1;
+            lineMarker.macrotime = 1000;
+            lcp.HandleMarker(lineMarker);
+            ValidPhotonEvent photon;
+            memset(&photon, 0, sizeof(photon));
+            for (uint64_t t = 0; t < c.lineTime; ++t) {
+                photon.macrotime = 1000 + t;
+                lcp.HandleValidPhoton(photon);
+            }
+
+            REQUIRE(output->pixelPhotons.size() == c.lineTime);
+            for (uint64_t t = 0; t < c.lineTime; ++t) {
+                REQUIRE(output->pixelPhotons[t].x == c.pixels * t / c.lineTime);
+            }
+        }
+    }
+
+    SECTION("Bidirectional mapping places reverse sweep in next row") {
+        // Forward sweep over [10, 30), reverse over [40, 60)
+        auto mapping = LineMapping::FromBoundaries({ 10, 20, 30 }, { 40, 50, 60 });
+        LineClockPixellator lcp(mapping, 2, 1, 0, 1, output);
+
+        ValidPhotonEvent photon;
+        memset(&photon, 0, sizeof(photon));
+        MarkerEvent lineMarker;
+        lineMarker.bits = 1 << 1;
+        for (uint64_t lineStart : { 100, 200 }) {
+            lineMarker.macrotime = lineStart;
+            lcp.HandleMarker(lineMarker);
+            for (auto t : { 5, 15, 25, 35, 45, 55 }) {
+                photon.macrotime = lineStart + t;
+                lcp.HandleValidPhoton(photon);
+            }
+        }
+        DecodedEvent timestamp;
+        timestamp.macrotime = 1000;
+        lcp.HandleTimestamp(timestamp);
+
+        REQUIRE(output->endFrameCount == 1);
+        REQUIRE(output->pixelPhotons.size() == 8); // None outside sweeps
+        struct Pixel { uint32_t x; uint32_t y; };
+        std::vector<Pixel> const expected{ { 0, 0 }, { 1, 0 }, { 1, 1 },
+            { 0, 1 }, { 0, 2 }, { 1, 2 }, { 1, 3 }, { 0, 3 } };
+        for (std::size_t i = 0; i < expected.size(); ++i) {
+            REQUIRE(output->pixelPhotons[i].x == expected[i].x);
+            REQUIRE(output->pixelPhotons[i].y == expected[i].y);
+        }
+    }
+
+    SECTION("Photons that cannot belong to a future line are not buffered") {
+        auto lcp = std::make_shared<LineClockPixellator>(2, 1, 1, -10, 20, 1, output);
+
+        ValidPhotonEvent photon;
+        memset(&photon, 0, sizeof(photon));
+        for (uint64_t mt = 0; mt < 10000; ++mt) {
+            photon.macrotime = mt;
+            lcp->HandleValidPhoton(photon);
+        }
+        // Only photons within the (negative) line delay of the latest time
+        REQUIRE(lcp->GetPendingPhotonCount() == 11);
+        REQUIRE(lcp->GetPeakPendingPhotonCount() == 11);
+        REQUIRE(output->errors.empty());
+    }
+
+    SECTION("Missing line markers are reported after the maximum lag") {
+        auto lcp = std::make_shared<LineClockPixellator>(2, 1, 1, 0, 20, 1, output);
+        lcp->SetMaxLineMarkerLag(1000);
+        lcp->SetMacrotimeUnitNs(1000.0);
+
+        ValidPhotonEvent photon;
+        memset(&photon, 0, sizeof(photon));
+        for (uint64_t mt = 500; mt <= 1500; mt += 10) {
+            photon.macrotime = mt;
+            lcp->HandleValidPhoton(photon);
+        }
+        REQUIRE(output->errors.empty());
+
+        SECTION("Line marker resets lag") {
+            MarkerEvent lineMarker;
+            lineMarker.bits = 1 << 1;
+            lineMarker.macrotime = 1600;
+            lcp->HandleMarker(lineMarker);
+            photon.macrotime = 2500;
+            lcp->HandleValidPhoton(photon);
+            REQUIRE(output->errors.empty());
+        }
+
+        SECTION("Error when exceeded") {
+            photon.macrotime = 1510;
+            lcp->HandleValidPhoton(photon);
+            REQUIRE(output->errors.size() == 1);
+            REQUIRE(output->errors[0].find("No line markers seen in 1 ms") == 0);
+        }
+    }
+
+    SECTION("Buffered photons are limited") {
+        auto lcp = std::make_shared<LineClockPixellator>(2, 1, 1, -1000, 20, 1, output);
+        lcp->SetMaxPendingPhotons(10);
+
+        ValidPhotonEvent photon;
+        memset(&photon, 0, sizeof(photon));
+        for (uint64_t mt = 0; mt < 20; ++mt) {
+            photon.macrotime = mt;
+            lcp->HandleValidPhoton(photon);
+        }
+        REQUIRE(output->errors.size() == 1);
+        REQUIRE(lcp->GetPendingPhotonCount() == 0);
+    }
+
+    SECTION("Buffered line markers are limited") {
+        auto lcp = std::make_shared<LineClockPixellator>(2, 10, 1, 1000, 20, 1, output);
+        lcp->SetMaxPendingLines(5);
+
+        MarkerEvent lineMarker;
+        lineMarker.bits = 1 << 1;
+        for (uint64_t mt = 0; mt < 200; mt += 30) {
+            lineMarker.macrotime = mt;
+            lcp->HandleMarker(lineMarker);
+        }
+        REQUIRE(output->errors.size() == 1);
+        REQUIRE(lcp->GetPendingLineCount() == 0);
+        REQUIRE(lcp->GetPeakPendingLineCount() == 6);
+    }
+
+    SECTION("Frames start on frame markers") {
+        // 2x2 frames, lines every 100 with a photon in each
+        auto lcp = std::make_shared<LineClockPixellator>(2, 2, 100, 0, 20, 1, output);
+        lcp->SetFrameMarkerBit(2);
+
+        auto sendLine = [&](uint64_t mt, bool frameMarker) {
+            MarkerEvent marker;
+            marker.bits = (1 << 1) | (frameMarker ? 1 << 2 : 0);
+            marker.macrotime = mt;
+            lcp->HandleMarker(marker);
+            ValidPhotonEvent photon;
+            memset(&photon, 0, sizeof(photon));
+            photon.macrotime = mt + 5;
+            lcp->HandleValidPhoton(photon);
+        };
+        auto sendDataLost = [&](uint64_t mt) {
+            DataLostEvent lost;
+            lost.macrotime = mt;
+            lcp->HandleDataLost(lost);
+        };
+
+        SECTION("Lines outside frames are ignored") {
+            sendLine(100, false); // Before first frame marker
+            sendLine(200, true);
+            sendLine(300, false);
+            sendLine(400, false); // Extra line after frame
+            sendLine(500, true);
+            sendLine(600, false);
+            sendLine(700, true);
+            REQUIRE(output->errors.empty());
+            REQUIRE(output->beginFrameCount == 3);
+            REQUIRE(output->endFrameCount == 2);
+            REQUIRE(output->pixelPhotons.size() == 5);
+            REQUIRE(output->pixelPhotons[2].frame == 1);
+            REQUIRE(output->pixelPhotons[2].y == 0);
+            REQUIRE(output->pixelPhotons[4].frame == 2);
+        }
+
+        SECTION("Data loss discards only the frame in progress") {
+            sendLine(100, true);
+            sendLine(200, false);
+            sendLine(300, true);
+            sendDataLost(350);
+            sendLine(400, false);
+            sendLine(500, true);
+            sendLine(600, false);
+            sendLine(700, true);
+            REQUIRE(output->errors.empty());
+            REQUIRE(output->finishCount == 0);
+            REQUIRE(output->beginFrameCount == 4);
+            REQUIRE(output->endFrameCount == 2);
+            REQUIRE(lcp->GetDiscardedFrameCount() == 1);
+            REQUIRE(output->pixelPhotons.size() == 6);
+            REQUIRE(output->pixelPhotons[3].frame == 2);
+            REQUIRE(output->pixelPhotons[3].y == 0);
+            REQUIRE(output->pixelPhotons[4].frame == 2);
+            REQUIRE(output->pixelPhotons[4].y == 1);
+            REQUIRE(output->pixelPhotons[5].frame == 3);
+        }
+
+        SECTION("Frames lost with data are counted") {
+            sendLine(100, true);
+            sendLine(200, false);
+            sendLine(300, true); // Frame period 200
+            sendDataLost(350);
+            sendLine(1100, true); // 4 frames later
+            REQUIRE(output->errors.empty());
+            REQUIRE(lcp->GetDiscardedFrameCount() == 4);
+            REQUIRE(output->pixelPhotons.back().frame == 5);
+        }
+
+        SECTION("Early frame marker discards incomplete frame") {
+            sendLine(100, true);
+            sendLine(200, true);
+            sendLine(300, false);
+            sendLine(400, true);
+            REQUIRE(output->errors.empty());
+            REQUIRE(output->beginFrameCount == 3);
+            REQUIRE(output->endFrameCount == 1);
+            REQUIRE(lcp->GetDiscardedFrameCount() == 1);
+            REQUIRE(output->pixelPhotons[1].frame == 1);
+        }
+    }
+
+    SECTION("Data loss is an error without frame marker") {
+        auto lcp = std::make_shared<LineClockPixellator>(2, 2, 100, 0, 20, 1, output);
+        DataLostEvent lost;
+        lost.macrotime = 100;
+        lcp->HandleDataLost(lost);
+        REQUIRE(output->errors.size() == 1);
+    }
+
     // TODO Other things we might test
     // - 1x1 frame size edge case
-    // - photons between lines discarded
     // - large line delay compared to line interval (with/without photons)
     // - large negative line delay compared to line interval (with/without photons)
     //   - in particular, line spanning negative time
@@ -0,0 +1,171 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/LineMapping.hpp"
+
+#include <random>
+
+
+namespace {
+    // Reference: linear search of boundaries; returns false if in no pixel
+    bool MapBySearch(std::vector<uint32_t> const& forward,
+        std::vector<uint32_t> const& reverse, uint32_t t,
+        uint32_t& x, uint32_t& row) {
+        uint32_t const pixels = static_cast<uint32_t>(forward.size() - 1);
+        for (uint32_t k = 0; k < pixels; ++k) {
+            if (t >= forward[k] && t < forward[k + 1]) {
+                x = k;
+                row = 0;
+                return true;
+            }
+            if (!reverse.empty() && t >= reverse[k] && t < reverse[k + 1]) {
+                x = pixels - 1 - k;
+                row = 1;
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+
+TEST_CASE("Linear mapping divides line equally", "[LineMapping]") {
+    auto const m = LineMapping::Linear(7, 100);
+    REQUIRE(m.GetPixelsPerLine() == 7);
+    REQUIRE(m.GetRowsPerLine() == 1);
+    REQUIRE(m.GetLineTime() == 100);
+    for (uint32_t t = 0; t < 100; ++t) {
+        uint32_t x, row;
+        REQUIRE(m.Map(t, x, row));
+        REQUIRE(x == 7 * t / 100);
+        REQUIRE(row == 0);
+    }
+}
+
+
+TEST_CASE("Mapping from boundaries", "[LineMapping]") {
+    SECTION("Unidirectional with leading gap") {
+        auto const m = LineMapping::FromBoundaries({ 10, 12, 30, 31 });
+        REQUIRE(m.GetPixelsPerLine() == 3);
+        REQUIRE(m.GetRowsPerLine() == 1);
+        REQUIRE(m.GetLineTime() == 31);
+
+        uint32_t x, row;
+        REQUIRE_FALSE(m.Map(0, x, row));
+        REQUIRE_FALSE(m.Map(9, x, row));
+        REQUIRE(m.Map(10, x, row));
+        REQUIRE(x == 0);
+        REQUIRE(m.Map(12, x, row));
+        REQUIRE(x == 1);
+        REQUIRE(m.Map(29, x, row));
+        REQUIRE(x == 1);
+        REQUIRE(m.Map(30, x, row));
+        REQUIRE(x == 2);
+    }
+
+    SECTION("Bidirectional without gap between sweeps") {
+        auto const m = LineMapping::FromBoundaries({ 0, 5, 10 }, { 10, 15, 20 });
+        REQUIRE(m.GetRowsPerLine() == 2);
+        REQUIRE(m.GetLineTime() == 20);
+
+        uint32_t x, row;
+        REQUIRE(m.Map(9, x, row));
+        REQUIRE(x == 1);
+        REQUIRE(row == 0);
+        REQUIRE(m.Map(10, x, row));
+        REQUIRE(x == 1);
+        REQUIRE(row == 1);
+        REQUIRE(m.Map(19, x, row));
+        REQUIRE(x == 0);
+        REQUIRE(row == 1);
+    }
+
+    SECTION("Invalid boundaries") {
+        REQUIRE_THROWS_AS(LineMapping::FromBoundaries({ 10 }),
+            std::invalid_argument);
+        REQUIRE_THROWS_AS(LineMapping::FromBoundaries({ 0, 0 }),
+            std::invalid_argument);
+        REQUIRE_THROWS_AS(LineMapping::FromBoundaries({ 0, 10, 5 }),
+            std::invalid_argument);
+        REQUIRE_THROWS_AS(LineMapping::FromBoundaries({ 0, 10, 20 }, { 15, 25, 30 }),
+            std::invalid_argument);
+        REQUIRE_THROWS_AS(LineMapping::FromBoundaries({ 0, 10, 20 }, { 20, 30 }),
+            std::invalid_argument);
+    }
+}
+
+
+TEST_CASE("Sinusoidal mapping", "[LineMapping]") {
+    uint32_t const pixels = 64;
+    uint32_t const period = 10000;
+    auto const m = LineMapping::Sinusoidal(pixels, period, 0.8, true);
+    REQUIRE(m.GetPixelsPerLine() == pixels);
+    REQUIRE(m.GetRowsPerLine() == 2);
+    REQUIRE(m.GetLineTime() <= period);
+
+    // Pixels are narrowest at the center of each sweep, and the reverse
+    // sweep mirrors the forward sweep
+    uint32_t prevX = 0;
+    uint32_t x, row;
+    std::vector<uint32_t> forwardCounts(pixels);
+    std::vector<uint32_t> reverseCounts(pixels);
+    for (uint32_t t = 0; t < m.GetLineTime(); ++t) {
+        if (m.Map(t, x, row)) {
+            REQUIRE(x < pixels);
+            if (row == 0) {
+                REQUIRE(x >= prevX);
+                prevX = x;
+                ++forwardCounts[x];
+            }
+            else {
+                REQUIRE(t > period / 2);
+                ++reverseCounts[x];
+            }
+        }
+    }
+    REQUIRE(forwardCounts[0] > forwardCounts[pixels / 2]);
+    for (uint32_t k = 0; k < pixels; ++k) {
+        REQUIRE(forwardCounts[k] > 0);
+        REQUIRE(forwardCounts[k] == forwardCounts[pixels - 1 - k]);
+        REQUIRE(reverseCounts[k] == forwardCounts[k]);
+    }
+
+    REQUIRE_THROWS_AS(LineMapping::Sinusoidal(pixels, period, 0.0, false),
+        std::invalid_argument);
+    REQUIRE_THROWS_AS(LineMapping::Sinusoidal(0, period, 0.5, false),
+        std::invalid_argument);
+}
+
+
+TEST_CASE("Mapping agrees with search of boundaries", "[LineMapping]") {
+    std::mt19937 rng(1);
+    for (int trial = 0; trial < 20; ++trial) {
+        uint32_t const pixels = 1 + rng() % 50;
+        bool const bidirectional = trial % 2 == 1;
+        std::vector<uint32_t> forward;
+        std::vector<uint32_t> reverse;
+        uint32_t t = rng() % 20;
+        for (uint32_t k = 0; k <= pixels; ++k) {
+            forward.push_back(t);
+            t += 1 + rng() % (trial < 10 ? 5 : 500); // Widely varying widths
+        }
+        if (bidirectional) {
+            t = forward.back() + rng() % 20;
+            for (uint32_t k = 0; k <= pixels; ++k) {
+                reverse.push_back(t);
+                t += 1 + rng() % 40;
+            }
+        }
+        auto const m = LineMapping::FromBoundaries(forward, reverse);
+
+        for (uint32_t time = 0; time < m.GetLineTime(); ++time) {
+            uint32_t x = 0, row = 0;
+            uint32_t expectedX = 0, expectedRow = 0;
+            bool const expected = MapBySearch(forward, reverse, time,
+                expectedX, expectedRow);
+            REQUIRE(m.Map(time, x, row) == expected);
+            if (expected) {
+                REQUIRE(x == expectedX);
+                REQUIRE(row == expectedRow);
+            }
+        }
+    }
+}
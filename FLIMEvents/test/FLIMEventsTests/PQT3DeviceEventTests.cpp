@@ -0,0 +1,300 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/PQT3DeviceEvent.hpp"
+
+#include <algorithm>
+#include <random>
+
+
+namespace {
+    template <typename E>
+    E MakeRecord(uint32_t word) {
+        E e;
+        e.bytes[0] = word & 0xff;
+        e.bytes[1] = (word >> 8) & 0xff;
+        e.bytes[2] = (word >> 16) & 0xff;
+        e.bytes[3] = (word >> 24) & 0xff;
+        return e;
+    }
+
+    uint32_t PicoPhoton(uint16_t nsync, uint16_t dtime, uint8_t channel) {
+        return nsync | (uint32_t(dtime & 0xfff) << 16) | (uint32_t(channel) << 28);
+    }
+
+    uint32_t PicoOverflow() {
+        return 0xf0000000;
+    }
+
+    uint32_t PicoMarker(uint16_t nsync, uint8_t bits) {
+        return nsync | (uint32_t(bits & 0x0f) << 16) | 0xf0000000;
+    }
+
+    uint32_t HydraPhoton(uint16_t nsync, uint16_t dtime, uint8_t channel) {
+        return (nsync & 0x3ff) | (uint32_t(dtime & 0x7fff) << 10) |
+            (uint32_t(channel & 0x3f) << 25);
+    }
+
+    uint32_t HydraOverflow(uint16_t count) {
+        return (count & 0x3ff) | (63u << 25) | 0x80000000;
+    }
+
+    uint32_t HydraMarker(uint16_t nsync, uint8_t bits) {
+        return (nsync & 0x3ff) | (uint32_t(bits & 0x0f) << 25) | 0x80000000;
+    }
+
+    class RecordingProcessor : public DecodedEventProcessor {
+    public:
+        std::vector<std::string> events;
+
+        void HandleTimestamp(DecodedEvent const& event) override {
+            events.emplace_back("T " + std::to_string(event.macrotime));
+        }
+
+        void HandleValidPhoton(ValidPhotonEvent const& event) override {
+            events.emplace_back("P " + std::to_string(event.macrotime) + ' ' +
+                std::to_string(event.microtime) + ' ' +
+                std::to_string(event.route));
+        }
+
+        void HandleInvalidPhoton(InvalidPhotonEvent const& event) override {
+            events.emplace_back("I " + std::to_string(event.macrotime));
+        }
+
+        void HandleMarker(MarkerEvent const& event) override {
+            events.emplace_back("M " + std::to_string(event.macrotime) + ' ' +
+                std::to_string(event.bits));
+        }
+
+        void HandleDataLost(DataLostEvent const& event) override {
+            events.emplace_back("D " + std::to_string(event.macrotime));
+        }
+
+        void HandleError(std::string const& message) override {
+            events.emplace_back("E " + message);
+        }
+
+        void HandleFinish() override {
+            events.emplace_back("F");
+        }
+    };
+
+    // Mostly photons, with occasional markers and overflows. Photons may
+    // share an nsync value, but markers do not share with preceding photons
+    // (so that batch order is the same as the per-event order). If errorRate
+    // > 0, some records will have decreasing nsync.
+    template <typename FPhoton, typename FOverflow, typename FMarker>
+    std::vector<uint32_t> MakeRandomWords(std::size_t count, unsigned seed,
+        double errorRate, uint16_t nsyncPeriod, uint16_t dtimeMax,
+        uint8_t channelCount, FPhoton photon, FOverflow overflow,
+        FMarker marker) {
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<double> u(0.0, 1.0);
+        std::uniform_int_distribution<int> step(0, 3);
+        std::uniform_int_distribution<int> dtime(0, dtimeMax);
+        std::uniform_int_distribution<int> channel(0, channelCount - 1);
+        std::uniform_int_distribution<int> bits(1, 15);
+
+        std::vector<uint32_t> words;
+        int t = 1;
+        while (words.size() < count) {
+            double r = u(gen);
+            t += step(gen);
+            if (t >= nsyncPeriod || r < 0.01) {
+                words.push_back(overflow());
+                t = 1;
+                continue;
+            }
+            if (u(gen) < errorRate && t > 2) {
+                t /= 2;
+            }
+            if (r < 0.02) {
+                ++t;
+                if (t >= nsyncPeriod) {
+                    continue;
+                }
+                words.push_back(marker(uint16_t(t), uint8_t(bits(gen))));
+                ++t;
+                continue;
+            }
+            words.push_back(photon(uint16_t(t), uint16_t(dtime(gen)),
+                uint8_t(channel(gen))));
+        }
+        return words;
+    }
+
+    template <typename Decoder, typename E>
+    std::vector<std::string> DecodeInBuffers(std::vector<E> const& events,
+        std::size_t bufferSize, SIMDLevel simd) {
+        auto output = std::make_shared<RecordingProcessor>();
+        Decoder decoder(output);
+        decoder.SetSIMDLevel(simd);
+        for (std::size_t i = 0; i < events.size(); i += bufferSize) {
+            auto n = std::min(bufferSize, events.size() - i);
+            decoder.HandleDeviceEvents(
+                reinterpret_cast<char const*>(events.data() + i), n);
+        }
+        decoder.HandleFinish();
+        return output->events;
+    }
+
+    template <typename Decoder, typename E>
+    std::vector<std::string> DecodeOneByOne(std::vector<E> const& events) {
+        auto output = std::make_shared<RecordingProcessor>();
+        Decoder decoder(output);
+        for (auto const& e : events) {
+            decoder.HandleDeviceEvent(reinterpret_cast<char const*>(&e));
+        }
+        decoder.HandleFinish();
+        return output->events;
+    }
+
+    std::vector<std::string> WithoutTimestamps(std::vector<std::string> events) {
+        events.erase(std::remove_if(events.begin(), events.end(),
+            [](std::string const& e) { return e[0] == 'T'; }), events.end());
+        return events;
+    }
+
+    template <typename Decoder, typename E>
+    void CheckDecodingPaths(std::vector<uint32_t> const& words, bool expectError) {
+        std::vector<E> events;
+        for (auto w : words) {
+            events.emplace_back(MakeRecord<E>(w));
+        }
+
+        auto perEvent = DecodeOneByOne<Decoder>(events);
+        REQUIRE(perEvent.size() > 2);
+        if (expectError) {
+            REQUIRE(perEvent[perEvent.size() - 1][0] == 'E');
+        }
+        else {
+            REQUIRE(perEvent[perEvent.size() - 1] == "F");
+        }
+
+        for (std::size_t bufferSize : { 7, 64, 1000, 10000 }) {
+            auto scalar = DecodeInBuffers<Decoder>(events, bufferSize, SIMDLevel::None);
+            // Batches carry only the final timestamp
+            REQUIRE(WithoutTimestamps(scalar) == WithoutTimestamps(perEvent));
+            REQUIRE(DecodeInBuffers<Decoder>(events, bufferSize, SIMDLevel::SSE41) == scalar);
+            REQUIRE(DecodeInBuffers<Decoder>(events, bufferSize, SIMDLevel::AVX2) == scalar);
+        }
+    }
+}
+
+
+TEST_CASE("PicoT3 record fields", "[PicoT3Event]") {
+    auto e = MakeRecord<PicoT3Event>(PicoPhoton(0xabcd, 0x123, 7));
+    REQUIRE(e.GetNSync() == 0xabcd);
+    REQUIRE(e.GetDTime() == 0x123);
+    REQUIRE(e.GetChannel() == 7);
+    REQUIRE(!e.IsSpecial());
+
+    e = MakeRecord<PicoT3Event>(PicoOverflow());
+    REQUIRE(e.IsNSyncOverflow());
+    REQUIRE(!e.IsExternalMarker());
+    REQUIRE(e.GetNSyncOverflowCount() == 1);
+
+    e = MakeRecord<PicoT3Event>(PicoMarker(0xff80, 5));
+    REQUIRE(e.IsExternalMarker());
+    REQUIRE(!e.IsNSyncOverflow());
+    REQUIRE(e.GetNSync() == 0xff80);
+    REQUIRE(e.GetExternalMarkerBits() == 5);
+}
+
+
+TEST_CASE("HydraT3 record fields", "[HydraT3Event]") {
+    auto e = MakeRecord<HydraT3Event<false>>(HydraPhoton(0x3ff, 0x7fff, 63));
+    REQUIRE(e.GetNSync() == 0x3ff);
+    REQUIRE(e.GetDTime() == 0x7fff);
+    REQUIRE(e.GetChannel() == 63);
+    REQUIRE(!e.IsSpecial());
+
+    e = MakeRecord<HydraT3Event<false>>(HydraPhoton(0x155, 0x2aaa, 21));
+    REQUIRE(e.GetNSync() == 0x155);
+    REQUIRE(e.GetDTime() == 0x2aaa);
+    REQUIRE(e.GetChannel() == 21);
+
+    e = MakeRecord<HydraT3Event<false>>(HydraMarker(17, 0x9));
+    REQUIRE(e.IsExternalMarker());
+    REQUIRE(e.GetExternalMarkerBits() == 0x9);
+
+    e = MakeRecord<HydraT3Event<false>>(HydraOverflow(5));
+    REQUIRE(e.IsNSyncOverflow());
+    REQUIRE(e.GetNSyncOverflowCount() == 5);
+    e = MakeRecord<HydraT3Event<false>>(HydraOverflow(0));
+    REQUIRE(e.GetNSyncOverflowCount() == 1);
+
+    auto v1 = MakeRecord<HydraT3Event<true>>(HydraOverflow(5));
+    REQUIRE(v1.IsNSyncOverflow());
+    REQUIRE(v1.GetNSyncOverflowCount() == 1);
+}
+
+
+TEST_CASE("Hydra V2 T3 decoding", "[PQT3EventDecoder]") {
+    std::vector<HydraT3Event<false>> events{
+        MakeRecord<HydraT3Event<false>>(HydraPhoton(10, 100, 0)),
+        MakeRecord<HydraT3Event<false>>(HydraPhoton(10, 200, 1)), // Same nsync
+        MakeRecord<HydraT3Event<false>>(HydraMarker(20, 2)),
+        MakeRecord<HydraT3Event<false>>(HydraOverflow(3)),
+        MakeRecord<HydraT3Event<false>>(HydraPhoton(5, 300, 2)),
+        MakeRecord<HydraT3Event<false>>(HydraPhoton(4, 400, 3)), // Decreasing
+        MakeRecord<HydraT3Event<false>>(HydraPhoton(6, 500, 3)),
+    };
+
+    auto output = DecodeOneByOne<PQHydraV2T3EventDecoder>(events);
+    REQUIRE(output.size() == 6);
+    REQUIRE(output[0] == "P 10 100 0");
+    REQUIRE(output[1] == "P 10 200 1");
+    REQUIRE(output[2] == "M 20 2");
+    REQUIRE(output[3] == "T 3072");
+    REQUIRE(output[4] == "P 3077 300 2");
+    REQUIRE(output[5] == "E Non-monotonic nsync encountered");
+
+    auto batchOutput = DecodeInBuffers<PQHydraV2T3EventDecoder>(events,
+        events.size(), SIMDLevel::None);
+    REQUIRE(batchOutput.size() == 5);
+    REQUIRE(batchOutput[3] == "P 3077 300 2");
+    REQUIRE(batchOutput[4] == "E Non-monotonic nsync encountered");
+}
+
+
+TEST_CASE("PicoT3 decoding", "[PQT3EventDecoder]") {
+    std::vector<PicoT3Event> events{
+        MakeRecord<PicoT3Event>(PicoPhoton(1000, 100, 0)),
+        MakeRecord<PicoT3Event>(PicoOverflow()),
+        MakeRecord<PicoT3Event>(PicoOverflow()),
+        MakeRecord<PicoT3Event>(PicoMarker(7, 4)),
+        MakeRecord<PicoT3Event>(PicoPhoton(8, 4095, 14)),
+    };
+
+    auto output = DecodeOneByOne<PQPicoT3EventDecoder>(events);
+    REQUIRE(output.size() == 6);
+    REQUIRE(output[0] == "P 1000 100 0");
+    REQUIRE(output[1] == "T 65536");
+    REQUIRE(output[2] == "T 131072");
+    REQUIRE(output[3] == "M 131079 4");
+    REQUIRE(output[4] == "P 131080 4095 14");
+    REQUIRE(output[5] == "F");
+}
+
+
+TEST_CASE("PQ T3 batch and vectorized decoding match per-event decoding", "[PQT3EventDecoder]") {
+    for (unsigned seed : { 1u, 2u }) {
+        for (double errorRate : { 0.0, 0.0002 }) {
+            bool expectError = errorRate > 0.0;
+
+            auto pico = MakeRandomWords(10000, seed, errorRate, 65535, 4095, 15,
+                PicoPhoton, PicoOverflow, PicoMarker);
+            CheckDecodingPaths<PQPicoT3EventDecoder, PicoT3Event>(pico, expectError);
+
+            auto hydraV1 = MakeRandomWords(10000, seed, errorRate, 1023, 32767, 63,
+                HydraPhoton, [] { return HydraOverflow(1); }, HydraMarker);
+            CheckDecodingPaths<PQHydraV1T3EventDecoder, HydraT3Event<true>>(hydraV1, expectError);
+
+            std::mt19937 gen(seed);
+            std::uniform_int_distribution<int> count(0, 1023);
+            auto hydraV2 = MakeRandomWords(10000, seed, errorRate, 1023, 32767, 63,
+                HydraPhoton, [&] { return HydraOverflow(uint16_t(count(gen))); },
+                HydraMarker);
+            CheckDecodingPaths<PQHydraV2T3EventDecoder, HydraT3Event<false>>(hydraV2, expectError);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/ParallelRunner.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+
+using flimevents::internal::ParallelRunner;
+
+
+TEST_CASE("Parallel runner calls the function for each index", "[ParallelRunner]") {
+    ParallelRunner runner;
+    for (std::size_t n : { 0, 1, 2, 5 }) {
+        std::vector<std::atomic<int>> calls(n);
+        for (auto& c : calls) {
+            c = 0;
+        }
+        runner.Run(n, [&](std::size_t k) { ++calls[k]; });
+        for (auto const& c : calls) {
+            CHECK(c == 1);
+        }
+    }
+}
+
+
+TEST_CASE("Parallel runner keeps its threads", "[ParallelRunner]") {
+    ParallelRunner runner;
+    CHECK(runner.GetThreadCount() == 0);
+    std::atomic<std::size_t> total{ 0 };
+    for (int i = 0; i < 100; ++i) {
+        runner.Run(4, [&](std::size_t k) { total += k; });
+    }
+    CHECK(total == 600);
+    CHECK(runner.GetThreadCount() == 3);
+
+    runner.Run(2, [&](std::size_t) {});
+    CHECK(runner.GetThreadCount() == 3);
+}
+
+
+TEST_CASE("Parallel runner rethrows after all calls return", "[ParallelRunner]") {
+    ParallelRunner runner;
+    std::atomic<int> calls{ 0 };
+    REQUIRE_THROWS_AS(runner.Run(4, [&](std::size_t k) {
+        ++calls;
+        if (k == 2) {
+            throw std::runtime_error("test");
+        }
+    }), std::runtime_error);
+    CHECK(calls == 4);
+
+    // Still usable
+    runner.Run(4, [&](std::size_t) { ++calls; });
+    CHECK(calls == 8);
+}
@@ -0,0 +1,223 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/PixelClockPixellator.hpp"
+
+
+namespace {
+    class MockProcessor : public PixelPhotonProcessor {
+    public:
+        unsigned beginFrameCount = 0;
+        unsigned endFrameCount = 0;
+        std::vector<PixelPhotonEvent> pixelPhotons;
+        std::vector<std::string> errors;
+        unsigned finishCount = 0;
+
+        void HandleBeginFrame() override {
+            ++beginFrameCount;
+        }
+
+        void HandleEndFrame() override {
+            ++endFrameCount;
+        }
+
+        void HandlePixelPhoton(PixelPhotonEvent const& event) override {
+            pixelPhotons.emplace_back(event);
+        }
+
+        void HandleError(std::string const& message) override {
+            errors.emplace_back(message);
+        }
+
+        void HandleFinish() override {
+            ++finishCount;
+        }
+    };
+
+    void SendPixelMarker(DecodedEventProcessor& proc, uint64_t macrotime) {
+        MarkerEvent marker;
+        marker.bits = 1 << 0;
+        marker.macrotime = macrotime;
+        proc.HandleMarker(marker);
+    }
+
+    void SendPhoton(DecodedEventProcessor& proc, uint64_t macrotime,
+        uint16_t microtime = 0) {
+        ValidPhotonEvent photon;
+        memset(&photon, 0, sizeof(photon));
+        photon.macrotime = macrotime;
+        photon.microtime = microtime;
+        proc.HandleValidPhoton(photon);
+    }
+}
+
+
+TEST_CASE("Pixels are produced according to pixel markers", "[PixelClockPixellator]") {
+    auto output = std::make_shared<MockProcessor>();
+
+    SECTION("2x2 frames with photons") {
+        // Pixel markers every 10, max pixel time 8
+        PixelClockPixellator pcp(2, 2, 2, 0, 8, 0, output);
+
+        for (uint64_t px = 0; px < 8; ++px) {
+            uint64_t const t = 100 + 10 * px;
+            SendPixelMarker(pcp, t);
+            SendPhoton(pcp, t + 1, static_cast<uint16_t>(px));
+            SendPhoton(pcp, t + 9); // Past max pixel time; discarded
+        }
+        SendPixelMarker(pcp, 200);
+
+        REQUIRE(output->beginFrameCount == 2);
+        REQUIRE(output->endFrameCount == 2);
+        REQUIRE(output->finishCount == 1);
+        REQUIRE(output->errors.empty());
+        REQUIRE(output->pixelPhotons.size() == 8);
+        for (uint32_t px = 0; px < 8; ++px) {
+            auto const& p = output->pixelPhotons[px];
+            REQUIRE(p.microtime == px);
+            REQUIRE(p.x == px % 2);
+            REQUIRE(p.y == px / 2 % 2);
+            REQUIRE(p.frame == px / 4);
+        }
+    }
+
+    SECTION("Pixels end at next pixel marker") {
+        // Non-uniform pixel durations
+        PixelClockPixellator pcp(3, 1, 1, 0, 100, 0, output);
+
+        SendPixelMarker(pcp, 100);
+        SendPhoton(pcp, 104);
+        SendPixelMarker(pcp, 105);
+        SendPhoton(pcp, 105);
+        SendPhoton(pcp, 150);
+        SendPixelMarker(pcp, 160);
+        SendPhoton(pcp, 259);
+        SendPhoton(pcp, 260);
+
+        REQUIRE(output->endFrameCount == 1);
+        REQUIRE(output->finishCount == 1);
+        REQUIRE(output->pixelPhotons.size() == 4);
+        REQUIRE(output->pixelPhotons[0].x == 0);
+        REQUIRE(output->pixelPhotons[1].x == 1);
+        REQUIRE(output->pixelPhotons[2].x == 1);
+        REQUIRE(output->pixelPhotons[3].x == 2);
+    }
+
+    SECTION("Photons arriving ahead of pixel marker are placed") {
+        // Pixels range over [-5, 5) relative to their marker
+        PixelClockPixellator pcp(2, 1, 1, -5, 10, 0, output);
+
+        SendPhoton(pcp, 94);
+        SendPhoton(pcp, 95);
+        SendPixelMarker(pcp, 100);
+        SendPhoton(pcp, 104);
+        SendPhoton(pcp, 105); // In second pixel
+        SendPixelMarker(pcp, 110);
+        REQUIRE(output->pixelPhotons.size() == 2);
+        SendPhoton(pcp, 114);
+        SendPhoton(pcp, 115);
+
+        DecodedEvent timestamp;
+        timestamp.macrotime = 1000;
+        pcp.HandleTimestamp(timestamp);
+
+        REQUIRE(output->errors.empty());
+        REQUIRE(output->endFrameCount == 1);
+        REQUIRE(output->pixelPhotons.size() == 4);
+        REQUIRE(output->pixelPhotons[0].x == 0);
+        REQUIRE(output->pixelPhotons[1].x == 0);
+        REQUIRE(output->pixelPhotons[2].x == 1);
+        REQUIRE(output->pixelPhotons[3].x == 1);
+    }
+
+    SECTION("Last frame completion detected by last seen timestamp") {
+        PixelClockPixellator pcp(1, 1, 1, 3, 10, 0, output);
+
+        SendPixelMarker(pcp, 100);
+        DecodedEvent timestamp;
+        timestamp.macrotime = 112;
+        pcp.HandleTimestamp(timestamp);
+        REQUIRE(output->endFrameCount == 0);
+
+        timestamp.macrotime = 113;
+        pcp.HandleTimestamp(timestamp);
+        REQUIRE(output->endFrameCount == 1);
+        REQUIRE(output->finishCount == 1);
+    }
+
+    SECTION("Out-of-order pixel markers are an error") {
+        PixelClockPixellator pcp(2, 2, 1, 0, 10, 0, output);
+
+        SendPixelMarker(pcp, 100);
+        SendPixelMarker(pcp, 90);
+        REQUIRE(output->errors.size() == 1);
+    }
+
+    SECTION("Photons without pixel markers are not buffered") {
+        PixelClockPixellator pcp(2, 2, 1, 0, 10, 0, output);
+
+        for (uint64_t t = 0; t < 1000; ++t) {
+            SendPhoton(pcp, t);
+        }
+        REQUIRE(pcp.GetPendingPhotonCount() == 0);
+    }
+
+    SECTION("Buffered photons are limited") {
+        PixelClockPixellator pcp(2, 2, 1, -1000, 10, 0, output);
+        pcp.SetMaxPendingPhotons(10);
+
+        for (uint64_t t = 0; t < 20; ++t) {
+            SendPhoton(pcp, t);
+        }
+        REQUIRE(output->errors.size() == 1);
+        REQUIRE(pcp.GetPendingPhotonCount() == 0);
+    }
+
+    SECTION("Output does not depend on event delivery") {
+        for (int32_t delay : { -7, 0, 4 }) {
+            DecodedEventBatch batch;
+            MarkerEvent pixelMarker;
+            pixelMarker.bits = 1 << 0;
+            uint64_t nextMarker = 20;
+            for (uint64_t t = 0; t < 3000; ++t) {
+                if (t == nextMarker) {
+                    pixelMarker.macrotime = t;
+                    batch.markers.emplace_back(pixelMarker);
+                    // Non-uniform pixels, with a gap after each line of 4
+                    nextMarker += (batch.markers.size() % 4 == 0) ? 40 : 9 + t % 5;
+                }
+                if (t % 2 == 0) {
+                    batch.AppendPhoton(t, static_cast<uint16_t>(t % 11), 0);
+                }
+            }
+            batch.timestamp = 3000;
+
+            auto batchOutput = std::make_shared<MockProcessor>();
+            PixelClockPixellator batchPcp(4, 3, 100, delay, 12, 0, batchOutput);
+            batchPcp.HandleEventBatch(batch);
+
+            // The same events one at a time, processing after each
+            auto singleOutput = std::make_shared<MockProcessor>();
+            PixelClockPixellator singlePcp(4, 3, 100, delay, 12, 0, singleOutput);
+            ForEachEventInBatch(batch,
+                [&](ValidPhotonEvent const& e) { singlePcp.HandleValidPhoton(e); singlePcp.Flush(); },
+                [&](InvalidPhotonEvent const& e) { singlePcp.HandleInvalidPhoton(e); singlePcp.Flush(); },
+                [&](MarkerEvent const& e) { singlePcp.HandleMarker(e); singlePcp.Flush(); },
+                [&](DataLostEvent const& e) { singlePcp.HandleDataLost(e); singlePcp.Flush(); },
+                [&](DecodedEvent const& e) { singlePcp.HandleTimestamp(e); singlePcp.Flush(); });
+
+            REQUIRE(batchOutput->errors.empty());
+            REQUIRE(batchOutput->beginFrameCount > 5);
+            REQUIRE(singleOutput->beginFrameCount == batchOutput->beginFrameCount);
+            REQUIRE(singleOutput->endFrameCount == batchOutput->endFrameCount);
+            REQUIRE(singleOutput->pixelPhotons.size() == batchOutput->pixelPhotons.size());
+            REQUIRE(batchOutput->pixelPhotons.size() > 500);
+            for (std::size_t i = 0; i < batchOutput->pixelPhotons.size(); ++i) {
+                auto const& a = batchOutput->pixelPhotons[i];
+                auto const& b = singleOutput->pixelPhotons[i];
+                REQUIRE(a.x == b.x);
+                REQUIRE(a.y == b.y);
+                REQUIRE(a.frame == b.frame);
+                REQUIRE(a.microtime == b.microtime);
+            }
+        }
+    }
+}
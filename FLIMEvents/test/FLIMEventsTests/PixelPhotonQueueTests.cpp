@@ -0,0 +1,86 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/PixelPhotonQueue.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+    class RecordingProcessor : public PixelPhotonProcessor {
+    public:
+        std::vector<std::string> events;
+
+        void HandleBeginFrame() override {
+            events.emplace_back("B");
+        }
+
+        void HandleEndFrame() override {
+            events.emplace_back("E");
+        }
+
+        void HandlePixelPhoton(PixelPhotonEvent const& event) override {
+            events.emplace_back(std::to_string(event.x));
+        }
+
+        void HandleError(std::string const& message) override {
+            events.emplace_back("Error " + message);
+        }
+
+        void HandleFinish() override {
+            events.emplace_back("F");
+        }
+    };
+}
+
+
+TEST_CASE("Pixel photons are delivered in order on receiving thread", "[PixelPhotonQueue]") {
+    auto output = std::make_shared<RecordingProcessor>();
+    auto queue = std::make_shared<PixelPhotonQueue>(output, 2);
+    std::thread receiver([queue] { queue->Pump(); });
+
+    RecordingProcessor expected;
+    PixelPhotonEvent photon{};
+
+    SECTION("Frames spanning several batches") {
+        for (uint32_t frame = 0; frame < 3; ++frame) {
+            queue->HandleBeginFrame();
+            expected.HandleBeginFrame();
+            // Enough photons to fill batches, and a frame with none
+            uint32_t const count = frame == 1 ? 0 :
+                3 * PixelPhotonQueue::MaxBatchPhotons + 5;
+            for (uint32_t i = 0; i < count; ++i) {
+                photon.x = i;
+                queue->HandlePixelPhoton(photon);
+                expected.HandlePixelPhoton(photon);
+            }
+            queue->HandleEndFrame();
+            expected.HandleEndFrame();
+        }
+        queue->HandleBeginFrame(); // Never ended
+        expected.HandleBeginFrame();
+        photon.x = 42;
+        queue->HandlePixelPhoton(photon);
+        expected.HandlePixelPhoton(photon);
+        queue->HandleFinish();
+        expected.HandleFinish();
+        receiver.join();
+
+        REQUIRE(output->events.size() == expected.events.size());
+        REQUIRE(output->events == expected.events);
+    }
+
+    SECTION("Error follows preceding events") {
+        queue->HandleBeginFrame();
+        expected.HandleBeginFrame();
+        photon.x = 1;
+        queue->HandlePixelPhoton(photon);
+        expected.HandlePixelPhoton(photon);
+        queue->HandleError("test");
+        expected.HandleError("test");
+        queue->HandleFinish(); // Ignored
+        receiver.join();
+
+        REQUIRE(output->events == expected.events);
+    }
+}
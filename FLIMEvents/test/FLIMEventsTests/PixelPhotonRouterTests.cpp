@@ -0,0 +1,60 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/PixelPhotonRouter.hpp"
+
+#include <string>
+#include <vector>
+
+
+namespace {
+    class CountingProcessor : public PixelPhotonProcessor {
+    public:
+        unsigned beginFrameCount = 0;
+        unsigned endFrameCount = 0;
+        std::vector<uint16_t> photonRoutes;
+        unsigned finishCount = 0;
+
+        void HandleBeginFrame() override {
+            ++beginFrameCount;
+        }
+
+        void HandleEndFrame() override {
+            ++endFrameCount;
+        }
+
+        void HandlePixelPhoton(PixelPhotonEvent const& event) override {
+            photonRoutes.push_back(event.route);
+        }
+
+        void HandleError(std::string const&) override {}
+
+        void HandleFinish() override {
+            ++finishCount;
+        }
+    };
+}
+
+
+TEST_CASE("Photons are routed by channel", "[PixelPhotonRouter]") {
+    auto group0 = std::make_shared<CountingProcessor>();
+    auto group1 = std::make_shared<CountingProcessor>();
+    // Channels 0 and 2 to group0, 1 to group1, 3 to none
+    PixelPhotonRouter router(std::vector<std::shared_ptr<PixelPhotonProcessor>>{
+        group0, group1, group0, nullptr });
+
+    router.HandleBeginFrame();
+    PixelPhotonEvent photon{};
+    for (uint16_t route = 0; route < 5; ++route) {
+        photon.route = route;
+        router.HandlePixelPhoton(photon);
+    }
+    router.HandleEndFrame();
+    router.HandleFinish();
+
+    REQUIRE(group0->photonRoutes == std::vector<uint16_t>{ 0, 2 });
+    REQUIRE(group1->photonRoutes == std::vector<uint16_t>{ 1 });
+    for (auto const& g : { group0, group1 }) {
+        REQUIRE(g->beginFrameCount == 1);
+        REQUIRE(g->endFrameCount == 1);
+        REQUIRE(g->finishCount == 1);
+    }
+}
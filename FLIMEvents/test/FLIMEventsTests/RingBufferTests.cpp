@@ -0,0 +1,51 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/RingBuffer.hpp"
+
+using flimevents::internal::RingBuffer;
+
+
+TEST_CASE("Ring buffer is first-in, first-out", "[RingBuffer]") {
+    RingBuffer<int> rb;
+    REQUIRE(rb.empty());
+
+    SECTION("Across growth") {
+        for (int i = 0; i < 100; ++i) {
+            rb.push_back(i);
+        }
+        REQUIRE(rb.size() == 100);
+        for (int i = 0; i < 100; ++i) {
+            REQUIRE(rb.front() == i);
+            rb.pop_front();
+        }
+        REQUIRE(rb.empty());
+    }
+
+    SECTION("Across wrap-around, including growth while wrapped") {
+        int pushed = 0;
+        int popped = 0;
+        for (int round = 0; round < 50; ++round) {
+            for (int i = 0; i < round % 7 + 3; ++i) {
+                rb.push_back(pushed++);
+            }
+            for (int i = 0; i < round % 5 + 1 && !rb.empty(); ++i) {
+                REQUIRE(rb.front() == popped++);
+                rb.pop_front();
+            }
+        }
+        REQUIRE(rb.size() == static_cast<std::size_t>(pushed - popped));
+        while (!rb.empty()) {
+            REQUIRE(rb.front() == popped++);
+            rb.pop_front();
+        }
+        REQUIRE(popped == pushed);
+    }
+
+    SECTION("Clear empties") {
+        rb.push_back(1);
+        rb.push_back(2);
+        rb.clear();
+        REQUIRE(rb.empty());
+        rb.push_back(3);
+        REQUIRE(rb.front() == 3);
+    }
+}
@@ -0,0 +1,164 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/BHDeviceEvent.hpp"
+#include "FLIMEvents/Histogram.hpp"
+#include "FLIMEvents/LineClockPixellator.hpp"
+#include "FLIMEvents/StaticDownstream.hpp"
+
+#include <vector>
+
+
+namespace {
+    class HistogramRecorder : public HistogramProcessor<uint16_t> {
+    public:
+        unsigned frameCount = 0;
+        std::vector<uint16_t> finalHistogram;
+        bool finalIsComplete = false;
+        std::vector<std::string> errors;
+
+        void HandleError(std::string const& message) override {
+            errors.emplace_back(message);
+        }
+
+        void HandleFrame(Histogram<uint16_t> const&) override {
+            ++frameCount;
+        }
+
+        void HandleFinish(Histogram<uint16_t>&& histogram, bool isCompleteFrame) override {
+            auto data = histogram.Get();
+            finalHistogram.assign(data, data + histogram.GetNumberOfElements());
+            finalIsComplete = isCompleteFrame;
+        }
+    };
+
+    BHSPCEvent MakeBHSPCEvent(uint64_t macrotime, uint64_t prevMacrotime,
+        uint16_t adc, uint8_t route, bool marker) {
+        bool overflow = macrotime / 4096 != prevMacrotime / 4096;
+        uint16_t mt = macrotime % 4096;
+        BHSPCEvent e;
+        e.bytes[0] = mt & 0xff;
+        e.bytes[1] = ((mt >> 8) & 0x0f) | ((route & 0x0f) << 4);
+        e.bytes[2] = adc & 0xff;
+        e.bytes[3] = ((adc >> 8) & 0x0f) | (overflow ? 0x40 : 0) |
+            (marker ? 0x10 : 0);
+        return e;
+    }
+
+    // Line markers (bit 1) every 1000 macro-time units, with photons on all
+    // 4 routes in between.
+    std::vector<BHSPCEvent> MakeLineScanEvents(unsigned lineCount) {
+        std::vector<BHSPCEvent> events;
+        uint64_t prev = 0;
+        unsigned i = 0;
+        for (unsigned line = 0; line < lineCount; ++line) {
+            uint64_t lineStart = 1000 * (line + 1);
+            events.emplace_back(MakeBHSPCEvent(lineStart, prev, 0, 1 << 1, true));
+            prev = lineStart;
+            for (uint64_t t = lineStart + 3; t < lineStart + 1000; t += 7, ++i) {
+                events.emplace_back(MakeBHSPCEvent(t, prev,
+                    uint16_t((i * 37) % 4096), i % 4, false));
+                prev = t;
+            }
+        }
+        return events;
+    }
+
+    template <typename P>
+    void SendInBuffers(P& decoder, std::vector<BHSPCEvent> const& events,
+        std::size_t bufferSize) {
+        auto data = reinterpret_cast<char const*>(events.data());
+        for (std::size_t i = 0; i < events.size(); i += bufferSize) {
+            auto n = std::min(bufferSize, events.size() - i);
+            decoder.HandleDeviceEvents(data + i * sizeof(BHSPCEvent), n);
+        }
+        decoder.HandleFinish();
+    }
+}
+
+
+TEST_CASE("Statically composed pipeline matches dynamic pipeline", "[StaticDownstream]") {
+    uint32_t const width = 4;
+    uint32_t const height = 2;
+    uint32_t const maxFrames = 3;
+    uint64_t const routeMask = 0x5; // Routes 0 and 2
+
+    auto events = MakeLineScanEvents(8);
+    std::size_t const bufferSize = GENERATE(1, 16, 1000);
+
+    // Dynamic graph, as constructed at run time
+    auto dynamicOutput = std::make_shared<HistogramRecorder>();
+    {
+        Histogram<uint16_t> cumulative(4, 12, false, width, height);
+        cumulative.Clear();
+        auto histogrammer = std::make_shared<Histogrammer<uint16_t>>(
+            Histogram<uint16_t>(4, 12, false, width, height),
+            std::make_shared<HistogramAccumulator<uint16_t>>(
+                std::move(cumulative), dynamicOutput));
+        auto pixellator = std::make_shared<LineClockPixellator>(
+            width, height, maxFrames, 0, 800, 1, histogrammer);
+        BHSPCEventDecoder decoder(pixellator);
+        decoder.SetRouteMask(routeMask);
+        SendInBuffers(decoder, events, bufferSize);
+    }
+
+    // Static composition of the same graph
+    auto staticOutput = std::make_shared<HistogramRecorder>();
+    {
+        Histogram<uint16_t> cumulative(4, 12, false, width, height);
+        cumulative.Clear();
+        auto accumulator = MakeStaticDownstream(
+            HistogramAccumulator<uint16_t>(std::move(cumulative),
+                staticOutput));
+        auto histogrammer = MakeStaticDownstream(
+            Histogrammer<uint16_t, decltype(accumulator)>(
+                Histogram<uint16_t>(4, 12, false, width, height),
+                std::move(accumulator)));
+        auto pixellator = MakeStaticDownstream(
+            BasicLineClockPixellator<decltype(histogrammer)>(
+                width, height, maxFrames, 0, 800, 1, std::move(histogrammer)));
+        BHEventDecoder<BHSPCEvent, decltype(pixellator)> decoder(
+            std::move(pixellator));
+        decoder.SetRouteMask(routeMask);
+        SendInBuffers(decoder, events, bufferSize);
+    }
+
+    REQUIRE(dynamicOutput->errors.empty());
+    REQUIRE(dynamicOutput->frameCount == maxFrames);
+    REQUIRE(dynamicOutput->finalIsComplete);
+    unsigned total = 0;
+    for (auto c : dynamicOutput->finalHistogram) {
+        total += c;
+    }
+    REQUIRE(total > 0);
+
+    REQUIRE(staticOutput->errors.empty());
+    REQUIRE(staticOutput->frameCount == dynamicOutput->frameCount);
+    REQUIRE(staticOutput->finalIsComplete);
+    REQUIRE(staticOutput->finalHistogram == dynamicOutput->finalHistogram);
+}
+
+
+TEST_CASE("StaticDownstream detaches on reset", "[StaticDownstream]") {
+    class CountingProcessor final : public PixelPhotonProcessor {
+    public:
+        unsigned photonCount = 0;
+
+        void HandleBeginFrame() override {}
+        void HandleEndFrame() override {}
+        void HandlePixelPhoton(PixelPhotonEvent const&) override {
+            ++photonCount;
+        }
+        void HandleError(std::string const&) override {}
+        void HandleFinish() override {}
+    };
+
+    auto downstream = MakeStaticDownstream(CountingProcessor());
+    REQUIRE(downstream);
+
+    PixelPhotonEvent e{};
+    downstream->HandlePixelPhoton(e);
+    downstream.reset();
+    REQUIRE(!downstream);
+
+    // The processor remains accessible after being detached
+    REQUIRE(downstream.Get().photonCount == 1);
+}
@@ -0,0 +1,265 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/StreamBuffer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+
+TEST_CASE("Pool reuses checked-in buffers", "[EventBufferPool]") {
+    EventBufferPool<int> pool(16);
+
+    auto buf = pool.CheckOut();
+    REQUIRE(buf);
+    REQUIRE(buf->GetCapacity() == 16);
+    buf->SetSize(10);
+    auto* const first = buf.get();
+
+    auto moved = std::move(buf);
+    REQUIRE(!buf);
+    REQUIRE(moved.get() == first);
+
+    moved.reset();
+    REQUIRE(!moved);
+
+    auto again = pool.CheckOut();
+    REQUIRE(again.get() == first);
+    REQUIRE(again->GetSize() == 0);
+
+    auto other = pool.CheckOut();
+    REQUIRE(other.get() != first);
+}
+
+
+TEST_CASE("Pool frees buffers beyond maximum idle count", "[EventBufferPool]") {
+    EventBufferPool<int> pool(16, 0, 2);
+
+    std::vector<EventBufferHandle<int>> handles;
+    for (int i = 0; i < 4; ++i) {
+        handles.emplace_back(pool.CheckOut());
+    }
+    handles.clear(); // 2 kept, 2 freed (checked by ASan/LSan)
+
+    auto a = pool.CheckOut();
+    auto b = pool.CheckOut();
+    auto c = pool.CheckOut();
+    REQUIRE(a.get() != b.get());
+    REQUIRE(c);
+}
+
+
+TEST_CASE("Pool keeps up to the maximum buffer count idle", "[EventBufferPool]") {
+    EventBufferPool<int> pool(16, 0, 2);
+    pool.SetMaxBufferCount(5);
+    REQUIRE(pool.GetMaxIdleCount() == 8);
+
+    std::vector<EventBufferHandle<int>> handles;
+    for (int i = 0; i < 5; ++i) {
+        handles.emplace_back(pool.CheckOut());
+    }
+    handles.clear();
+    REQUIRE(pool.ReleaseIdleBuffers() == 5);
+
+    // Never lowered
+    pool.SetMaxBufferCount(1);
+    REQUIRE(pool.GetMaxIdleCount() == 8);
+}
+
+
+TEST_CASE("Pool reports checked-out and high-water counts", "[EventBufferPool]") {
+    EventBufferPool<int> pool(16);
+
+    {
+        auto a = pool.CheckOut();
+        auto b = pool.CheckOut();
+        REQUIRE(pool.GetCheckedOutCount() == 2);
+        auto c = pool.CheckOut();
+        REQUIRE(pool.GetCheckedOutCount() == 3);
+    }
+    REQUIRE(pool.GetCheckedOutCount() == 0);
+    REQUIRE(pool.GetHighWaterCount() == 3);
+
+    auto d = pool.CheckOut();
+    REQUIRE(pool.GetHighWaterCount() == 3);
+    REQUIRE(pool.ReleaseIdleBuffers() == 2);
+    REQUIRE(pool.ReleaseIdleBuffers() == 0);
+    d.reset();
+    REQUIRE(pool.ReleaseIdleBuffers() == 1);
+    REQUIRE(pool.GetOverflowCount() == 0);
+}
+
+
+TEST_CASE("Pool can be reused with fresh statistics", "[EventBufferPool]") {
+    EventBufferPool<int> pool(16);
+    REQUIRE(pool.GetBufferSize() == 16);
+    pool.SetMaxBufferCount(1, EventBufferPoolPolicy::Report);
+    {
+        auto a = pool.CheckOut();
+        REQUIRE(!pool.CheckOut());
+    }
+    REQUIRE(pool.GetHighWaterCount() == 1);
+    REQUIRE(pool.GetOverflowCount() == 1);
+
+    pool.ResetStatistics();
+    REQUIRE(pool.GetHighWaterCount() == 0);
+    REQUIRE(pool.GetOverflowCount() == 0);
+
+    pool.SetMaxBufferCount(2, EventBufferPoolPolicy::Report);
+    auto b = pool.CheckOut();
+    auto c = pool.CheckOut();
+    REQUIRE(c);
+    REQUIRE(pool.GetHighWaterCount() == 2);
+    REQUIRE(pool.GetOverflowCount() == 0);
+}
+
+
+TEST_CASE("Bounded pool fails or reports when exhausted", "[EventBufferPool]") {
+    EventBufferPool<int> pool(16);
+
+    SECTION("Fail") {
+        pool.SetMaxBufferCount(2, EventBufferPoolPolicy::Fail);
+        auto a = pool.CheckOut();
+        auto b = pool.CheckOut();
+        REQUIRE_THROWS_AS(pool.CheckOut(), std::runtime_error);
+        REQUIRE(pool.GetCheckedOutCount() == 2);
+        a.reset();
+        REQUIRE(pool.CheckOut());
+        REQUIRE(pool.GetOverflowCount() == 1);
+    }
+
+    SECTION("Report") {
+        pool.SetMaxBufferCount(2, EventBufferPoolPolicy::Report);
+        auto a = pool.CheckOut();
+        auto b = pool.CheckOut();
+        REQUIRE(!pool.CheckOut());
+        REQUIRE(!pool.CheckOut());
+        b.reset();
+        REQUIRE(pool.CheckOut());
+        REQUIRE(pool.GetOverflowCount() == 2);
+    }
+
+    REQUIRE(pool.GetHighWaterCount() == 2);
+}
+
+
+TEST_CASE("Bounded pool blocks until a buffer is checked in", "[EventBufferPool]") {
+    EventBufferPool<int> pool(1);
+    pool.SetMaxBufferCount(2, EventBufferPoolPolicy::Block);
+    EventStream<int> stream;
+    int const count = 1000;
+
+    std::thread sender([&] {
+        for (int i = 0; i < count; ++i) {
+            auto buf = pool.CheckOut();
+            buf->GetData()[0] = i;
+            buf->SetSize(1);
+            stream.Send(std::move(buf));
+        }
+        stream.Send({});
+    });
+
+    int received = 0;
+    while (auto buf = stream.ReceiveBlocking()) {
+        if (buf->GetData()[0] == received) {
+            ++received;
+        }
+        if (received % 100 == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    sender.join();
+
+    REQUIRE(received == count);
+    REQUIRE(pool.GetHighWaterCount() == 2);
+}
+
+
+TEST_CASE("Stream delivers buffers in order across threads", "[EventStream]") {
+    EventBufferPool<int> pool(1);
+    EventStream<int> stream(4); // Small, so that sender blocks when full
+    int const count = 10000;
+
+    std::thread sender([&] {
+        for (int i = 0; i < count; ++i) {
+            auto buf = pool.CheckOut();
+            buf->GetData()[0] = i;
+            buf->SetSize(1);
+            stream.Send(std::move(buf));
+        }
+        stream.Send({});
+    });
+
+    std::vector<int> received;
+    for (;;) {
+        auto buf = stream.ReceiveBlocking();
+        if (!buf) {
+            break;
+        }
+        REQUIRE(buf->GetSize() == 1);
+        received.push_back(buf->GetData()[0]);
+    }
+    sender.join();
+
+    std::vector<int> expected(count);
+    for (int i = 0; i < count; ++i) {
+        expected[i] = i;
+    }
+    REQUIRE(received == expected);
+}
+
+
+TEST_CASE("Stream exception is thrown after preceding buffers", "[EventStream]") {
+    EventBufferPool<int> pool(1);
+    EventStream<int> stream;
+
+    stream.Send(pool.CheckOut());
+    stream.SendException(std::make_exception_ptr(std::runtime_error("test")));
+    REQUIRE(stream.GetQueuedCount() == 2);
+
+    REQUIRE(stream.ReceiveBlocking());
+    REQUIRE_THROWS_AS(stream.ReceiveBlocking(), std::runtime_error);
+}
+
+
+TEST_CASE("MPMC queue passes each item exactly once", "[MPMCQueue]") {
+    flimevents::internal::MPMCQueue<int> queue(8);
+    REQUIRE_THROWS_AS(flimevents::internal::MPMCQueue<int>(6),
+        std::invalid_argument);
+
+    int const perProducer = 20000;
+    std::vector<std::thread> threads;
+    std::vector<std::vector<int>> popped(2);
+    for (int p = 0; p < 2; ++p) {
+        threads.emplace_back([&, p] {
+            for (int i = 0; i < perProducer; ++i) {
+                while (!queue.TryPush(p * perProducer + i)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (int c = 0; c < 2; ++c) {
+        threads.emplace_back([&, c] {
+            int value;
+            for (int i = 0; i < perProducer; ++i) {
+                while (!queue.TryPop(value)) {
+                    std::this_thread::yield();
+                }
+                popped[c].push_back(value);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    std::vector<int> seen(2 * perProducer);
+    for (auto const& v : popped) {
+        for (int value : v) {
+            ++seen[value];
+        }
+    }
+    REQUIRE(std::count(seen.begin(), seen.end(), 1) == 2 * perProducer);
+}
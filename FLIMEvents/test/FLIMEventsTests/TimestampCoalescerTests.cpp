@@ -0,0 +1,90 @@
+#include <catch2/catch.hpp>
+#include "FLIMEvents/TimestampCoalescer.hpp"
+#include "DecodedEventRecorder.hpp"
+
+#include <string>
+#include <vector>
+
+
+namespace {
+    // Records batches as such, rather than as their events
+    class BatchRecorder : public DecodedEventRecorder {
+    public:
+        void HandleEventBatch(DecodedEventBatch const& batch) override {
+            events.emplace_back("B " + std::to_string(batch.timestamp));
+        }
+    };
+
+    DecodedEvent MakeTimestamp(uint64_t macrotime) {
+        DecodedEvent e;
+        e.macrotime = macrotime;
+        return e;
+    }
+}
+
+
+TEST_CASE("Timestamps are limited to one per interval", "[TimestampCoalescer]") {
+    auto output = std::make_shared<BatchRecorder>();
+    TimestampCoalescer coalescer(10000, output);
+
+    for (uint64_t t = 4096; t < 40000; t += 4096) {
+        coalescer.HandleTimestamp(MakeTimestamp(t));
+    }
+    REQUIRE(output->events.size() == 3);
+    REQUIRE(output->events[0] == "T 12288");
+    REQUIRE(output->events[1] == "T 24576");
+    REQUIRE(output->events[2] == "T 36864");
+
+    // Other events are always forwarded and count as known macro-time
+    ValidPhotonEvent photon{};
+    photon.macrotime = 46000;
+    coalescer.HandleValidPhoton(photon);
+    coalescer.HandleTimestamp(MakeTimestamp(49152));
+    REQUIRE(output->events.size() == 4);
+    REQUIRE(output->events[3] == "P 46000 0 0");
+
+    // Withheld timestamp is sent before finishing
+    coalescer.HandleFinish();
+    REQUIRE(output->events.size() == 6);
+    REQUIRE(output->events[4] == "T 49152");
+    REQUIRE(output->events[5] == "F");
+}
+
+
+TEST_CASE("Withheld timestamp superseded by later event", "[TimestampCoalescer]") {
+    auto output = std::make_shared<BatchRecorder>();
+    TimestampCoalescer coalescer(10000, output);
+
+    coalescer.HandleTimestamp(MakeTimestamp(4096));
+    MarkerEvent marker{};
+    marker.macrotime = 5000;
+    coalescer.HandleMarker(marker);
+
+    DecodedEventBatch batch;
+    batch.AppendPhoton(6000, 0, 0);
+    batch.timestamp = 8192;
+    coalescer.HandleTimestamp(MakeTimestamp(7000));
+    coalescer.HandleEventBatch(batch);
+    coalescer.HandleFinish();
+
+    REQUIRE(output->events.size() == 3);
+    REQUIRE(output->events[0] == "M 5000 0");
+    REQUIRE(output->events[1] == "B 8192");
+    REQUIRE(output->events[2] == "F");
+}
+
+
+TEST_CASE("Zero interval forwards all timestamps", "[TimestampCoalescer]") {
+    auto output = std::make_shared<BatchRecorder>();
+    TimestampCoalescer coalescer(0, output);
+
+    coalescer.HandleTimestamp(MakeTimestamp(4096));
+    coalescer.HandleTimestamp(MakeTimestamp(8192));
+    coalescer.HandleError("test");
+    coalescer.HandleTimestamp(MakeTimestamp(12288));
+
+    REQUIRE(output->events.size() == 3);
+    REQUIRE(output->events[0] == "T 4096");
+    REQUIRE(output->events[1] == "T 8192");
+    REQUIRE(output->events[2] == "E test");
+}
@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <mutex>
+#include <utility>
 
 
 struct RateCounts {
@@ -53,6 +54,13 @@ extern "C" void StopRateCounterMonitor(struct RateCounts *data)
 }
 
 
+void SetRateCounterThreadPlacer(struct RateCounts *rates,
+	std::shared_ptr<ThreadPlacer const> placer)
+{
+	rates->monitor->SetThreadPlacer(std::move(placer));
+}
+
+
 extern "C" void GetRates(const struct RateCounts *rates, float *values)
 {
 	std::lock_guard<std::mutex> hold(rates->mutex);
@@ -16,4 +16,12 @@ void SetRates(struct RateCounts *rates, const float *values);
 
 #ifdef __cplusplus
 } // extern "C"
+
+#include "ThreadPlacement.hpp"
+
+#include <memory>
+
+// Place the monitor thread (see RateCounterMonitor::SetThreadPlacer())
+void SetRateCounterThreadPlacer(struct RateCounts *rates,
+	std::shared_ptr<ThreadPlacer const> placer);
 #endif
\ No newline at end of file
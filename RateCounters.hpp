@@ -1,5 +1,7 @@
 #pragma once
 
+#include "ThreadPlacement.hpp"
+
 #include <Spcm_def.h>
 
 #include <array>
@@ -8,7 +10,9 @@
 #include <cstdint>
 #include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 
 
 class RateCountsProcessor {
@@ -23,8 +27,16 @@ public:
 
 // Read rate counters in a background thread
 class RateCounterMonitor {
+	// Placement to be applied by the background thread
+	struct PendingPlacement {
+		std::mutex mutex;
+		std::shared_ptr<ThreadPlacer const> placer;
+	};
+
 	std::promise<void> requestStop;
 	std::future<void> finish;
+	std::shared_ptr<PendingPlacement> pendingPlacement =
+		std::make_shared<PendingPlacement>();
 
 public:
 	// module must be initialized
@@ -83,8 +95,22 @@ public:
 			std::round(1000.0f * seconds)));
 
 		finish = std::async(std::launch::async,
-			[module, downstream, interval, stopRequested = requestStop.get_future()]() mutable {
-			
+			[module, downstream, interval, pendingPlacement = pendingPlacement,
+			stopRequested = requestStop.get_future()]() mutable {
+
+			ThreadPlacementScope placement;
+			auto placeIfRequested = [&] {
+				std::shared_ptr<ThreadPlacer const> placer;
+				{
+					std::lock_guard<std::mutex> hold(pendingPlacement->mutex);
+					placer = std::move(pendingPlacement->placer);
+				}
+				if (placer) {
+					placement = placer->PlaceCurrentThread(ThreadRole::RateMonitor,
+						"Rate counter monitor (module " + std::to_string(module) + ")");
+				}
+			};
+
 			short err = SPC_clear_rates(module);
 			if (err < 0) {
 				downstream->HandleError("Cannot clear rate counters");
@@ -92,6 +118,8 @@ public:
 			}
 
 			while (stopRequested.wait_for(interval) != std::future_status::ready) {
+				placeIfRequested();
+
 				rate_values rates;
 				short err = SPC_read_rates(module, &rates);
 				if (err == -SPC_RATES_NOT_RDY)
@@ -109,6 +137,12 @@ public:
 		});
 	}
 
+	// The monitor thread is (re)placed within one interval
+	void SetThreadPlacer(std::shared_ptr<ThreadPlacer const> placer) {
+		std::lock_guard<std::mutex> hold(pendingPlacement->mutex);
+		pendingPlacement->placer = std::move(placer);
+	}
+
 	~RateCounterMonitor() {
 		requestStop.set_value();
 		finish.get();
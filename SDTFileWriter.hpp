@@ -2,6 +2,7 @@
 
 #include "AcquisitionCompletion.hpp"
 #include "SDTFile.h"
+#include "ThreadPlacement.hpp"
 
 #include <FLIMEvents/Histogram.hpp>
 
@@ -31,6 +32,7 @@ class SDTWriter final : public std::enable_shared_from_this<SDTWriter> {
 
 	std::future<void> asyncWriteCompletion;
 	std::shared_ptr<AcquisitionCompletion> downstream;
+	std::shared_ptr<ThreadPlacer const> threadPlacer;
 
 	void SendError(std::string const& message) {
 		{
@@ -82,8 +84,15 @@ public:
 		}
 	}
 
+	// Optional; the file is written on a thread of the FileWriting role
+	void SetThreadPlacer(std::shared_ptr<ThreadPlacer const> placer) {
+		threadPlacer = placer;
+	}
+
 	// Should be called after setting all SPC parameters but before starting
-	// measurement.
+	// measurement. The file has a single setup, so with several modules the
+	// parameters of one (the first) are recorded for all; the histograms of
+	// every module's channels share its histogram settings.
 	void SetPreacquisitionData(short module, uint32_t histogramBits,
 		uint32_t width, uint32_t height, bool useCompression,
 		double pixelRateHz, bool usePixelMarkers, bool recordPixelMarkers,
@@ -193,6 +202,11 @@ private:
 		}
 
 		asyncWriteCompletion = std::async([self = shared_from_this()] {
+			ThreadPlacementScope placement;
+			if (self->threadPlacer) {
+				placement = self->threadPlacer->PlaceCurrentThread(ThreadRole::FileWriting, "SDT file writer");
+			}
+
 			std::vector<uint16_t const*> histoDataPtrs;
 			for (auto const& h : self->histograms) {
 				histoDataPtrs.emplace_back(h.Get());
@@ -205,6 +219,16 @@ private:
 			
 			int err = WriteSDTFile(self->filename.c_str(), &self->data,
 				chanDataPtrs.data(), histoDataPtrs.data(), &self->params);
+
+			// Release the histograms (possibly to a pool for reuse) now,
+			// rather than whenever we are destroyed
+			{
+				std::lock_guard<std::mutex> hold(self->mutex);
+				for (auto& h : self->histograms) {
+					h = {};
+				}
+			}
+
 			if (err) {
 				self->SendError("Write error in SDT file");
 			}
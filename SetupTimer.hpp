@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <utility>
+
+
+// Measures the phases of acquisition setup, some of which run concurrently
+// on different threads, and logs the duration of each.
+class SetupTimer {
+	using Clock = std::chrono::steady_clock;
+
+	Clock::time_point const setupStart;
+	std::function<void(std::string const&)> logFunc;
+
+	static std::string FormatMs(Clock::duration d) {
+		char s[32];
+		std::snprintf(s, sizeof(s), "%.1f ms",
+			std::chrono::duration<double, std::milli>(d).count());
+		return s;
+	}
+
+public:
+	// Times a phase from construction to destruction, and logs its duration.
+	// If timer is null, nothing is logged.
+	class Phase {
+		SetupTimer const* timer;
+		std::string name;
+		Clock::time_point start;
+
+	public:
+		Phase(SetupTimer const* timer, std::string name) :
+			timer(timer),
+			name(std::move(name)),
+			start(Clock::now())
+		{}
+
+		Phase(Phase const&) = delete;
+		Phase& operator=(Phase const&) = delete;
+
+		~Phase() {
+			if (timer) {
+				auto const now = Clock::now();
+				timer->Log("Setup: " + name + " took " + FormatMs(now - start) +
+					" (done at " + FormatMs(now - timer->setupStart) + ")");
+			}
+		}
+	};
+
+	// Setup is taken to start when the timer is constructed
+	template <typename F>
+	explicit SetupTimer(F logFunc) :
+		setupStart(Clock::now()),
+		logFunc(logFunc)
+	{}
+
+	// Log a milestone with its time since the start of setup
+	void LogMilestone(std::string const& what) const {
+		Log("Setup: " + what + " at " + FormatMs(Clock::now() - setupStart));
+	}
+
+private:
+	void Log(std::string const& message) const {
+		if (logFunc) {
+			logFunc(message);
+		}
+	}
+};
@@ -0,0 +1,608 @@
+// Runs the acquisition and processing path (FIFOAcquisition.cpp and
+// DataStream.cpp) against the simulated SPC library, for stress testing and
+// profiling without BH hardware.
+//
+// This follows StartAcquisition() in AcquisitionControl.cpp, minus the
+// OpenScan device and settings.
+
+#include "SimulatedSPC.h"
+
+#include "../AcquisitionCompletion.hpp"
+#include "../DataStream.hpp"
+#include "../FIFOAcquisition.hpp"
+#include "../FIFOPolling.hpp"
+#include "../RateCounters.h"
+#include "../SPCFileWriter.hpp"
+#include "../SetupTimer.hpp"
+#include "../ThreadPlacement.hpp"
+#include "../WorkerThreadPool.hpp"
+
+#include <Spcm_def.h>
+
+#include <FLIMEvents/HistogramPool.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Stand-ins for OpenScanLib
+
+struct OScDev_Acquisition {
+	std::atomic<uint32_t> frameCount{ 0 };
+};
+
+extern "C" void* OScDev_Device_GetImplData(OScDev_Device*)
+{
+	return nullptr;
+}
+
+extern "C" bool OScDev_Acquisition_CallFrameCallback(OScDev_Acquisition* acq,
+	uint32_t, void*)
+{
+	++acq->frameCount;
+	return true;
+}
+
+static bool g_verbose = false;
+
+extern "C" void OScDev_Log_Debug(OScDev_Device*, const char* message)
+{
+	if (g_verbose) {
+		std::fprintf(stderr, "debug: %s\n", message);
+	}
+}
+
+extern "C" void OScDev_Log_Info(OScDev_Device*, const char* message)
+{
+	std::fprintf(stderr, "info: %s\n", message);
+}
+
+extern "C" void OScDev_Log_Warning(OScDev_Device*, const char* message)
+{
+	std::fprintf(stderr, "warning: %s\n", message);
+}
+
+extern "C" void OScDev_Log_Error(OScDev_Device*, const char* message)
+{
+	std::fprintf(stderr, "error: %s\n", message);
+}
+
+
+// SDTFile.c requires BH's data file header, which we do not have; histogram
+// (.sdt) output is not supported here.
+extern "C" int WriteSDTFile(const char*, const struct SDTFileData*,
+	const struct SDTFileChannelData* const[], const uint16_t* const[],
+	const SPCdata*)
+{
+	return 1;
+}
+
+
+namespace {
+	struct Options {
+		SimSPC_Config sim;
+		double seconds = 5.0;
+		uint32_t width = 256;
+		uint32_t height = 256;
+		uint32_t frames = 0; // 0 = until time is up
+		bool pixelMarkers = false;
+		bool frameSync = false;
+		double resonantFill = 0.0; // 0 = linear line clock
+		int modules = 1;
+		bool alignModules = true;
+		bool pipelined = true;
+		int repeat = 1;
+		bool reuse = true;
+		double latencyMs = 20.0;
+		int32_t bufferMemoryMB = 1024;
+		EventBufferPoolPolicy policy = EventBufferPoolPolicy::Fail;
+		ThreadPlacement readerPlacement;
+		ThreadPlacement processingPlacement;
+		ThreadPlacement histogrammingPlacement;
+		std::string spcFilename;
+	};
+
+
+	void PrintUsage(char const* program)
+	{
+		std::fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  --seconds S         Acquisition duration (default 5)\n"
+			"  --rate HZ           Photon rate (default 1e6)\n"
+			"  --dead-time NS      Detector/TAC dead time (default 100)\n"
+			"  --lifetime NS       Decay lifetime (default 2.5)\n"
+			"  --channels N        Routing channels (default 1)\n"
+			"  --line-rate HZ      Line marker rate (default 1000)\n"
+			"  --width PX          Pixels per line (default 256)\n"
+			"  --height PX         Lines per frame (default 256)\n"
+			"  --frames N          Stop after N frames (default: run for --seconds)\n"
+			"  --pixel-markers     Generate pixel markers and map pixels by them\n"
+			"  --frame-sync        Start frames on frame markers; discard frames\n"
+			"                      affected by data loss instead of stopping\n"
+			"  --resonant FILL     Treat line markers as periods of a bidirectional\n"
+			"                      resonant scan (2 rows each), using fraction FILL\n"
+			"                      of each sweep\n"
+			"  --fifo RECORDS      Device FIFO capacity (default 2097152)\n"
+			"  --gap-interval S    Simulate data loss every S seconds\n"
+			"  --gap-duration US   Duration of each simulated loss (default 1000)\n"
+			"  --latency-ms MS     FIFO latency target (default 20)\n"
+			"  --buffer-mb MB      Buffer memory limit (default 1024)\n"
+			"  --policy P          block, fail, or report (default fail)\n"
+			"  --reader-cpu N      Pin FIFO reader threads to CPU N\n"
+			"  --reader-priority P normal, high, or realtime (default normal)\n"
+			"  --processing-cpu N  Pin processing threads to CPU N\n"
+			"  --processing-priority P\n"
+			"                      normal, high, or realtime (default normal)\n"
+			"  --histogramming-cpu N\n"
+			"                      Pin pipeline stage threads to CPU N\n"
+			"  --no-pipeline       Assign pixels and histogram on the decoding thread\n"
+			"  --modules N         Simulated modules to merge (default 1)\n"
+			"  --no-align          Do not align modules on their first marker\n"
+			"  --spc FILE          Also write raw data to .spc file (per module)\n"
+			"  --repeat N          Run N acquisitions in a row (default 1)\n"
+			"  --no-reuse          Do not reuse threads, buffers, and histograms\n"
+			"                      between repeated acquisitions\n"
+			"  --verbose           Print debug messages\n",
+			program);
+	}
+
+
+	bool ParsePriority(std::string const& p, ThreadPriority& priority)
+	{
+		if (p == "normal")
+			priority = ThreadPriority::Normal;
+		else if (p == "high")
+			priority = ThreadPriority::High;
+		else if (p == "realtime")
+			priority = ThreadPriority::RealTime;
+		else
+			return false;
+		return true;
+	}
+
+
+	bool ParseOptions(int argc, char** argv, Options& opts)
+	{
+		SimSPC_GetDefaultConfig(&opts.sim);
+		double lineRateHz = 1000.0;
+		opts.sim.gapDurationUs = 1000.0;
+
+		for (int i = 1; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (arg == "--verbose") {
+				g_verbose = true;
+				continue;
+			}
+			if (arg == "--no-align") {
+				opts.alignModules = false;
+				continue;
+			}
+			if (arg == "--no-pipeline") {
+				opts.pipelined = false;
+				continue;
+			}
+			if (arg == "--no-reuse") {
+				opts.reuse = false;
+				continue;
+			}
+			if (arg == "--pixel-markers") {
+				opts.pixelMarkers = true;
+				continue;
+			}
+			if (arg == "--frame-sync") {
+				opts.frameSync = true;
+				continue;
+			}
+			if (i + 1 >= argc) {
+				return false;
+			}
+			char const* value = argv[++i];
+			if (arg == "--seconds")
+				opts.seconds = std::atof(value);
+			else if (arg == "--rate")
+				opts.sim.photonRateHz = std::atof(value);
+			else if (arg == "--dead-time")
+				opts.sim.deadTimeNs = std::atof(value);
+			else if (arg == "--lifetime")
+				opts.sim.lifetimeNs = std::atof(value);
+			else if (arg == "--channels")
+				opts.sim.routingChannels = std::atoi(value);
+			else if (arg == "--line-rate")
+				lineRateHz = std::atof(value);
+			else if (arg == "--width")
+				opts.width = std::atoi(value);
+			else if (arg == "--height")
+				opts.height = std::atoi(value);
+			else if (arg == "--resonant")
+				opts.resonantFill = std::atof(value);
+			else if (arg == "--frames")
+				opts.frames = std::atoi(value);
+			else if (arg == "--fifo")
+				opts.sim.fifoCapacity = std::atoi(value);
+			else if (arg == "--gap-interval")
+				opts.sim.gapIntervalSeconds = std::atof(value);
+			else if (arg == "--gap-duration")
+				opts.sim.gapDurationUs = std::atof(value);
+			else if (arg == "--latency-ms")
+				opts.latencyMs = std::atof(value);
+			else if (arg == "--buffer-mb")
+				opts.bufferMemoryMB = std::atoi(value);
+			else if (arg == "--policy") {
+				std::string p = value;
+				if (p == "block")
+					opts.policy = EventBufferPoolPolicy::Block;
+				else if (p == "fail")
+					opts.policy = EventBufferPoolPolicy::Fail;
+				else if (p == "report")
+					opts.policy = EventBufferPoolPolicy::Report;
+				else
+					return false;
+			}
+			else if (arg == "--reader-cpu")
+				opts.readerPlacement.cpu = std::atoi(value);
+			else if (arg == "--reader-priority") {
+				if (!ParsePriority(value, opts.readerPlacement.priority))
+					return false;
+			}
+			else if (arg == "--processing-cpu")
+				opts.processingPlacement.cpu = std::atoi(value);
+			else if (arg == "--histogramming-cpu")
+				opts.histogrammingPlacement.cpu = std::atoi(value);
+			else if (arg == "--processing-priority") {
+				if (!ParsePriority(value, opts.processingPlacement.priority))
+					return false;
+			}
+			else if (arg == "--modules")
+				opts.modules = std::atoi(value);
+			else if (arg == "--spc")
+				opts.spcFilename = value;
+			else if (arg == "--repeat")
+				opts.repeat = std::atoi(value);
+			else
+				return false;
+		}
+
+		if (lineRateHz <= 0.0 || opts.width == 0 || opts.height == 0 ||
+			opts.modules < 1 || opts.modules > MAX_NO_OF_SPC ||
+			opts.repeat < 1 || (opts.frameSync && opts.pixelMarkers) ||
+			opts.resonantFill < 0.0 || opts.resonantFill > 1.0 ||
+			(opts.resonantFill > 0.0 &&
+				(opts.pixelMarkers || opts.height % 2 != 0))) {
+			return false;
+		}
+		opts.sim.linePeriodUs = 1e6 / lineRateHz;
+		opts.sim.linesPerFrame = opts.resonantFill > 0.0 ?
+			opts.height / 2 : opts.height;
+		opts.sim.pixelsPerLine = opts.pixelMarkers ? opts.width : 0;
+		return true;
+	}
+
+
+	std::shared_ptr<RateCounts> StartRates(short module)
+	{
+		return std::shared_ptr<RateCounts>(
+			StartRateCounterMonitor(module, 0.25f), StopRateCounterMonitor);
+	}
+
+
+	// Same naming as AcquisitionControl.cpp
+	std::string ModuleFilename(std::string const& filename, int m)
+	{
+		if (m == 0 || filename.empty()) {
+			return filename;
+		}
+		auto dot = filename.rfind('.');
+		if (dot == std::string::npos || filename.find('/', dot) != std::string::npos) {
+			dot = filename.size();
+		}
+		return filename.substr(0, dot) + "-m" + std::to_string(m) + filename.substr(dot);
+	}
+
+
+	// Kept across repeated acquisitions, as with AcqEngine in
+	// AcquisitionControl.cpp
+	struct Engine {
+		std::shared_ptr<WorkerThreadPool> workers;
+		std::vector<std::shared_ptr<EventBufferPool<BHSPCEvent>>> bufferPools;
+		std::shared_ptr<HistogramPool<uint16_t>> histogramPool;
+
+		Engine() = default;
+
+		explicit Engine(int moduleCount) :
+			workers(std::make_shared<WorkerThreadPool>(4 * moduleCount + 4)),
+			bufferPools(moduleCount),
+			histogramPool(std::make_shared<HistogramPool<uint16_t>>())
+		{}
+	};
+
+
+	std::shared_ptr<ThreadPlacer const> MakeThreadPlacer(Options const& opts)
+	{
+		auto threadPlacer = std::make_shared<ThreadPlacer>(
+			[](std::string const& m) { OScDev_Log_Info(nullptr, m.c_str()); });
+		threadPlacer->SetPlacement(ThreadRole::FIFOReader, opts.readerPlacement);
+		threadPlacer->SetPlacement(ThreadRole::Processing, opts.processingPlacement);
+		threadPlacer->SetPlacement(ThreadRole::Histogramming, opts.histogrammingPlacement);
+		return threadPlacer;
+	}
+}
+
+
+// Run one acquisition and print its statistics
+static int RunAcquisition(Options const& opts, Engine& engine,
+	std::vector<std::array<char, 4>> fileHeaders,
+	LineMapping const& lineMapping, int32_t lineDelay, uint32_t pixelTime,
+	int macroTimeUnitsTenthNs, RateCounts* rateCounts,
+	std::shared_ptr<ThreadPlacer const> threadPlacer)
+{
+	int const moduleCount = opts.modules;
+	auto const setupStartTime = std::chrono::steady_clock::now();
+	auto const setupTimer = std::make_shared<SetupTimer>(
+		[](std::string const& m) { OScDev_Log_Info(nullptr, m.c_str()); });
+	int ret = 0;
+
+	std::promise<void> requestStop;
+	std::shared_future<void> stopRequested = requestStop.get_future().share();
+	std::atomic_flag stopSignaled = ATOMIC_FLAG_INIT;
+	auto stopFunc = [&requestStop, &stopSignaled] {
+		if (!stopSignaled.test_and_set()) {
+			requestStop.set_value();
+		}
+	};
+
+	auto completion = std::make_shared<AcquisitionCompletion>(stopFunc,
+		[](std::string const& m) { OScDev_Log_Debug(nullptr, m.c_str()); });
+	completion->AddProcess("Setup");
+
+	// As on the device, .spc files are created on worker threads while the
+	// rest of the setup proceeds
+	std::vector<PendingDeviceEventProcessor> spcWriters(moduleCount);
+	if (!opts.spcFilename.empty()) {
+		for (int m = 0; m < moduleCount; ++m) {
+			spcWriters[m] = RunOnWorkerThread(engine.workers,
+				[setupTimer, m, filename = ModuleFilename(opts.spcFilename, m),
+				fileHeader = fileHeaders[m], completion]() mutable
+				-> std::shared_ptr<DeviceEventProcessor> {
+				SetupTimer::Phase phase(setupTimer.get(),
+					"SPC file creation (module " + std::to_string(m) + ")");
+				return std::make_shared<SPCFileWriter>(filename,
+					fileHeader.data(), completion);
+			}).share();
+		}
+	}
+
+	auto const latencyTarget = std::chrono::microseconds(
+		static_cast<int64_t>(std::round(1000.0 * opts.latencyMs)));
+	std::size_t const bufferEvents =
+		AdaptiveFIFOPoller::BufferCapacityForLatency(latencyTarget, 10e6);
+	std::size_t const bufferBytes = bufferEvents * sizeof(BHSPCEvent);
+	std::size_t const maxBufferCount = std::max<std::size_t>(1,
+		static_cast<std::size_t>(opts.bufferMemoryMB) * 1024 * 1024 / bufferBytes /
+		moduleCount);
+
+	auto const histogramAllocations = engine.histogramPool->GetAllocationCount();
+	auto const histogramReuses = engine.histogramPool->GetReuseCount();
+	auto lineMarkerBufferUsage = opts.pixelMarkers ? nullptr :
+		std::make_shared<LineMarkerBufferUsage>();
+	OScDev_Acquisition acq;
+	auto streams_and_done = SetUpProcessing(opts.width, opts.height,
+		opts.frames > 0 ? opts.frames : UINT32_MAX, 1, true, lineDelay,
+		lineMapping, opts.sim.lineMarkerBit,
+		opts.pixelMarkers ? opts.sim.pixelMarkerBit : UINT32_MAX, pixelTime,
+		opts.frameSync ? opts.sim.frameMarkerBit : UINT32_MAX,
+		0.1 * macroTimeUnitsTenthNs, 10000.0, lineMarkerBufferUsage, &acq,
+		stopFunc, spcWriters,
+		opts.alignModules, opts.pipelined, nullptr, maxBufferCount, threadPlacer,
+		engine.histogramPool, engine.workers, setupTimer, completion);
+	auto streams = std::get<0>(streams_and_done);
+	std::future<void> pumpingFinish = std::move(std::get<1>(streams_and_done));
+	for (auto& w : spcWriters) {
+		if (w.valid()) {
+			w.wait();
+		}
+	}
+	completion->HandleFinish("Setup");
+
+	auto& pools = engine.bufferPools;
+	for (int m = 0; m < moduleCount; ++m) {
+		if (!pools[m] || pools[m]->GetBufferSize() != bufferEvents) {
+			pools[m] = std::make_shared<EventBufferPool<BHSPCEvent>>(bufferEvents);
+		}
+		pools[m]->SetMaxBufferCount(maxBufferCount, opts.policy);
+		pools[m]->ResetStatistics();
+	}
+
+	auto adcRate = [rateCounts]() -> double {
+		float values[4];
+		GetRates(rateCounts, values);
+		return values[3];
+	};
+
+	auto const startTime = std::chrono::steady_clock::now();
+	std::vector<std::shared_ptr<FIFOMonitor>> fifoMonitors;
+	std::vector<std::future<void>> acquisitionFinishes;
+	for (short m = 0; m < moduleCount; ++m) {
+		fifoMonitors.push_back(std::make_shared<FIFOMonitor>(
+			[m](std::string const& msg) {
+				std::string const s = "Module " + std::to_string(m) + ": " + msg;
+				OScDev_Log_Warning(nullptr, s.c_str());
+			}));
+		auto err_and_finish = StartAcquisitionStandardFIFO(m, pools[m],
+			streams[m], latencyTarget,
+			m == 0 ? std::function<double()>(adcRate) : nullptr,
+			fifoMonitors[m], threadPlacer, engine.workers, stopRequested,
+			completion);
+		ret = std::get<0>(err_and_finish);
+		acquisitionFinishes.push_back(std::move(std::get<1>(err_and_finish)));
+		if (ret != 0) {
+			std::fprintf(stderr, "Failed to start acquisition (%d)\n", ret);
+			stopFunc();
+			for (int n = m + 1; n < moduleCount; ++n) {
+				streams[n]->Send({});
+			}
+			break;
+		}
+	}
+
+	setupTimer->LogMilestone("all modules armed");
+	double const setupMs = std::chrono::duration<double, std::milli>(
+		startTime - setupStartTime).count();
+
+	auto finish = completion->GetCompletion();
+	if (finish.wait_for(std::chrono::duration<double>(opts.seconds)) !=
+		std::future_status::ready) {
+		stopFunc();
+	}
+	auto errors = finish.get();
+	for (auto& f : acquisitionFinishes) {
+		f.wait();
+	}
+	pumpingFinish.wait();
+	// As after acquisitions on the device, clear in the background
+	auto histogramPool = engine.histogramPool;
+	engine.workers->Run([histogramPool] { histogramPool->ClearIdle(); });
+	double const elapsed = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - startTime).count();
+
+	std::printf("Setup: %.3f ms; histograms: %zu allocated, %zu reused; %zu worker threads\n",
+		setupMs, engine.histogramPool->GetAllocationCount() - histogramAllocations,
+		engine.histogramPool->GetReuseCount() - histogramReuses,
+		engine.workers->GetThreadCount());
+	std::printf("Elapsed: %.3f s\n", elapsed);
+	std::printf("Frames: %u\n", acq.frameCount.load());
+	for (short m = 0; m < moduleCount; ++m) {
+		SimSPC_Stats stats;
+		SimSPC_GetStats(m, &stats);
+		auto const& pool = pools[m];
+		auto const& stream = streams[m];
+
+		if (moduleCount > 1) {
+			std::printf("Module %d:\n", m);
+		}
+		std::printf("Photons arrived: %llu (%.3g/s)\n",
+			static_cast<unsigned long long>(stats.photonsArrived),
+			stats.photonsArrived / elapsed);
+		std::printf("Records generated: %llu, read: %llu, lost: %llu\n",
+			static_cast<unsigned long long>(stats.recordsGenerated),
+			static_cast<unsigned long long>(stats.recordsRead),
+			static_cast<unsigned long long>(stats.recordsLost));
+		std::printf("Device FIFO: peak %u of %u records; overflowed %u time(s)\n",
+			stats.peakFifoUsage, opts.sim.fifoCapacity, stats.fifoOverflowCount);
+		auto const& monitor = *fifoMonitors[m];
+		std::printf("FIFO monitor: peak %.0f%% full; %zu warning(s), %zu overflow(s); drained at %.3g events/s\n",
+			100.0 * monitor.GetPeakFillLevel(), monitor.GetWarningCount(),
+			monitor.GetOverflowCount(), monitor.GetMeanDrainRate());
+		std::printf("Buffer pool: peak %zu of %zu buffers (%zu events each); limit reached %zu time(s)\n",
+			pool->GetHighWaterCount(), pool->GetMaxBufferCount(), bufferEvents,
+			pool->GetOverflowCount());
+		std::printf("Peak consumer lag (buffers):");
+		for (std::size_t i = 0; i < stream->GetConsumerCount(); ++i) {
+			std::printf(" %zu", stream->GetPeakConsumerLag(i));
+		}
+		std::printf("\n");
+	}
+	if (lineMarkerBufferUsage) {
+		std::printf("Peak buffered awaiting line markers: %zu photons; %zu line markers\n",
+			lineMarkerBufferUsage->peakPendingPhotons.load(),
+			lineMarkerBufferUsage->peakPendingLines.load());
+	}
+	for (auto const& e : errors) {
+		std::printf("Error: %s\n", e.c_str());
+	}
+	return errors.empty() && ret == 0 ? 0 : 1;
+}
+
+
+int main(int argc, char** argv)
+{
+	Options opts;
+	if (!ParseOptions(argc, argv, opts)) {
+		PrintUsage(argv[0]);
+		return 2;
+	}
+
+	// Modules are simulated independently (different seeds), as if each
+	// were connected to its own detector but the same scanner
+	int const moduleCount = opts.modules;
+	for (short m = 0; m < moduleCount; ++m) {
+		SimSPC_Config cfg = opts.sim;
+		cfg.randomSeed = opts.sim.randomSeed + m;
+		if (SimSPC_Configure(m, &cfg) < 0) {
+			std::fprintf(stderr, "Invalid simulation parameters\n");
+			return 1;
+		}
+	}
+	char iniFile[] = "sspcm.ini";
+	SPC_init(iniFile);
+
+	uint16_t const enabledMarkers = (1 << opts.sim.lineMarkerBit) |
+		(1 << opts.sim.frameMarkerBit) |
+		(opts.pixelMarkers ? 1 << opts.sim.pixelMarkerBit : 0);
+	std::vector<std::array<char, 4>> fileHeaders(moduleCount);
+	int macroTimeUnitsTenthNs = 0;
+	int ret = 0;
+	for (short m = 0; m < moduleCount && ret == 0; ++m) {
+		ret = ConfigureDeviceForFIFOAcquisition(m);
+		if (ret == 0) {
+			ret = SetMarkerPolarities(m, enabledMarkers, enabledMarkers);
+		}
+		short fifoType = 0;
+		if (ret == 0) {
+			ret = SetUpAcquisition(m, true, fileHeaders[m].data(), &fifoType,
+				&macroTimeUnitsTenthNs);
+		}
+		if (ret == 0 && !IsStandardFIFO(fifoType)) {
+			ret = 1;
+		}
+	}
+	if (ret != 0) {
+		std::fprintf(stderr, "Device setup failed (%d)\n", ret);
+		return 1;
+	}
+
+	short const module = 0;
+	auto rates = StartRates(module);
+
+	uint32_t const lineTime = static_cast<uint32_t>(std::round(
+		10.0 * opts.sim.linePeriodUs * 1000.0 / macroTimeUnitsTenthNs));
+	int32_t const lineDelay = opts.pixelMarkers || opts.resonantFill > 0.0 ?
+		0 : -static_cast<int32_t>(lineTime); // Line end markers
+	// Resonant: the line marker period is the scan period
+	auto const lineMapping = opts.resonantFill > 0.0 ?
+		LineMapping::Sinusoidal(opts.width, lineTime, opts.resonantFill, true) :
+		LineMapping::Linear(opts.width, lineTime);
+	// Pixel markers are exact, so the pixel time only needs to cover the
+	// marker interval
+	uint32_t const pixelTime = static_cast<uint32_t>(std::ceil(
+		10.0 * opts.sim.linePeriodUs * 1000.0 / opts.width / macroTimeUnitsTenthNs));
+
+	auto const threadPlacer = MakeThreadPlacer(opts);
+	Engine engine;
+	for (int run = 0; run < opts.repeat; ++run) {
+		if (opts.repeat > 1) {
+			std::printf("Acquisition %d:\n", run + 1);
+		}
+		if (run == 0 || !opts.reuse) {
+			engine = Engine(moduleCount);
+		}
+		ret = RunAcquisition(opts, engine, fileHeaders, lineMapping, lineDelay,
+			pixelTime, macroTimeUnitsTenthNs, rates.get(), threadPlacer);
+		if (ret != 0)
+			break;
+	}
+
+	rates.reset();
+	SPC_close();
+	return ret;
+}
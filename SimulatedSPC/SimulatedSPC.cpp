@@ -0,0 +1,811 @@
+#include "Spcm_def.h"
+#include "SimulatedSPC.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <vector>
+
+
+// Simulated implementation of the SPCM DLL API (the subset declared in our
+// Spcm_def.h). See SimulatedSPC.h for configuration.
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	// Standard FIFO record (see BHSPCEvent in FLIMEvents/BHDeviceEvent.hpp)
+	struct Record {
+		uint8_t bytes[4];
+	};
+
+	uint8_t const FlagInvalid = 1 << 7;
+	uint8_t const FlagMacroTimeOverflow = 1 << 6;
+	uint8_t const FlagGap = 1 << 5;
+	uint8_t const FlagMarker = 1 << 4;
+
+	uint64_t const MacroTimeOverflowPeriod = 1 << 12;
+
+	struct Module {
+		std::mutex mutex; // Rate counters may be read on a separate thread
+
+		SimSPC_Config config;
+		SPCdata params;
+		float rateCountTime;
+
+		bool running;
+		Clock::time_point startTime;
+		double generatedUntilNs;
+
+		std::mt19937_64 rng;
+		std::exponential_distribution<double> photonInterval;
+		std::exponential_distribution<double> decay;
+		double nextPhotonNs;
+		double lastRecordedPhotonNs;
+		double nextLineNs;
+		uint64_t lineCount;
+		double nextPixelNs;
+		uint32_t pixelsLeftInLine; // After the one at nextPixelNs
+		double nextGapNs;
+
+		uint64_t lastTick; // Macro-time of last stored record
+		uint64_t storedPeriod; // lastTick / MacroTimeOverflowPeriod
+		bool gapPending;
+		bool overflowed;
+
+		std::vector<Record> fifo;
+		std::size_t fifoHead;
+		std::size_t fifoCount;
+
+		SimSPC_Stats stats;
+
+		// Rate counting
+		Clock::time_point rateWindowStart;
+		uint64_t rateWindowArrived;
+		uint64_t rateWindowConverted;
+		uint64_t photonsConverted; // Not lost to dead time
+	};
+
+	bool initialized = false;
+	Module modules[MAX_NO_OF_SPC];
+
+
+	bool IsStandardFIFOModel(short model) {
+		switch (model) {
+		case M_SPC130:
+		case M_SPC131:
+		case M_SPC140:
+		case M_SPC150:
+		case M_SPC151:
+		case M_SPC152:
+		case M_SPC160:
+		case M_SPC161:
+		case M_SPC830:
+		case M_SPC930:
+			return true;
+		}
+		return false;
+	}
+
+
+	short FIFOTypeForModel(short model) {
+		switch (model) {
+		case M_SPC130:
+			return FIFO_130;
+		case M_SPC830:
+			return FIFO_830;
+		case M_SPC140:
+			return FIFO_140;
+		case M_SPC600:
+		case M_SPC630:
+			return FIFO_48;
+		default:
+			return FIFO_150;
+		}
+	}
+
+
+	short CheckModule(short mod_no) {
+		if (!initialized) {
+			return -SPC_NOT_INIT;
+		}
+		if (mod_no < 0 || mod_no >= MAX_NO_OF_SPC) {
+			return -SPC_WRONG_ID;
+		}
+		return 0;
+	}
+
+
+	double ElapsedNs(Module const& m, Clock::time_point now) {
+		return std::chrono::duration<double, std::nano>(now - m.startTime).count();
+	}
+
+
+	void ResetModule(Module& m) {
+		SimSPC_GetDefaultConfig(&m.config);
+		std::memset(&m.params, 0, sizeof(m.params));
+		m.params.tac_range = static_cast<float>(m.config.syncPeriodNs);
+		m.params.adc_resolution = 12;
+		m.rateCountTime = 1.0f;
+		m.running = false;
+		m.generatedUntilNs = 0.0;
+		m.fifo.clear();
+		m.fifoHead = 0;
+		m.fifoCount = 0;
+		std::memset(&m.stats, 0, sizeof(m.stats));
+		m.rateWindowStart = Clock::now();
+		m.rateWindowArrived = 0;
+		m.rateWindowConverted = 0;
+		m.photonsConverted = 0;
+	}
+
+
+	void StartGenerator(Module& m) {
+		auto const& c = m.config;
+		m.rng.seed(c.randomSeed);
+		m.photonInterval = std::exponential_distribution<double>(
+			c.photonRateHz > 0.0 ? c.photonRateHz * 1e-9 : 1.0);
+		m.decay = std::exponential_distribution<double>(
+			c.lifetimeNs > 0.0 ? 1.0 / c.lifetimeNs : 1.0);
+
+		m.startTime = Clock::now();
+		m.generatedUntilNs = 0.0;
+		m.nextPhotonNs = c.photonRateHz > 0.0 ? m.photonInterval(m.rng) : HUGE_VAL;
+		m.lastRecordedPhotonNs = -HUGE_VAL;
+		m.nextLineNs = c.linePeriodUs > 0.0 ? 1000.0 * c.linePeriodUs : HUGE_VAL;
+		m.lineCount = 0;
+		m.nextPixelNs = HUGE_VAL;
+		m.pixelsLeftInLine = 0;
+		m.nextGapNs = c.gapIntervalSeconds > 0.0 ? 1e9 * c.gapIntervalSeconds : HUGE_VAL;
+
+		m.lastTick = 0;
+		m.storedPeriod = 0;
+		m.gapPending = false;
+		m.overflowed = false;
+
+		m.fifo.assign(std::max<uint32_t>(c.fifoCapacity, 2), Record());
+		m.fifoHead = 0;
+		m.fifoCount = 0;
+		std::memset(&m.stats, 0, sizeof(m.stats));
+	}
+
+
+	void PushRecord(Module& m, Record r) {
+		m.fifo[(m.fifoHead + m.fifoCount) % m.fifo.size()] = r;
+		++m.fifoCount;
+		++m.stats.recordsGenerated;
+		m.stats.peakFifoUsage = std::max(m.stats.peakFifoUsage,
+			static_cast<uint32_t>(m.fifoCount));
+	}
+
+
+	// Records have strictly increasing macro-time
+	uint64_t TickAt(Module const& m, double timeNs) {
+		uint64_t tick = static_cast<uint64_t>(timeNs / m.config.macroTimeUnitNs);
+		return std::max(tick, m.lastTick + 1);
+	}
+
+
+	// Store a record, preceded by a macro-time overflow record if needed.
+	// Caller ensures there is space for 2 records.
+	void Emit(Module& m, uint64_t tick, uint8_t routing, uint16_t adc,
+		uint8_t flags) {
+		m.lastTick = tick;
+
+		uint64_t const period = tick / MacroTimeOverflowPeriod;
+		uint64_t overflows = period - m.storedPeriod;
+		m.storedPeriod = period;
+		if (overflows == 1) {
+			flags |= FlagMacroTimeOverflow;
+		}
+		else {
+			while (overflows > 1) {
+				uint32_t n = static_cast<uint32_t>(
+					std::min<uint64_t>(overflows, (1u << 28) - 1));
+				Record r;
+				r.bytes[0] = n & 0xff;
+				r.bytes[1] = (n >> 8) & 0xff;
+				r.bytes[2] = (n >> 16) & 0xff;
+				r.bytes[3] = FlagInvalid | FlagMacroTimeOverflow | ((n >> 24) & 0x0f);
+				PushRecord(m, r);
+				overflows -= n;
+				if (overflows == 1) { // Only possible with huge gaps
+					flags |= FlagMacroTimeOverflow;
+					break;
+				}
+			}
+		}
+
+		if (m.gapPending) {
+			flags |= FlagGap;
+			m.gapPending = false;
+		}
+
+		uint16_t const macro = tick % MacroTimeOverflowPeriod;
+		Record r;
+		r.bytes[0] = macro & 0xff;
+		r.bytes[1] = static_cast<uint8_t>(((routing & 0x0f) << 4) | (macro >> 8));
+		r.bytes[2] = adc & 0xff;
+		r.bytes[3] = static_cast<uint8_t>(flags | ((adc >> 8) & 0x0f));
+		PushRecord(m, r);
+	}
+
+
+	// Discard everything that would have happened up to untilNs
+	void Skip(Module& m, double untilNs) {
+		auto const& c = m.config;
+		if (m.nextPhotonNs < untilNs) {
+			double const expected = c.photonRateHz * 1e-9 * (untilNs - m.nextPhotonNs) + 1.0;
+			m.stats.photonsArrived += static_cast<uint64_t>(expected);
+			m.stats.recordsLost += static_cast<uint64_t>(expected);
+			m.rateWindowArrived += static_cast<uint64_t>(expected);
+			m.rateWindowConverted += static_cast<uint64_t>(expected);
+			m.nextPhotonNs = untilNs + m.photonInterval(m.rng);
+		}
+		if (m.nextPixelNs < untilNs) {
+			double const period = 1000.0 * c.linePeriodUs / c.pixelsPerLine;
+			uint64_t const pixels = std::min<uint64_t>(m.pixelsLeftInLine + 1,
+				static_cast<uint64_t>(std::floor((untilNs - m.nextPixelNs) / period)) + 1);
+			m.stats.recordsLost += pixels;
+			if (pixels > m.pixelsLeftInLine) {
+				m.nextPixelNs = HUGE_VAL;
+				m.pixelsLeftInLine = 0;
+			}
+			else {
+				m.nextPixelNs += pixels * period;
+				m.pixelsLeftInLine -= static_cast<uint32_t>(pixels);
+			}
+		}
+		if (m.nextLineNs < untilNs) {
+			double const period = 1000.0 * c.linePeriodUs;
+			uint64_t const lines = static_cast<uint64_t>(
+				std::floor((untilNs - m.nextLineNs) / period)) + 1;
+			m.lineCount += lines;
+			m.nextLineNs += lines * period;
+			m.stats.recordsLost += lines;
+			// The rest of the last skipped line is lost, too
+			m.nextPixelNs = HUGE_VAL;
+			m.pixelsLeftInLine = 0;
+		}
+		m.gapPending = true;
+	}
+
+
+	// Generate records for events up to nowNs
+	void Generate(Module& m, double nowNs) {
+		auto const& c = m.config;
+		uint8_t const enabledMarkers = (m.params.routing_mode >> 8) & 0x0f;
+
+		while (m.generatedUntilNs < nowNs) {
+			double const nextMarkerNs = std::min(m.nextLineNs, m.nextPixelNs);
+			if (m.nextGapNs <= nowNs &&
+				m.nextGapNs <= std::min(m.nextPhotonNs, nextMarkerNs)) {
+				double const gapEnd = m.nextGapNs + 1000.0 * c.gapDurationUs;
+				Skip(m, std::min(gapEnd, nowNs));
+				if (gapEnd > nowNs) {
+					break; // Continue the gap at the next call
+				}
+				m.nextGapNs += 1e9 * c.gapIntervalSeconds;
+				continue;
+			}
+
+			double const t = std::min(m.nextPhotonNs, nextMarkerNs);
+			if (t > nowNs) {
+				break;
+			}
+
+			if (m.fifoCount + 2 > m.fifo.size()) {
+				// Overflow; all data until the FIFO is next read is lost
+				if (!m.gapPending) {
+					++m.stats.fifoOverflowCount;
+				}
+				m.overflowed = true;
+				Skip(m, nowNs);
+				break;
+			}
+
+			if (m.nextPixelNs < m.nextLineNs && m.nextPixelNs <= m.nextPhotonNs) {
+				uint8_t const bits = (1 << c.pixelMarkerBit) & enabledMarkers;
+				if (bits) {
+					Emit(m, TickAt(m, m.nextPixelNs), bits, 0, FlagInvalid | FlagMarker);
+				}
+				if (m.pixelsLeftInLine > 0) {
+					--m.pixelsLeftInLine;
+					m.nextPixelNs += 1000.0 * c.linePeriodUs / c.pixelsPerLine;
+				}
+				else {
+					m.nextPixelNs = HUGE_VAL;
+				}
+				continue;
+			}
+
+			if (m.nextLineNs <= m.nextPhotonNs) {
+				uint8_t bits = 0;
+				if (c.lineMarkerBit < 4) {
+					bits |= 1 << c.lineMarkerBit;
+				}
+				if (c.linesPerFrame > 0 && m.lineCount % c.linesPerFrame == 0 &&
+					c.frameMarkerBit < 4) {
+					bits |= 1 << c.frameMarkerBit;
+				}
+				// The first pixel marker of a line coincides with the line
+				// marker; the rest follow at the pixel period
+				if (c.pixelsPerLine > 0 && c.pixelMarkerBit < 4) {
+					bits |= 1 << c.pixelMarkerBit;
+					if (c.pixelsPerLine > 1) {
+						m.nextPixelNs = m.nextLineNs + 1000.0 * c.linePeriodUs / c.pixelsPerLine;
+						m.pixelsLeftInLine = c.pixelsPerLine - 2;
+					}
+				}
+				bits &= enabledMarkers;
+				if (bits) {
+					Emit(m, TickAt(m, m.nextLineNs), bits, 0, FlagInvalid | FlagMarker);
+				}
+				++m.lineCount;
+				m.nextLineNs += 1000.0 * c.linePeriodUs;
+				continue;
+			}
+
+			++m.stats.photonsArrived;
+			++m.rateWindowArrived;
+			// Photons are not allowed to delay the next marker, because the
+			// pixellator relies on exact marker timing
+			uint64_t const tick = TickAt(m, m.nextPhotonNs);
+			uint64_t const nextMarkerTick = static_cast<uint64_t>(
+				std::min(nextMarkerNs / c.macroTimeUnitNs, 1.8e19));
+			if (m.nextPhotonNs - m.lastRecordedPhotonNs >= c.deadTimeNs &&
+				tick < nextMarkerTick) {
+				m.lastRecordedPhotonNs = m.nextPhotonNs;
+				++m.photonsConverted;
+				++m.rateWindowConverted;
+
+				double micro = c.lifetimeNs > 0.0 ?
+					std::fmod(m.decay(m.rng), c.syncPeriodNs) :
+					std::uniform_real_distribution<double>(0.0, c.syncPeriodNs)(m.rng);
+				uint16_t adc = static_cast<uint16_t>(std::min(4095.0,
+					std::floor(4096.0 * micro / c.syncPeriodNs)));
+				uint8_t route = static_cast<uint8_t>(
+					m.rng() % std::max<uint32_t>(1, std::min<uint32_t>(c.routingChannels, 16)));
+				Emit(m, tick, route, adc, 0);
+			}
+			m.nextPhotonNs += m.photonInterval(m.rng);
+		}
+		m.generatedUntilNs = std::max(m.generatedUntilNs, nowNs);
+	}
+
+
+	void GenerateToNow(Module& m) {
+		if (m.running) {
+			Generate(m, ElapsedNs(m, Clock::now()));
+		}
+	}
+}
+
+
+extern "C" void SimSPC_GetDefaultConfig(struct SimSPC_Config* config)
+{
+	config->model = M_SPC150;
+	config->macroTimeUnitNs = 25.0;
+	config->photonRateHz = 1e6;
+	config->deadTimeNs = 100.0;
+	config->lifetimeNs = 2.5;
+	config->syncPeriodNs = 12.5;
+	config->routingChannels = 1;
+	config->linePeriodUs = 1000.0;
+	config->linesPerFrame = 512;
+	config->pixelsPerLine = 0;
+	config->pixelMarkerBit = 0;
+	config->lineMarkerBit = 1;
+	config->frameMarkerBit = 2;
+	config->gapIntervalSeconds = 0.0;
+	config->gapDurationUs = 0.0;
+	config->fifoCapacity = 2 * 1024 * 1024;
+	config->randomSeed = 42;
+}
+
+
+extern "C" short SimSPC_Configure(short mod_no, const struct SimSPC_Config* config)
+{
+	if (mod_no < 0 || mod_no >= MAX_NO_OF_SPC) {
+		return -SPC_WRONG_ID;
+	}
+	if (!IsStandardFIFOModel(config->model) || config->macroTimeUnitNs <= 0.0 ||
+		config->syncPeriodNs <= 0.0 || config->photonRateHz < 0.0) {
+		return -SPC_WRONG_PAR;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	m.config = *config;
+	m.params.tac_range = static_cast<float>(config->syncPeriodNs);
+	return 0;
+}
+
+
+extern "C" short SimSPC_GetStats(short mod_no, struct SimSPC_Stats* stats)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	*stats = m.stats;
+	return 0;
+}
+
+
+// The .ini file is ignored; modules keep any configuration made with
+// SimSPC_Configure() before SPC_init().
+extern "C" short SPC_init(char* ini_file)
+{
+	(void)ini_file;
+	if (!initialized) {
+		for (auto& m : modules) {
+			std::lock_guard<std::mutex> hold(m.mutex);
+			SimSPC_Config config = m.config;
+			bool const configured = config.model != 0;
+			ResetModule(m);
+			if (configured) {
+				m.config = config;
+			}
+		}
+		initialized = true;
+	}
+	return 0;
+}
+
+
+extern "C" short SPC_close(void)
+{
+	initialized = false;
+	return 0;
+}
+
+
+extern "C" short SPC_test_id(short mod_no)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	return modules[mod_no].config.model;
+}
+
+
+extern "C" short SPC_get_version(short mod_no, unsigned short* version)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	*version = 0x0100;
+	return 0;
+}
+
+
+extern "C" short SPC_get_eeprom_data(short mod_no, SPC_EEP_Data* eep_data)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	std::memset(eep_data, 0, sizeof(SPC_EEP_Data));
+	std::snprintf(eep_data->module_type, sizeof(eep_data->module_type),
+		"SPC-%d (sim)", modules[mod_no].config.model % 1000);
+	std::snprintf(eep_data->serial_no, sizeof(eep_data->serial_no),
+		"SIM%05d", mod_no);
+	std::snprintf(eep_data->date, sizeof(eep_data->date), "2020-01-01");
+	return 0;
+}
+
+
+extern "C" short SPC_get_parameters(short mod_no, SPCdata* data)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	*data = m.params;
+	return 0;
+}
+
+
+extern "C" short SPC_set_parameters(short mod_no, SPCdata* data)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	if (m.running) {
+		return -SPC_ARMED_ERR;
+	}
+	m.params = *data;
+	return 0;
+}
+
+
+extern "C" short SPC_get_parameter(short mod_no, short par_id, float* value)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	switch (par_id) {
+	case SYNC_FREQ_DIV:
+		*value = m.params.sync_freq_div;
+		break;
+	case TAC_RANGE:
+		*value = m.params.tac_range;
+		break;
+	case MODE:
+		*value = m.params.mode;
+		break;
+	case ROUTING_MODE:
+		*value = m.params.routing_mode;
+		break;
+	case RATE_COUNT_TIME:
+		*value = m.rateCountTime;
+		break;
+	case MACRO_TIME_CLK:
+		*value = static_cast<float>(m.config.macroTimeUnitNs);
+		break;
+	default:
+		return -SPC_WRONG_PAR;
+	}
+	return 0;
+}
+
+
+extern "C" short SPC_set_parameter(short mod_no, short par_id, float value)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	switch (par_id) {
+	case SYNC_FREQ_DIV:
+		m.params.sync_freq_div = static_cast<short>(value);
+		break;
+	case TAC_RANGE:
+		m.params.tac_range = value;
+		break;
+	case MODE:
+		m.params.mode = static_cast<short>(value);
+		break;
+	case ROUTING_MODE:
+		m.params.routing_mode = static_cast<unsigned short>(value);
+		break;
+	case RATE_COUNT_TIME:
+		m.rateCountTime = value;
+		break;
+	default:
+		return -SPC_WRONG_PAR;
+	}
+	return 0;
+}
+
+
+extern "C" short SPC_get_fifo_init_vars(short mod_no, short* fifo_type,
+	short* stream_type, int* mt_clock, unsigned int* spc_header)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	int const clockTenthNs = static_cast<int>(std::round(10.0 * m.config.macroTimeUnitNs));
+	if (fifo_type) {
+		*fifo_type = FIFOTypeForModel(m.config.model);
+	}
+	if (stream_type) {
+		*stream_type = 0;
+	}
+	if (mt_clock) {
+		*mt_clock = clockTenthNs;
+	}
+	if (spc_header) {
+		// Bits 0-23: macro-time clock in 0.1 ns; bits 24-26: routing bits
+		*spc_header = (static_cast<unsigned>(clockTenthNs) & 0xffffff) | (4u << 24);
+	}
+	return 0;
+}
+
+
+extern "C" short SPC_get_sync_state(short mod_no, short* sync_state)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	*sync_state = 1; // Sync OK
+	return 0;
+}
+
+
+extern "C" short SPC_test_state(short mod_no, short* state)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	GenerateToNow(m);
+	unsigned short s = 0;
+	if (m.running) {
+		s |= SPC_ARMED;
+	}
+	if (m.overflowed) {
+		s |= SPC_FOVFL;
+	}
+	if (m.fifoCount == 0) {
+		s |= SPC_FEMPTY;
+	}
+	*state = static_cast<short>(s);
+	return 0;
+}
+
+
+extern "C" short SPC_start_measurement(short mod_no)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	if (m.running) {
+		return -SPC_ARMED_ERR;
+	}
+	if (!IsStandardFIFOModel(m.config.model)) {
+		return -SPC_BAD_FUNC;
+	}
+	StartGenerator(m);
+	m.running = true;
+	return 0;
+}
+
+
+// Data already in the FIFO can still be read after stopping.
+extern "C" short SPC_stop_measurement(short mod_no)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	GenerateToNow(m);
+	m.running = false;
+	return 0;
+}
+
+
+// count: in 16-bit words (as with the real DLL)
+extern "C" short SPC_read_fifo(short mod_no, unsigned long* count,
+	unsigned short* data)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	GenerateToNow(m);
+
+	std::size_t const n = std::min<std::size_t>(*count / 2, m.fifoCount);
+	char* dest = reinterpret_cast<char*>(data);
+	std::size_t const capacity = m.fifo.size();
+	std::size_t const firstRun = std::min(n, capacity - m.fifoHead);
+	std::memcpy(dest, &m.fifo[m.fifoHead], firstRun * sizeof(Record));
+	std::memcpy(dest + firstRun * sizeof(Record), &m.fifo[0],
+		(n - firstRun) * sizeof(Record));
+	m.fifoHead = (m.fifoHead + n) % capacity;
+	m.fifoCount -= n;
+	m.stats.recordsRead += n;
+
+	*count = static_cast<unsigned long>(n * 2);
+	return 0;
+}
+
+
+extern "C" short SPC_get_fifo_usage(short mod_no, float* usage_degree)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	GenerateToNow(m);
+	*usage_degree = m.fifo.empty() ? 0.0f :
+		static_cast<float>(m.fifoCount) / m.fifo.size();
+	return 0;
+}
+
+
+extern "C" short SPC_get_error_string(short error_id, char* dest_string,
+	short max_length)
+{
+	static char const* const messages[] = {
+		"No error",
+		"Library not initialized",
+		"Wrong module number",
+		"Wrong parameter",
+		"Measurement in progress",
+		"Function not supported by module",
+		"Rate values not ready",
+		"File not valid",
+	};
+	int const index = error_id < 0 ? -error_id : error_id;
+	if (max_length <= 0 || index >= static_cast<int>(sizeof(messages) / sizeof(messages[0]))) {
+		return -SPC_WRONG_PAR;
+	}
+	std::snprintf(dest_string, max_length, "%s", messages[index]);
+	return 0;
+}
+
+
+extern "C" short SPC_clear_rates(short mod_no)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	GenerateToNow(m);
+	m.rateWindowStart = Clock::now();
+	m.rateWindowArrived = 0;
+	m.rateWindowConverted = 0;
+	return 0;
+}
+
+
+// While not measuring, the rates are those expected from the configuration.
+extern "C" short SPC_read_rates(short mod_no, rate_values* rates)
+{
+	short err = CheckModule(mod_no);
+	if (err < 0) {
+		return err;
+	}
+	Module& m = modules[mod_no];
+	std::lock_guard<std::mutex> hold(m.mutex);
+	auto const now = Clock::now();
+	double const seconds = std::chrono::duration<double>(now - m.rateWindowStart).count();
+	if (seconds < m.rateCountTime) {
+		return -SPC_RATES_NOT_RDY;
+	}
+
+	auto const& c = m.config;
+	rates->sync_rate = static_cast<float>(1e9 / c.syncPeriodNs);
+	if (m.running) {
+		GenerateToNow(m);
+		rates->cfd_rate = static_cast<float>(m.rateWindowArrived / seconds);
+		rates->tac_rate = static_cast<float>(m.rateWindowConverted / seconds);
+	}
+	else {
+		double const converted = c.photonRateHz / (1.0 + c.photonRateHz * c.deadTimeNs * 1e-9);
+		rates->cfd_rate = static_cast<float>(c.photonRateHz);
+		rates->tac_rate = static_cast<float>(converted);
+	}
+	rates->adc_rate = rates->tac_rate;
+
+	m.rateWindowStart = now;
+	m.rateWindowArrived = 0;
+	m.rateWindowConverted = 0;
+	return 0;
+}
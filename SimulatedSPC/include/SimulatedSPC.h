@@ -0,0 +1,74 @@
+#pragma once
+
+// Control of the simulated SPC library (see Spcm_def.h in this directory).
+//
+// Each simulated module produces standard FIFO records (the format of the
+// SPC-130/140/150/160/830/930) as if photons and scan markers were arriving
+// in real time since SPC_start_measurement(). Records are generated when the
+// FIFO is read (or its state queried), into a FIFO of fixed capacity; if the
+// FIFO is not read often enough, it overflows and the next record carries
+// the gap flag, as with the real devices.
+//
+// Generation runs in the calling thread (with the module locked), so the
+// photon rates that can be sustained are limited by the host CPU.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct SimSPC_Config {
+	short model; // Returned by SPC_test_id(); must be a standard FIFO model
+	double macroTimeUnitNs; // Macro-time clock period
+
+	// Photons
+	double photonRateHz; // Mean rate of photons reaching the detector
+	double deadTimeNs; // Photons within this time of the last are not recorded
+	double lifetimeNs; // Exponential decay; 0 for uniform micro-time
+	double syncPeriodNs; // Laser period (full scale of the ADC)
+	uint32_t routingChannels; // Photons are spread evenly over this many (1-16)
+
+	// Scan timing; markers are only recorded if enabled (ROUTING_MODE)
+	double linePeriodUs; // 0 = no line markers
+	uint32_t linesPerFrame; // A frame marker accompanies every nth line marker
+	uint32_t pixelsPerLine; // Pixel markers evenly spaced over each line (0 = none)
+	uint32_t pixelMarkerBit;
+	uint32_t lineMarkerBit;
+	uint32_t frameMarkerBit;
+
+	// Data loss
+	double gapIntervalSeconds; // Drop data periodically (0 = never)
+	double gapDurationUs;
+
+	uint32_t fifoCapacity; // Records the device FIFO can hold
+	uint64_t randomSeed;
+};
+
+
+// Fill config with the defaults (SPC-150, 1 Mcps, 1 kHz lines, 512 lines per
+// frame, 2M-record FIFO)
+void SimSPC_GetDefaultConfig(struct SimSPC_Config *config);
+
+// Configure a module; takes effect at the next SPC_start_measurement()
+short SimSPC_Configure(short mod_no, const struct SimSPC_Config *config);
+
+
+struct SimSPC_Stats {
+	uint64_t photonsArrived; // Including those lost to dead time
+	uint64_t recordsGenerated;
+	uint64_t recordsRead;
+	uint64_t recordsLost; // Due to FIFO overflow or simulated gaps
+	uint32_t fifoOverflowCount;
+	uint32_t peakFifoUsage; // Records
+};
+
+// Statistics since the last SPC_start_measurement()
+short SimSPC_GetStats(short mod_no, struct SimSPC_Stats *stats);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
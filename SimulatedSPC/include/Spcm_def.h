@@ -0,0 +1,152 @@
+#pragma once
+
+// Stand-in for Becker & Hickl's Spcm_def.h, declaring the subset of the SPCM
+// DLL API used by OpenScan-BHSPC. It is implemented by the simulated SPC
+// library (SimulatedSPC.cpp), so that the acquisition code can be built and
+// run without BH hardware or the (Windows-only) SPCM DLL.
+//
+// Names and signatures follow BH's header. The numeric values of the
+// constants are not necessarily the same, so code must only use the names.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define MAX_NO_OF_SPC 8
+
+
+// Module types returned by SPC_test_id()
+#define M_SPC600 600
+#define M_SPC630 630
+#define M_SPC700 700
+#define M_SPC730 730
+#define M_SPC130 130
+#define M_SPC131 131
+#define M_SPC140 140
+#define M_SPC150 150
+#define M_SPC151 151
+#define M_SPC152 152
+#define M_SPC160 160
+#define M_SPC161 161
+#define M_SPC830 830
+#define M_SPC930 930
+
+
+// FIFO data formats returned by SPC_get_fifo_init_vars()
+#define FIFO_48 1
+#define FIFO_32 2
+#define FIFO_130 3
+#define FIFO_830 4
+#define FIFO_140 5
+#define FIFO_150 6
+#define FIFO_32M 7
+
+
+// Parameter identifiers for SPC_get_parameter() and SPC_set_parameter()
+#define SYNC_FREQ_DIV 1
+#define TAC_RANGE 2
+#define MODE 3
+#define ROUTING_MODE 4
+#define RATE_COUNT_TIME 5
+#define MACRO_TIME_CLK 6
+
+
+// State bits returned by SPC_test_state()
+#define SPC_OVERFL 0x1
+#define SPC_TIME_OVER 0x4
+#define SPC_COLTIM_OVER 0x8
+#define SPC_ARMED 0x80
+#define SPC_FOVFL 0x400
+#define SPC_FEMPTY 0x800
+
+
+// Command codes (as stored in .sdt files)
+#define SPC_CMD_STOP 1
+
+
+// Error codes; functions return the negated code on failure
+#define SPC_NONE 0
+#define SPC_NOT_INIT 1
+#define SPC_WRONG_ID 2
+#define SPC_WRONG_PAR 3
+#define SPC_ARMED_ERR 4
+#define SPC_BAD_FUNC 5
+#define SPC_RATES_NOT_RDY 6
+#define SPC_FILE_NVALID 7
+
+
+typedef struct {
+	short mode;
+	short adc_resolution;
+	short count_incr;
+	short stop_on_time;
+	unsigned short routing_mode;
+	short stop_on_ovfl;
+	float collect_time;
+	float repeat_time;
+	short scan_polarity;
+	short pixel_clock;
+	short adc_zoom;
+
+	float cfd_limit_low;
+	float cfd_limit_high;
+	float cfd_zc_level;
+	float cfd_holdoff;
+	float sync_zc_level;
+	float sync_threshold;
+	float sync_holdoff;
+	short sync_freq_div;
+	float tac_range;
+	short tac_gain;
+	float tac_offset;
+	float tac_limit_low;
+	float tac_limit_high;
+	short dither_range;
+	short ext_latch_delay;
+	short trigger;
+	short ext_pixclk_div;
+	short master_clock;
+} SPCdata;
+
+
+typedef struct {
+	char module_type[16];
+	char serial_no[16];
+	char date[16];
+} SPC_EEP_Data;
+
+
+typedef struct {
+	float sync_rate;
+	float cfd_rate;
+	float tac_rate;
+	float adc_rate;
+} rate_values;
+
+
+short SPC_init(char *ini_file);
+short SPC_close(void);
+short SPC_test_id(short mod_no);
+short SPC_get_version(short mod_no, unsigned short *version);
+short SPC_get_eeprom_data(short mod_no, SPC_EEP_Data *eep_data);
+short SPC_get_parameters(short mod_no, SPCdata *data);
+short SPC_set_parameters(short mod_no, SPCdata *data);
+short SPC_get_parameter(short mod_no, short par_id, float *value);
+short SPC_set_parameter(short mod_no, short par_id, float value);
+short SPC_get_fifo_init_vars(short mod_no, short *fifo_type, short *stream_type,
+	int *mt_clock, unsigned int *spc_header);
+short SPC_get_sync_state(short mod_no, short *sync_state);
+short SPC_test_state(short mod_no, short *state);
+short SPC_start_measurement(short mod_no);
+short SPC_stop_measurement(short mod_no);
+short SPC_read_fifo(short mod_no, unsigned long *count, unsigned short *data);
+short SPC_get_fifo_usage(short mod_no, float *usage_degree);
+short SPC_get_error_string(short error_id, char *dest_string, short max_length);
+short SPC_clear_rates(short mod_no);
+short SPC_read_rates(short mod_no, rate_values *rates);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+// Minimal stand-in for OpenScanDeviceLib.h, declaring only what the
+// acquisition and processing code (as linked into SimulatedAcquisition) uses.
+// The functions are defined by the driver program.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OScDev_MAX_STR_LEN 511
+#define OScDev_MAX_STR_SIZE (OScDev_MAX_STR_LEN + 1)
+
+typedef int32_t OScDev_Error;
+typedef struct OScDev_Device OScDev_Device;
+typedef struct OScDev_Acquisition OScDev_Acquisition;
+typedef struct OScDev_PtrArray OScDev_PtrArray;
+
+void *OScDev_Device_GetImplData(OScDev_Device *device);
+
+bool OScDev_Acquisition_CallFrameCallback(OScDev_Acquisition *acq,
+	uint32_t channel, void *pixels);
+
+void OScDev_Log_Debug(OScDev_Device *device, const char *message);
+void OScDev_Log_Info(OScDev_Device *device, const char *message);
+void OScDev_Log_Warning(OScDev_Device *device, const char *message);
+void OScDev_Log_Error(OScDev_Device *device, const char *message);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,166 @@
+#include "ThreadPlacement.hpp"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+#include <algorithm>
+#include <string>
+#include <thread>
+
+
+int GetCPUCount()
+{
+	int count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+#ifdef _WIN32
+	// Thread affinity masks only cover the current processor group
+	count = std::min(count, static_cast<int>(8 * sizeof(DWORD_PTR)));
+#endif
+	return count;
+}
+
+
+// cpu == -1 allows all CPUs (of the process)
+static bool PinCurrentThread(int cpu)
+{
+	if (cpu >= GetCPUCount()) {
+		return false;
+	}
+#if defined(_WIN32)
+	DWORD_PTR mask;
+	if (cpu < 0) {
+		DWORD_PTR systemMask;
+		if (!GetProcessAffinityMask(GetCurrentProcess(), &mask, &systemMask)) {
+			return false;
+		}
+	}
+	else {
+		mask = DWORD_PTR(1) << cpu;
+	}
+	return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	if (cpu < 0) {
+		// The kernel restricts this to the CPUs allowed for the process
+		for (int i = 0; i < CPU_SETSIZE; ++i) {
+			CPU_SET(i, &cpus);
+		}
+	}
+	else {
+		CPU_SET(cpu, &cpus);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+	return cpu < 0; // No thread affinity API
+#endif
+}
+
+
+static bool SetCurrentThreadPriority(ThreadPriority priority)
+{
+#ifdef _WIN32
+	int winPriority = THREAD_PRIORITY_NORMAL;
+	switch (priority) {
+	case ThreadPriority::Normal:
+		break;
+	case ThreadPriority::High:
+		winPriority = THREAD_PRIORITY_HIGHEST;
+		break;
+	case ThreadPriority::RealTime:
+		winPriority = THREAD_PRIORITY_TIME_CRITICAL;
+		break;
+	}
+	return SetThreadPriority(GetCurrentThread(), winPriority) != 0;
+#else
+	switch (priority) {
+	case ThreadPriority::Normal: {
+		sched_param param{};
+		if (pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) != 0) {
+			return false;
+		}
+#ifdef __linux__
+		pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+		setpriority(PRIO_PROCESS, static_cast<id_t>(tid), 0);
+#endif
+		return true;
+	}
+	case ThreadPriority::High: {
+#ifdef __linux__
+		// On Linux, the nice value is per thread
+		pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+		return setpriority(PRIO_PROCESS, static_cast<id_t>(tid), -10) == 0;
+#else
+		sched_param param{};
+		param.sched_priority = sched_get_priority_max(SCHED_OTHER);
+		return pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) == 0;
+#endif
+	}
+	case ThreadPriority::RealTime: {
+		// Stay in the lower part of the range, below kernel threads (such as
+		// interrupt handlers) that use real-time priorities
+		int const minPriority = sched_get_priority_min(SCHED_FIFO);
+		int const maxPriority = sched_get_priority_max(SCHED_FIFO);
+		sched_param param{};
+		param.sched_priority = minPriority + (maxPriority - minPriority) / 4;
+		return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+	}
+	}
+	return false;
+#endif
+}
+
+
+static char const* PriorityName(ThreadPriority priority)
+{
+	switch (priority) {
+	case ThreadPriority::Normal:
+		return "normal";
+	case ThreadPriority::High:
+		return "high";
+	case ThreadPriority::RealTime:
+		return "real-time";
+	}
+	return "unknown";
+}
+
+
+std::string PlaceCurrentThread(ThreadPlacement const& placement)
+{
+	// Placement is always set explicitly (rather than left alone for the
+	// defaults), in case the thread was previously placed
+	std::string cpu = "any CPU";
+	std::string notes;
+	if (placement.cpu >= 0 && PinCurrentThread(placement.cpu)) {
+		cpu = "CPU " + std::to_string(placement.cpu);
+	}
+	else {
+		if (placement.cpu >= 0) {
+			notes += "; cannot pin to CPU " + std::to_string(placement.cpu);
+		}
+		PinCurrentThread(-1);
+	}
+
+	// Fall back to lower priorities when not permitted (e.g. no
+	// CAP_SYS_NICE or RLIMIT_RTPRIO on Linux)
+	ThreadPriority priority = placement.priority;
+	while (!SetCurrentThreadPriority(priority) && priority != ThreadPriority::Normal) {
+		notes += std::string("; ") + PriorityName(priority) + " priority not permitted";
+		priority = priority == ThreadPriority::RealTime ?
+			ThreadPriority::High : ThreadPriority::Normal;
+	}
+
+	std::string ret = cpu + ", " + PriorityName(priority) + " priority";
+	if (!notes.empty()) {
+		ret += " (" + notes.substr(2) + ")";
+	}
+	return ret;
+}
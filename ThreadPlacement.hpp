@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <string>
+
+
+// Threads we start, by what they do
+enum class ThreadRole {
+	FIFOReader, // Reads the device FIFO (one per module)
+	Processing, // Decodes events (and, unless pipelined, builds images and histograms)
+	Histogramming, // Pipeline stages: assigns photons to pixels, builds histograms
+	FileWriting, // Writes .spc and .sdt files
+	RateMonitor, // Polls the rate counters (while the device is open)
+};
+
+constexpr std::size_t NumThreadRoles = 5;
+
+
+enum class ThreadPriority {
+	Normal,
+	High, // Above other threads of normal priority
+	RealTime, // Real-time scheduling (SCHED_FIFO) or time-critical priority
+};
+
+
+struct ThreadPlacement {
+	int cpu = -1; // Pin to this CPU (0-based); -1 = any CPU
+	ThreadPriority priority = ThreadPriority::Normal;
+};
+
+
+// Number of CPUs a thread can be pinned to
+int GetCPUCount();
+
+
+// Apply placement to the calling thread. Requests that cannot be honored
+// (typically because elevated priority requires privileges we do not have)
+// fall back to the nearest placement that can. Returns a description of the
+// effective placement.
+std::string PlaceCurrentThread(ThreadPlacement const& placement);
+
+
+// Restores the default placement (any CPU, normal priority) of the calling
+// thread on destruction, as std::async may run tasks on pooled threads.
+class ThreadPlacementScope {
+	bool placed = false;
+
+public:
+	ThreadPlacementScope() = default;
+
+	explicit ThreadPlacementScope(bool placed) :
+		placed(placed)
+	{}
+
+	ThreadPlacementScope(ThreadPlacementScope const&) = delete;
+	ThreadPlacementScope& operator=(ThreadPlacementScope const&) = delete;
+
+	ThreadPlacementScope(ThreadPlacementScope&& other) noexcept :
+		placed(other.placed)
+	{
+		other.placed = false;
+	}
+
+	// Re-placing a thread keeps the obligation to restore it
+	ThreadPlacementScope& operator=(ThreadPlacementScope&& rhs) noexcept {
+		placed = placed || rhs.placed;
+		rhs.placed = false;
+		return *this;
+	}
+
+	~ThreadPlacementScope() {
+		if (placed) {
+			::PlaceCurrentThread(ThreadPlacement());
+		}
+	}
+};
+
+
+// Placement of each thread role, applied by the threads themselves when they
+// start. The effective placement of each thread is logged.
+class ThreadPlacer {
+	std::array<ThreadPlacement, NumThreadRoles> placements;
+	std::function<void(std::string const&)> logFunc;
+
+public:
+	template <typename F>
+	explicit ThreadPlacer(F logFunc) :
+		logFunc(logFunc)
+	{}
+
+	void SetPlacement(ThreadRole role, ThreadPlacement const& placement) {
+		placements[static_cast<std::size_t>(role)] = placement;
+	}
+
+	ThreadPlacement GetPlacement(ThreadRole role) const {
+		return placements[static_cast<std::size_t>(role)];
+	}
+
+	// Call from the thread to be placed; threadName is used for logging. The
+	// thread keeps its placement until the returned scope is destroyed.
+	ThreadPlacementScope PlaceCurrentThread(ThreadRole role,
+		std::string const& threadName) const {
+		auto effective = ::PlaceCurrentThread(GetPlacement(role));
+		if (logFunc) {
+			logFunc("Thread placement: " + threadName + ": " + effective);
+		}
+		return ThreadPlacementScope(true);
+	}
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// Threads that are kept alive between acquisitions, so that starting an
+// acquisition does not create threads. Each task runs on a thread of its own
+// (our tasks typically block for the whole acquisition); a thread is created
+// when none is idle, and threads are kept until the pool is destroyed.
+//
+// Unlike those from std::async, the returned futures do not block on
+// destruction. A task's function object is destroyed before its future
+// becomes ready.
+class WorkerThreadPool {
+	class Task {
+	public:
+		virtual ~Task() = default;
+		virtual void Run() noexcept = 0;
+	};
+
+	template <typename F, typename R>
+	class FunctionTask final : public Task {
+		F func;
+		std::promise<R> done;
+
+		static R Invoke(F f) {
+			return f(); // f is destroyed on return
+		}
+
+		template <typename T>
+		void Complete(std::promise<T>& promise) {
+			T result = Invoke(std::move(func));
+			promise.set_value(std::move(result));
+		}
+
+		void Complete(std::promise<void>& promise) {
+			Invoke(std::move(func));
+			promise.set_value();
+		}
+
+	public:
+		explicit FunctionTask(F&& f) :
+			func(std::move(f))
+		{}
+
+		std::future<R> GetFuture() {
+			return done.get_future();
+		}
+
+		void Run() noexcept override {
+			try {
+				Complete(done);
+			}
+			catch (...) {
+				done.set_exception(std::current_exception());
+			}
+		}
+	};
+
+	std::mutex mutex; // Protects all of the following
+	std::condition_variable taskQueued;
+	std::deque<std::unique_ptr<Task>> tasks;
+	std::size_t idleCount = 0; // Threads not running a task
+	bool shuttingDown = false;
+	std::vector<std::thread> threads;
+
+	void StartThread() {
+		threads.emplace_back([this] { RunTasks(); });
+		++idleCount;
+	}
+
+	void RunTasks() {
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;) {
+			taskQueued.wait(lock, [this] { return shuttingDown || !tasks.empty(); });
+			if (tasks.empty()) {
+				return; // Shutting down
+			}
+			auto task = std::move(tasks.front());
+			tasks.pop_front();
+			--idleCount;
+
+			lock.unlock();
+			task->Run();
+			task.reset();
+			lock.lock();
+			++idleCount;
+		}
+	}
+
+public:
+	explicit WorkerThreadPool(std::size_t initialThreadCount = 0) {
+		std::lock_guard<std::mutex> hold(mutex);
+		for (std::size_t i = 0; i < initialThreadCount; ++i) {
+			StartThread();
+		}
+	}
+
+	WorkerThreadPool(WorkerThreadPool const&) = delete;
+	WorkerThreadPool& operator=(WorkerThreadPool const&) = delete;
+
+	// Waits for queued and running tasks to finish
+	~WorkerThreadPool() {
+		{
+			std::lock_guard<std::mutex> hold(mutex);
+			shuttingDown = true;
+		}
+		taskQueued.notify_all();
+		for (auto& t : threads) {
+			t.join();
+		}
+	}
+
+	// Run f() on a pool thread. The result of f(), or the exception it
+	// throws, is delivered via the returned future.
+	template <typename F, typename R = std::result_of_t<std::decay_t<F>()>>
+	std::future<R> Run(F&& f) {
+		auto task = std::make_unique<FunctionTask<std::decay_t<F>, R>>(
+			std::decay_t<F>(std::forward<F>(f)));
+		auto future = task->GetFuture();
+		{
+			std::lock_guard<std::mutex> hold(mutex);
+			tasks.push_back(std::move(task));
+			if (tasks.size() > idleCount) {
+				try {
+					StartThread();
+				}
+				catch (...) {
+					tasks.pop_back();
+					throw;
+				}
+			}
+		}
+		taskQueued.notify_one();
+		return future;
+	}
+
+	std::size_t GetThreadCount() {
+		std::lock_guard<std::mutex> hold(mutex);
+		return threads.size();
+	}
+};
+
+
+// Run f() on a pool thread, or on a new thread if pool is null
+template <typename F, typename R = std::result_of_t<std::decay_t<F>()>>
+inline std::future<R> RunOnWorkerThread(
+	std::shared_ptr<WorkerThreadPool> const& pool, F&& f)
+{
+	if (pool) {
+		return pool->Run(std::forward<F>(f));
+	}
+	return std::async(std::launch::async, std::forward<F>(f));
+}